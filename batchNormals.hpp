@@ -0,0 +1,500 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <Eigen/Core>
+
+#include "load.hpp"
+#include "meshContext.hpp"
+#include "parallelFor.hpp"
+#include "perCornerNormals.hpp"
+#include "perFacenormals.hpp"
+#include "perVertexNormals.hpp"
+#include "profiler.hpp"
+#include "streamNormals.hpp"
+
+using namespace Eigen;
+
+/**
+ * @brief Il formato dei file scritti da batchNormals().
+ */
+enum class BatchFormat
+{
+    Normals, // file binario di normali (NormalsFile), "<mesh>.obj.wsnormals"
+    Obj      // la mesh in OBJ con le normali come record "vn", "<mesh>.normals.obj"
+};
+
+/**
+ * @brief Le opzioni di batchNormals().
+ */
+struct BatchOptions
+{
+    NormalMode mode = NormalMode::Vertex;
+    // soglia dei settori delle normali ai corner, in gradi
+    double cornerAngle = 30.0;
+    BatchFormat format = BatchFormat::Normals;
+    // cartella dei file di output; se vuota, quella di ogni mesh
+    std::string outputDirectory;
+    // memoria, in byte, per tutte le mesh in elaborazione contemporaneamente
+    std::size_t memoryBudget = std::size_t(1) << 30;
+    // cartella dei file temporanei delle mesh piu' grandi della memoria
+    std::string tempDirectory;
+    // mesh elaborate contemporaneamente; 0: una per core
+    unsigned jobs = 0;
+};
+
+/**
+ * @brief L'esito dell'elaborazione di una mesh.
+ */
+struct BatchResult
+{
+    std::string input;
+    std::string output;
+    bool ok = false;
+    long long vertices = 0;
+    long long faces = 0;
+    double seconds = 0.0;
+    // calcolata da streamNormals() perche' piu' grande della memoria
+    bool outOfCore = false;
+};
+
+namespace batch_normals {
+
+// byte stimati per triangolo in un file OBJ (riga "f" e meta' di una riga
+// "v"), per difetto: la stima del numero di facce e' per eccesso
+const std::uint64_t obj_bytes_per_face = 24;
+
+// mesh da almeno questo numero di facce (stimato) usano tutti i core
+const std::uint64_t parallel_faces = std::uint64_t(1) << 20;
+
+/**
+ * @brief Un budget di unita' (byte di memoria, core) condiviso fra i thread.
+ *
+ * acquire() attende che le unita' richieste siano disponibili; una richiesta
+ * maggiore del budget viene ridotta al budget intero, cioe' attende che il
+ * budget sia tutto libero e poi lo occupa da sola.
+ *
+ * Le richieste vengono servite in ordine di ticket (0, 1, 2, ...), ognuno
+ * usato da una sola richiesta: finche' la richiesta successiva attende, le
+ * unita' liberate non vanno alle richieste dopo di essa, per cui una
+ * richiesta grande non viene superata da quelle piccole arrivate dopo.
+ */
+class Budget
+{
+  public:
+    explicit Budget(std::uint64_t limit) : _limit(std::max<std::uint64_t>(1, limit)) {}
+
+    // restituisce le unita' effettivamente occupate, da passare a release()
+    std::uint64_t acquire(std::uint64_t units, std::uint64_t ticket)
+    {
+        units = std::min(units, _limit);
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [&]() { return ticket == _next && _used + units <= _limit; });
+        _used += units;
+        ++_next;
+        lock.unlock();
+        _cv.notify_all();
+        return units;
+    }
+
+    void release(std::uint64_t units)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _used -= units;
+        }
+        _cv.notify_all();
+    }
+
+    std::uint64_t limit() const { return _limit; }
+
+  private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::uint64_t _limit;
+    std::uint64_t _used = 0;
+    // il ticket della prossima richiesta da servire
+    std::uint64_t _next = 0;
+};
+
+inline bool ends_with_nocase(std::string const &s, std::string const &suffix)
+{
+    if (s.size() < suffix.size()) {
+        return false;
+    }
+    for (std::size_t k = 0; k < suffix.size(); ++k) {
+        char c = s[s.size() - suffix.size() + k];
+        if (c >= 'A' && c <= 'Z') {
+            c = char(c - 'A' + 'a');
+        }
+        if (c != suffix[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief true per i file OBJ da elaborare: esclusi quelli scritti da
+ * batchNormals() in formato OBJ, che altrimenti verrebbero rielaborati.
+ */
+inline bool is_mesh_file(std::string const &name)
+{
+    return ends_with_nocase(name, ".obj") && !ends_with_nocase(name, ".normals.obj");
+}
+
+inline std::uint64_t file_size(std::string const &filename)
+{
+    std::FILE *file = std::fopen(filename.c_str(), "rb");
+    if (file == nullptr) {
+        return 0;
+    }
+    std::uint64_t size = 0;
+#if defined(_WIN32)
+    if (_fseeki64(file, 0, SEEK_END) == 0) {
+        size = std::uint64_t(_ftelli64(file));
+    }
+#else
+    if (fseeko(file, 0, SEEK_END) == 0) {
+        size = std::uint64_t(ftello(file));
+    }
+#endif
+    std::fclose(file);
+    return size;
+}
+
+/**
+ * @brief La memoria di picco stimata per calcolare in memoria le normali di
+ * una mesh di faces triangoli: V e F, adiacenze, record delle facce e
+ * normali in uscita.
+ */
+inline std::uint64_t memory_per_face(NormalMode mode)
+{
+    return mode == NormalMode::Face ? 64 : mode == NormalMode::Vertex ? 128 : 256;
+}
+
+/**
+ * @brief Il file di output della mesh input.
+ */
+inline std::string output_path(std::string const &input, BatchOptions const &options)
+{
+    std::string::size_type slash = input.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+    if (options.format == BatchFormat::Obj) {
+        name = (ends_with_nocase(name, ".obj") ? name.substr(0, name.size() - 4) : name) + ".normals.obj";
+    } else {
+        name += ".wsnormals";
+    }
+    if (!options.outputDirectory.empty()) {
+        return options.outputDirectory + "/" + name;
+    }
+    return slash == std::string::npos ? name : input.substr(0, slash + 1) + name;
+}
+
+/**
+ * @brief Scrive le righe 0 .. n - 1 in file: ogni blocco di righe viene
+ * formattato in parallelo in una stringa (format(i, buffer) aggiunge la riga
+ * i), poi le stringhe vengono scritte in ordine.
+ */
+template <typename Format>
+bool write_lines(std::FILE *file, std::int64_t n, Format format)
+{
+    const std::int64_t block = 1 << 14;
+    // blocchi formattati per ogni scrittura, per limitare la memoria
+    const std::int64_t group = 64;
+    std::vector<std::string> text;
+    for (std::int64_t b0 = 0; b0 * block < n; b0 += group) {
+        const std::int64_t nb = std::min(group, (n + block - 1) / block - b0);
+        text.assign(std::size_t(nb), std::string());
+        parallel::parallel_for(nb, [&](std::int64_t b) {
+            const std::int64_t begin = (b0 + b) * block;
+            const std::int64_t end = std::min(n, begin + block);
+            std::string &s = text[std::size_t(b)];
+            s.reserve(std::size_t(end - begin) * 48);
+            char line[160];
+            for (std::int64_t i = begin; i < end; ++i) {
+                s.append(line, std::size_t(format(i, line)));
+            }
+        }, 2);
+        for (auto const &s : text) {
+            if (std::fwrite(s.data(), 1, s.size(), file) != s.size()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace batch_normals
+
+/**
+ * @brief Scrive una mesh di triangoli in formato OBJ, con le normali del tipo
+ * dato come record "vn" referenziati dagli elementi "v//n" delle facce.
+ *
+ * Le normali ai triangoli e ai corner hanno un record per faccia o per corner
+ * (nello stesso ordine di N), quelle ai vertici uno per vertice. Le posizioni
+ * sono scritte con 17 cifre significative, per cui rileggendo il file si
+ * ottengono gli stessi double; le normali con 9. La formattazione e'
+ * parallela.
+ *
+ * @param N Le normali: F.rows(), V.rows() o 3 * F.rows() righe.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedN>
+bool saveOBJ(
+    std::string const &filename,
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    NormalMode mode,
+    MatrixBase<DerivedN> const &N)
+{
+    WS_PROFILE_SCOPE("saveOBJ");
+
+    const std::int64_t expected = mode == NormalMode::Face ? F.rows() : mode == NormalMode::Vertex ? V.rows() : 3 * F.rows();
+    if (N.rows() != expected) {
+        return false;
+    }
+
+    std::string tmpFilename = filename + ".tmp";
+    std::FILE *file = std::fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<char> buffer(std::size_t(1) << 20);
+    std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+    bool ok = batch_normals::write_lines(file, V.rows(), [&](std::int64_t i, char *line) {
+        return std::snprintf(line, 160, "v %.17g %.17g %.17g\n", double(V(i, 0)), double(V(i, 1)), double(V(i, 2)));
+    });
+    ok = ok && batch_normals::write_lines(file, N.rows(), [&](std::int64_t i, char *line) {
+        return std::snprintf(line, 160, "vn %.9g %.9g %.9g\n", double(N(i, 0)), double(N(i, 1)), double(N(i, 2)));
+    });
+    ok = ok && batch_normals::write_lines(file, F.rows(), [&](std::int64_t f, char *line) {
+        long long n[3];
+        for (int p = 0; p < 3; ++p) {
+            n[p] = mode == NormalMode::Face ? f : mode == NormalMode::Vertex ? (long long)F(f, p) : 3 * f + p;
+        }
+        return std::snprintf(line, 160, "f %lld//%lld %lld//%lld %lld//%lld\n",
+                             (long long)F(f, 0) + 1, n[0] + 1, (long long)F(f, 1) + 1, n[1] + 1,
+                             (long long)F(f, 2) + 1, n[2] + 1);
+    });
+
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Aggiunge a files i file OBJ della cartella directory (e delle
+ * sottocartelle, se recursive), in ordine alfabetico. Sono esclusi i file
+ * "*.normals.obj" scritti da batchNormals().
+ *
+ * @return false se la cartella non puo' essere letta.
+ */
+inline bool listMeshFiles(std::string const &directory, bool recursive, std::vector<std::string> &files)
+{
+    std::vector<std::string> found, subdirectories;
+#if defined(_WIN32)
+    struct _finddata64i32_t entry;
+    intptr_t handle = _findfirst64i32((directory + "/*").c_str(), &entry);
+    if (handle == -1) {
+        return false;
+    }
+    do {
+        std::string name = entry.name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        if (entry.attrib & _A_SUBDIR) {
+            subdirectories.push_back(directory + "/" + name);
+        } else if (batch_normals::is_mesh_file(name)) {
+            found.push_back(directory + "/" + name);
+        }
+    } while (_findnext64i32(handle, &entry) == 0);
+    _findclose(handle);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = directory + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            subdirectories.push_back(path);
+        } else if (S_ISREG(st.st_mode) && batch_normals::is_mesh_file(name)) {
+            found.push_back(path);
+        }
+    }
+    closedir(dir);
+#endif
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+    if (recursive) {
+        std::sort(subdirectories.begin(), subdirectories.end());
+        for (auto const &subdirectory : subdirectories) {
+            listMeshFiles(subdirectory, recursive, files);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Calcola le normali del tipo options.mode di molte mesh OBJ e le
+ * scrive, per ogni mesh, in un file accanto ad essa o in
+ * options.outputDirectory (vedi BatchFormat).
+ *
+ * Le mesh vengono elaborate da options.jobs thread, che prendono la
+ * successiva da una coda comune appena finiscono la precedente, dalla piu'
+ * grande (dimensione del file) alla piu' piccola: le grandi, che durano di
+ * piu', iniziano per prime e le piccole riempiono i thread liberi verso la
+ * fine. Due budget regolano le mesh in elaborazione contemporaneamente,
+ * entrambi concessi nell'ordine della coda (vedi Budget), per cui una mesh
+ * grande in attesa dei core non viene superata dalle piccole successive:
+ * - core: una mesh piccola ne occupa uno, una grande (almeno
+ *   batch_normals::parallel_faces facce stimate) li occupa tutti; i kernel
+ *   chiamati per una mesh usano al piu' i core che ha occupato
+ *   (parallel::ThreadLimit), per cui quelli di una mesh piccola sono seriali
+ *   e i thread in esecuzione non superano options.jobs;
+ * - memoria: ogni mesh occupa la propria memoria di picco stimata dalla
+ *   dimensione del file, e attende che sia libera.
+ * Le mesh la cui stima supera options.memoryBudget occupano tutto il budget;
+ * le normali ai triangoli e ai vertici in formato Normals vengono allora
+ * calcolate con streamNormals(), con memoria limitata (il file contiene
+ * entrambe le sezioni), le altre comunque in memoria.
+ *
+ * Le mesh in formato OBJ vengono scritte triangolate, senza coordinate di
+ * texture; i file vengono scritti con un nome temporaneo e rinominati alla
+ * fine.
+ *
+ * @param files I file OBJ (vedi listMeshFiles()).
+ * @param options Le opzioni.
+ * @param progress Se non nulla, chiamata (da un thread alla volta) con
+ *                 l'esito di ogni mesh appena elaborata.
+ * @return Gli esiti, nell'ordine di files.
+ */
+inline std::vector<BatchResult> batchNormals(
+    std::vector<std::string> const &files,
+    BatchOptions const &options,
+    std::function<void(BatchResult const &)> const &progress = nullptr)
+{
+    using namespace batch_normals;
+
+    WS_PROFILE_SCOPE("batchNormals");
+
+    const std::size_t n = files.size();
+    const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned jobs = unsigned(std::min<std::size_t>(options.jobs > 0 ? options.jobs : hw, std::max<std::size_t>(1, n)));
+
+    std::vector<BatchResult> results(n);
+    std::vector<std::uint64_t> sizes(n);
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        sizes[i] = file_size(files[i]);
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return sizes[a] > sizes[b]; });
+
+    Budget cores(jobs);
+    Budget memory(options.memoryBudget);
+    std::atomic<std::size_t> next{0};
+    std::mutex progressMutex;
+
+    // k: posizione nella coda, che e' anche il ticket dei due budget
+    auto process = [&](std::size_t k) {
+        const std::size_t i = order[k];
+        BatchResult &r = results[i];
+        r.input = files[i];
+        r.output = output_path(files[i], options);
+
+        const std::uint64_t faces = sizes[i] / obj_bytes_per_face + 1;
+        const std::uint64_t bytes = faces * memory_per_face(options.mode);
+        const bool large = bytes >= memory.limit();
+        const std::uint64_t c = cores.acquire(faces >= parallel_faces || large ? jobs : 1, k);
+        const std::uint64_t m = memory.acquire(bytes, k);
+        parallel::ThreadLimit limit{unsigned(c)};
+
+        auto start = std::chrono::steady_clock::now();
+        if (large && options.format == BatchFormat::Normals && options.mode != NormalMode::Corner) {
+            WS_PROFILE_SCOPE("batchNormals/stream");
+            StreamOptions streamOptions;
+            streamOptions.memoryBudget = options.memoryBudget;
+            streamOptions.tempDirectory = options.tempDirectory;
+            StreamStats stats;
+            r.ok = streamNormals(r.input, r.output, streamOptions, &stats);
+            r.vertices = stats.vertices;
+            r.faces = stats.faces;
+            r.outOfCore = true;
+        } else {
+            WS_PROFILE_SCOPE("batchNormals/mesh");
+            MatrixXd V, N;
+            MatrixXi F;
+            if (loadOBJ(r.input, V, F)) {
+                r.vertices = V.rows();
+                r.faces = F.rows();
+                switch (options.mode) {
+                case NormalMode::Face:
+                    perFaceNormals(V, F, N);
+                    break;
+                case NormalMode::Vertex:
+                    N = perVertexNormals(V, F);
+                    break;
+                case NormalMode::Corner:
+                    N = perCornerNormals(V, F, options.cornerAngle);
+                    break;
+                }
+                r.ok = options.format == BatchFormat::Obj
+                    ? saveOBJ(r.output, V, F, options.mode, N)
+                    : writeNormalsFile(r.output, V.rows(), F.rows(), options.mode, N);
+            }
+        }
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        memory.release(m);
+        cores.release(c);
+
+        if (progress) {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            progress(r);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < jobs; ++t) {
+        threads.emplace_back([&]() {
+            for (std::size_t k; (k = next++) < n;) {
+                process(k);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    return results;
+}
@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "../bvh.hpp"
+#include "../load.hpp"
+#include "../meshCache.hpp"
+#include "../meshContext.hpp"
+#include "../meshRepair.hpp"
+#include "../simplify.hpp"
+#include "../octNormals.hpp"
+#include "../topology.hpp"
+#include "../perFacenormals.hpp"
+#include "../perVertexNormals.hpp"
+#include "../perCornerNormals.hpp"
+#include "../reorder.hpp"
+#include "../streamNormals.hpp"
+#include "../triangleGeometry.hpp"
+#include "syntheticMeshes.hpp"
+
+using namespace Eigen;
+
+/**
+ * Benchmark headless dei kernel di geometria.
+ *
+ * Per ogni mesh richiesta (caricata da file o generata proceduralmente) esegue
+ * ogni kernel piu' volte e scrive su stdout (o su file) un documento JSON con,
+ * per ogni coppia (mesh, kernel): tempo minimo e mediano, facce al secondo,
+ * stima dei byte letti/scritti e picco di memoria residente del processo.
+ *
+ * Con --shuffle vertici e facce di ogni mesh vengono permutati casualmente,
+ * come in una mesh acquisita con ordine arbitrario: i kernel *_reordered
+ * misurano lo stesso calcolo dopo reorderMesh().
+ *
+ * Uso:
+ *   ws_geo3D_bench [--mesh vase|vase-subdiv|sphere|torus|grid]...
+ *                  [--obj file.obj] [--faces N] [--repeat R] [--shuffle]
+ *                  [--kernel nome]... [--output file.json]
+ */
+
+namespace {
+
+struct Mesh
+{
+    std::string name;
+    MatrixXd V;
+    MatrixXi F;
+};
+
+struct Kernel
+{
+    std::string name;
+    // esegue il kernel sulla mesh; prepare() calcola gli input non misurati
+    std::function<void()> prepare;
+    std::function<void()> run;
+    // stima del traffico di memoria obbligatorio del kernel, in byte
+    std::function<double()> bytes;
+};
+
+long long peakRSSBytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // su Linux ru_maxrss e' in kilobyte
+    return (long long)usage.ru_maxrss * 1024;
+}
+
+double seconds(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+bool makeMesh(std::string const &name, std::string const &objFile, long long faces, Mesh &mesh)
+{
+    mesh.name = name;
+    if (name == "vase") {
+        loadAsIndexedTriangleMesh(objFile, mesh.V, mesh.F);
+        return mesh.F.rows() > 0;
+    }
+    if (name == "vase-subdiv") {
+        loadAsIndexedTriangleMesh(objFile, mesh.V, mesh.F);
+        if (mesh.F.rows() == 0) {
+            return false;
+        }
+        while (mesh.F.rows() < faces) {
+            subdivideMidpoint(mesh.V, mesh.F);
+        }
+        return true;
+    }
+    if (name == "sphere") {
+        makeIcosphere(int(std::ceil(std::sqrt(faces / 20.0))), mesh.V, mesh.F);
+        return true;
+    }
+    if (name == "torus") {
+        int nv = int(std::ceil(std::sqrt(faces / 4.0)));
+        makeTorus(2 * nv, nv, 1.0, 0.3, mesh.V, mesh.F);
+        return true;
+    }
+    if (name == "grid") {
+        int n = int(std::ceil(std::sqrt(faces / 2.0)));
+        makeGrid(n, n, mesh.V, mesh.F);
+        return true;
+    }
+    return false;
+}
+
+std::vector<Kernel> makeKernels(Mesh const &mesh, std::string const &objFile)
+{
+    MatrixXd const &V = mesh.V;
+    MatrixXi const &F = mesh.F;
+
+    // stato condiviso fra i kernel di topologia
+    struct State
+    {
+        std::vector<std::vector<int>> VF, VFi;
+        VectorXi VFoffsets, VFc;
+        MatrixXi FF, FFi;
+        CornerTable table;
+        MatrixXd N;
+        // la stessa mesh in float e con indici a 64 bit
+        MatrixXf Vf, Nf;
+        // normali ai corner quantizzate
+        OctNormals16 NQ;
+        OctNormals8 NQ8;
+        Matrix<std::int64_t, Dynamic, Dynamic> Fl;
+        Bvh bvh;
+        MeshContext mesh;
+        VectorXi moved;
+        MatrixXd positions;
+        // la mesh riordinata per la localita' in cache
+        MatrixXd Vr;
+        MatrixXi Fr;
+        VectorXi VI, FI;
+        // la mesh come zuppa di triangoli e saldata
+        MatrixXd Vs, Vw;
+        MatrixXi Fs, Fw;
+        // buffer dei kernel fusi, riutilizzati fra le ripetizioni
+        NormalsWorkspace<double, int> workspace;
+    };
+    auto s = std::make_shared<State>();
+
+    const double nf = double(F.rows());
+    const double nv = double(V.rows());
+    // lettura di F e dei 3 vertici di ogni faccia
+    const double faceGather = nf * 3 * sizeof(int) + nf * 9 * sizeof(double);
+
+    std::vector<Kernel> kernels;
+    if (mesh.name == "vase") {
+        kernels.push_back({"loadOBJ",
+            [] {},
+            [&objFile, s] {
+                MatrixXd V2;
+                MatrixXi F2;
+                loadOBJ(objFile, V2, F2);
+            },
+            [=, &objFile] {
+                MappedFile file(objFile);
+                return double(file.size()) + nv * 3 * sizeof(double) + nf * 3 * sizeof(int);
+            }});
+        // il prepare genera la cache, il run misura solo il caricamento da essa
+        kernels.push_back({"loadMeshCached",
+            [&objFile] {
+                MeshContext mesh;
+                loadMeshCached(objFile, mesh);
+            },
+            [&objFile] {
+                MeshContext mesh;
+                loadMeshCached(objFile, mesh);
+            },
+            [&objFile] {
+                MappedFile file(meshCachePath(objFile));
+                return double(file.size());
+            }});
+        // normali per faccia e per vertice dal file OBJ: in memoria e in streaming
+        kernels.push_back({"loadOBJ_normals",
+            [] {},
+            [&objFile, s] {
+                MatrixXd V2;
+                MatrixXi F2;
+                loadOBJ(objFile, V2, F2);
+                MatrixXd FN = perFaceNormals(V2, F2);
+                s->N = perVertexNormals(V2, F2);
+            },
+            [=, &objFile] {
+                MappedFile file(objFile);
+                return double(file.size()) + nv * 3 * sizeof(double) + nf * 3 * sizeof(int) +
+                       nf * 3 * sizeof(double) + nv * 3 * sizeof(double);
+            }});
+        kernels.push_back({"streamNormals",
+            [] {},
+            [&objFile] { streamNormals(objFile, objFile + ".wsnormals"); },
+            [=, &objFile] {
+                // testo, file temporanei scritti e riletti, normali scritte
+                MappedFile file(objFile);
+                return double(file.size()) + (nv + nf) * 3 * 8 * 2 + (nf + nv) * 3 * sizeof(double);
+            }});
+    }
+    kernels.push_back({"perFaceNormals",
+        [] {},
+        [&V, &F, s] { s->N = perFaceNormals(V, F); },
+        [=] { return faceGather + nf * 3 * sizeof(double); }});
+    kernels.push_back({"perVertexNormals",
+        [] {},
+        [&V, &F, s] { s->N = perVertexNormals(V, F); },
+        [=] {
+            // geometria per faccia (FN, W), adiacenza CSR, gather e scrittura di N
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(int) * 3 +
+                   nv * sizeof(int) + nv * 3 * sizeof(double);
+        }});
+    kernels.push_back({"perCornerNormals",
+        [] {},
+        [&V, &F, s] { s->N = perCornerNormals(V, F); },
+        [=] {
+            // record per faccia, corner table (chiavi degli spigoli ordinate, O, VC) e normali ai corner
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * (sizeof(std::uint64_t) + sizeof(int)) * 4 +
+                   nf * 3 * sizeof(int) + nv * sizeof(int) + nf * 9 * sizeof(double);
+        }});
+    kernels.push_back({"perCornerNormals_sectors",
+        [&V, &F, s] {
+            // corner table e geometria gia' calcolate: solo i settori
+            s->mesh.set_mesh(V, F);
+            s->mesh.FN();
+            s->mesh.corner_table();
+        },
+        [s] { s->N = perCornerNormals(s->mesh); },
+        [=] {
+            return nf * 3 * sizeof(int) * 2 + nv * sizeof(int) + nf * 7 * sizeof(double) +
+                   nf * 9 * sizeof(double);
+        }});
+    kernels.push_back({"updateNormals_0.1%",
+        [&V, &F, s] {
+            // tutte le normali gia' calcolate; si sposta un vertice ogni 1000
+            s->mesh.set_mesh(V, F);
+            s->mesh.normals(NormalMode::Vertex, [](MeshContext &m, MatrixXd &N) { perVertexNormals(m, N); });
+            s->mesh.normals(NormalMode::Corner, [](MeshContext &m, MatrixXd &N) { perCornerNormals(m, N); });
+            s->moved.resize(V.rows() / 1000);
+            s->positions.resize(s->moved.size(), 3);
+            for (int k = 0; k < s->moved.size(); ++k) {
+                s->moved(k) = k * 1000;
+                s->positions.row(k) = V.row(k * 1000) * 1.01;
+            }
+        },
+        [s] {
+            s->mesh.update_vertices(s->moved, s->positions);
+            s->mesh.normals(NormalMode::Vertex, nullptr, [](MeshContext &m, MatrixXd &N) { updateVertexNormals(m, N); });
+            s->mesh.normals(NormalMode::Corner, nullptr, [](MeshContext &m, MatrixXd &N) { updateCornerNormals(m, N); });
+        },
+        [=] {
+            // per vertice spostato circa 6 facce e 12 vertici con 6 corner ciascuno
+            return nv / 1000 * (6 * (faceGather / nf + 19 * sizeof(double)) + 12 * 6 * 10 * sizeof(double));
+        }});
+    // kernel fusi a regime: adiacenze gia' calcolate, nessuna allocazione
+    auto adjacency = [&V, &F, s] {
+        vertex_face_adjacency(V, F, s->VFoffsets, s->VFc);
+        face_face_adjacency(V, F, s->VFoffsets, s->VFc, s->FF, s->FFi);
+    };
+    kernels.push_back({"faceRecords",
+        [] {},
+        [&V, &F, s] { faceRecords(V, F, s->workspace.records); },
+        [=] { return faceGather + nf * 6 * sizeof(double); }});
+    kernels.push_back({"perVertexNormals_fused",
+        adjacency,
+        [&V, &F, s] { perVertexNormals(V, F, s->VFoffsets, s->VFc, s->workspace, s->N); },
+        [=] {
+            // record scritti e letti una volta per corner, adiacenza CSR, N
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(int) + nv * sizeof(int) +
+                   nv * 3 * sizeof(double);
+        }});
+    kernels.push_back({"perCornerNormals_fused",
+        adjacency,
+        [&V, &F, s] { perCornerNormals(V, F, s->VFoffsets, s->VFc, s->FF, s->FFi, 30.0, s->workspace, s->N); },
+        [=] {
+            // record, adiacenze (VF, FF, FFi) e normali ai corner
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(int) * 3 + nv * sizeof(int) +
+                   nf * 9 * sizeof(double);
+        }});
+    kernels.push_back({"corner_table",
+        [] {},
+        [&V, &F, s] { s->table.build(V, F); },
+        [=] {
+            // chiavi degli spigoli e corner (doppio buffer del radix sort), O, VC e visita dei ventagli
+            return nf * 3 * sizeof(int) + nf * 3 * (sizeof(std::uint64_t) + sizeof(int)) * 4 +
+                   nf * 3 * sizeof(int) * 3 + nv * sizeof(std::int64_t);
+        }});
+    auto cornerTable = [&V, &F, s] { s->table.build(V, F); };
+    kernels.push_back({"perVertexNormals_corner_table",
+        cornerTable,
+        [&V, &F, s] { perVertexNormals(V, F, s->table, s->workspace, s->N); },
+        [=] {
+            // record scritti e letti una volta per corner, O, VC, N
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(int) + nv * sizeof(int) +
+                   nv * 3 * sizeof(double);
+        }});
+    kernels.push_back({"perCornerNormals_corner_table",
+        cornerTable,
+        [&V, &F, s] { perCornerNormals(V, F, s->table, 30.0, s->workspace, s->N); },
+        [=] {
+            // record, O, VC e normali ai corner
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(int) + nv * sizeof(int) +
+                   nf * 9 * sizeof(double);
+        }});
+    kernels.push_back({"triangleGeometry",
+        [] {},
+        [&V, &F, s] {
+            MatrixXd Fangles;
+            VectorXd Fareas;
+            triangleGeometry(V, F, s->N, Fareas, Fangles);
+        },
+        [=] { return faceGather + nf * 7 * sizeof(double); }});
+    kernels.push_back({"triangleGeometry_float",
+        [&V, s] { s->Vf = V.cast<float>(); },
+        [&F, s] {
+            MatrixXf Fangles;
+            VectorXf Fareas;
+            triangleGeometry(s->Vf, F, s->Nf, Fareas, Fangles);
+        },
+        [=] { return (faceGather + nf * 7 * sizeof(double) - nf * 3 * sizeof(int)) / 2 + nf * 3 * sizeof(int); }});
+    kernels.push_back({"perVertexNormals_float",
+        [&V, s] { s->Vf = V.cast<float>(); },
+        [&F, s] { s->Nf = perVertexNormals(s->Vf, F); },
+        [=] {
+            return (faceGather - nf * 3 * sizeof(int) + nf * 6 * sizeof(double) * 2 + nv * 3 * sizeof(double)) / 2 +
+                   nf * 3 * sizeof(int) * 4 + nv * sizeof(int);
+        }});
+    kernels.push_back({"perVertexNormals_int64",
+        [&F, s] { s->Fl = F.cast<std::int64_t>(); },
+        [&V, s] { s->N = perVertexNormals(V, s->Fl); },
+        [=] {
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(std::int64_t) * 3 +
+                   nv * sizeof(std::int64_t) + nv * 3 * sizeof(double);
+        }});
+    kernels.push_back({"octEncode_corner16",
+        [&V, &F, s] { s->N = perCornerNormals(V, F); },
+        [s] { octEncode(s->N, s->NQ); },
+        [=] { return nf * 3 * (3 * sizeof(double) + 2 * sizeof(std::int16_t)); }});
+    kernels.push_back({"octEncode_corner8",
+        [&V, &F, s] { s->N = perCornerNormals(V, F); },
+        [s] { octEncode(s->N, s->NQ8); },
+        [=] { return nf * 3 * (3 * sizeof(double) + 2 * sizeof(std::int8_t)); }});
+    kernels.push_back({"octDecode_corner16",
+        [&V, &F, s] { octEncode(perCornerNormals(V, F), s->NQ); },
+        [s] { octDecode(s->NQ, s->N); },
+        [=] { return nf * 3 * (3 * sizeof(double) + 2 * sizeof(std::int16_t)); }});
+    kernels.push_back({"perCornerNormals_oct16",
+        [&V, &F, s] {
+            s->mesh.set_mesh(V, F);
+            s->mesh.FN();
+            s->mesh.corner_table();
+        },
+        [s] { perCornerNormals(s->mesh, s->NQ); },
+        [=] {
+            return nf * 3 * sizeof(int) * 2 + nv * sizeof(int) + nf * 7 * sizeof(double) +
+                   nf * 9 * sizeof(double) * 2 + nf * 3 * 2 * sizeof(std::int16_t);
+        }});
+    kernels.push_back({"MeshContext_all_modes",
+        [] {},
+        [&V, &F, s] {
+            // i tre tipi di normali condividono geometria e adiacenze
+            MeshContext mesh(V, F);
+            mesh.normals(NormalMode::Face, [](MeshContext &m, MatrixXd &N) { perFaceNormals(m, N); });
+            mesh.normals(NormalMode::Vertex, [](MeshContext &m, MatrixXd &N) { perVertexNormals(m, N); });
+            mesh.normals(NormalMode::Corner, [](MeshContext &m, MatrixXd &N) { perCornerNormals(m, N); });
+        },
+        [=] { return nf * 3 * sizeof(int) * 2 + nv * 3 * sizeof(double) * 2 + faceGather + nf * 30 * sizeof(double); }});
+    kernels.push_back({"vertex_face_adjacency",
+        [] {},
+        [&V, &F, s] { vertex_face_adjacency(V, F, s->VF, s->VFi); },
+        [=] { return nf * 3 * sizeof(int) + nf * 3 * sizeof(int) * 2; }});
+    kernels.push_back({"face_face_adjacency",
+        [&V, &F, s] { vertex_face_adjacency(V, F, s->VF, s->VFi); },
+        [&V, &F, s] { face_face_adjacency(V, F, s->VF, s->VFi, s->FF, s->FFi); },
+        [=] { return nf * 3 * sizeof(int) + nf * 3 * sizeof(int) * 2 + nf * 3 * sizeof(int) * 2; }});
+    kernels.push_back({"vertex_face_adjacency_csr",
+        [] {},
+        [&V, &F, s] { vertex_face_adjacency(V, F, s->VFoffsets, s->VFc); },
+        [=] { return nf * 3 * sizeof(int) + nf * 3 * sizeof(int) * 2 + nv * sizeof(int) * 2; }});
+    kernels.push_back({"face_face_adjacency_csr",
+        [&V, &F, s] { vertex_face_adjacency(V, F, s->VFoffsets, s->VFc); },
+        [&V, &F, s] { face_face_adjacency(V, F, s->VFoffsets, s->VFc, s->FF, s->FFi); },
+        [=] { return nf * 3 * sizeof(int) + nf * 3 * sizeof(int) + nv * sizeof(int) + nf * 3 * sizeof(int) * 2; }});
+    kernels.push_back({"face_face_adjacency_edges",
+        [] {},
+        [&V, &F, s] { face_face_adjacency(V, F, s->FF, s->FFi); },
+        [=] {
+            // F, chiavi e corner (ordinamento con doppio buffer), FF e FFi
+            return nf * 3 * sizeof(int) + nf * 3 * (sizeof(std::uint64_t) + sizeof(int)) * 4 + nf * 3 * sizeof(int) * 2;
+        }});
+    kernels.push_back({"reorderMesh",
+        [] {},
+        [&V, &F, s] {
+            s->Vr = V;
+            s->Fr = F;
+            reorderMesh(s->Vr, s->Fr, s->VI, s->FI);
+        },
+        [=] {
+            // chiavi e indici (doppio buffer), copie di V e F, permutazioni
+            return (nv + nf) * (sizeof(std::uint64_t) + sizeof(int)) * 4 + nv * 3 * sizeof(double) * 3 +
+                   nf * 3 * sizeof(int) * 4 + (nv + nf) * sizeof(int) * 2;
+        }});
+    auto reorder = [&V, &F, s] {
+        s->Vr = V;
+        s->Fr = F;
+        reorderMesh(s->Vr, s->Fr, s->VI, s->FI);
+    };
+    kernels.push_back({"perVertexNormals_reordered",
+        reorder,
+        [s] { s->N = perVertexNormals(s->Vr, s->Fr); },
+        [=] {
+            return faceGather + nf * 6 * sizeof(double) * 2 + nf * 3 * sizeof(int) * 3 +
+                   nv * sizeof(int) + nv * 3 * sizeof(double);
+        }});
+    kernels.push_back({"perCornerNormals_reordered",
+        reorder,
+        [s] { s->N = perCornerNormals(s->Vr, s->Fr); },
+        [=] {
+            return faceGather + nf * 3 * sizeof(int) * 4 + nf * 8 * sizeof(double) +
+                   nf * 3 * sizeof(double) + nf * 9 * sizeof(double) * 2;
+        }});
+    kernels.push_back({"weldVertices",
+        [&V, &F, s] {
+            s->Vs.resize(F.rows() * 3, 3);
+            s->Fs.resize(F.rows(), 3);
+            for (int f = 0; f < F.rows(); ++f) {
+                for (int p = 0; p < 3; ++p) {
+                    s->Vs.row(3 * f + p) = V.row(F(f, p));
+                    s->Fs(f, p) = 3 * f + p;
+                }
+            }
+        },
+        [s] { weldVertices(s->Vs, s->Fs, 1e-9, s->Vw, s->Fw, s->VI); },
+        [=] {
+            // zuppa, chiavi e indici (doppio buffer) di vertici e facce, mesh saldata
+            return nf * 3 * (3 * sizeof(double) + sizeof(int)) + nf * 4 * (sizeof(std::uint64_t) + sizeof(int)) * 4 +
+                   nv * 3 * sizeof(double) + nf * 3 * sizeof(int);
+        }});
+    // pulizia di facce duplicate, lati accoppiati e ventagli dei vertici:
+    // F, terne ordinate, chiavi e indici (doppio buffer) di facce e lati,
+    // gemelli, adiacenza vertice->facce e ventagli
+    const double topologyCheck = nf * 3 * sizeof(int) * 2 + nf * (sizeof(std::uint64_t) + sizeof(int)) * 4 +
+                                 nf * 3 * (sizeof(std::uint64_t) + sizeof(int)) * 4 + nf * 3 * sizeof(int) * 4 +
+                                 nv * sizeof(int) * 2;
+    kernels.push_back({"validateMesh",
+        [] {},
+        [&V, &F] { validateMesh(V, F); },
+        [=] { return topologyCheck; }});
+    kernels.push_back({"repairMesh",
+        [] {},
+        [&V, &F, s] { repairMesh(V, F, s->Vw, s->Fw, s->VI, s->FI); },
+        [=] { return topologyCheck + nv * 3 * sizeof(double) * 2 + nf * 3 * sizeof(int) * 2; }});
+    // i turni di collassi rileggono la mesh, che cala di pochi punti
+    // percentuali a turno: fino a un quarto delle facce sono circa 7 letture
+    // della mesh iniziale (corner table, chiavi, priorita')
+    kernels.push_back({"simplifyMesh_quarter",
+        [] {},
+        [&V, &F, s] { simplifyMesh(V, F, F.rows() / 4, s->Vw, s->Fw); },
+        [=] { return topologyCheck + 7.0 * nf * 3 * (sizeof(int) * 4 + sizeof(std::uint64_t) * 2); }});
+    kernels.push_back({"bvh_build",
+        [] {},
+        [&V, &F, s] { s->bvh.build(V, F); },
+        [=] { return faceGather + nf * 9 * sizeof(double) + 2 * nf / bvh::max_leaf * sizeof(bvh::Node); }});
+    kernels.push_back({"bvh_raycast_1000",
+        [&V, &F, s] { s->bvh.build(V, F); },
+        [&V, &F, s] {
+            // 1000 raggi dall'esterno verso punti della mesh, come i click
+            Vector3d center = V.colwise().mean().transpose();
+            double radius = (V.rowwise() - center.transpose()).rowwise().norm().maxCoeff();
+            for (int r = 0; r < 1000; ++r) {
+                int f = int((std::int64_t(r) * 7919) % F.rows());
+                Vector3d target = (V.row(F(f, 0)) + V.row(F(f, 1)) + V.row(F(f, 2))).transpose() / 3.0;
+                Vector3d source = center + 3.0 * radius * Vector3d(std::cos(r), std::sin(r), 0.5);
+                int fid;
+                Vector3d bc;
+                s->bvh.intersect(V, F, source, target - source, fid, bc);
+            }
+        },
+        [] { return 0.0; }});
+    return kernels;
+}
+
+void usage()
+{
+    std::cerr << "uso: ws_geo3D_bench [--mesh vase|vase-subdiv|sphere|torus|grid]...\n"
+                 "                    [--obj file.obj] [--faces N] [--repeat R] [--shuffle]\n"
+                 "                    [--kernel nome]... [--output file.json]\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> meshNames;
+    std::vector<std::string> kernelNames;
+    std::string objFile = "../meshes/vase.obj";
+    std::string outFile;
+    long long faces = 1000000;
+    int repeat = 3;
+    bool shuffle = false;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        auto next = [&]() -> std::string {
+            if (a + 1 >= argc) {
+                usage();
+                std::exit(1);
+            }
+            return argv[++a];
+        };
+        if (arg == "--mesh") {
+            meshNames.push_back(next());
+        } else if (arg == "--kernel") {
+            kernelNames.push_back(next());
+        } else if (arg == "--obj") {
+            objFile = next();
+        } else if (arg == "--faces") {
+            faces = std::atoll(next().c_str());
+        } else if (arg == "--repeat") {
+            repeat = std::max(1, std::atoi(next().c_str()));
+        } else if (arg == "--shuffle") {
+            shuffle = true;
+        } else if (arg == "--output") {
+            outFile = next();
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (meshNames.empty()) {
+        meshNames = {"vase", "sphere", "torus", "grid"};
+    }
+
+    std::ostringstream json;
+    json.precision(9);
+    json << "{\n"
+         << "  \"benchmark\": \"ws_geo3D\",\n"
+         << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+         << "  \"repeat\": " << repeat << ",\n"
+         << "  \"shuffle\": " << (shuffle ? "true" : "false") << ",\n"
+         << "  \"results\": [";
+
+    bool first = true;
+    for (auto const &meshName : meshNames) {
+        Mesh mesh;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!makeMesh(meshName, objFile, faces, mesh)) {
+            std::cerr << "impossibile costruire la mesh '" << meshName << "'\n";
+            return 1;
+        }
+        if (shuffle) {
+            shuffleMesh(mesh.V, mesh.F);
+        }
+        double buildTime = seconds(t0, std::chrono::steady_clock::now());
+        std::cerr << meshName << ": " << mesh.V.rows() << " vertici, " << mesh.F.rows()
+                  << " facce (" << buildTime << " s)\n";
+
+        for (auto &kernel : makeKernels(mesh, objFile)) {
+            if (!kernelNames.empty() &&
+                std::find(kernelNames.begin(), kernelNames.end(), kernel.name) == kernelNames.end()) {
+                continue;
+            }
+
+            kernel.prepare();
+            std::vector<double> times;
+            for (int r = 0; r < repeat; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                kernel.run();
+                times.push_back(seconds(start, std::chrono::steady_clock::now()));
+            }
+            std::sort(times.begin(), times.end());
+            double tmin = times.front();
+            double tmed = times[times.size() / 2];
+            double bytes = kernel.bytes();
+
+            std::cerr << "  " << kernel.name << ": " << tmin << " s\n";
+
+            json << (first ? "\n" : ",\n") << "    {"
+                 << "\"mesh\": \"" << mesh.name << "\", "
+                 << "\"vertices\": " << mesh.V.rows() << ", "
+                 << "\"faces\": " << mesh.F.rows() << ", "
+                 << "\"kernel\": \"" << kernel.name << "\", "
+                 << "\"time_s_min\": " << tmin << ", "
+                 << "\"time_s_median\": " << tmed << ", "
+                 << "\"faces_per_s\": " << (tmin > 0 ? mesh.F.rows() / tmin : 0.0) << ", "
+                 << "\"bytes_touched\": " << (long long)bytes << ", "
+                 << "\"bandwidth_gb_s\": " << (tmin > 0 ? bytes / tmin * 1e-9 : 0.0) << ", "
+                 << "\"peak_rss_bytes\": " << peakRSSBytes() << "}";
+            first = false;
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (outFile.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream out(outFile);
+        out << json.str();
+    }
+    return 0;
+}
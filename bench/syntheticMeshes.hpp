@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "../parallelFor.hpp"
+#include "../topology.hpp"
+
+using namespace Eigen;
+
+/**
+ * @brief Genera una sfera geodetica (icosaedro suddiviso) di raggio 1.
+ *
+ * Ogni faccia dell'icosaedro viene suddivisa in n x n triangoli (n segmenti
+ * per lato) e i vertici vengono proiettati sulla sfera. I vertici sui lati
+ * dell'icosaedro sono condivisi fra le due facce adiacenti, per cui la mesh
+ * risultante e' chiusa e manifold. Le facce generate sono 20 * n^2.
+ *
+ * @param n Numero di segmenti per lato dell'icosaedro (n >= 1).
+ * @param V I vertici della mesh generata.
+ * @param F I triangoli della mesh generata, in senso antiorario visti
+ *          dall'esterno.
+ */
+inline void makeIcosphere(int n, MatrixXd &V, MatrixXi &F)
+{
+    n = std::max(n, 1);
+
+    const double t = (1.0 + std::sqrt(5.0)) / 2.0;
+    const double V0[12][3] = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+    const int F0[20][3] = {
+        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}};
+
+    // lati unici dell'icosaedro, orientati dal vertice di indice minore
+    std::vector<std::pair<int, int>> E;
+    for (int f = 0; f < 20; ++f) {
+        for (int p = 0; p < 3; ++p) {
+            int a = F0[f][p];
+            int b = F0[f][(p + 1) % 3];
+            E.emplace_back(std::min(a, b), std::max(a, b));
+        }
+    }
+    std::sort(E.begin(), E.end());
+    E.erase(std::unique(E.begin(), E.end()), E.end());
+
+    auto edgeIndex = [&E](int a, int b) -> int {
+        auto key = std::make_pair(std::min(a, b), std::max(a, b));
+        return int(std::lower_bound(E.begin(), E.end(), key) - E.begin());
+    };
+
+    const long long nEdgeVerts = (long long)E.size() * (n - 1);
+    const long long nFaceVerts = (long long)(n - 1) * (n - 2) / 2;
+    const long long nv = 12 + nEdgeVerts + 20 * nFaceVerts;
+
+    V.resize(nv, 3);
+    F.resize(20 * (long long)n * n, 3);
+
+    auto corner = [&V0](int i) { return Vector3d(V0[i][0], V0[i][1], V0[i][2]); };
+
+    for (int i = 0; i < 12; ++i) {
+        V.row(i) = corner(i).normalized();
+    }
+    for (int e = 0; e < int(E.size()); ++e) {
+        Vector3d a = corner(E[e].first);
+        Vector3d b = corner(E[e].second);
+        for (int s = 1; s < n; ++s) {
+            V.row(12 + (long long)e * (n - 1) + (s - 1)) = (a + (b - a) * (double(s) / n)).normalized();
+        }
+    }
+
+    // indice del vertice che si trova sul lato (a, b) a s passi da a
+    auto edgeVertex = [&](int a, int b, int s) -> int {
+        if (s == 0) return a;
+        if (s == n) return b;
+        int k = a < b ? s : n - s;
+        return int(12 + (long long)edgeIndex(a, b) * (n - 1) + (k - 1));
+    };
+
+    parallel::parallel_for(20, [&](int f) {
+        const int a = F0[f][0];
+        const int b = F0[f][1];
+        const int c = F0[f][2];
+        const long long faceBase = 12 + nEdgeVerts + f * nFaceVerts;
+
+        // vertice del reticolo (i, j): A + i/n (B - A) + j/n (C - A)
+        auto lattice = [&](int i, int j) -> int {
+            if (j == 0) return edgeVertex(a, b, i);
+            if (i == 0) return edgeVertex(a, c, j);
+            if (i + j == n) return edgeVertex(b, c, j);
+            // indice locale dei vertici interni, riga per riga (j = 1..n-2)
+            long long row = j - 1;
+            long long local = row * (n - 2) - row * (row - 1) / 2 + (i - 1);
+            return int(faceBase + local);
+        };
+
+        Vector3d A = corner(a), B = corner(b), C = corner(c);
+        for (int j = 1; j < n - 1; ++j) {
+            for (int i = 1; i + j < n; ++i) {
+                V.row(lattice(i, j)) = (A + (B - A) * (double(i) / n) + (C - A) * (double(j) / n)).normalized();
+            }
+        }
+
+        long long out = (long long)f * n * n;
+        for (int j = 0; j < n; ++j) {
+            for (int i = 0; i + j < n; ++i) {
+                F.row(out++) << lattice(i, j), lattice(i + 1, j), lattice(i, j + 1);
+                if (i + j + 1 < n) {
+                    F.row(out++) << lattice(i + 1, j), lattice(i + 1, j + 1), lattice(i, j + 1);
+                }
+            }
+        }
+    });
+}
+
+/**
+ * @brief Genera un toro chiuso con nu x nv quadrilateri, ognuno diviso in due
+ * triangoli (2 * nu * nv facce).
+ *
+ * @param nu Numero di suddivisioni lungo la circonferenza maggiore.
+ * @param nv Numero di suddivisioni lungo la circonferenza minore.
+ * @param R Raggio maggiore.
+ * @param r Raggio minore.
+ * @param V I vertici della mesh generata.
+ * @param F I triangoli della mesh generata.
+ */
+inline void makeTorus(int nu, int nv, double R, double r, MatrixXd &V, MatrixXi &F)
+{
+    nu = std::max(nu, 3);
+    nv = std::max(nv, 3);
+
+    V.resize((long long)nu * nv, 3);
+    F.resize(2 * (long long)nu * nv, 3);
+
+    parallel::parallel_for(nu, [&](int i) {
+        double u = 2.0 * M_PI * i / nu;
+        for (int j = 0; j < nv; ++j) {
+            double v = 2.0 * M_PI * j / nv;
+            long long id = (long long)i * nv + j;
+            V.row(id) << (R + r * std::cos(v)) * std::cos(u),
+                         (R + r * std::cos(v)) * std::sin(u),
+                         r * std::sin(v);
+
+            int i1 = (i + 1) % nu;
+            int j1 = (j + 1) % nv;
+            int a = int(id);
+            int b = int((long long)i1 * nv + j);
+            int c = int((long long)i1 * nv + j1);
+            int d = int((long long)i * nv + j1);
+            F.row(2 * id) << a, b, c;
+            F.row(2 * id + 1) << a, c, d;
+        }
+    });
+}
+
+/**
+ * @brief Genera una griglia aperta (con bordo) di nx x ny quadrilateri, ognuno
+ * diviso in due triangoli (2 * nx * ny facce). La quota z segue un'onda, per
+ * avere normali non tutte uguali e spigoli vivi lungo la diagonale.
+ *
+ * @param nx Numero di quadrilateri lungo x.
+ * @param ny Numero di quadrilateri lungo y.
+ * @param V I vertici della mesh generata.
+ * @param F I triangoli della mesh generata.
+ */
+inline void makeGrid(int nx, int ny, MatrixXd &V, MatrixXi &F)
+{
+    nx = std::max(nx, 1);
+    ny = std::max(ny, 1);
+
+    V.resize((long long)(nx + 1) * (ny + 1), 3);
+    F.resize(2 * (long long)nx * ny, 3);
+
+    parallel::parallel_for(ny + 1, [&](int j) {
+        for (int i = 0; i <= nx; ++i) {
+            double x = double(i) / nx;
+            double y = double(j) / ny;
+            double z = 0.05 * std::sin(8.0 * M_PI * x) * std::cos(6.0 * M_PI * y) + (x + y > 1.0 ? 0.1 * (x + y - 1.0) : 0.0);
+            V.row((long long)j * (nx + 1) + i) << x, y, z;
+        }
+    });
+
+    parallel::parallel_for(ny, [&](int j) {
+        for (int i = 0; i < nx; ++i) {
+            int a = int((long long)j * (nx + 1) + i);
+            int b = a + 1;
+            int c = a + nx + 2;
+            int d = a + nx + 1;
+            long long q = (long long)j * nx + i;
+            F.row(2 * q) << a, b, c;
+            F.row(2 * q + 1) << a, c, d;
+        }
+    });
+}
+
+/**
+ * @brief Suddivide ogni triangolo della mesh in 4 triangoli, inserendo un
+ * nuovo vertice nel punto medio di ogni lato (il numero di facce quadruplica).
+ *
+ * I punti medi sono condivisi fra facce adiacenti, grazie all'adiacenza
+ * faccia->facce, per cui la topologia della mesh originale (bordi, buchi) e'
+ * preservata.
+ *
+ * @param V I vertici della mesh, sostituiti con quelli della mesh suddivisa.
+ * @param F I triangoli della mesh, sostituiti con quelli della mesh suddivisa.
+ */
+inline void subdivideMidpoint(MatrixXd &V, MatrixXi &F)
+{
+    MatrixXi FF, FFi;
+    face_face_adjacency(V, F, FF, FFi);
+
+    // ogni lato appartiene alla faccia di indice minore fra le due adiacenti
+    MatrixXi E(F.rows(), 3);
+    long long nv = V.rows();
+    for (int f = 0; f < F.rows(); ++f) {
+        for (int p = 0; p < 3; ++p) {
+            int g = FF(f, p);
+            if (g < 0 || f < g) {
+                E(f, p) = int(nv++);
+            } else {
+                E(f, p) = E(g, FFi(f, p));
+            }
+        }
+    }
+
+    MatrixXd V2(nv, 3);
+    MatrixXi F2(F.rows() * 4, 3);
+    V2.topRows(V.rows()) = V;
+
+    parallel::parallel_for(int(F.rows()), [&](int f) {
+        for (int p = 0; p < 3; ++p) {
+            if (FF(f, p) < 0 || f < FF(f, p)) {
+                V2.row(E(f, p)) = (V.row(F(f, p)) + V.row(F(f, (p + 1) % 3))) / 2.0;
+            }
+        }
+        F2.row(4 * (long long)f + 0) << F(f, 0), E(f, 0), E(f, 2);
+        F2.row(4 * (long long)f + 1) << F(f, 1), E(f, 1), E(f, 0);
+        F2.row(4 * (long long)f + 2) << F(f, 2), E(f, 2), E(f, 1);
+        F2.row(4 * (long long)f + 3) << E(f, 0), E(f, 1), E(f, 2);
+    });
+
+    V.swap(V2);
+    F.swap(F2);
+}
+
+/**
+ * @brief Permuta casualmente vertici e facce della mesh, come in una mesh
+ * acquisita con ordine arbitrario (ad esempio da scanner). La geometria e
+ * l'orientazione delle facce non cambiano.
+ *
+ * @param V I vertici della mesh, permutati in-place.
+ * @param F I triangoli della mesh, permutati e rimappati in-place.
+ * @param seed Il seme del generatore pseudo-casuale.
+ */
+inline void shuffleMesh(MatrixXd &V, MatrixXi &F, unsigned seed = 1)
+{
+    std::mt19937 rng(seed);
+
+    std::vector<int> vperm(V.rows());
+    for (int v = 0; v < V.rows(); ++v) {
+        vperm[v] = v;
+    }
+    std::shuffle(vperm.begin(), vperm.end(), rng);
+
+    std::vector<int> fperm(F.rows());
+    for (int f = 0; f < F.rows(); ++f) {
+        fperm[f] = f;
+    }
+    std::shuffle(fperm.begin(), fperm.end(), rng);
+
+    // il vertice v va in posizione vperm[v], la faccia f in fperm[f]
+    MatrixXd V2(V.rows(), 3);
+    MatrixXi F2(F.rows(), 3);
+    parallel::parallel_for(int(V.rows()), [&](int v) { V2.row(vperm[v]) = V.row(v); });
+    parallel::parallel_for(int(F.rows()), [&](int f) {
+        for (int p = 0; p < 3; ++p) {
+            F2(fperm[f], p) = vperm[F(f, p)];
+        }
+    });
+
+    V.swap(V2);
+    F.swap(F2);
+}
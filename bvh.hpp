@@ -0,0 +1,597 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+
+using namespace Eigen;
+
+namespace bvh {
+
+// numero di bin per asse nella valutazione della SAH
+const int bins = 16;
+// i nodi con al piu' min_leaf triangoli sono sempre foglie; i nodi con piu'
+// di max_leaf triangoli non lo sono mai
+const int min_leaf = 4;
+const int max_leaf = 8;
+// sotto questa soglia di triangoli un sottoalbero viene costruito da un solo
+// thread; sopra, il binning di un nodo e' parallelo
+const std::int64_t min_parallel = 1 << 15;
+
+struct Box
+{
+    Vector3d min = Vector3d::Constant(std::numeric_limits<double>::infinity());
+    Vector3d max = Vector3d::Constant(-std::numeric_limits<double>::infinity());
+
+    void extend(Box const &b)
+    {
+        min = min.cwiseMin(b.min);
+        max = max.cwiseMax(b.max);
+    }
+
+    void extend(Vector3d const &p)
+    {
+        min = min.cwiseMin(p);
+        max = max.cwiseMax(p);
+    }
+
+    double area() const
+    {
+        if (!(min.array() <= max.array()).all()) {
+            return 0.0;
+        }
+        Vector3d d = max - min;
+        return 2.0 * (d(0) * d(1) + d(1) * d(2) + d(2) * d(0));
+    }
+};
+
+/**
+ * @brief Un nodo della gerarchia, 64 byte (una linea di cache).
+ *
+ * Se count > 0 e' una foglia con i triangoli [start, start + count) della
+ * permutazione dei triangoli, altrimenti e' un nodo interno con i due figli
+ * consecutivi start e start + 1.
+ */
+struct Node
+{
+    double min[3];
+    double max[3];
+    std::int64_t start;
+    std::int32_t count;
+    std::int32_t padding;
+};
+
+// un bin della SAH: box dei triangoli e numero di triangoli
+struct Bin
+{
+    Box box;
+    std::int64_t count = 0;
+};
+
+/**
+ * @brief Intersezione raggio-triangolo di Moller-Trumbore, con le stesse
+ * operazioni e la stessa tolleranza di igl::ray_mesh_intersect (raytri.c,
+ * intersect_triangle1), cosi' che i risultati coincidano.
+ */
+inline bool intersect_triangle(
+    Vector3d const &o, Vector3d const &d,
+    Vector3d const &v0, Vector3d const &v1, Vector3d const &v2,
+    double &t, double &u, double &v)
+{
+    const double epsilon = 0.000001;
+
+    Vector3d e1 = v1 - v0;
+    Vector3d e2 = v2 - v0;
+    Vector3d p = d.cross(e2);
+    double det = e1.dot(p);
+    Vector3d q;
+    if (det > epsilon) {
+        Vector3d s = o - v0;
+        u = s.dot(p);
+        if (u < 0.0 || u > det) {
+            return false;
+        }
+        q = s.cross(e1);
+        v = d.dot(q);
+        if (v < 0.0 || u + v > det) {
+            return false;
+        }
+    } else if (det < -epsilon) {
+        Vector3d s = o - v0;
+        u = s.dot(p);
+        if (u > 0.0 || u < det) {
+            return false;
+        }
+        q = s.cross(e1);
+        v = d.dot(q);
+        if (v > 0.0 || u + v < det) {
+            return false;
+        }
+    } else {
+        // raggio parallelo al piano del triangolo
+        return false;
+    }
+    double inv = 1.0 / det;
+    t = e2.dot(q) * inv;
+    u *= inv;
+    v *= inv;
+    return true;
+}
+
+} // namespace bvh
+
+/**
+ * @brief Gerarchia di bounding box (BVH) sui triangoli di una mesh, per il
+ * lancio di raggi (picking).
+ *
+ * La gerarchia viene costruita una volta per mesh (build()) e riusata per
+ * tutti i raggi (intersect()), che visitano solo i nodi attraversati dal
+ * raggio invece di tutti i triangoli.
+ *
+ * Costruzione: i nodi vengono divisi con la SAH (surface area heuristic)
+ * valutata su 16 bin per asse dei centroidi dei triangoli; un nodo con al
+ * piu' 4 triangoli e' una foglia, uno con 5-8 triangoli lo diventa se la SAH
+ * non trova una divisione piu' conveniente. I nodi grandi calcolano i bin in parallelo, con bin privati
+ * per thread; i sottoalberi piccoli vengono costruiti in parallelo, uno per
+ * thread, e poi copiati nell'array dei nodi. La costruzione e' deterministica.
+ *
+ * Memoria: i nodi sono in un solo array, con i figli consecutivi (un solo
+ * indice per nodo), e i triangoli di ogni foglia sono contigui nella
+ * permutazione _faces, per cui la visita legge memoria sequenziale.
+ *
+ * Visita: iterativa con uno stack esplicito; il test raggio-box usa gli slab
+ * con l'inverso della direzione precalcolato (solo moltiplicazioni e min/max,
+ * senza rami dipendenti dai dati, vettorizzabili dal compilatore), si
+ * scende prima nel figlio piu' vicino e si scartano i nodi piu' lontani
+ * dell'intersezione gia' trovata.
+ */
+template <typename Int>
+class BvhT
+{
+  public:
+    /**
+     * @brief Costruisce la gerarchia sui triangoli della mesh (V, F).
+     */
+    template <typename DerivedV, typename DerivedF>
+    void build(MatrixBase<DerivedV> const &V, MatrixBase<DerivedF> const &F)
+    {
+        using namespace bvh;
+
+        WS_PROFILE_SCOPE("Bvh::build");
+
+        const Int nf = Int(F.rows());
+        _nodes.clear();
+        _faces.resize(nf);
+        if (nf == 0) {
+            return;
+        }
+
+        // box e centroide di ogni triangolo
+        _boxes.resize(nf);
+        _centroids.resize(nf);
+        parallel::parallel_for(nf, [&](Int f) {
+            Box b;
+            for (int p = 0; p < 3; ++p) {
+                b.extend(Vector3d(V.row(F(f, p)).template cast<double>().transpose()));
+            }
+            _boxes[f] = b;
+            _centroids[f] = 0.5 * (b.min + b.max);
+            _faces[f] = f;
+        }, 1 << 14);
+
+        // box della radice, riduzione parallela
+        std::vector<Box> partial;
+        parallel::parallel_for(nf,
+            [&](int nthreads) { partial.assign(nthreads, Box()); },
+            [&](Int f, std::size_t t) { partial[t].extend(_boxes[f]); },
+            [&](std::size_t) {},
+            1 << 14);
+        Box root;
+        for (Box const &b : partial) {
+            root.extend(b);
+        }
+
+        // parte alta dell'albero, con binning parallelo; i sottoalberi
+        // piccoli vengono raccolti e costruiti dopo, in parallelo
+        std::vector<Task> tasks;
+        _nodes.reserve(2 * std::size_t(nf) / max_leaf + 1);
+        _nodes.push_back(Node());
+        split(0, 0, nf, root, tasks);
+
+        std::vector<std::vector<Node>> subtrees(tasks.size());
+        parallel::parallel_for(Int(tasks.size()), [&](Int k) {
+            Task const &task = tasks[k];
+            std::vector<Node> &nodes = subtrees[k];
+            nodes.push_back(Node());
+            build_serial(nodes, 0, task.begin, task.end, task.box);
+        }, 2);
+
+        // copia dei sottoalberi: la radice va nel nodo riservato, gli altri
+        // nodi in coda, spostando gli indici dei figli
+        std::vector<std::size_t> base(tasks.size());
+        std::size_t total = _nodes.size();
+        for (std::size_t k = 0; k < tasks.size(); ++k) {
+            base[k] = total;
+            total += subtrees[k].size() - 1;
+        }
+        _nodes.resize(total);
+        parallel::parallel_for(Int(tasks.size()), [&](Int k) {
+            std::vector<Node> const &nodes = subtrees[k];
+            auto relocate = [&](Node n) {
+                if (n.count == 0) {
+                    n.start = std::int64_t(base[k]) + n.start - 1;
+                }
+                return n;
+            };
+            _nodes[tasks[k].node] = relocate(nodes[0]);
+            for (std::size_t i = 1; i < nodes.size(); ++i) {
+                _nodes[base[k] + i - 1] = relocate(nodes[i]);
+            }
+        }, 2);
+
+        std::vector<Box>().swap(_boxes);
+        std::vector<Vector3d>().swap(_centroids);
+    }
+
+    bool empty() const { return _nodes.empty(); }
+
+    /**
+     * @brief Interseca un raggio con la mesh e restituisce l'intersezione piu'
+     * vicina all'origine.
+     *
+     * Il risultato e' lo stesso di igl::unproject_onto_mesh (stesso test
+     * raggio-triangolo, t > 0, intersezione di t minimo); a parita' di t (ad
+     * esempio un raggio che passa esattamente per un lato) viene scelto il
+     * triangolo di indice minore.
+     *
+     * @param V I vertici della mesh su cui e' stata costruita la gerarchia.
+     * @param F I triangoli della mesh su cui e' stata costruita la gerarchia.
+     * @param source L'origine del raggio.
+     * @param dir La direzione del raggio (non necessariamente unitaria).
+     * @param fid L'indice del triangolo colpito.
+     * @param bc Le coordinate baricentriche del punto colpito rispetto ai 3
+     *           vertici di F.row(fid).
+     * @return true se il raggio colpisce la mesh.
+     */
+    template <typename DerivedV, typename DerivedF>
+    bool intersect(
+        MatrixBase<DerivedV> const &V,
+        MatrixBase<DerivedF> const &F,
+        Vector3d const &source,
+        Vector3d const &dir,
+        Int &fid,
+        Vector3d &bc) const
+    {
+        using namespace bvh;
+
+        if (_nodes.empty()) {
+            return false;
+        }
+
+        const double inf = std::numeric_limits<double>::infinity();
+        double inv[3];
+        for (int k = 0; k < 3; ++k) {
+            inv[k] = dir(k) != 0.0 ? 1.0 / dir(k) : (std::signbit(dir(k)) ? -inf : inf);
+        }
+
+        double best = inf;
+        Int bestFace = -1;
+        double bestU = 0.0, bestV = 0.0;
+
+        // un nodo va visitato se il raggio lo attraversa non oltre best (a
+        // parita' di t vince il triangolo di indice minore)
+        auto visit = [&](double t) { return t < inf && t <= best; };
+
+        // nello stack ci sono i nodi da visitare, con la distanza di ingresso
+        std::vector<std::pair<std::int64_t, double>> stack;
+        stack.reserve(64);
+        stack.push_back(std::make_pair(std::int64_t(0), slab(_nodes[0], source, inv)));
+        while (!stack.empty()) {
+            Node const &node = _nodes[stack.back().first];
+            double entry = stack.back().second;
+            stack.pop_back();
+            if (!visit(entry)) {
+                continue;
+            }
+            if (node.count > 0) {
+                for (std::int64_t i = node.start; i < node.start + node.count; ++i) {
+                    Int f = _faces[i];
+                    double t, u, v;
+                    if (intersect_triangle(
+                            source, dir,
+                            V.row(F(f, 0)).template cast<double>().transpose(),
+                            V.row(F(f, 1)).template cast<double>().transpose(),
+                            V.row(F(f, 2)).template cast<double>().transpose(),
+                            t, u, v) &&
+                        t > 0 && (t < best || (t == best && f < bestFace))) {
+                        best = t;
+                        bestFace = f;
+                        bestU = u;
+                        bestV = v;
+                    }
+                }
+                continue;
+            }
+            // prima il figlio piu' vicino: viene estratto per primo
+            double t0 = slab(_nodes[node.start], source, inv);
+            double t1 = slab(_nodes[node.start + 1], source, inv);
+            std::int64_t near = t0 <= t1 ? node.start : node.start + 1;
+            if (visit(std::max(t0, t1))) {
+                stack.push_back(std::make_pair(2 * node.start + 1 - near, std::max(t0, t1)));
+            }
+            if (visit(std::min(t0, t1))) {
+                stack.push_back(std::make_pair(near, std::min(t0, t1)));
+            }
+        }
+
+        if (bestFace < 0) {
+            return false;
+        }
+        fid = bestFace;
+        bc << 1.0 - bestU - bestV, bestU, bestV;
+        return true;
+    }
+
+  private:
+    // sottoalbero da costruire in parallelo nel nodo riservato node
+    struct Task
+    {
+        std::size_t node;
+        Int begin;
+        Int end;
+        bvh::Box box;
+    };
+
+    /**
+     * @brief Distanza di ingresso del raggio nel box del nodo, o +inf se il
+     * raggio non lo attraversa per t > 0.
+     *
+     * L'uscita e' aumentata di qualche ulp per non scartare box attraversati
+     * di striscio a causa degli arrotondamenti.
+     */
+    static double slab(bvh::Node const &node, Vector3d const &o, double const inv[3])
+    {
+        double tmin = 0.0;
+        double tmax = std::numeric_limits<double>::infinity();
+        for (int k = 0; k < 3; ++k) {
+            double a = (node.min[k] - o(k)) * inv[k];
+            double b = (node.max[k] - o(k)) * inv[k];
+            // un NaN (0 * inf: raggio parallelo con l'origine su un piano del
+            // box) e' il secondo argomento di max/min e viene ignorato
+            tmin = std::max(tmin, std::min(a, b));
+            tmax = std::min(tmax, std::max(a, b));
+        }
+        tmax *= 1.0 + 4.0 * DBL_EPSILON;
+        return tmin <= tmax ? tmin : std::numeric_limits<double>::infinity();
+    }
+
+    static void set_box(bvh::Node &node, bvh::Box const &box)
+    {
+        for (int k = 0; k < 3; ++k) {
+            node.min[k] = box.min(k);
+            node.max[k] = box.max(k);
+        }
+    }
+
+    /**
+     * @brief Calcola i bin dei triangoli [begin, end) sui 3 assi, in
+     * parallelo se sono molti.
+     */
+    void binning(Int begin, Int end, bvh::Box const &centroids, bvh::Bin bins[3][bvh::bins]) const
+    {
+        using namespace bvh;
+
+        auto bin_of = [&](Vector3d const &c, int axis) {
+            double extent = centroids.max(axis) - centroids.min(axis);
+            int b = int(bvh::bins * (c(axis) - centroids.min(axis)) / extent);
+            return std::min(std::max(b, 0), bvh::bins - 1);
+        };
+        auto add = [&](Bin local[3][bvh::bins], Int i) {
+            Int f = _faces[i];
+            for (int axis = 0; axis < 3; ++axis) {
+                if (centroids.max(axis) > centroids.min(axis)) {
+                    Bin &b = local[axis][bin_of(_centroids[f], axis)];
+                    b.box.extend(_boxes[f]);
+                    ++b.count;
+                }
+            }
+        };
+
+        if (end - begin < min_parallel) {
+            for (Int i = begin; i < end; ++i) {
+                add(bins, i);
+            }
+            return;
+        }
+
+        typedef std::array<std::array<Bin, bvh::bins>, 3> Bins;
+        std::vector<Bins> partial;
+        parallel::parallel_for(end - begin,
+            [&](int nthreads) { partial.assign(nthreads, Bins()); },
+            [&](Int i, std::size_t t) {
+                Int f = _faces[begin + i];
+                for (int axis = 0; axis < 3; ++axis) {
+                    if (centroids.max(axis) > centroids.min(axis)) {
+                        Bin &b = partial[t][axis][bin_of(_centroids[f], axis)];
+                        b.box.extend(_boxes[f]);
+                        ++b.count;
+                    }
+                }
+            },
+            [&](std::size_t) {},
+            min_parallel);
+        for (Bins const &p : partial) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int b = 0; b < bvh::bins; ++b) {
+                    bins[axis][b].box.extend(p[axis][b].box);
+                    bins[axis][b].count += p[axis][b].count;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Sceglie la divisione dei triangoli [begin, end) con la SAH e li
+     * partiziona. Restituisce false se conviene una foglia.
+     */
+    bool choose_split(Int begin, Int end, bvh::Box const &box, Int &mid, bvh::Box &left, bvh::Box &right)
+    {
+        using namespace bvh;
+
+        const Int n = end - begin;
+        if (n <= min_leaf) {
+            return false;
+        }
+
+        Box centroids;
+        for (Int i = begin; i < end; ++i) {
+            centroids.extend(_centroids[_faces[i]]);
+        }
+
+        Bin binsAxes[3][bvh::bins];
+        binning(begin, end, centroids, binsAxes);
+
+        // costo di una foglia: un test per triangolo; di un nodo interno:
+        // un test di box piu' i triangoli dei figli pesati per l'area
+        double bestCost = double(n);
+        int bestAxis = -1;
+        int bestSplit = 0;
+        const double area = box.area();
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!(centroids.max(axis) > centroids.min(axis))) {
+                continue;
+            }
+            Bin const *b = binsAxes[axis];
+            // aree e conteggi cumulati da destra
+            double rightArea[bvh::bins];
+            std::int64_t rightCount[bvh::bins];
+            Box acc;
+            std::int64_t count = 0;
+            for (int i = bvh::bins - 1; i > 0; --i) {
+                acc.extend(b[i].box);
+                count += b[i].count;
+                rightArea[i] = acc.area();
+                rightCount[i] = count;
+            }
+            acc = Box();
+            count = 0;
+            for (int i = 1; i < bvh::bins; ++i) {
+                acc.extend(b[i - 1].box);
+                count += b[i - 1].count;
+                if (count == 0 || rightCount[i] == 0) {
+                    continue;
+                }
+                double cost = 1.0 + (acc.area() * double(count) + rightArea[i] * double(rightCount[i])) / area;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        if (bestAxis < 0) {
+            if (n <= max_leaf) {
+                return false;
+            }
+            // centroidi coincidenti o SAH sfavorevole, ma troppi triangoli
+            // per una foglia: divisione a meta' dell'intervallo
+            mid = begin + n / 2;
+            left = Box();
+            right = Box();
+            for (Int i = begin; i < mid; ++i) {
+                left.extend(_boxes[_faces[i]]);
+            }
+            for (Int i = mid; i < end; ++i) {
+                right.extend(_boxes[_faces[i]]);
+            }
+            return true;
+        }
+
+        const double lo = centroids.min(bestAxis);
+        const double extent = centroids.max(bestAxis) - lo;
+        auto it = std::partition(_faces.begin() + begin, _faces.begin() + end, [&](Int f) {
+            int b = int(bvh::bins * (_centroids[f](bestAxis) - lo) / extent);
+            return std::min(std::max(b, 0), bvh::bins - 1) < bestSplit;
+        });
+        mid = Int(it - _faces.begin());
+        left = Box();
+        right = Box();
+        for (int i = 0; i < bestSplit; ++i) {
+            left.extend(binsAxes[bestAxis][i].box);
+        }
+        for (int i = bestSplit; i < bvh::bins; ++i) {
+            right.extend(binsAxes[bestAxis][i].box);
+        }
+        return true;
+    }
+
+    // parte alta: i sottoalberi con meno di min_parallel triangoli diventano task
+    void split(std::size_t node, Int begin, Int end, bvh::Box const &box, std::vector<Task> &tasks)
+    {
+        using namespace bvh;
+
+        if (end - begin < min_parallel) {
+            tasks.push_back({node, begin, end, box});
+            return;
+        }
+        set_box(_nodes[node], box);
+        Int mid;
+        Box left, right;
+        if (!choose_split(begin, end, box, mid, left, right)) {
+            _nodes[node].start = std::int64_t(begin);
+            _nodes[node].count = std::int32_t(end - begin);
+            return;
+        }
+        std::size_t child = _nodes.size();
+        _nodes[node].start = std::int64_t(child);
+        _nodes[node].count = 0;
+        _nodes.push_back(Node());
+        _nodes.push_back(Node());
+        split(child, begin, mid, left, tasks);
+        split(child + 1, mid, end, right, tasks);
+    }
+
+    // sottoalbero costruito da un solo thread in un array di nodi locale
+    void build_serial(std::vector<bvh::Node> &nodes, std::size_t node, Int begin, Int end, bvh::Box const &box)
+    {
+        using namespace bvh;
+
+        set_box(nodes[node], box);
+        Int mid;
+        Box left, right;
+        if (!choose_split(begin, end, box, mid, left, right)) {
+            nodes[node].start = std::int64_t(begin);
+            nodes[node].count = std::int32_t(end - begin);
+            return;
+        }
+        std::size_t child = nodes.size();
+        nodes[node].start = std::int64_t(child);
+        nodes[node].count = 0;
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        build_serial(nodes, child, begin, mid, left);
+        build_serial(nodes, child + 1, mid, end, right);
+    }
+
+    std::vector<bvh::Node> _nodes;
+    std::vector<Int> _faces;
+
+    // dati temporanei della costruzione
+    std::vector<bvh::Box> _boxes;
+    std::vector<Vector3d> _centroids;
+};
+
+typedef BvhT<int> Bvh;
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "parallelFor.hpp"
+#include "parallelGroup.hpp"
+#include "profiler.hpp"
+#include "radixSort.hpp"
+
+using namespace Eigen;
+
+/**
+ * @brief Topologia compatta di una mesh di triangoli (corner table): per ogni
+ * corner il corner opposto, per ogni vertice uno dei suoi corner.
+ *
+ * Il corner p della faccia f ha indice c = 3 * f + p. Il corner opposto
+ * O(c) e' il corner, nella faccia adiacente attraverso il lato opposto a c
+ * (da next(c) a prev(c)), che non sta su quel lato; -1 sul bordo. La
+ * topologia occupa quindi 4 byte per corner (con indici a 32 bit), piu' 4
+ * per vertice, contro gli 8 per corner di FF/FFi e i 4 per corner (piu' 4 per
+ * vertice) dell'adiacenza vertice->facce.
+ *
+ * I corner di un vertice formano un ventaglio (fan): swing(c) e' il corner
+ * dello stesso vertice nella faccia successiva in senso antiorario, unswing(c)
+ * in quella precedente. corner(v) e' il primo corner del ventaglio: su un
+ * vertice di bordo quello per cui unswing() e' -1, per cui one_ring(v)
+ * visita tutti i corner del vertice partendo da corner(v). I vertici
+ * non-manifold (piu' ventagli che si toccano solo nel vertice) hanno i
+ * ventagli successivi al primo in una lista a parte, di norma vuota, visitata
+ * anch'essa da one_ring().
+ *
+ * Sono accoppiati solo i lati manifold percorsi in senso opposto da due facce
+ * diverse: i lati di bordo, non-manifold (piu' di due facce), con facce
+ * orientate in modo incoerente o degeneri hanno O(c) == -1. Per questo
+ * O(O(c)) == c e i ventagli sono sempre ben definiti. Sui lati manifold
+ * l'adiacenza coincide con face_face_adjacency() (vedi face_face_adjacency()
+ * di questa classe).
+ *
+ * La costruzione (build()) e' parallela e deterministica: i lati sono
+ * accoppiati ordinando con radix_sort() le chiavi dei loro vertici, come in
+ * face_face_adjacency(), e il primo corner di ogni vertice e' il minore fra i
+ * candidati.
+ */
+template <typename Int>
+class CornerTableT
+{
+  public:
+    static Int face(Int c) { return c / 3; }
+    static Int next(Int c) { return c % 3 == 2 ? c - 2 : c + 1; }
+    static Int prev(Int c) { return c % 3 == 0 ? c + 2 : c - 1; }
+
+    /**
+     * @brief Costruisce la tabella della mesh (V, F).
+     */
+    template <typename DerivedV, typename DerivedF>
+    void build(MatrixBase<DerivedV> const &V, MatrixBase<DerivedF> const &F)
+    {
+        WS_PROFILE_SCOPE("CornerTable::build");
+
+        const Int nv = Int(V.rows());
+        const Int nc = Int(F.rows() * 3);
+        const size_t min_parallel = 1 << 14;
+
+        WS_PROFILE_COUNT("corners", nc);
+        // O e VC, chiavi e corner del radix sort (con doppio buffer)
+        WS_PROFILE_COUNT("allocated_bytes", (nc + nv) * sizeof(Int) + nc * (sizeof(std::uint64_t) + sizeof(Int)) * 2);
+
+        _O.assign(nc, -1);
+        _VC.assign(nv, -1);
+        _fanVertices.clear();
+        _fanCorners.clear();
+        if (nc == 0) {
+            return;
+        }
+
+        auto vertex = [&](Int c) { return Int(F(c / 3, c % 3)); };
+
+        // 1. opposti: il lato opposto a c va da next(c) a prev(c)
+        int bits = 1;
+        while (bits < 32 && (std::int64_t(1) << bits) < nv) {
+            ++bits;
+        }
+        std::vector<std::uint64_t> keys(nc);
+        std::vector<Int> corners(nc);
+        parallel::parallel_for(nc, [&](Int c) {
+            std::uint64_t a = std::uint64_t(vertex(next(c)));
+            std::uint64_t b = std::uint64_t(vertex(prev(c)));
+            keys[c] = (std::min(a, b) << bits) | std::max(a, b);
+            corners[c] = c;
+        }, min_parallel);
+
+        radix_sort(keys, corners, 2 * bits);
+
+        parallel::parallel_for(nc, [&](Int g) {
+            if (g > 0 && keys[g] == keys[g - 1]) {
+                return;
+            }
+            if (g + 2 > nc || keys[g + 1] != keys[g] || (g + 2 < nc && keys[g + 2] == keys[g])) {
+                return;
+            }
+            Int c0 = corners[g];
+            Int c1 = corners[g + 1];
+            if (vertex(next(c0)) == vertex(prev(c1)) && vertex(prev(c0)) == vertex(next(c1)) &&
+                vertex(next(c0)) != vertex(prev(c0)) && face(c0) != face(c1)) {
+                _O[c0] = c1;
+                _O[c1] = c0;
+            }
+        }, min_parallel);
+
+        // 2. primo corner di ogni vertice: il minore fra gli inizi di un
+        //    ventaglio aperto, o il minore se i ventagli sono tutti chiusi
+        {
+            const std::int64_t closed = std::int64_t(1) << 62;
+            std::vector<std::atomic<std::int64_t>> first(nv);
+            parallel::parallel_for(nv, [&](Int v) {
+                first[v].store(std::numeric_limits<std::int64_t>::max(), std::memory_order_relaxed);
+            }, min_parallel);
+            parallel::parallel_for(nc, [&](Int c) {
+                weld::atomic_min(first[vertex(c)], std::int64_t((unswing(c) < 0 ? 0 : closed) | c));
+            }, min_parallel);
+            parallel::parallel_for(nv, [&](Int v) {
+                std::int64_t k = first[v].load(std::memory_order_relaxed);
+                _VC[v] = k == std::numeric_limits<std::int64_t>::max() ? -1 : Int(k & (closed - 1));
+            }, min_parallel);
+        }
+
+        // 3. i corner non raggiunti dal primo ventaglio sono di vertici
+        //    non-manifold: i loro ventagli vanno nella lista a parte
+        std::vector<char> visited(nc, 0);
+        parallel::parallel_for(nv, [&](Int v) {
+            walk(_VC[v], [&](Int c) { visited[c] = 1; });
+        }, min_parallel);
+
+        std::vector<std::pair<Int, Int>> fans;
+        for (auto it = std::find(visited.begin(), visited.end(), 0); it != visited.end();
+             it = std::find(it + 1, visited.end(), 0)) {
+            Int c = Int(it - visited.begin());
+            if (visited[c]) {
+                continue;
+            }
+            // inizio del ventaglio: all'indietro fino al bordo o al giro completo
+            Int start = c;
+            for (Int u = unswing(c); u >= 0 && u != c; u = unswing(u)) {
+                start = u;
+            }
+            walk(start, [&](Int k) { visited[k] = 1; });
+            fans.emplace_back(vertex(c), start);
+        }
+        std::sort(fans.begin(), fans.end());
+        for (auto const &fan : fans) {
+            _fanVertices.push_back(fan.first);
+            _fanCorners.push_back(fan.second);
+        }
+        WS_PROFILE_COUNT("nonmanifold_fans", fans.size());
+    }
+
+    Int corners() const { return Int(_O.size()); }
+    Int vertices() const { return Int(_VC.size()); }
+
+    /**
+     * @brief Il corner opposto a c, o -1 se il lato opposto e' di bordo.
+     */
+    Int opposite(Int c) const { return _O[c]; }
+
+    /**
+     * @brief Il primo corner del vertice v, o -1 se v non ha facce.
+     */
+    Int corner(Int v) const { return _VC[v]; }
+
+    /**
+     * @brief Il corner dello stesso vertice di c nella faccia successiva in
+     * senso antiorario (attraverso il lato da c a prev(c)), o -1 sul bordo.
+     */
+    Int swing(Int c) const
+    {
+        Int o = _O[next(c)];
+        return o < 0 ? -1 : next(o);
+    }
+
+    /**
+     * @brief L'inverso di swing(): il corner dello stesso vertice nella
+     * faccia precedente (attraverso il lato da c a next(c)), o -1 sul bordo.
+     */
+    Int unswing(Int c) const
+    {
+        Int o = _O[prev(c)];
+        return o < 0 ? -1 : prev(o);
+    }
+
+    /**
+     * @brief La faccia adiacente a f attraverso il lato p (da F(f, p) a
+     * F(f, (p + 1) % 3)), come FF(f, p), o -1.
+     */
+    Int neighbour(Int f, Int p) const
+    {
+        Int o = _O[3 * f + (p + 2) % 3];
+        return o < 0 ? -1 : face(o);
+    }
+
+    /**
+     * @brief Il lato della faccia neighbour(f, p) condiviso con il lato p di
+     * f, come FFi(f, p), o -1.
+     */
+    Int neighbour_edge(Int f, Int p) const
+    {
+        Int o = _O[3 * f + (p + 2) % 3];
+        return o < 0 ? -1 : (o % 3 + 1) % 3;
+    }
+
+    /**
+     * @brief Visita un ventaglio a partire dal corner start, in senso
+     * antiorario, fino al bordo o al giro completo.
+     */
+    template <typename Visit>
+    void walk(Int start, Visit visit) const
+    {
+        if (start < 0) {
+            return;
+        }
+        Int c = start;
+        do {
+            visit(c);
+            c = swing(c);
+        } while (c >= 0 && c != start);
+    }
+
+    /**
+     * @brief Visita i ventagli del vertice v: fan(start) per l'inizio di ogni
+     * ventaglio (uno solo se v e' manifold).
+     */
+    template <typename Fan>
+    void for_each_fan(Int v, Fan fan) const
+    {
+        if (_VC[v] < 0) {
+            return;
+        }
+        fan(_VC[v]);
+        if (_fanVertices.empty()) {
+            return;
+        }
+        auto it = std::lower_bound(_fanVertices.begin(), _fanVertices.end(), v);
+        for (; it != _fanVertices.end() && *it == v; ++it) {
+            fan(_fanCorners[it - _fanVertices.begin()]);
+        }
+    }
+
+    /**
+     * @brief Iteratore sui corner di un vertice, ventaglio per ventaglio (vedi
+     * one_ring()).
+     */
+    class RingIterator
+    {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Int value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Int const *pointer;
+        typedef Int const &reference;
+
+        RingIterator() = default;
+        RingIterator(CornerTableT const *table, Int start, std::size_t fan, std::size_t fanEnd)
+            : _table(table), _start(start), _c(start), _fan(fan), _fanEnd(fanEnd)
+        {
+        }
+
+        Int operator*() const { return _c; }
+
+        RingIterator &operator++()
+        {
+            _c = _table->swing(_c);
+            if (_c < 0 || _c == _start) {
+                // ventaglio successivo dello stesso vertice, se c'e'
+                _c = _fan < _fanEnd ? _table->_fanCorners[_fan++] : -1;
+                _start = _c;
+            }
+            return *this;
+        }
+
+        bool operator==(RingIterator const &o) const { return _c == o._c; }
+        bool operator!=(RingIterator const &o) const { return _c != o._c; }
+
+      private:
+        CornerTableT const *_table = nullptr;
+        Int _start = -1;
+        Int _c = -1;
+        // ventagli ancora da visitare: [_fan, _fanEnd) in _fanCorners
+        std::size_t _fan = 0;
+        std::size_t _fanEnd = 0;
+    };
+
+    struct Ring
+    {
+        RingIterator first;
+        RingIterator begin() const { return first; }
+        RingIterator end() const { return RingIterator(); }
+    };
+
+    /**
+     * @brief I corner del vertice v, in senso antiorario a partire da
+     * corner(v), poi quelli degli eventuali altri ventagli:
+     *
+     *     for (Int c : table.one_ring(v)) { ... F(c / 3, c % 3) == v ... }
+     *
+     * I vertici adiacenti a v sono quelli di next(c) (e, sul bordo, quello di
+     * prev() dell'ultimo corner del ventaglio).
+     */
+    Ring one_ring(Int v) const
+    {
+        std::size_t fan = 0;
+        std::size_t fanEnd = 0;
+        if (!_fanVertices.empty()) {
+            auto range = std::equal_range(_fanVertices.begin(), _fanVertices.end(), v);
+            fan = std::size_t(range.first - _fanVertices.begin());
+            fanEnd = std::size_t(range.second - _fanVertices.begin());
+        }
+        return Ring{RingIterator(this, _VC[v], fan, fanEnd)};
+    }
+
+    /**
+     * @brief Iteratore sulle facce adiacenti a una faccia (al piu' 3, i lati
+     * di bordo sono saltati).
+     */
+    class FaceIterator
+    {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Int value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Int const *pointer;
+        typedef Int const &reference;
+
+        FaceIterator(CornerTableT const *table, Int f, Int p) : _table(table), _f(f), _p(p) { skip(); }
+
+        Int operator*() const { return _table->neighbour(_f, _p); }
+
+        FaceIterator &operator++()
+        {
+            ++_p;
+            skip();
+            return *this;
+        }
+
+        bool operator==(FaceIterator const &o) const { return _p == o._p; }
+        bool operator!=(FaceIterator const &o) const { return _p != o._p; }
+
+      private:
+        void skip()
+        {
+            while (_p < 3 && _table->neighbour(_f, _p) < 0) {
+                ++_p;
+            }
+        }
+
+        CornerTableT const *_table;
+        Int _f;
+        Int _p;
+    };
+
+    struct Faces
+    {
+        FaceIterator first;
+        FaceIterator last;
+        FaceIterator begin() const { return first; }
+        FaceIterator end() const { return last; }
+    };
+
+    /**
+     * @brief Le facce adiacenti alla faccia f, nell'ordine dei lati:
+     *
+     *     for (Int g : table.neighbours(f)) { ... }
+     */
+    Faces neighbours(Int f) const
+    {
+        return Faces{FaceIterator(this, f, 0), FaceIterator(this, f, 3)};
+    }
+
+    /**
+     * @brief L'adiacenza faccia->facce nel formato di face_face_adjacency(),
+     * per il codice che usa FF e FFi.
+     */
+    template <typename DerivedFF, typename DerivedFFi>
+    void face_face_adjacency(PlainObjectBase<DerivedFF> &FF, PlainObjectBase<DerivedFFi> &FFi) const
+    {
+        const Int nf = corners() / 3;
+        FF.resize(nf, 3);
+        FFi.resize(nf, 3);
+        parallel::parallel_for(nf, [&](Int f) {
+            for (Int p = 0; p < 3; ++p) {
+                FF(f, p) = neighbour(f, p);
+                FFi(f, p) = neighbour_edge(f, p);
+            }
+        }, 1 << 14);
+    }
+
+    /**
+     * @brief La memoria occupata dalla tabella, in byte.
+     */
+    std::size_t bytes() const
+    {
+        return (_O.size() + _VC.size() + _fanVertices.size() + _fanCorners.size()) * sizeof(Int);
+    }
+
+  private:
+    std::vector<Int> _O;
+    std::vector<Int> _VC;
+    // ventagli successivi al primo dei vertici non-manifold, per vertice
+    std::vector<Int> _fanVertices;
+    std::vector<Int> _fanCorners;
+};
+
+typedef CornerTableT<int> CornerTable;
@@ -1,31 +1,966 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
-#include <igl/readOBJ.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mappedFile.hpp"
+#include "parallelFor.hpp"
+#include "parallelGroup.hpp"
+#include "profiler.hpp"
+#include "radixSort.hpp"
 
 using namespace Eigen;
 
-void loadAsIndexedTriangleMesh(std::string const &filename, MatrixXd &V, MatrixXi &F)
+namespace obj {
+
+// potenze di 10 rappresentabili esattamente in double
+const double exact_pow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline char const *skip_spaces(char const *p, char const *end)
+{
+    while (p < end && is_space(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+inline char const *skip_token(char const *p, char const *end)
+{
+    while (p < end && !is_space(*p) && *p != '\n') {
+        ++p;
+    }
+    return p;
+}
+
+/**
+ * @brief Legge un numero reale a partire da p.
+ *
+ * Caso veloce (quello dei file OBJ usuali, ad es. "%.6f"): mantissa di al piu'
+ * 19 cifre che sta esattamente in un double (< 2^53) ed esponente decimale
+ * in [-22, 22]. Il risultato e' un solo prodotto o quoziente fra due double
+ * esatti, quindi correttamente arrotondato (algoritmo di Clinger). In tutti
+ * gli altri casi si usa std::strtod, sulla stessa porzione di testo.
+ */
+inline char const *parse_double(char const *p, char const *end, double &value)
+{
+    char const *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    std::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + std::uint64_t(*p - '0');
+            if (mantissa != 0) {
+                ++digits;
+            }
+        } else {
+            ++exponent;
+        }
+        ++p;
+    }
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + std::uint64_t(*p - '0');
+                if (mantissa != 0) {
+                    ++digits;
+                }
+                --exponent;
+            }
+            ++p;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        char const *q = p + 1;
+        bool expNegative = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            expNegative = *q == '-';
+            ++q;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            while (q < end && *q >= '0' && *q <= '9') {
+                e = std::min(e * 10 + (*q - '0'), 100000);
+                ++q;
+            }
+            exponent += expNegative ? -e : e;
+            p = q;
+        }
+    }
+
+    if (p == start || digits >= 19 || mantissa >= (std::uint64_t(1) << 53) || exponent < -22 || exponent > 22) {
+        // caso lento: strtod richiede una stringa terminata
+        std::string text(start, skip_token(start, end));
+        char *stop = nullptr;
+        value = std::strtod(text.c_str(), &stop);
+        return start + (stop - text.c_str());
+    }
+
+    double v = double(mantissa);
+    v = exponent < 0 ? v / exact_pow10[-exponent] : v * exact_pow10[exponent];
+    value = negative ? -v : v;
+    return p;
+}
+
+/**
+ * @brief Legge l'indice di vertice di un elemento di faccia ("v", "v/t",
+ * "v/t/n" o "v//n") e salta il resto dell'elemento.
+ */
+inline char const *parse_index(char const *p, char const *end, long long &index, bool &ok)
 {
-    igl::readOBJ(filename, V, F);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    long long v = 0;
+    char const *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p - '0');
+        ++p;
+    }
+    ok = p != digits && v != 0;
+    index = negative ? -v : v;
+    return skip_token(p, end);
 }
 
-void loadAsTriangleSoup(std::string const &filename, MatrixXd &V, MatrixXi &F)
+// statistiche di un blocco di righe
+struct Chunk
+{
+    char const *begin;
+    char const *end;
+    long long vertices = 0;
+    long long triangles = 0;
+    long long vertexBase = 0;
+    long long triangleBase = 0;
+    // il massimo indice di vertice (a base 0) usato dalle facce
+    long long maxIndex = -1;
+    bool ok = true;
+};
+
+// tipo di riga: 'v', 'f' o 0 per le righe ignorate
+inline char line_type(char const *&p, char const *end)
+{
+    p = skip_spaces(p, end);
+    if (end - p >= 2 && (p[0] == 'v' || p[0] == 'f') && (p[1] == ' ' || p[1] == '\t')) {
+        char t = p[0];
+        p += 2;
+        return t;
+    }
+    return 0;
+}
+
+inline char const *next_line(char const *p, char const *end)
+{
+    while (p < end && *p != '\n') {
+        ++p;
+    }
+    return p < end ? p + 1 : end;
+}
+
+/**
+ * @brief Divide il testo [data, end) in nchunks blocchi di dimensione simile
+ * che iniziano e finiscono a inizio riga.
+ */
+inline std::vector<Chunk> split(char const *data, char const *end, std::size_t nchunks)
+{
+    const std::size_t size = std::size_t(end - data);
+    std::vector<Chunk> chunks(nchunks);
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        char const *b = c == 0 ? data : chunks[c - 1].end;
+        char const *e = c + 1 == nchunks ? end : std::max(b, data + size / nchunks * (c + 1));
+        // il blocco termina a fine riga
+        if (e < end && e > data && e[-1] != '\n') {
+            e = next_line(e, end);
+        }
+        chunks[c].begin = b;
+        chunks[c].end = e;
+    }
+    return chunks;
+}
+
+/**
+ * @brief Conta i vertici ("v") del blocco e i triangoli prodotti dalle sue
+ * facce ("f").
+ */
+inline void count(Chunk &chunk)
+{
+    for (char const *p = chunk.begin; p < chunk.end; p = next_line(p, chunk.end)) {
+        char const *q = p;
+        char t = line_type(q, chunk.end);
+        if (t == 'v') {
+            ++chunk.vertices;
+        } else if (t == 'f') {
+            int n = 0;
+            for (q = skip_spaces(q, chunk.end); q < chunk.end && *q != '\n'; q = skip_spaces(q, chunk.end)) {
+                q = skip_token(q, chunk.end);
+                ++n;
+            }
+            chunk.triangles += std::max(0, n - 2);
+        }
+    }
+}
+
+/**
+ * @brief Legge i vertici e le facce del blocco (gia' contati da count()).
+ *
+ * Il vertice di indice globale i (a base 0) e' scritto in V.row(i -
+ * firstVertex), i triangoli a partire da F.row(chunk.triangleBase - firstTriangle);
+ * chunk.vertexBase e' l'indice globale del primo vertice del blocco, a cui
+ * sono relativi gli indici negativi. Gli indici di vertice devono essere
+ * minori di maxVertices: con un limite maggiore del numero di vertici (ad
+ * esempio leggendo un file un blocco alla volta) la validita' va controllata
+ * alla fine con chunk.maxIndex.
+ */
+template <typename DerivedV, typename DerivedF>
+void parse(
+    Chunk &chunk,
+    long long firstVertex,
+    long long firstTriangle,
+    long long maxVertices,
+    PlainObjectBase<DerivedV> &V,
+    PlainObjectBase<DerivedF> &F)
+{
+    typedef typename DerivedF::Scalar Int;
+
+    long long v = chunk.vertexBase;
+    long long t = chunk.triangleBase - firstTriangle;
+    for (char const *p = chunk.begin; p < chunk.end && chunk.ok; p = next_line(p, chunk.end)) {
+        char const *q = p;
+        char type = line_type(q, chunk.end);
+        if (type == 'v') {
+            for (int k = 0; k < 3; ++k) {
+                double x = 0.0;
+                q = parse_double(skip_spaces(q, chunk.end), chunk.end, x);
+                V(v - firstVertex, k) = x;
+            }
+            ++v;
+        } else if (type == 'f') {
+            // indici a base 0; i negativi sono relativi ai vertici letti finora
+            long long first = -1;
+            long long prev = -1;
+            int n = 0;
+            for (q = skip_spaces(q, chunk.end); q < chunk.end && *q != '\n'; q = skip_spaces(q, chunk.end)) {
+                long long index = 0;
+                bool ok = false;
+                q = parse_index(q, chunk.end, index, ok);
+                index = index < 0 ? v + index : index - 1;
+                if (!ok || index < 0 || index >= maxVertices) {
+                    chunk.ok = false;
+                    break;
+                }
+                chunk.maxIndex = std::max(chunk.maxIndex, index);
+                if (n == 0) {
+                    first = index;
+                } else if (n >= 2) {
+                    F(t, 0) = Int(first);
+                    F(t, 1) = Int(prev);
+                    F(t, 2) = Int(index);
+                    ++t;
+                }
+                prev = index;
+                ++n;
+            }
+        }
+    }
+}
+
+} // namespace obj
+
+/**
+ * @brief Legge una mesh da un file OBJ, in parallelo.
+ *
+ * Il file viene mappato in memoria (MappedFile) e diviso in blocchi che
+ * iniziano e finiscono a inizio riga, uno o piu' per thread. Il parsing
+ * avviene in due passate parallele sui blocchi:
+ * 1. ogni blocco conta i propri vertici ("v") e i triangoli prodotti dalle
+ *    proprie facce ("f"); con una somma prefissa ogni blocco conosce la
+ *    posizione dei propri elementi in V e F, che vengono allocate una sola
+ *    volta;
+ * 2. ogni blocco legge i propri vertici e facce e li scrive direttamente in
+ *    V e F, senza strutture intermedie.
+ *
+ * Sono supportati gli elementi di faccia "v", "v/t", "v/t/n" e "v//n"
+ * (coordinate di texture e normali sono ignorate), gli indici negativi
+ * (relativi all'ultimo vertice letto) e le facce poligonali, che vengono
+ * triangolate a ventaglio dal primo vertice. Le altre righe sono ignorate.
+ *
+ * @param filename Il percorso del file OBJ.
+ * @param V I vertici della mesh (V.rows() x 3).
+ * @param F I triangoli della mesh (F.rows() x 3).
+ * @return true se il file e' stato letto correttamente, false se non esiste o
+ *         contiene facce con indici non validi (in tal caso V e F sono vuote).
+ */
+inline bool loadOBJ(std::string const &filename, MatrixXd &V, MatrixXi &F)
+{
+    WS_PROFILE_SCOPE("loadOBJ");
+
+    V.resize(0, 3);
+    F.resize(0, 3);
+
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+    char const *data = file.data();
+    char const *end = data + file.size();
+
+    // blocchi da almeno 1MB, 4 per thread per bilanciare il carico
+    const std::size_t hw = std::size_t(parallel::threads());
+    const std::size_t nchunks = std::max<std::size_t>(1, std::min(4 * hw, file.size() / (1 << 20)));
+
+    std::vector<obj::Chunk> chunks = obj::split(data, end, nchunks);
+
+    WS_PROFILE_COUNT("obj_bytes", file.size());
+
+    // 1. conteggio
+    parallel::parallel_for(nchunks, [&](std::size_t c) {
+        WS_PROFILE_SCOPE("loadOBJ/count");
+        obj::count(chunks[c]);
+    }, 0);
+
+    long long nv = 0;
+    long long nt = 0;
+    for (auto &chunk : chunks) {
+        chunk.vertexBase = nv;
+        chunk.triangleBase = nt;
+        nv += chunk.vertices;
+        nt += chunk.triangles;
+    }
+
+    V.resize(nv, 3);
+    F.resize(nt, 3);
+    WS_PROFILE_COUNT("obj_vertices", nv);
+    WS_PROFILE_COUNT("obj_triangles", nt);
+    WS_PROFILE_COUNT("allocated_bytes", nv * 3 * sizeof(double) + nt * 3 * sizeof(int));
+
+    // 2. lettura
+    parallel::parallel_for(nchunks, [&](std::size_t c) {
+        WS_PROFILE_SCOPE("loadOBJ/parse");
+        obj::parse(chunks[c], 0, 0, nv, V, F);
+    }, 0);
+
+    for (auto const &chunk : chunks) {
+        if (!chunk.ok) {
+            V.resize(0, 3);
+            F.resize(0, 3);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Legge un file OBJ un blocco alla volta, con memoria limitata.
+ *
+ * A differenza di loadOBJ(), che mappa e legge tutto il file, ogni chiamata a
+ * read() legge dal file al piu' circa chunkBytes byte, li divide in blocchi
+ * di righe e li legge in parallelo con lo stesso parser, restituendo solo i
+ * vertici e i triangoli di quelle righe. La memoria usata dipende quindi
+ * dalla dimensione del blocco e non da quella del file.
+ *
+ * Gli indici dei triangoli sono globali (a base 0) e a 64 bit. Poiche' una
+ * faccia puo' riferirsi a vertici che compaiono piu' avanti nel file, la loro
+ * validita' si conosce solo alla fine: dopo l'ultimo blocco, valid() indica
+ * se tutti gli indici sono minori del numero di vertici letti.
+ */
+class ObjReader
+{
+  public:
+    ObjReader() = default;
+
+    ~ObjReader()
+    {
+        close();
+    }
+
+    ObjReader(ObjReader const &) = delete;
+    ObjReader &operator=(ObjReader const &) = delete;
+
+    /**
+     * @brief Apre il file OBJ.
+     *
+     * @param filename Il percorso del file OBJ.
+     * @param chunkBytes La dimensione (indicativa) dei blocchi letti da
+     *                   read(); una riga piu' lunga del blocco viene comunque
+     *                   letta per intero.
+     * @return true se il file e' stato aperto.
+     */
+    bool open(std::string const &filename, std::size_t chunkBytes = std::size_t(64) << 20)
+    {
+        close();
+        _file = std::fopen(filename.c_str(), "rb");
+        if (_file == nullptr) {
+            return false;
+        }
+        // un file piccolo viene letto in un solo blocco della sua dimensione
+        std::size_t size = chunkBytes;
+        if (std::fseek(_file, 0, SEEK_END) == 0) {
+            long end = std::ftell(_file);
+            size = end >= 0 ? std::min(chunkBytes, std::size_t(end) + 1) : chunkBytes;
+            std::rewind(_file);
+        }
+        _buffer.resize(std::max<std::size_t>(size, 1 << 12));
+        return true;
+    }
+
+    void close()
+    {
+        if (_file != nullptr) {
+            std::fclose(_file);
+        }
+        _file = nullptr;
+        _buffer.clear();
+        _pending = 0;
+        _eof = false;
+        _ok = true;
+        _vertices = 0;
+        _triangles = 0;
+        _maxIndex = -1;
+    }
+
+    /**
+     * @brief Legge il blocco successivo del file.
+     *
+     * @param V I vertici del blocco (double, 3 colonne): V.row(i) e' il
+     *          vertice di indice globale vertices() - V.rows() + i, con
+     *          vertices() dopo la chiamata.
+     * @param F I triangoli del blocco, con indici di vertice globali (di
+     *          norma std::int64_t).
+     * @return false se il file e' finito o contiene un errore (vedi ok()).
+     */
+    template <typename DerivedV, typename DerivedF>
+    bool read(PlainObjectBase<DerivedV> &V, PlainObjectBase<DerivedF> &F)
+    {
+        WS_PROFILE_SCOPE("ObjReader::read");
+
+        V.resize(0, 3);
+        F.resize(0, 3);
+        if (_file == nullptr || !_ok || (_eof && _pending == 0)) {
+            return false;
+        }
+
+        // riempie il buffer dopo la riga incompleta del blocco precedente;
+        // se nel buffer non c'e' nemmeno una riga completa lo raddoppia
+        char const *data = _buffer.data();
+        char const *end = data;
+        for (;;) {
+            if (!_eof) {
+                std::size_t n = std::fread(_buffer.data() + _pending, 1, _buffer.size() - _pending, _file);
+                _pending += n;
+                _eof = _pending < _buffer.size();
+                if (_eof && std::ferror(_file)) {
+                    _ok = false;
+                    return false;
+                }
+            }
+            data = _buffer.data();
+            end = data + _pending;
+            if (_eof) {
+                break;
+            }
+            while (end > data && end[-1] != '\n') {
+                --end;
+            }
+            if (end > data) {
+                break;
+            }
+            _buffer.resize(2 * _buffer.size());
+        }
+
+        const std::size_t size = std::size_t(end - data);
+        const std::size_t hw = std::size_t(parallel::threads());
+        const std::size_t nchunks = std::max<std::size_t>(1, std::min(4 * hw, size / (1 << 20)));
+        std::vector<obj::Chunk> chunks = obj::split(data, end, nchunks);
+
+        parallel::parallel_for(nchunks, [&](std::size_t c) {
+            obj::count(chunks[c]);
+        }, 0);
+
+        long long nv = _vertices;
+        long long nt = _triangles;
+        for (auto &chunk : chunks) {
+            chunk.vertexBase = nv;
+            chunk.triangleBase = nt;
+            nv += chunk.vertices;
+            nt += chunk.triangles;
+        }
+        V.resize(nv - _vertices, 3);
+        F.resize(nt - _triangles, 3);
+
+        parallel::parallel_for(nchunks, [&](std::size_t c) {
+            obj::parse(chunks[c], _vertices, _triangles, std::numeric_limits<long long>::max(), V, F);
+        }, 0);
+
+        for (auto const &chunk : chunks) {
+            _ok = _ok && chunk.ok;
+            _maxIndex = std::max(_maxIndex, chunk.maxIndex);
+        }
+        _vertices = nv;
+        _triangles = nt;
+        WS_PROFILE_COUNT("obj_bytes", size);
+
+        // la riga incompleta resta all'inizio del buffer
+        _pending -= size;
+        std::memmove(_buffer.data(), end, _pending);
+
+        if (!_ok) {
+            V.resize(0, 3);
+            F.resize(0, 3);
+        }
+        return _ok;
+    }
+
+    /**
+     * @brief false se il file non e' stato letto o contiene una faccia non
+     * valida.
+     */
+    bool ok() const { return _ok && _file != nullptr; }
+
+    /**
+     * @brief true se il file e' stato letto tutto e ogni indice di vertice
+     * delle facce e' valido.
+     */
+    bool valid() const { return ok() && _eof && _pending == 0 && _maxIndex < _vertices; }
+
+    long long vertices() const { return _vertices; }
+    long long triangles() const { return _triangles; }
+
+  private:
+    std::FILE *_file = nullptr;
+    std::vector<char> _buffer;
+    std::size_t _pending = 0;
+    bool _eof = false;
+    bool _ok = true;
+    long long _vertices = 0;
+    long long _triangles = 0;
+    long long _maxIndex = -1;
+};
+
+inline bool loadAsIndexedTriangleMesh(std::string const &filename, MatrixXd &V, MatrixXi &F)
+{
+    return loadOBJ(filename, V, F);
+}
+
+/**
+ * @brief Legge una mesh da un file OBJ come zuppa di triangoli: ogni corner
+ * diventa un vertice a se', per cui i triangoli non condividono vertici.
+ *
+ * La copia dei vertici avviene in parallelo sui triangoli. L'operazione
+ * inversa e' weldVertices().
+ *
+ * @param filename Il percorso del file OBJ.
+ * @param V I vertici della zuppa (3 * F.rows() x 3).
+ * @param F I triangoli della zuppa: F(i, j) == 3 * i + j.
+ * @return true se il file e' stato letto correttamente.
+ */
+inline bool loadAsTriangleSoup(std::string const &filename, MatrixXd &V, MatrixXi &F)
 {
     MatrixXd VV;
     MatrixXi FF;
-    igl::readOBJ(filename, VV, FF);
+    if (!loadOBJ(filename, VV, FF)) {
+        return false;
+    }
+
+    WS_PROFILE_SCOPE("loadAsTriangleSoup");
 
     V.resize(FF.rows() * 3, 3);
     F.resize(FF.rows(), 3);
 
-    for (int i = 0; i < FF.rows(); ++i)
-    {
-        for (int j = 0; j < 3; ++j)
-        {
+    parallel::parallel_for(FF.rows(), [&](int i) {
+        for (int j = 0; j < 3; ++j) {
             int ind = i * 3 + j;
             V.row(ind) = VV.row(FF(i, j));
             F(i, j) = ind;
         }
+    }, 1 << 14);
+    return true;
+}
+
+namespace weld {
+
+// cella della griglia di lato epsilon che contiene un punto
+struct Cell
+{
+    std::int64_t c[3];
+
+    bool operator==(Cell const &o) const
+    {
+        return c[0] == o.c[0] && c[1] == o.c[1] && c[2] == o.c[2];
+    }
+
+    std::uint64_t hash() const
+    {
+        return hash3(std::uint64_t(c[0]), std::uint64_t(c[1]), std::uint64_t(c[2]));
+    }
+};
+
+/**
+ * @brief Quantizza le coordinate: con epsilon > 0 la cella di lato epsilon
+ * (a partire da lo), con epsilon == 0 la rappresentazione binaria della
+ * coordinata stessa (0.0 e -0.0 coincidono).
+ */
+struct Grid
+{
+    double lo[3];
+    double inv_epsilon;
+
+    template <typename DerivedV>
+    Cell cell(MatrixBase<DerivedV> const &V, std::int64_t v) const
+    {
+        Cell cell;
+        for (int k = 0; k < 3; ++k) {
+            double x = double(V(v, k));
+            if (inv_epsilon > 0) {
+                cell.c[k] = std::int64_t(std::floor((x - lo[k]) * inv_epsilon));
+            } else {
+                x += 0.0;
+                std::memcpy(&cell.c[k], &x, sizeof(x));
+            }
+        }
+        return cell;
+    }
+};
+
+/**
+ * @brief Indice per la ricerca di un hash fra le chiavi ordinate da group():
+ * gli hash sono distribuiti uniformemente, per cui i loro bit piu'
+ * significativi li dividono in secchi di pochi elementi ciascuno e basta
+ * conoscere l'inizio di ogni secchio.
+ */
+struct Directory
+{
+    std::vector<std::uint64_t> const *keys = nullptr;
+    std::vector<std::size_t> start;
+    int shift = hash_bits;
+
+    explicit Directory(std::vector<std::uint64_t> const &k) : keys(&k)
+    {
+        const std::size_t n = k.size();
+        int bits = 0;
+        while (bits < 32 && bits < hash_bits && (std::size_t(1) << bits) < n) {
+            ++bits;
+        }
+        shift = hash_bits - bits;
+        const std::size_t nbuckets = std::size_t(1) << bits;
+        start.resize(nbuckets + 1);
+
+        // start[p] e' la prima posizione con prefisso >= p: ogni secchio e'
+        // scritto dalla posizione in cui il prefisso cambia
+        parallel::parallel_for(n + 1, [&](std::size_t j) {
+            const std::size_t lo = j == 0 ? 0 : bucket(k[j - 1]) + 1;
+            const std::size_t hi = j == n ? nbuckets : bucket(k[j]);
+            for (std::size_t p = lo; p <= hi; ++p) {
+                start[p] = j;
+            }
+        }, 1 << 14);
+    }
+
+    std::size_t bucket(std::uint64_t key) const
+    {
+        return std::size_t(key >> shift);
+    }
+
+    /**
+     * @return La prima posizione con keys[j] == key, o keys.size() se manca.
+     */
+    std::size_t find(std::uint64_t key) const
+    {
+        std::vector<std::uint64_t> const &k = *keys;
+        const std::size_t p = bucket(key);
+        for (std::size_t j = start[p]; j < start[p + 1]; ++j) {
+            if (k[j] >= key) {
+                return k[j] == key ? j : k.size();
+            }
+        }
+        return k.size();
     }
-}
\ No newline at end of file
+};
+
+} // namespace weld
+
+/**
+ * @brief Salda i vertici coincidenti di una zuppa di triangoli (o di una mesh
+ * con vertici duplicati, ad esempio esportata da STL o unita da piu' parti),
+ * producendo una mesh indicizzata su cui le adiacenze trovano i vicini.
+ *
+ * Il bounding box viene diviso in celle di lato epsilon e i vertici nella
+ * stessa cella vengono uniti nel primo di essi (indice minore), di cui il
+ * vertice saldato mantiene la posizione. Perche' il risultato non dipenda da
+ * dove cadono i bordi delle celle, due celle vicine (fra le 26 attorno a
+ * ognuna) con almeno una coppia di vertici a distanza al piu' epsilon vengono
+ * poi unite, e cosi' via a catena, nel primo vertice del gruppo. Con
+ * epsilon == 0 vengono uniti solo i vertici con coordinate identiche. epsilon
+ * va scelto molto maggiore dell'errore sulle coordinate e molto minore dei
+ * lati dei triangoli.
+ *
+ * Dopo la saldatura vengono eliminati i triangoli degeneri (con due corner
+ * sullo stesso vertice) e i duplicati (stessi tre vertici, in qualunque
+ * ordine), tenendo la prima occorrenza. Vertici e triangoli mantengono
+ * l'ordine di partenza, per cui il risultato e' deterministico.
+ *
+ * Le fasi sono parallele. I vertici sono raggruppati per cella
+ * (weld::group(): radix_sort() sull'hash della cella e confronto delle celle
+ * con lo stesso hash), e cosi' i triangoli per vertici. Le celle vicine sono
+ * trovate cercandone l'hash fra quelli ordinati, tramite i secchi per
+ * prefisso di weld::Directory; ogni cella confronta i propri vertici con
+ * quelli delle 13 celle vicine successive e le coppie di celle con vertici
+ * vicini sono unite con un union-find. Il costo e' circa lineare nel numero
+ * di corner.
+ *
+ * @param V I vertici in ingresso.
+ * @param F I triangoli in ingresso.
+ * @param epsilon Il lato delle celle di saldatura (>= 0).
+ * @param VO I vertici saldati, nell'ordine della loro prima occorrenza in V.
+ * @param FO I triangoli rimasti, rimappati sui vertici saldati.
+ * @param VI Per ogni vertice i di V, l'indice VI(i) del vertice saldato.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedVO, typename DerivedFO, typename DerivedVI>
+void weldVertices(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    double epsilon,
+    PlainObjectBase<DerivedVO> &VO,
+    PlainObjectBase<DerivedFO> &FO,
+    PlainObjectBase<DerivedVI> &VI)
+{
+    typedef typename DerivedF::Scalar Int;
+
+    WS_PROFILE_SCOPE("weldVertices");
+
+    const Int nv = Int(V.rows());
+    const Int nf = Int(F.rows());
+    const size_t min_parallel = 1 << 14;
+
+    // 1. vertici nella stessa cella
+    weld::Grid grid;
+    grid.inv_epsilon = epsilon > 0 ? 1.0 / epsilon : 0.0;
+    for (int k = 0; k < 3; ++k) {
+        grid.lo[k] = nv > 0 ? double(V.col(k).minCoeff()) : 0.0;
+    }
+
+    std::vector<std::uint64_t> keys;
+    std::vector<Int> order;
+    std::vector<Int> first;
+    weld::group(nv, [&](Int v) {
+        return grid.cell(V, v).hash();
+    }, [&](Int a, Int b) {
+        return grid.cell(V, a) == grid.cell(V, b);
+    }, keys, order, first);
+
+    // 2. le celle con due vertici a distanza al piu' epsilon vengono unite, e
+    //    cosi' via a catena, nel primo vertice (indice minore) del gruppo
+    std::vector<Int> position;
+    if (epsilon > 0) {
+        WS_PROFILE_SCOPE("weldVertices/neighbours");
+
+        const weld::Directory directory(keys);
+
+        // ogni coppia di celle vicine e' esaminata una volta sola, dalla cella
+        // minore: le 13 celle successive nell'ordine (z, y, x), saltando quelle
+        // il cui bordo dista piu' di epsilon da tutti i vertici della cella, e
+        // i vertici delle due celle confrontati fino alla prima coppia vicina
+        auto members = [&](weld::Cell const &cell, std::vector<Int> &list) {
+            list.clear();
+            const std::uint64_t key = cell.hash();
+            for (std::size_t j = directory.find(key); j < keys.size() && keys[j] == key; ++j) {
+                if (grid.cell(V, order[j]) == cell) {
+                    list.push_back(order[j]);
+                }
+            }
+        };
+        std::vector<std::vector<std::pair<Int, Int>>> pairs;
+        parallel::parallel_for(nv, [&](std::size_t nthreads) {
+            pairs.resize(nthreads);
+        }, [&](Int v, std::size_t thread) {
+            if (first[v] != v) {
+                return;
+            }
+            thread_local std::vector<Int> own, others;
+            const weld::Cell cell = grid.cell(V, v);
+            members(cell, own);
+            // posizione dei vertici nella cella, in unita' di epsilon
+            double tmin[3] = {1.0, 1.0, 1.0};
+            double tmax[3] = {0.0, 0.0, 0.0};
+            for (Int w : own) {
+                for (int k = 0; k < 3; ++k) {
+                    const double t = (double(V(w, k)) - grid.lo[k]) * grid.inv_epsilon - double(cell.c[k]);
+                    tmin[k] = std::min(tmin[k], t);
+                    tmax[k] = std::max(tmax[k], t);
+                }
+            }
+            for (int d = 14; d < 27; ++d) {
+                const int step[3] = {d % 3 - 1, d / 3 % 3 - 1, d / 9 - 1};
+                weld::Cell other = cell;
+                double gap = 0.0;
+                for (int k = 0; k < 3; ++k) {
+                    other.c[k] += step[k];
+                    double g = step[k] > 0 ? 1.0 - tmax[k] : step[k] < 0 ? tmin[k] : 0.0;
+                    gap += g * g;
+                }
+                if (gap > 1.0 + 1e-6) {
+                    continue;
+                }
+                members(other, others);
+                bool found = false;
+                for (std::size_t a = 0; a < own.size() && !found; ++a) {
+                    for (std::size_t b = 0; b < others.size() && !found; ++b) {
+                        found = (V.row(others[b]) - V.row(own[a])).squaredNorm() <= epsilon * epsilon;
+                    }
+                }
+                if (found) {
+                    pairs[thread].emplace_back(v, first[others[0]]);
+                }
+            }
+        }, [](std::size_t) {}, min_parallel);
+
+        // union-find sui primi vertici delle celle: la radice di ogni gruppo
+        // e' il suo vertice minore, per cui il risultato non dipende
+        // dall'ordine delle coppie
+        std::vector<Int> parent(nv);
+        parallel::parallel_for(nv, [&](Int v) {
+            parent[v] = v;
+        }, min_parallel);
+        auto find = [&](Int v) {
+            while (parent[v] != v) {
+                parent[v] = parent[parent[v]];
+                v = parent[v];
+            }
+            return v;
+        };
+        std::vector<Int> linked;
+        for (auto const &thread : pairs) {
+            for (auto const &pair : thread) {
+                const Int a = find(pair.first);
+                const Int b = find(pair.second);
+                if (a != b) {
+                    parent[std::max(a, b)] = std::min(a, b);
+                    linked.push_back(std::max(a, b));
+                }
+            }
+        }
+
+        // parent[v] < v e' gia' definitivo quando si arriva a v: una passata in
+        // ordine crescente porta ogni vertice unito sulla radice
+        std::sort(linked.begin(), linked.end());
+        for (Int v : linked) {
+            parent[v] = parent[parent[v]];
+        }
+        parallel::parallel_for(nv, [&](Int v) {
+            first[v] = parent[first[v]];
+        }, min_parallel);
+    }
+
+    const Int nwelded = weld::enumerate(nv, [&](Int v) { return first[v] == v; }, position);
+    WS_PROFILE_COUNT("weld_merged_vertices", nv - nwelded);
+
+    VO.resize(nwelded, V.cols());
+    VI.resize(nv, 1);
+    parallel::parallel_for(nv, [&](Int v) {
+        VI(v) = position[first[v]];
+        if (first[v] == v) {
+            VO.row(position[v]) = V.row(v);
+        }
+    }, min_parallel);
+
+    // 3. triangoli rimappati, ordinati per vertice (a < b < c)
+    Matrix<Int, Dynamic, 3, RowMajor> sorted(nf, 3);
+    parallel::parallel_for(nf, [&](Int f) {
+        Int a = Int(VI(F(f, 0)));
+        Int b = Int(VI(F(f, 1)));
+        Int c = Int(VI(F(f, 2)));
+        if (a > b) std::swap(a, b);
+        if (b > c) std::swap(b, c);
+        if (a > b) std::swap(a, b);
+        sorted(f, 0) = a;
+        sorted(f, 1) = b;
+        sorted(f, 2) = c;
+    }, min_parallel);
+
+    // 4. triangoli uguali a uno precedente (degeneri a parte)
+    std::vector<Int> firstFace;
+    weld::group(nf, [&](Int f) {
+        return weld::hash3(std::uint64_t(sorted(f, 0)), std::uint64_t(sorted(f, 1)), std::uint64_t(sorted(f, 2)));
+    }, [&](Int a, Int b) {
+        return sorted.row(a) == sorted.row(b);
+    }, keys, order, firstFace);
+
+    auto keep = [&](Int f) {
+        return firstFace[f] == f && sorted(f, 0) != sorted(f, 1) && sorted(f, 1) != sorted(f, 2);
+    };
+    const Int nkept = weld::enumerate(nf, keep, position);
+    WS_PROFILE_COUNT("weld_removed_faces", nf - nkept);
+
+    FO.resize(nkept, 3);
+    parallel::parallel_for(nf, [&](Int f) {
+        if (keep(f)) {
+            for (int k = 0; k < 3; ++k) {
+                FO(position[f], k) = VI(F(f, k));
+            }
+        }
+    }, min_parallel);
+}
+
+/**
+ * @brief Salda i vertici coincidenti di una zuppa di triangoli (vedi
+ * weldVertices(V, F, epsilon, VO, FO, VI)).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedVO, typename DerivedFO>
+void weldVertices(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    double epsilon,
+    PlainObjectBase<DerivedVO> &VO,
+    PlainObjectBase<DerivedFO> &FO)
+{
+    Matrix<typename DerivedF::Scalar, Dynamic, 1> VI;
+    weldVertices(V, F, epsilon, VO, FO, VI);
+}
+
+/**
+ * @brief Legge una mesh da un file OBJ e ne salda i vertici coincidenti (vedi
+ * weldVertices()): da usare per i file che contengono zuppe di triangoli o
+ * vertici duplicati.
+ *
+ * @param filename Il percorso del file OBJ.
+ * @param epsilon Il lato delle celle di saldatura (0: solo vertici identici).
+ * @param V I vertici saldati.
+ * @param F I triangoli, senza degeneri e duplicati.
+ * @return true se il file e' stato letto correttamente.
+ */
+inline bool loadAsWeldedMesh(std::string const &filename, double epsilon, MatrixXd &V, MatrixXi &F)
+{
+    MatrixXd VV;
+    MatrixXi FF;
+    if (!loadOBJ(filename, VV, FF)) {
+        return false;
+    }
+    weldVertices(VV, FF, epsilon, V, F);
+    return true;
+}
@@ -1,25 +1,56 @@
-#include <chrono>
-#include <igl/readOBJ.h>
+#include <iostream>
 #include <igl/opengl/glfw/Viewer.h>
-#include <igl/unproject_onto_mesh.h>
 
 #include "viewer.hpp"
 #include "load.hpp"
+#include "meshCache.hpp"
+#include "meshRepair.hpp"
 #include "perFacenormals.hpp"
 #include "perVertexNormals.hpp"
 #include "perCornerNormals.hpp"
+#include "reorder.hpp"
 
 using namespace Eigen;
 
 int main(int argc, char *argv[]) {
-    MatrixXd V;
-    MatrixXi F;
-
-    Viewer viewer(&perFaceNormals, &perVertexNormals, &perCornerNormals);
+    Viewer viewer(
+        [](MeshContext &mesh, MatrixXd &N) { perFaceNormals(mesh, N); },
+        [](MeshContext &mesh, MatrixXd &N) { perVertexNormals(mesh, N); },
+        [](MeshContext &mesh, MatrixXd &N) { perCornerNormals(mesh, N); },
+        // aggiornamenti incrementali dopo viewer.update_vertices()
+        [](MeshContext &mesh, MatrixXd &N) { updateFaceNormals(mesh, N); },
+        [](MeshContext &mesh, MatrixXd &N) { updateVertexNormals(mesh, N); },
+        [](MeshContext &mesh, MatrixXd &N) { updateCornerNormals(mesh, N); });
 
+    // MatrixXd V;
+    // MatrixXi F;
     // loadAsTriangleSoup("../meshes/vase.obj", V, F);
-    loadAsIndexedTriangleMesh("../meshes/vase.obj", V, F);
+    // loadAsIndexedTriangleMesh("../meshes/vase.obj", V, F);
+    // viewer.set_mesh(V, F);
+
+    // la prima volta legge il file OBJ e scrive la cache binaria accanto ad
+    // esso (vase.obj.wsmesh), le volte successive legge direttamente la cache
+    MeshContext mesh;
+    if (!loadMeshCached("../meshes/vase.obj", mesh)) {
+        std::cerr << "impossibile leggere '../meshes/vase.obj'\n";
+        return 1;
+    }
+
+    // riparazione opzionale della topologia, per mesh con difetti (ad
+    // esempio scansioni): facce degeneri o duplicate, lati e vertici
+    // non-manifold, orientazione incoerente, vertici non usati
+    // TopologyReport report = repairMesh(mesh);
+
+    // riordino opzionale per la localita' in cache, per mesh con vertici e
+    // facce in ordine arbitrario (ad esempio da scanner); VI e FI riportano
+    // i risultati agli indici originali (restoreRowOrder, restoreCornerOrder)
+    // VectorXi VI, FI;
+    // reorderMesh(mesh, VI, FI);
+
+    // facce disegnate al piu' mentre si ruota la vista: le mesh piu' grandi
+    // vengono semplificate in background (simplifyChain); 0 per disattivare
+    // viewer.set_interactive_faces(1 << 18);
 
-    viewer.set_mesh(V, F);
+    viewer.set_mesh(std::move(mesh));
     viewer.launch();
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#define WS_GEO3D_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Un file mappato in memoria in sola lettura.
+ *
+ * Il contenuto del file e' accessibile come un array di byte senza copie: e'
+ * il sistema operativo a caricare le pagine quando vengono lette. Dove mmap
+ * non e' disponibile il file viene letto per intero in un buffer.
+ * Il file resta mappato finche' l'oggetto esiste.
+ */
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+
+    explicit MappedFile(std::string const &filename)
+    {
+        open(filename);
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    /**
+     * @brief Mappa il file in memoria.
+     *
+     * @param filename Il percorso del file.
+     * @return true se il file e' stato aperto (anche se vuoto), false altrimenti.
+     */
+    bool open(std::string const &filename)
+    {
+        close();
+#if defined(WS_GEO3D_NO_MMAP)
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in) {
+            return false;
+        }
+        _buffer.resize(std::size_t(in.tellg()));
+        in.seekg(0);
+        in.read(_buffer.data(), _buffer.size());
+        _data = _buffer.data();
+        _size = _buffer.size();
+        return bool(in);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        _size = std::size_t(st.st_size);
+        if (_size > 0) {
+            void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                _size = 0;
+                return false;
+            }
+            // il file viene letto dall'inizio alla fine
+            madvise(p, _size, MADV_SEQUENTIAL);
+            _data = static_cast<char const *>(p);
+        }
+        ::close(fd);
+        return true;
+#endif
+    }
+
+    /**
+     * @brief Rilascia la mappatura.
+     */
+    void close()
+    {
+#if defined(WS_GEO3D_NO_MMAP)
+        _buffer.clear();
+#else
+        if (_data != nullptr) {
+            munmap(const_cast<char *>(_data), _size);
+        }
+#endif
+        _data = nullptr;
+        _size = 0;
+    }
+
+    char const *data() const { return _data; }
+    std::size_t size() const { return _size; }
+
+  private:
+    char const *_data = nullptr;
+    std::size_t _size = 0;
+#if defined(WS_GEO3D_NO_MMAP)
+    std::vector<char> _buffer;
+#endif
+};
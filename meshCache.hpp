@@ -0,0 +1,442 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <Eigen/Core>
+
+#include "load.hpp"
+#include "mappedFile.hpp"
+#include "meshContext.hpp"
+#include "parallelFor.hpp"
+#include "perCornerNormals.hpp"
+#include "perFacenormals.hpp"
+#include "perVertexNormals.hpp"
+#include "profiler.hpp"
+
+using namespace Eigen;
+
+/**
+ * Formato binario della cache di una mesh (file "<nome>.obj.wsmesh", accanto
+ * al file OBJ).
+ *
+ * Il file inizia con un'intestazione di dimensione fissa (mesh_cache::Header)
+ * seguita dalle sezioni dei dati, ognuna allineata a 64 byte e memorizzata
+ * esattamente come in memoria nelle matrici Eigen (column-major, double e int
+ * a 32 bit little-endian): V, F e, opzionalmente, FF, FFi e le normali per
+ * faccia, per vertice e per corner. Le sezioni possono quindi essere usate
+ * direttamente dal file mappato in memoria tramite Eigen::Map, senza copie.
+ *
+ * L'intestazione contiene la versione del formato, la dimensione e la data di
+ * modifica del file OBJ da cui la cache e' stata generata (se non coincidono
+ * la cache e' obsoleta), la soglia con cui sono state calcolate le normali ai
+ * corner (MeshContext::corner_angle()), un checksum dell'intestazione,
+ * verificato ad ogni apertura, e un checksum dei dati (combinazione dei
+ * checksum delle sezioni), verificato solo su richiesta perche' richiede di
+ * leggere tutto il file.
+ *
+ * NOTA: il formato usa l'ordine dei byte della macchina (little-endian sulle
+ * piattaforme supportate); una cache non valida viene semplicemente
+ * rigenerata dal file OBJ.
+ */
+namespace mesh_cache {
+
+const char magic[8] = {'W', 'S', 'G', 'E', 'O', '3', 'D', 'M'};
+const std::uint32_t version = 2;
+const std::uint64_t alignment = 64;
+
+enum Section
+{
+    SectionV,
+    SectionF,
+    SectionFF,
+    SectionFFi,
+    SectionFaceNormals,
+    SectionVertexNormals,
+    SectionCornerNormals,
+    SectionCount
+};
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+    std::uint64_t vertices;
+    std::uint64_t faces;
+    std::uint64_t sourceSize;
+    std::int64_t sourceTime;
+    double cornerAngle;
+    std::uint64_t offset[SectionCount];
+    std::uint64_t size[SectionCount];
+    std::uint64_t dataChecksum;
+    std::uint64_t headerChecksum;
+};
+
+/**
+ * @brief Checksum a 64 bit (FNV-1a su parole di 64 bit) di un blocco di byte.
+ */
+inline std::uint64_t checksum_block(char const *data, std::size_t size)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    std::size_t words = size / 8;
+    for (std::size_t i = 0; i < words; ++i) {
+        std::uint64_t w;
+        std::memcpy(&w, data + 8 * i, 8);
+        h = (h ^ w) * 1099511628211ull;
+    }
+    for (std::size_t i = 8 * words; i < size; ++i) {
+        h = (h ^ std::uint64_t((unsigned char)data[i])) * 1099511628211ull;
+    }
+    return h;
+}
+
+/**
+ * @brief Checksum di un array di byte, calcolato in parallelo su blocchi da
+ * 1MB e combinando i checksum dei blocchi nell'ordine: il risultato non
+ * dipende dal numero di thread.
+ */
+inline std::uint64_t checksum(char const *data, std::size_t size)
+{
+    const std::size_t block = 1 << 20;
+    const std::size_t nblocks = (size + block - 1) / block;
+    std::vector<std::uint64_t> partial(nblocks);
+    parallel::parallel_for(nblocks, [&](std::size_t b) {
+        partial[b] = checksum_block(data + b * block, std::min(block, size - b * block));
+    }, 2);
+    return checksum_block(reinterpret_cast<char const *>(partial.data()), partial.size() * 8);
+}
+
+/**
+ * @brief Checksum dei dati: combinazione dei checksum delle singole sezioni.
+ */
+inline std::uint64_t data_checksum(Header const &h, char const *const data[SectionCount])
+{
+    std::uint64_t sums[SectionCount] = {0};
+    for (int s = 0; s < SectionCount; ++s) {
+        if (h.size[s] > 0) {
+            sums[s] = checksum(data[s], h.size[s]);
+        }
+    }
+    return checksum_block(reinterpret_cast<char const *>(sums), sizeof(sums));
+}
+
+inline std::uint64_t header_checksum(Header const &h)
+{
+    return checksum_block(reinterpret_cast<char const *>(&h), offsetof(Header, headerChecksum));
+}
+
+/**
+ * @brief Dimensione e data di modifica di un file.
+ */
+inline bool file_stamp(std::string const &filename, std::uint64_t &size, std::int64_t &time)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    size = std::uint64_t(st.st_size);
+    time = std::int64_t(st.st_mtime);
+    return true;
+}
+
+} // namespace mesh_cache
+
+/**
+ * @brief Il percorso del file di cache associato a un file OBJ.
+ */
+inline std::string meshCachePath(std::string const &objFilename)
+{
+    return objFilename + ".wsmesh";
+}
+
+/**
+ * @brief Una cache binaria di una mesh, mappata in memoria in sola lettura.
+ *
+ * Le matrici sono esposte come Eigen::Map sui dati del file: restano valide
+ * finche' l'oggetto esiste.
+ */
+class MeshCache
+{
+  public:
+    /**
+     * @brief Apre il file di cache e ne controlla l'intestazione.
+     *
+     * @param filename Il percorso del file di cache.
+     * @param sourceFilename Il file OBJ da cui la cache e' stata generata: se
+     *                       non vuoto, la cache e' valida solo se dimensione e
+     *                       data di modifica del file coincidono con quelle
+     *                       memorizzate.
+     * @param verifyData Se true, verifica anche il checksum dei dati (richiede
+     *                   di leggere tutto il file).
+     * @return true se la cache e' valida e aggiornata.
+     */
+    bool open(std::string const &filename, std::string const &sourceFilename = "", bool verifyData = false)
+    {
+        using namespace mesh_cache;
+
+        _valid = false;
+        if (!_file.open(filename) || _file.size() < sizeof(Header)) {
+            return false;
+        }
+        std::memcpy(&_header, _file.data(), sizeof(Header));
+
+        if (std::memcmp(_header.magic, magic, sizeof(magic)) != 0 ||
+            _header.version != version ||
+            _header.headerSize != sizeof(Header) ||
+            _header.headerChecksum != header_checksum(_header)) {
+            return false;
+        }
+        for (int s = 0; s < SectionCount; ++s) {
+            if (_header.size[s] > 0 && _header.offset[s] + _header.size[s] > _file.size()) {
+                return false;
+            }
+        }
+        if (_header.size[SectionV] != _header.vertices * 3 * sizeof(double) ||
+            _header.size[SectionF] != _header.faces * 3 * sizeof(int)) {
+            return false;
+        }
+
+        if (!sourceFilename.empty()) {
+            std::uint64_t size;
+            std::int64_t time;
+            if (!file_stamp(sourceFilename, size, time) || size != _header.sourceSize || time != _header.sourceTime) {
+                return false;
+            }
+        }
+
+        if (verifyData && !verify()) {
+            return false;
+        }
+
+        _valid = true;
+        return true;
+    }
+
+    /**
+     * @brief Verifica il checksum di tutti i dati del file.
+     */
+    bool verify() const
+    {
+        char const *data[mesh_cache::SectionCount];
+        for (int s = 0; s < mesh_cache::SectionCount; ++s) {
+            data[s] = _file.data() + _header.offset[s];
+        }
+        return mesh_cache::data_checksum(_header, data) == _header.dataChecksum;
+    }
+
+    bool valid() const { return _valid; }
+
+    Map<const MatrixXd> V() const
+    {
+        return Map<const MatrixXd>(section<double>(mesh_cache::SectionV), _header.vertices, 3);
+    }
+
+    Map<const MatrixXi> F() const
+    {
+        return Map<const MatrixXi>(section<int>(mesh_cache::SectionF), _header.faces, 3);
+    }
+
+    bool has_face_adjacency() const
+    {
+        return _header.size[mesh_cache::SectionFF] > 0;
+    }
+
+    Map<const MatrixXi> FF() const
+    {
+        return Map<const MatrixXi>(section<int>(mesh_cache::SectionFF), _header.faces, 3);
+    }
+
+    Map<const MatrixXi> FFi() const
+    {
+        return Map<const MatrixXi>(section<int>(mesh_cache::SectionFFi), _header.faces, 3);
+    }
+
+    bool has_normals(NormalMode mode) const
+    {
+        return _header.size[normalSection(mode)] > 0;
+    }
+
+    /**
+     * @brief La soglia, in gradi, con cui sono state calcolate le normali ai
+     * corner salvate.
+     */
+    double corner_angle() const
+    {
+        return _header.cornerAngle;
+    }
+
+    Map<const MatrixXd> normals(NormalMode mode) const
+    {
+        int s = normalSection(mode);
+        return Map<const MatrixXd>(section<double>(s), _header.size[s] / (3 * sizeof(double)), 3);
+    }
+
+    /**
+     * @brief Scrive il file di cache di una mesh.
+     *
+     * Oltre a V e F vengono salvati i dati derivati gia' calcolati nel
+     * MeshContext: l'adiacenza faccia->facce e le normali di ogni tipo. Il
+     * file viene prima scritto con un nome temporaneo e poi rinominato, per
+     * cui chi legge la cache non vede mai un file scritto a meta'.
+     *
+     * @param filename Il percorso del file di cache.
+     * @param sourceFilename Il file OBJ da cui la mesh e' stata letta.
+     * @param mesh La mesh, con i dati derivati.
+     * @param withAdjacency Se true, salva anche FF e FFi (calcolandole se
+     *                      necessario).
+     * @return true se il file e' stato scritto.
+     */
+    static bool write(std::string const &filename, std::string const &sourceFilename, MeshContext &mesh, bool withAdjacency = true)
+    {
+        using namespace mesh_cache;
+
+        Header header;
+        std::memset(&header, 0, sizeof(Header));
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.headerSize = sizeof(Header);
+        header.vertices = std::uint64_t(mesh.V().rows());
+        header.faces = std::uint64_t(mesh.F().rows());
+        header.cornerAngle = mesh.corner_angle();
+        if (!file_stamp(sourceFilename, header.sourceSize, header.sourceTime)) {
+            return false;
+        }
+
+        char const *data[SectionCount] = {nullptr};
+        data[SectionV] = reinterpret_cast<char const *>(mesh.V().data());
+        header.size[SectionV] = header.vertices * 3 * sizeof(double);
+        data[SectionF] = reinterpret_cast<char const *>(mesh.F().data());
+        header.size[SectionF] = header.faces * 3 * sizeof(int);
+        if (withAdjacency) {
+            data[SectionFF] = reinterpret_cast<char const *>(mesh.FF().data());
+            header.size[SectionFF] = header.faces * 3 * sizeof(int);
+            data[SectionFFi] = reinterpret_cast<char const *>(mesh.FFi().data());
+            header.size[SectionFFi] = header.faces * 3 * sizeof(int);
+        }
+        for (NormalMode mode : {NormalMode::Face, NormalMode::Vertex, NormalMode::Corner}) {
+            if (mesh.has_normals(mode)) {
+                MatrixXd const &N = mesh.normals(mode);
+                data[normalSection(mode)] = reinterpret_cast<char const *>(N.data());
+                header.size[normalSection(mode)] = std::uint64_t(N.size()) * sizeof(double);
+            }
+        }
+
+        // posizione delle sezioni, allineate
+        std::uint64_t end = (sizeof(Header) + alignment - 1) / alignment * alignment;
+        for (int s = 0; s < SectionCount; ++s) {
+            if (header.size[s] > 0) {
+                header.offset[s] = end;
+                end = (end + header.size[s] + alignment - 1) / alignment * alignment;
+            }
+        }
+        header.dataChecksum = data_checksum(header, data);
+        header.headerChecksum = header_checksum(header);
+
+        std::string tmp = filename + ".tmp";
+        FILE *out = std::fopen(tmp.c_str(), "wb");
+        if (out == nullptr) {
+            return false;
+        }
+        const char padding[alignment] = {0};
+        bool ok = std::fwrite(&header, sizeof(Header), 1, out) == 1;
+        std::uint64_t pos = sizeof(Header);
+        for (int s = 0; s < SectionCount && ok; ++s) {
+            if (header.size[s] > 0) {
+                ok = std::fwrite(padding, 1, header.offset[s] - pos, out) == header.offset[s] - pos &&
+                     std::fwrite(data[s], 1, header.size[s], out) == header.size[s];
+                pos = header.offset[s] + header.size[s];
+            }
+        }
+        ok = ok && std::fwrite(padding, 1, end - pos, out) == end - pos;
+        ok = std::fclose(out) == 0 && ok;
+        if (!ok || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    static int normalSection(NormalMode mode)
+    {
+        return mesh_cache::SectionFaceNormals + int(mode);
+    }
+
+    template <typename T>
+    T const *section(int s) const
+    {
+        return reinterpret_cast<T const *>(_file.data() + _header.offset[s]);
+    }
+
+    MappedFile _file;
+    mesh_cache::Header _header;
+    bool _valid = false;
+};
+
+/**
+ * @brief Carica una mesh da un file OBJ usando, se possibile, la cache
+ * binaria associata (meshCachePath()).
+ *
+ * Se la cache esiste ed e' aggiornata, V e F, l'adiacenza faccia->facce e le
+ * normali vengono prese dal file mappato in memoria, senza parsing ne'
+ * calcoli (le normali ai corner solo se calcolate con la soglia
+ * mesh.corner_angle()). Altrimenti il file OBJ viene letto con loadOBJ(),
+ * vengono calcolate adiacenza e normali (se richiesto) e la cache viene
+ * riscritta, cosi' che il caricamento successivo sia immediato.
+ *
+ * @param objFilename Il percorso del file OBJ.
+ * @param mesh La mesh caricata, con i dati derivati trovati nella cache.
+ * @param withNormals Se true, quando la cache viene (ri)generata calcola e
+ *                    salva anche i tre tipi di normali.
+ * @return true se la mesh e' stata caricata.
+ */
+inline bool loadMeshCached(std::string const &objFilename, MeshContext &mesh, bool withNormals = true)
+{
+    WS_PROFILE_SCOPE("loadMeshCached");
+
+    std::string cacheFilename = meshCachePath(objFilename);
+
+    MeshCache cache;
+    if (cache.open(cacheFilename, objFilename)) {
+        mesh.set_mesh(cache.V(), cache.F());
+        if (cache.has_face_adjacency()) {
+            mesh.set_face_adjacency(cache.FF(), cache.FFi());
+        }
+        for (NormalMode mode : {NormalMode::Face, NormalMode::Vertex, NormalMode::Corner}) {
+            // normali ai corner calcolate con un'altra soglia: vanno ricalcolate
+            if (mode == NormalMode::Corner && cache.corner_angle() != mesh.corner_angle()) {
+                continue;
+            }
+            if (cache.has_normals(mode)) {
+                mesh.set_normals(mode, cache.normals(mode));
+            }
+        }
+        return true;
+    }
+
+    MatrixXd V;
+    MatrixXi F;
+    if (!loadOBJ(objFilename, V, F)) {
+        return false;
+    }
+    mesh.set_mesh(V, F);
+
+    if (withNormals) {
+        mesh.normals(NormalMode::Face, [](MeshContext &m, MatrixXd &N) { perFaceNormals(m, N); });
+        mesh.normals(NormalMode::Vertex, [](MeshContext &m, MatrixXd &N) { perVertexNormals(m, N); });
+        mesh.normals(NormalMode::Corner, [](MeshContext &m, MatrixXd &N) { perCornerNormals(m, N); });
+    }
+
+    // se la cache non puo' essere scritta (es. cartella in sola lettura) la
+    // mesh e' comunque caricata
+    MeshCache::write(cacheFilename, objFilename, mesh);
+    return true;
+}
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "cornerTable.hpp"
+#include "octNormals.hpp"
+#include "profiler.hpp"
+#include "topology.hpp"
+#include "triangleGeometry.hpp"
+
+using namespace Eigen;
+
+/**
+ * @brief Tipo di normali calcolate su una mesh.
+ */
+enum class NormalMode
+{
+    Face,   // una normale per triangolo (flat shading)
+    Vertex, // una normale per vertice (smooth shading)
+    Corner  // una normale per corner di triangolo (sharp/smooth shading)
+};
+
+/**
+ * @brief Una mesh di triangoli M = (V, F) insieme ai dati derivati da essa,
+ * calcolati solo quando servono e poi riutilizzati.
+ *
+ * I dati derivati sono:
+ * - l'adiacenza vertice->facce in formato CSR (VFoffsets, VFc);
+ * - l'adiacenza faccia->facce (FF, FFi);
+ * - la corner table con le one-ring dei vertici (corner_table());
+ * - la geometria dei triangoli: normali, aree e angoli (FN, Fareas, Fangles);
+ * - i coseni degli angoli diedrali fra facce adiacenti (FF_cosines);
+ * - le normali di ogni tipo (NormalMode), calcolate con la funzione fornita
+ *   dal chiamante, in precisione piena (normals()) o quantizzate a 2 x 16 bit
+ *   (oct_normals()).
+ * Ognuno viene calcolato la prima volta che e' richiesto; set_mesh() li
+ * invalida tutti. In questo modo, ad esempio, passare da un tipo di normali
+ * all'altro nel Viewer non ricalcola nulla dopo la prima volta.
+ *
+ * Se si spostano solo alcuni vertici (animazione, sculpting),
+ * update_vertices() aggiorna la geometria e i coseni diedrali delle sole
+ * facce coinvolte; le normali gia' calcolate restano in memoria e vengono
+ * aggiornate alla richiesta successiva con la funzione di aggiornamento
+ * fornita dal chiamante (vedi normals()), che ricalcola solo le righe delle
+ * facce e dei vertici modificati (dirty_faces(), dirty_vertices()).
+ *
+ * La classe e' generica sul tipo delle coordinate (Scalar: double o float) e
+ * degli indici (Int: int o std::int64_t, per mesh con piu' di 2^31 corner);
+ * tutti i dati derivati usano gli stessi tipi. MeshContext e' la versione
+ * double/int.
+ *
+ * NOTA: la classe non e' thread-safe: i dati derivati vengono calcolati su
+ * richiesta anche dai metodi di lettura.
+ */
+template <typename Scalar, typename Int>
+class MeshContextT
+{
+  public:
+    typedef Matrix<Scalar, Dynamic, Dynamic> MatrixS;
+    typedef Matrix<Scalar, Dynamic, 1> VectorS;
+    typedef Matrix<Int, Dynamic, Dynamic> MatrixI;
+    typedef Matrix<Int, Dynamic, 1> VectorI;
+
+    // funzione che calcola le normali di un tipo nella matrice data, vedi
+    // normals(); la matrice contiene il risultato precedente (se c'e'), di cui
+    // la funzione puo' riutilizzare la memoria
+    typedef std::function<void(MeshContextT &, MatrixS &)> NormalFunction;
+    // funzione che aggiorna le normali di un tipo dopo update_vertices()
+    typedef std::function<void(MeshContextT &, MatrixS &)> NormalUpdateFunction;
+
+    MeshContextT() = default;
+
+    MeshContextT(Ref<const MatrixS> const &V, Ref<const MatrixI> const &F)
+    {
+        set_mesh(V, F);
+    }
+
+    /**
+     * @brief Sostituisce la mesh e invalida tutti i dati derivati.
+     *
+     * V e F possono essere matrici o Eigen::Map su dati esterni (ad esempio
+     * una cache mappata in memoria): vengono copiate una sola volta.
+     */
+    void set_mesh(Ref<const MatrixS> const &V, Ref<const MatrixI> const &F)
+    {
+        _V = V;
+        _F = F;
+        invalidate();
+    }
+
+    /**
+     * @brief Invalida tutti i dati derivati, ad esempio dopo aver modificato
+     * la mesh.
+     */
+    void invalidate()
+    {
+        _hasVF = false;
+        _hasFF = false;
+        _hasCT = false;
+        _hasGeometry = false;
+        _hasCosines = false;
+        for (int m = 0; m < 3; ++m) {
+            _hasNormals[m] = false;
+            _staleNormals[m] = false;
+            _hasOctNormals[m] = false;
+            _staleOctNormals[m] = false;
+        }
+        _dirtyFaces.resize(0);
+        _dirtyVertices.resize(0);
+    }
+
+    /**
+     * @brief Sposta alcuni vertici della mesh, aggiornando in modo
+     * incrementale i dati derivati gia' calcolati.
+     *
+     * Le adiacenze non cambiano. Le facce modificate (dirty_faces()) sono
+     * quelle incidenti sui vertici spostati: di queste vengono ricalcolate
+     * normale, area e angoli, e i coseni diedrali con le loro adiacenti. I
+     * vertici modificati (dirty_vertices()) sono i vertici di quelle facce:
+     * solo le loro normali ai vertici e ai corner possono cambiare.
+     *
+     * Le normali gia' calcolate diventano da aggiornare: la richiesta
+     * successiva con normals(mode, compute, update) le aggiorna con update in
+     * tempo proporzionale alle facce modificate. Le normali che erano gia' da
+     * aggiornare (cioe' non richieste dopo lo spostamento precedente) vengono
+     * invece invalidate e saranno ricalcolate per intero.
+     *
+     * @param vertices Gli indici dei vertici spostati, senza ripetizioni.
+     * @param positions Le nuove posizioni (vertices.size() x 3).
+     */
+    void update_vertices(Ref<const VectorI> const &vertices, Ref<const MatrixS> const &positions)
+    {
+        WS_PROFILE_SCOPE("MeshContext::update_vertices");
+
+        for (Index k = 0; k < vertices.size(); ++k) {
+            _V.row(vertices(k)) = positions.row(k);
+        }
+
+        // facce incidenti sui vertici spostati e loro vertici
+        auto const &VFo = VFoffsets();
+        auto const &VFcorners = VFc();
+        std::vector<Int> faces;
+        for (Index k = 0; k < vertices.size(); ++k) {
+            for (Int c = VFo(vertices(k)); c < VFo(vertices(k) + 1); ++c) {
+                faces.push_back(VFcorners(c) / 3);
+            }
+        }
+        std::sort(faces.begin(), faces.end());
+        faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+
+        std::vector<Int> verts;
+        verts.reserve(faces.size() * 3);
+        for (Int f : faces) {
+            for (int p = 0; p < 3; ++p) {
+                verts.push_back(_F(f, p));
+            }
+        }
+        std::sort(verts.begin(), verts.end());
+        verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
+
+        _dirtyFaces = Map<const VectorI>(faces.data(), Index(faces.size()));
+        _dirtyVertices = Map<const VectorI>(verts.data(), Index(verts.size()));
+
+        if (_hasGeometry) {
+            triangleGeometry(_V, _F, _dirtyFaces, _FN, _Fareas, _Fangles);
+        }
+        if (_hasCosines) {
+            // le righe delle facce modificate e delle loro adiacenti
+            std::vector<Int> rows(faces);
+            for (Int f : faces) {
+                for (int p = 0; p < 3; ++p) {
+                    if (_FF(f, p) >= 0) {
+                        rows.push_back(_FF(f, p));
+                    }
+                }
+            }
+            std::sort(rows.begin(), rows.end());
+            rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+            dihedralCosines(_FN, _FF, Map<const VectorI>(rows.data(), Index(rows.size())), _FF_cosines);
+        }
+
+        for (int m = 0; m < 3; ++m) {
+            _staleNormals[m] = _hasNormals[m];
+            _hasNormals[m] = false;
+            _staleOctNormals[m] = _hasOctNormals[m];
+            _hasOctNormals[m] = false;
+        }
+    }
+
+    /**
+     * @brief Le facce modificate dall'ultima chiamata a update_vertices(), in
+     * ordine crescente.
+     */
+    VectorI const &dirty_faces() const { return _dirtyFaces; }
+
+    /**
+     * @brief I vertici delle facce modificate dall'ultima chiamata a
+     * update_vertices(), in ordine crescente.
+     */
+    VectorI const &dirty_vertices() const { return _dirtyVertices; }
+
+    MatrixS const &V() const { return _V; }
+    MatrixI const &F() const { return _F; }
+
+    VectorI const &VFoffsets()
+    {
+        computeVF();
+        return _VFoffsets;
+    }
+
+    VectorI const &VFc()
+    {
+        computeVF();
+        return _VFc;
+    }
+
+    MatrixI const &FF()
+    {
+        computeFF();
+        return _FF;
+    }
+
+    MatrixI const &FFi()
+    {
+        computeFF();
+        return _FFi;
+    }
+
+    MatrixS const &FN()
+    {
+        computeGeometry();
+        return _FN;
+    }
+
+    VectorS const &Fareas()
+    {
+        computeGeometry();
+        return _Fareas;
+    }
+
+    MatrixS const &Fangles()
+    {
+        computeGeometry();
+        return _Fangles;
+    }
+
+    /**
+     * @brief Imposta l'adiacenza faccia->facce gia' calcolata (ad esempio
+     * letta da una cache), che non verra' quindi ricalcolata.
+     */
+    void set_face_adjacency(Ref<const MatrixI> const &FF, Ref<const MatrixI> const &FFi)
+    {
+        _FF = FF;
+        _FFi = FFi;
+        _hasFF = true;
+        _hasCosines = false;
+    }
+
+    /**
+     * @brief La corner table della mesh (vedi CornerTableT), usata dalle
+     * normali ai corner e per percorrere le one-ring dei vertici.
+     */
+    CornerTableT<Int> const &corner_table()
+    {
+        if (!_hasCT) {
+            _cornerTable.build(_V, _F);
+            _hasCT = true;
+        }
+        return _cornerTable;
+    }
+
+    MatrixS const &FF_cosines()
+    {
+        if (!_hasCosines) {
+            dihedralCosines(FN(), FF(), _FF_cosines);
+            _hasCosines = true;
+        }
+        return _FF_cosines;
+    }
+
+    /**
+     * @brief Indica se le normali del tipo dato sono gia' state calcolate.
+     */
+    bool has_normals(NormalMode mode) const
+    {
+        return _hasNormals[int(mode)];
+    }
+
+    /**
+     * @brief Restituisce le normali del tipo dato, calcolandole con compute
+     * solo se non sono gia' disponibili.
+     *
+     * Il risultato viene scritto nella matrice delle normali di quel tipo,
+     * per cui ricalcolarle (ad esempio dopo set_corner_angle()) non alloca
+     * memoria.
+     *
+     * @param mode Il tipo di normali.
+     * @param compute La funzione che calcola le normali di quel tipo su questa
+     *                mesh (ad esempio perCornerNormals(mesh, N)).
+     */
+    MatrixS const &normals(NormalMode mode, NormalFunction const &compute)
+    {
+        return normals(mode, compute, nullptr);
+    }
+
+    /**
+     * @brief Come normals(mode, compute), ma se le normali sono da aggiornare
+     * dopo update_vertices() le aggiorna in-place con update invece di
+     * ricalcolarle per intero.
+     *
+     * @param update La funzione che aggiorna le normali di quel tipo (ad
+     *               esempio updateCornerNormals); se nulla, si usa compute.
+     */
+    MatrixS const &normals(NormalMode mode, NormalFunction const &compute, NormalUpdateFunction const &update)
+    {
+        int m = int(mode);
+        if (!_hasNormals[m]) {
+            if (_staleNormals[m] && update) {
+                update(*this, _normals[m]);
+            } else {
+                compute(*this, _normals[m]);
+            }
+            _hasNormals[m] = true;
+            _staleNormals[m] = false;
+        }
+        return _normals[m];
+    }
+
+    /**
+     * @brief Restituisce le normali del tipo dato gia' calcolate
+     * (has_normals(mode) deve essere true).
+     */
+    MatrixS const &normals(NormalMode mode) const
+    {
+        return _normals[int(mode)];
+    }
+
+    /**
+     * @brief Imposta le normali del tipo dato gia' calcolate (ad esempio
+     * lette da una cache), che non verranno quindi ricalcolate.
+     */
+    void set_normals(NormalMode mode, Ref<const MatrixS> const &N)
+    {
+        _normals[int(mode)] = N;
+        _hasNormals[int(mode)] = true;
+        _staleNormals[int(mode)] = false;
+    }
+
+    /**
+     * @brief Indica se le normali quantizzate del tipo dato sono gia' state
+     * calcolate.
+     */
+    bool has_oct_normals(NormalMode mode) const
+    {
+        return _hasOctNormals[int(mode)];
+    }
+
+    /**
+     * @brief Come normals(mode, compute, update), ma restituisce le normali
+     * quantizzate in coordinate ottaedriche a 2 x 16 bit (vedi octEncode()),
+     * 4 byte per normale invece di 3 * sizeof(Scalar).
+     *
+     * Solo le normali quantizzate restano in memoria: quelle in precisione
+     * piena vengono calcolate in una matrice temporanea, a meno che non siano
+     * gia' disponibili (normals()), nel qual caso vengono solo codificate. Le
+     * normali da aggiornare dopo update_vertices() vengono decodificate,
+     * aggiornate con update e ricodificate: le righe non modificate
+     * ritrovano gli stessi codici, a meno di codici equivalenti sul bordo del
+     * quadrato (la stessa direzione).
+     */
+    OctNormals16 const &oct_normals(NormalMode mode, NormalFunction const &compute,
+                                    NormalUpdateFunction const &update = nullptr)
+    {
+        int m = int(mode);
+        if (!_hasOctNormals[m]) {
+            if (_hasNormals[m]) {
+                octEncode(_normals[m], _octNormals[m]);
+            } else {
+                MatrixS N;
+                if (_staleOctNormals[m] && update) {
+                    octDecode(_octNormals[m], N);
+                    update(*this, N);
+                } else {
+                    compute(*this, N);
+                }
+                octEncode(N, _octNormals[m]);
+            }
+            _hasOctNormals[m] = true;
+            _staleOctNormals[m] = false;
+        }
+        return _octNormals[m];
+    }
+
+    /**
+     * @brief Restituisce le normali quantizzate del tipo dato gia' calcolate
+     * (has_oct_normals(mode) deve essere true).
+     */
+    OctNormals16 const &oct_normals(NormalMode mode) const
+    {
+        return _octNormals[int(mode)];
+    }
+
+    /**
+     * @brief Imposta le normali quantizzate del tipo dato gia' calcolate (ad
+     * esempio lette da un file), che non verranno quindi ricalcolate.
+     */
+    void set_oct_normals(NormalMode mode, OctNormals16 NQ)
+    {
+        _octNormals[int(mode)] = std::move(NQ);
+        _hasOctNormals[int(mode)] = true;
+        _staleOctNormals[int(mode)] = false;
+    }
+
+    /**
+     * @brief La soglia, in gradi, dell'angolo diedrale fra due facce dello
+     * stesso settore, usata da perCornerNormals().
+     */
+    double corner_angle() const { return _cornerAngle; }
+
+    /**
+     * @brief Imposta la soglia dei settori delle normali ai corner; se cambia,
+     * invalida solo le normali ai corner (le adiacenze e la geometria non
+     * dipendono dalla soglia).
+     */
+    void set_corner_angle(double angle)
+    {
+        if (angle != _cornerAngle) {
+            _cornerAngle = angle;
+            _hasNormals[int(NormalMode::Corner)] = false;
+            _staleNormals[int(NormalMode::Corner)] = false;
+            _hasOctNormals[int(NormalMode::Corner)] = false;
+            _staleOctNormals[int(NormalMode::Corner)] = false;
+        }
+    }
+
+    /**
+     * @brief I buffer di lavoro dei kernel delle normali su questa mesh,
+     * riutilizzati fra un calcolo e il successivo.
+     */
+    NormalsWorkspace<Scalar, Int> &workspace() { return _workspace; }
+
+  private:
+    void computeVF()
+    {
+        if (!_hasVF) {
+            vertex_face_adjacency(_V, _F, _VFoffsets, _VFc);
+            _hasVF = true;
+        }
+    }
+
+    void computeFF()
+    {
+        if (!_hasFF) {
+            face_face_adjacency(_V, _F, _FF, _FFi);
+            _hasFF = true;
+        }
+    }
+
+    void computeGeometry()
+    {
+        if (!_hasGeometry) {
+            triangleGeometry(_V, _F, _FN, _Fareas, _Fangles);
+            _hasGeometry = true;
+        }
+    }
+
+    MatrixS _V;
+    MatrixI _F;
+
+    bool _hasVF = false;
+    VectorI _VFoffsets;
+    VectorI _VFc;
+
+    bool _hasFF = false;
+    MatrixI _FF;
+    MatrixI _FFi;
+
+    bool _hasCT = false;
+    CornerTableT<Int> _cornerTable;
+
+    bool _hasGeometry = false;
+    MatrixS _FN;
+    VectorS _Fareas;
+    MatrixS _Fangles;
+
+    bool _hasCosines = false;
+    MatrixS _FF_cosines;
+
+    double _cornerAngle = 30.0;
+
+    bool _hasNormals[3] = {false, false, false};
+    // normali calcolate prima di update_vertices(), da aggiornare
+    bool _staleNormals[3] = {false, false, false};
+    MatrixS _normals[3];
+
+    bool _hasOctNormals[3] = {false, false, false};
+    bool _staleOctNormals[3] = {false, false, false};
+    OctNormals16 _octNormals[3];
+
+    VectorI _dirtyFaces;
+    VectorI _dirtyVertices;
+
+    NormalsWorkspace<Scalar, Int> _workspace;
+};
+
+typedef MeshContextT<double, int> MeshContext;
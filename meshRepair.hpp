@@ -0,0 +1,743 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "meshContext.hpp"
+#include "parallelFor.hpp"
+#include "parallelGroup.hpp"
+#include "profiler.hpp"
+#include "radixSort.hpp"
+#include "topology.hpp"
+
+using namespace Eigen;
+
+/**
+ * @brief Statistiche sulla topologia di una mesh di triangoli, prodotte da
+ * validateMesh() e repairMesh().
+ *
+ * I campi da invalidFaces a nonOrientableEdges descrivono la mesh in
+ * ingresso; lati, vertici e componenti sono contati sulle sole facce valide
+ * (non invalide, degeneri o duplicate). Gli ultimi due campi descrivono le
+ * modifiche fatte da repairMesh().
+ */
+struct TopologyReport
+{
+    // facce con un indice di vertice fuori da [0, V.rows())
+    long long invalidFaces = 0;
+    // facce con due corner sullo stesso vertice
+    long long degenerateFaces = 0;
+    // facce con gli stessi tre vertici di una precedente, in qualunque ordine
+    long long duplicateFaces = 0;
+    // vertici non usati da nessuna faccia valida
+    long long unreferencedVertices = 0;
+    // lati di una sola faccia
+    long long boundaryEdges = 0;
+    // lati di piu' di due facce
+    long long nonManifoldEdges = 0;
+    // vertici con piu' ventagli di facce, che si toccano solo nel vertice
+    long long nonManifoldVertices = 0;
+    // lati di due facce che li percorrono nello stesso verso
+    long long inconsistentEdges = 0;
+    // componenti connesse attraverso i lati
+    long long components = 0;
+    // facce da invertire per orientare in modo coerente ogni componente
+    long long flippedFaces = 0;
+    // lati da tagliare perche' la componente non e' orientabile (come un
+    // nastro di Moebius)
+    long long nonOrientableEdges = 0;
+
+    // repairMesh(): copie aggiunte per separare i ventagli dei vertici
+    long long splitVertices = 0;
+    // repairMesh(): facce tolte dai lati rimasti non-manifold dopo la
+    // separazione dei vertici
+    long long removedFaces = 0;
+
+    /**
+     * @brief true se la mesh puo' essere usata cosi' com'e' dalle adiacenze
+     * e dalle normali: ogni lato e ogni vertice sono manifold e le facce sono
+     * orientate in modo coerente (i bordi sono ammessi).
+     */
+    bool clean() const
+    {
+        return invalidFaces == 0 && degenerateFaces == 0 && duplicateFaces == 0 && unreferencedVertices == 0 &&
+               nonManifoldEdges == 0 && nonManifoldVertices == 0 && inconsistentEdges == 0 &&
+               flippedFaces == 0 && nonOrientableEdges == 0;
+    }
+};
+
+namespace mesh_repair {
+
+template <typename Int>
+using Faces = Matrix<Int, Dynamic, 3, RowMajor>;
+
+const size_t min_parallel = 1 << 14;
+
+// distanza fra i contatori di due thread, per non condividere linee di cache
+const std::size_t stride = 8;
+
+/**
+ * @brief Somma count(i, sums) per i in [0, n) in parallelo: count aggiunge i
+ * propri contatori a sums[0..stride), distinti per thread, poi sommati in
+ * total.
+ */
+template <typename Index, typename Count>
+void sum(Index n, Count count, long long *total)
+{
+    std::vector<long long> partial;
+    parallel::parallel_for(n, [&](std::size_t nt) {
+        partial.assign(nt * stride, 0);
+    }, [&](Index i, std::size_t t) {
+        count(i, &partial[t * stride]);
+    }, [&](std::size_t t) {
+        for (std::size_t k = 0; k < stride; ++k) {
+            total[k] += partial[t * stride + k];
+        }
+    }, min_parallel);
+}
+
+/**
+ * @brief I lati di una mesh contati da pair_edges().
+ */
+struct EdgeCounts
+{
+    long long boundary = 0;
+    long long nonManifold = 0;
+    long long inconsistent = 0;
+    // coppie di lati orientati nello stesso verso
+    long long sameDirection = 0;
+};
+
+/**
+ * @brief Accoppia i lati orientati (half-edge) delle facce FW: il lato
+ * orientato h = 3 * f + p va da FW(f, p) a FW(f, (p + 1) % 3) e twin[h] e'
+ * il suo gemello, o -1.
+ *
+ * I lati orientati sono raggruppati per lato come in face_face_adjacency()
+ * (radix_sort() sulle chiavi dei due vertici). Il lato di due facce e'
+ * accoppiato se le facce lo percorrono in versi opposti o, con same, anche
+ * nello stesso verso. Su un lato non-manifold i lati orientati vengono
+ * accoppiati in ordine di faccia, ognuno con il primo ancora libero di verso
+ * opposto e poi, con same, dello stesso verso; quelli rimasti sono senza
+ * gemello. Con extra non nullo, (*extra)[h] e' 1 per i lati orientati di un
+ * lato non-manifold che non fanno parte della sua prima coppia.
+ *
+ * Le facce devono essere valide e non degeneri.
+ */
+template <typename Int>
+EdgeCounts pair_edges(Int nv, Faces<Int> const &FW, bool same, std::vector<Int> &twin, std::vector<char> *extra = nullptr)
+{
+    WS_PROFILE_SCOPE("repairMesh/pair_edges");
+
+    const Int nh = Int(FW.rows() * 3);
+    EdgeCounts counts;
+    twin.assign(nh, -1);
+    if (extra) {
+        extra->assign(nh, 0);
+    }
+    if (nh == 0) {
+        return counts;
+    }
+
+    int bits = 1;
+    while (bits < 32 && (std::int64_t(1) << bits) < nv) {
+        ++bits;
+    }
+
+    auto from = [&](Int h) { return FW(h / 3, h % 3); };
+    auto to = [&](Int h) { return FW(h / 3, (h % 3 + 1) % 3); };
+
+    std::vector<std::uint64_t> keys(nh);
+    std::vector<Int> edges(nh);
+    parallel::parallel_for(nh, [&](Int h) {
+        std::uint64_t a = std::uint64_t(from(h));
+        std::uint64_t b = std::uint64_t(to(h));
+        keys[h] = (std::min(a, b) << bits) | std::max(a, b);
+        edges[h] = h;
+    }, min_parallel);
+
+    radix_sort(keys, edges, 2 * bits);
+
+    long long total[stride] = {};
+    sum(nh, [&](Int g, long long *count) {
+        if (g > 0 && keys[g] == keys[g - 1]) {
+            return;
+        }
+        Int end = g + 1;
+        while (end < nh && keys[end] == keys[g]) {
+            ++end;
+        }
+
+        if (end - g == 1) {
+            ++count[0];
+            return;
+        }
+        if (end - g == 2) {
+            Int h0 = edges[g];
+            Int h1 = edges[g + 1];
+            bool opposite = from(h0) == to(h1);
+            if (!opposite) {
+                ++count[2];
+            }
+            if (h0 / 3 != h1 / 3 && (opposite || same)) {
+                twin[h0] = h1;
+                twin[h1] = h0;
+                count[3] += opposite ? 0 : 1;
+            }
+            return;
+        }
+
+        // lato non-manifold: raro, per cui basta una lista dei lati liberi
+        ++count[1];
+        std::vector<Int> free;
+        Int first = -1;
+        auto link = [&](Int a, Int b) {
+            twin[a] = b;
+            twin[b] = a;
+            first = first < 0 ? std::min(a, b) : first;
+        };
+        for (Int i = g; i < end; ++i) {
+            Int h = edges[i];
+            auto it = std::find_if(free.begin(), free.end(), [&](Int w) {
+                return from(w) == to(h) && w / 3 != h / 3;
+            });
+            if (it != free.end()) {
+                link(*it, h);
+                free.erase(it);
+            } else {
+                free.push_back(h);
+            }
+        }
+        for (std::size_t i = 0; same && i < free.size(); ++i) {
+            for (std::size_t j = i + 1; j < free.size() && twin[free[i]] < 0; ++j) {
+                if (twin[free[j]] < 0 && free[i] / 3 != free[j] / 3) {
+                    link(free[i], free[j]);
+                    ++count[3];
+                }
+            }
+        }
+        if (extra) {
+            // senza coppie resta solo il primo lato orientato
+            first = first < 0 ? edges[g] : first;
+            for (Int i = g; i < end; ++i) {
+                Int h = edges[i];
+                (*extra)[h] = (h == first || (first >= 0 && twin[h] == first)) ? 0 : 1;
+            }
+        }
+    }, total);
+
+    counts.boundary = total[0];
+    counts.nonManifold = total[1];
+    counts.inconsistent = total[2];
+    counts.sameDirection = total[3];
+    return counts;
+}
+
+/**
+ * @brief Divide i corner di ogni vertice in ventagli: due corner dello stesso
+ * vertice sono nello stesso ventaglio se le loro facce sono collegate, lato
+ * per lato intorno al vertice, da lati accoppiati (twin).
+ *
+ * fan[c] e' l'indice del ventaglio del corner c fra quelli del suo vertice,
+ * in ordine di primo corner (0 per quello del corner minore), e count[v] il
+ * numero di ventagli del vertice v (0 se v non ha facce). I vertici sono
+ * elaborati in parallelo, ognuno con una union-find sui propri corner.
+ */
+template <typename Int>
+void fans(Int nv, Faces<Int> const &FW, std::vector<Int> const &twin, std::vector<Int> &fan, std::vector<Int> &count)
+{
+    WS_PROFILE_SCOPE("repairMesh/fans");
+
+    // per l'adiacenza vertice->facce basta il numero di vertici
+    Matrix<Int, Dynamic, 1> VFoffsets, VFc;
+    vertex_face_adjacency(MatrixXd(nv, 0), FW, VFoffsets, VFc);
+
+    fan.resize(FW.rows() * 3);
+    count.assign(nv, 0);
+
+    std::vector<std::vector<Int>> parents;
+    parallel::parallel_for(nv, [&](std::size_t nt) {
+        parents.resize(nt);
+    }, [&](Int v, std::size_t t) {
+        const Int begin = VFoffsets(v);
+        const Int n = VFoffsets(v + 1) - begin;
+        Int const *corners = VFc.data() + begin;
+
+        std::vector<Int> &parent = parents[t];
+        parent.resize(n);
+        for (Int i = 0; i < n; ++i) {
+            parent[i] = i;
+        }
+        auto find = [&](Int i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        };
+
+        // il lato uscente dal corner c e' c stesso, quello entrante il
+        // precedente nella faccia; il corner di v nella faccia del gemello
+        // appartiene allo stesso ventaglio
+        for (Int i = 0; i < n; ++i) {
+            const Int c = corners[i];
+            const Int sides[2] = {c, c % 3 == 0 ? c + 2 : c - 1};
+            for (Int h : sides) {
+                const Int o = twin[h];
+                if (o < 0) {
+                    continue;
+                }
+                const Int g = o / 3;
+                const Int q = FW(g, 0) == v ? 0 : (FW(g, 1) == v ? 1 : 2);
+                const Int j = Int(std::lower_bound(corners, corners + n, 3 * g + q) - corners);
+                const Int a = find(i);
+                const Int b = find(j);
+                if (a != b) {
+                    parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+
+        // la radice e' il corner minore del ventaglio: viene prima degli altri
+        Int k = 0;
+        for (Int i = 0; i < n; ++i) {
+            const Int r = find(i);
+            fan[corners[i]] = r == i ? k++ : fan[corners[r]];
+        }
+        count[v] = k;
+    }, [](std::size_t) {}, min_parallel);
+}
+
+/**
+ * @brief Orienta in modo coerente le facce di ogni componente connessa: flip[f]
+ * e' 1 se la faccia f va invertita.
+ *
+ * Ogni componente viene visitata in ampiezza attraverso i lati accoppiati:
+ * una faccia adiacente che percorre il lato comune nello stesso verso va
+ * invertita rispetto alla faccia da cui e' raggiunta. Se una faccia gia'
+ * visitata richiede l'orientazione opposta la componente non e' orientabile
+ * e il lato viene tagliato (twin = -1 da entrambe le parti). Di ogni
+ * componente viene infine invertita la parte minore, per cambiare il minor
+ * numero di facce. La visita e' sequenziale, lineare nel numero di corner.
+ */
+template <typename Int>
+void orient(Faces<Int> const &FW, std::vector<Int> &twin, std::vector<char> &flip, TopologyReport &report)
+{
+    WS_PROFILE_SCOPE("repairMesh/orient");
+
+    const Int nf = Int(FW.rows());
+    flip.assign(nf, 0);
+    std::vector<char> visited(nf, 0);
+    std::vector<Int> queue;
+    queue.reserve(nf);
+
+    auto from = [&](Int h) { return FW(h / 3, h % 3); };
+
+    for (Int root = 0; root < nf; ++root) {
+        if (visited[root]) {
+            continue;
+        }
+        const std::size_t start = queue.size();
+        visited[root] = 1;
+        queue.push_back(root);
+        for (std::size_t head = start; head < queue.size(); ++head) {
+            const Int f = queue[head];
+            for (Int h = 3 * f; h < 3 * f + 3; ++h) {
+                const Int o = twin[h];
+                if (o < 0) {
+                    continue;
+                }
+                const Int g = o / 3;
+                const char want = char(flip[f] ^ (from(o) == from(h) ? 1 : 0));
+                if (!visited[g]) {
+                    visited[g] = 1;
+                    flip[g] = want;
+                    queue.push_back(g);
+                } else if (flip[g] != want) {
+                    twin[h] = -1;
+                    twin[o] = -1;
+                    ++report.nonOrientableEdges;
+                }
+            }
+        }
+
+        const std::size_t size = queue.size() - start;
+        std::size_t flipped = 0;
+        for (std::size_t k = start; k < queue.size(); ++k) {
+            flipped += flip[queue[k]];
+        }
+        if (2 * flipped > size) {
+            for (std::size_t k = start; k < queue.size(); ++k) {
+                flip[queue[k]] ^= 1;
+            }
+            flipped = size - flipped;
+        }
+        report.flippedFaces += (long long)flipped;
+        ++report.components;
+    }
+}
+
+/**
+ * @brief Separa i ventagli dei vertici (vedi fans()): il ventaglio del corner
+ * minore tiene il vertice, ogni altro ne riceve una copia nuova, con indice
+ * a partire da nv. src[u] e' il vertice di partenza (della mesh in ingresso)
+ * di ogni vertice u e viene esteso alle copie.
+ *
+ * @param count Il numero di ventagli di ognuno degli nv vertici (0 se il
+ *              vertice non ha facce), prima della separazione.
+ * @return Il nuovo numero di vertici.
+ */
+template <typename Int>
+Int split(Int nv, Faces<Int> &FW, std::vector<Int> const &twin, std::vector<Int> &src, std::vector<Int> &count)
+{
+    WS_PROFILE_SCOPE("repairMesh/split");
+
+    std::vector<Int> fan;
+    fans(nv, FW, twin, fan, count);
+
+    // prima copia di ogni vertice (somma prefissa delle copie)
+    std::vector<Int> base(nv + 1);
+    base[0] = nv;
+    for (Int v = 0; v < nv; ++v) {
+        base[v + 1] = base[v] + std::max<Int>(count[v], 1) - 1;
+    }
+    const Int nsplit = base[nv];
+    if (nsplit == nv) {
+        return nv;
+    }
+
+    src.resize(nsplit);
+    parallel::parallel_for(nv, [&](Int v) {
+        for (Int u = base[v]; u < base[v + 1]; ++u) {
+            src[u] = src[v];
+        }
+    }, min_parallel);
+
+    // ogni corner e' scritto solo da se stesso
+    parallel::parallel_for(Int(FW.rows() * 3), [&](Int c) {
+        if (fan[c] > 0) {
+            Int &v = FW(c / 3, c % 3);
+            v = base[v] + fan[c] - 1;
+        }
+    }, min_parallel);
+    return nsplit;
+}
+
+/**
+ * @brief Toglie le facce con indici non validi, degeneri (due corner sullo
+ * stesso vertice) e duplicate (stessi tre vertici di una faccia precedente,
+ * in qualunque ordine e orientazione): FW sono le facce rimaste, nell'ordine
+ * di F, e FI(k) l'indice in F della faccia FW.row(k).
+ *
+ * I duplicati sono raggruppati come in weldVertices() (weld::group()).
+ */
+template <typename DerivedF, typename Int>
+void clean_faces(Int nv, MatrixBase<DerivedF> const &F, Faces<Int> &FW, std::vector<Int> &FI, TopologyReport &report)
+{
+    WS_PROFILE_SCOPE("repairMesh/clean_faces");
+
+    const Int nf = Int(F.rows());
+
+    // vertici ordinati (a < b < c); le facce non valide hanno chiavi
+    // distinte, per non formare gruppi di hash uguali
+    enum : char { Valid, Invalid, Degenerate };
+    Faces<Int> sorted(nf, 3);
+    std::vector<char> state(nf);
+    parallel::parallel_for(nf, [&](Int f) {
+        Int a = Int(F(f, 0));
+        Int b = Int(F(f, 1));
+        Int c = Int(F(f, 2));
+        if (a < 0 || b < 0 || c < 0 || a >= nv || b >= nv || c >= nv) {
+            state[f] = Invalid;
+            sorted.row(f) << -1 - f, -1, -1;
+            return;
+        }
+        if (a > b) std::swap(a, b);
+        if (b > c) std::swap(b, c);
+        if (a > b) std::swap(a, b);
+        state[f] = (a == b || b == c) ? Degenerate : Valid;
+        sorted.row(f) << a, b, c;
+    }, min_parallel);
+
+    std::vector<std::uint64_t> keys;
+    std::vector<Int> order;
+    std::vector<Int> first;
+    weld::group(nf, [&](Int f) {
+        return weld::hash3(std::uint64_t(sorted(f, 0)), std::uint64_t(sorted(f, 1)), std::uint64_t(sorted(f, 2)));
+    }, [&](Int a, Int b) {
+        return sorted.row(a) == sorted.row(b);
+    }, keys, order, first);
+
+    long long total[stride] = {};
+    sum(nf, [&](Int f, long long *count) {
+        count[0] += state[f] == Invalid;
+        count[1] += state[f] == Degenerate;
+        count[2] += state[f] == Valid && first[f] != f;
+    }, total);
+    report.invalidFaces = total[0];
+    report.degenerateFaces = total[1];
+    report.duplicateFaces = total[2];
+
+    auto keep = [&](Int f) { return state[f] == Valid && first[f] == f; };
+    std::vector<Int> position;
+    const Int nkept = weld::enumerate(nf, keep, position);
+    FW.resize(nkept, 3);
+    FI.resize(nkept);
+    parallel::parallel_for(nf, [&](Int f) {
+        if (keep(f)) {
+            FW.row(position[f]) = F.row(f).template cast<Int>();
+            FI[position[f]] = f;
+        }
+    }, min_parallel);
+}
+
+/**
+ * @brief La parte di analisi comune a validateMesh() e repairMesh(): facce
+ * valide (clean_faces()), lati accoppiati anche se orientati nello stesso
+ * verso, ventagli dei vertici e orientazione delle componenti.
+ *
+ * @return I lati contati da pair_edges().
+ */
+template <typename DerivedF, typename Int>
+EdgeCounts analyze(
+    Int nv,
+    MatrixBase<DerivedF> const &F,
+    Faces<Int> &FW,
+    std::vector<Int> &FI,
+    std::vector<Int> &twin,
+    std::vector<char> &flip,
+    TopologyReport &report)
+{
+    clean_faces(nv, F, FW, FI, report);
+
+    EdgeCounts edges = pair_edges(nv, FW, true, twin);
+    report.boundaryEdges = edges.boundary;
+    report.nonManifoldEdges = edges.nonManifold;
+    report.inconsistentEdges = edges.inconsistent;
+
+    std::vector<Int> fan, count;
+    fans(nv, FW, twin, fan, count);
+    long long total[stride] = {};
+    sum(nv, [&](Int v, long long *n) {
+        n[0] += count[v] > 1;
+        n[1] += count[v] == 0;
+    }, total);
+    report.nonManifoldVertices = total[0];
+    report.unreferencedVertices = total[1];
+
+    orient(FW, twin, flip, report);
+    return edges;
+}
+
+} // namespace mesh_repair
+
+/**
+ * @brief Controlla la topologia di una mesh di triangoli senza modificarla
+ * (vedi TopologyReport e repairMesh()).
+ *
+ * Il costo e' lineare nel numero di corner e, salvo la visita delle
+ * componenti per l'orientazione, tutte le fasi sono parallele.
+ *
+ * @param V I vertici della mesh (solo il loro numero, V.rows()).
+ * @param F I triangoli della mesh.
+ * @return Le statistiche della mesh; report.clean() se non ha difetti.
+ */
+template <typename DerivedV, typename DerivedF>
+TopologyReport validateMesh(MatrixBase<DerivedV> const &V, MatrixBase<DerivedF> const &F)
+{
+    typedef typename DerivedF::Scalar Int;
+
+    WS_PROFILE_SCOPE("validateMesh");
+
+    TopologyReport report;
+    mesh_repair::Faces<Int> FW;
+    std::vector<Int> FI, twin;
+    std::vector<char> flip;
+    mesh_repair::analyze(Int(V.rows()), F, FW, FI, twin, flip, report);
+    return report;
+}
+
+/**
+ * @brief Ripara la topologia di una mesh di triangoli (ad esempio una
+ * scansione) prima del calcolo delle adiacenze e delle normali.
+ *
+ * Le riparazioni, nell'ordine:
+ * 1. le facce con indici non validi, degeneri e duplicate vengono tolte;
+ * 2. le facce di ogni componente connessa vengono orientate in modo coerente
+ *    con quella della maggioranza (sulle componenti non orientabili i lati
+ *    in conflitto vengono tagliati);
+ * 3. i vertici non-manifold vengono separati: ogni ventaglio di facce oltre
+ *    al primo riceve una copia del vertice, nella stessa posizione. Sui lati
+ *    non-manifold le facce sono accoppiate a due a due (vedi
+ *    mesh_repair::pair_edges()), per cui le facce in piu' vengono staccate
+ *    insieme ai vertici del lato;
+ * 4. se un lato resta condiviso da piu' di due facce (ventagli che passano
+ *    due volte per lo stesso lato, raro) le facce oltre alla prima coppia
+ *    vengono tolte e i vertici separati di nuovo;
+ * 5. i vertici non usati da nessuna faccia vengono tolti.
+ *
+ * Il risultato ha solo lati e vertici manifold, con le facce orientate in
+ * modo coerente: face_face_adjacency() e CornerTableT accoppiano tutti i
+ * lati interni e ogni vertice ha un solo ventaglio. Le facce degeneri per
+ * area (con tre vertici distinti ma allineati) non sono difetti topologici e
+ * restano. Vertici e facce mantengono l'ordine di partenza, con le copie dei
+ * vertici in fondo, per cui il risultato e' deterministico.
+ *
+ * Il costo e' lineare nel numero di corner: i lati sono raggruppati con
+ * radix_sort() come in face_face_adjacency() e i ventagli calcolati sui
+ * corner di ogni vertice, in parallelo; solo la visita delle componenti per
+ * l'orientazione e' sequenziale. Una mesh gia' pulita (report.clean()) viene
+ * copiata senza altre fasi.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh.
+ * @param VO I vertici della mesh riparata.
+ * @param FO I triangoli della mesh riparata.
+ * @param VI Per ogni vertice di VO, l'indice del vertice di V da cui viene
+ *           (per riportare attributi come colori o coordinate texture).
+ * @param FI Per ogni triangolo di FO, l'indice del triangolo di F da cui viene
+ *           (con i vertici eventualmente in ordine inverso).
+ * @return Le statistiche della mesh in ingresso e delle riparazioni.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedVO, typename DerivedFO, typename DerivedVI, typename DerivedFI>
+TopologyReport repairMesh(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedVO> &VO,
+    PlainObjectBase<DerivedFO> &FO,
+    PlainObjectBase<DerivedVI> &VI,
+    PlainObjectBase<DerivedFI> &FI)
+{
+    typedef typename DerivedF::Scalar Int;
+
+    WS_PROFILE_SCOPE("repairMesh");
+
+    const Int nv = Int(V.rows());
+    const size_t min_parallel = mesh_repair::min_parallel;
+
+    TopologyReport report;
+    mesh_repair::Faces<Int> FW;
+    std::vector<Int> faces, twin;
+    std::vector<char> flip;
+    mesh_repair::EdgeCounts edges = mesh_repair::analyze(nv, F, FW, faces, twin, flip, report);
+
+    if (report.clean()) {
+        VO = V;
+        FO = F.template cast<typename DerivedFO::Scalar>();
+        VI.resize(nv, 1);
+        FI.resize(F.rows(), 1);
+        std::iota(VI.data(), VI.data() + nv, typename DerivedVI::Scalar(0));
+        std::iota(FI.data(), FI.data() + F.rows(), typename DerivedFI::Scalar(0));
+        return report;
+    }
+
+    // 2. orientazione; i lati vanno riaccoppiati se sono cambiati i versi o
+    //    erano accoppiati lati nello stesso verso
+    if (report.flippedFaces > 0) {
+        parallel::parallel_for(Int(FW.rows()), [&](Int f) {
+            if (flip[f]) {
+                std::swap(FW(f, 1), FW(f, 2));
+            }
+        }, min_parallel);
+    }
+    if (report.flippedFaces > 0 || report.nonOrientableEdges > 0 || edges.sameDirection > 0) {
+        mesh_repair::pair_edges(nv, FW, false, twin);
+    }
+
+    // 3. separazione dei ventagli
+    std::vector<Int> src(nv), count;
+    std::iota(src.begin(), src.end(), Int(0));
+    Int n = mesh_repair::split(nv, FW, twin, src, count);
+
+    // 4. lati ancora non-manifold (possibili solo se ce n'erano)
+    if (report.nonManifoldEdges > 0) {
+        std::vector<char> extra;
+        if (mesh_repair::pair_edges(n, FW, false, twin, &extra).nonManifold > 0) {
+            auto keep = [&](Int f) { return !extra[3 * f] && !extra[3 * f + 1] && !extra[3 * f + 2]; };
+            std::vector<Int> position;
+            const Int nkept = weld::enumerate(Int(FW.rows()), keep, position);
+            report.removedFaces = (long long)(FW.rows() - nkept);
+
+            mesh_repair::Faces<Int> kept(nkept, 3);
+            std::vector<Int> keptFaces(nkept);
+            parallel::parallel_for(Int(FW.rows()), [&](Int f) {
+                if (keep(f)) {
+                    kept.row(position[f]) = FW.row(f);
+                    keptFaces[position[f]] = faces[f];
+                }
+            }, min_parallel);
+            FW.swap(kept);
+            faces.swap(keptFaces);
+
+            mesh_repair::pair_edges(n, FW, false, twin);
+            n = mesh_repair::split(n, FW, twin, src, count);
+        }
+    }
+    report.splitVertices = (long long)(n - nv);
+
+    // 5. vertici senza facce; le copie aggiunte dall'ultima separazione ne
+    //    hanno sempre
+    const Int ncounted = Int(count.size());
+    auto used = [&](Int u) { return u >= ncounted || count[u] > 0; };
+    std::vector<Int> position;
+    const Int nused = weld::enumerate(n, used, position);
+
+    VO.resize(nused, V.cols());
+    VI.resize(nused, 1);
+    parallel::parallel_for(n, [&](Int u) {
+        if (used(u)) {
+            VO.row(position[u]) = V.row(src[u]);
+            VI(position[u]) = typename DerivedVI::Scalar(src[u]);
+        }
+    }, min_parallel);
+
+    FO.resize(FW.rows(), 3);
+    FI.resize(FW.rows(), 1);
+    parallel::parallel_for(Int(FW.rows()), [&](Int f) {
+        for (int k = 0; k < 3; ++k) {
+            FO(f, k) = typename DerivedFO::Scalar(position[FW(f, k)]);
+        }
+        FI(f) = typename DerivedFI::Scalar(faces[f]);
+    }, min_parallel);
+
+    WS_PROFILE_COUNT("repair_split_vertices", report.splitVertices);
+    WS_PROFILE_COUNT("repair_removed_faces", F.rows() - FO.rows());
+    return report;
+}
+
+/**
+ * @brief Ripara la topologia di una mesh (vedi repairMesh(V, F, VO, FO, VI,
+ * FI)).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedVO, typename DerivedFO>
+TopologyReport repairMesh(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedVO> &VO,
+    PlainObjectBase<DerivedFO> &FO)
+{
+    Matrix<typename DerivedF::Scalar, Dynamic, 1> VI, FI;
+    return repairMesh(V, F, VO, FO, VI, FI);
+}
+
+/**
+ * @brief Ripara la topologia della mesh di un MeshContext (vedi
+ * repairMesh(V, F, VO, FO, VI, FI)), da chiamare prima di richiederne le
+ * adiacenze o le normali. Se la mesh e' gia' pulita non viene modificata e i
+ * dati derivati gia' calcolati restano validi.
+ */
+template <typename Scalar, typename Int>
+TopologyReport repairMesh(MeshContextT<Scalar, Int> &mesh)
+{
+    typename MeshContextT<Scalar, Int>::MatrixS V;
+    typename MeshContextT<Scalar, Int>::MatrixI F;
+    TopologyReport report = repairMesh(mesh.V(), mesh.F(), V, F);
+    if (!report.clean()) {
+        mesh.set_mesh(V, F);
+    }
+    return report;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include <igl/parallel_for.h>
+
+namespace parallel {
+
+// limite del thread corrente, 0 se nessuno (vedi ThreadLimit)
+inline unsigned &thread_limit()
+{
+    thread_local unsigned limit = 0;
+    return limit;
+}
+
+/**
+ * @brief Il numero di thread che i kernel chiamati dal thread corrente
+ * possono usare: quelli dell'hardware, o meno se limitati con ThreadLimit.
+ */
+inline unsigned threads()
+{
+    const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned limit = thread_limit();
+    return limit == 0 ? hw : std::min(limit, hw);
+}
+
+/**
+ * @brief Limita, finche' esiste, i thread usati da parallel_for() e dagli
+ * altri kernel paralleli chiamati dal thread corrente (ad esempio da un
+ * thread di un pool che ha riservato solo alcuni core). Con limite 1 i
+ * kernel sono seriali.
+ */
+class ThreadLimit
+{
+  public:
+    explicit ThreadLimit(unsigned threads) : _previous(thread_limit())
+    {
+        thread_limit() = std::max(1u, threads);
+    }
+
+    ~ThreadLimit()
+    {
+        thread_limit() = _previous;
+    }
+
+    ThreadLimit(ThreadLimit const &) = delete;
+    ThreadLimit &operator=(ThreadLimit const &) = delete;
+
+  private:
+    unsigned _previous;
+};
+
+/**
+ * @brief Come igl::parallel_for (stessa firma e stessa divisione del ciclo
+ * in blocchi contigui, uno per thread), ma con al piu' threads() thread.
+ *
+ * Senza limite chiama igl::parallel_for. Con un limite i thread creati
+ * hanno limite 1, per cui un parallel_for chiamato al loro interno e'
+ * seriale.
+ */
+template <typename Index, typename PrepFunction, typename Function, typename AccumFunction>
+bool parallel_for(
+    const Index loop_size,
+    PrepFunction const &prep_func,
+    Function const &func,
+    AccumFunction const &accum_func,
+    const std::size_t min_parallel = 0)
+{
+    if (thread_limit() == 0) {
+        return igl::parallel_for(loop_size, prep_func, func, accum_func, min_parallel);
+    }
+    if (loop_size <= 0) {
+        return false;
+    }
+    const std::size_t nthreads = loop_size < Index(min_parallel) ? 1 : threads();
+    if (nthreads <= 1) {
+        prep_func(1);
+        for (Index i = 0; i < loop_size; ++i) {
+            func(i, 0);
+        }
+        accum_func(0);
+        return false;
+    }
+
+    const Index slice = std::max(Index(std::round((loop_size + 1) / double(nthreads))), Index(1));
+    auto range = [&func](Index begin, Index end, std::size_t t) {
+        ThreadLimit serial(1);
+        for (Index i = begin; i < end; ++i) {
+            func(i, t);
+        }
+    };
+    prep_func(nthreads);
+    std::vector<std::thread> pool;
+    pool.reserve(nthreads);
+    Index begin = 0;
+    for (std::size_t t = 0; t < nthreads && begin < loop_size; ++t) {
+        const Index end = t + 1 == nthreads ? loop_size : std::min(begin + slice, loop_size);
+        pool.emplace_back(range, begin, end, t);
+        begin = end;
+    }
+    for (auto &thread : pool) {
+        thread.join();
+    }
+    for (std::size_t t = 0; t < nthreads; ++t) {
+        accum_func(t);
+    }
+    return true;
+}
+
+template <typename Index, typename Function>
+bool parallel_for(const Index loop_size, Function const &func, const std::size_t min_parallel = 0)
+{
+    auto no_op = [](std::size_t) {};
+    auto wrapper = [&func](Index i, std::size_t) { func(i); };
+    return parallel_for(loop_size, no_op, wrapper, no_op, min_parallel);
+}
+
+} // namespace parallel
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parallelFor.hpp"
+#include "radixSort.hpp"
+
+/**
+ * Primitive parallele per raggruppare e compattare elementi, nate per
+ * weldVertices() (load.hpp) e condivise con le altre fasi che lavorano su
+ * tutta la mesh: hash a 64 bit, minimo atomico, numerazione degli elementi da
+ * tenere (enumerate()) e raggruppamento per chiave (group()).
+ */
+namespace weld {
+
+
+// rimescola i bit di x (finalizzatore di splitmix64)
+inline std::uint64_t mix(std::uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// bit degli hash: bastano a rendere rare le collisioni (gestite comunque da
+// group()) e risparmiano 3 passate di radix_sort() su 8
+const int hash_bits = 40;
+
+inline std::uint64_t hash3(std::uint64_t a, std::uint64_t b, std::uint64_t c)
+{
+    return mix(a + 0x9e3779b97f4a7c15ULL * mix(b + 0x9e3779b97f4a7c15ULL * mix(c))) >> (64 - hash_bits);
+}
+
+// a = min(a, value), senza lock
+template <typename Index>
+void atomic_min(std::atomic<Index> &a, Index value)
+{
+    Index current = a.load(std::memory_order_relaxed);
+    while (value < current && !a.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief Numera in parallelo gli elementi da tenere: per ogni i con keep(i),
+ * position[i] e' il numero di elementi tenuti prima di i (somma prefissa a
+ * blocchi, uno per thread).
+ *
+ * @return Il numero di elementi tenuti.
+ */
+template <typename Index, typename Keep>
+Index enumerate(Index n, Keep keep, std::vector<Index> &position)
+{
+    const Index min_parallel = 1 << 16;
+    const Index hw = Index(parallel::threads());
+    const Index nblocks = n < min_parallel ? 1 : std::min(hw, n / (min_parallel / 4));
+    const Index block = (n + nblocks - 1) / nblocks;
+
+    position.resize(n);
+    std::vector<Index> base(nblocks + 1, 0);
+    parallel::parallel_for(nblocks, [&](Index b) {
+        const Index end = std::min(n, (b + 1) * block);
+        Index count = 0;
+        for (Index i = b * block; i < end; ++i) {
+            count += keep(i) ? 1 : 0;
+        }
+        base[b + 1] = count;
+    });
+    for (Index b = 0; b < nblocks; ++b) {
+        base[b + 1] += base[b];
+    }
+    parallel::parallel_for(nblocks, [&](Index b) {
+        const Index end = std::min(n, (b + 1) * block);
+        Index next = base[b];
+        for (Index i = b * block; i < end; ++i) {
+            if (keep(i)) {
+                position[i] = next++;
+            }
+        }
+    });
+    return base[nblocks];
+}
+
+/**
+ * @brief Raggruppa gli elementi 0..n-1 per chiave: first[i] e' il primo
+ * elemento (indice minore) equivalente a i.
+ *
+ * Gli elementi vengono ordinati (radix_sort() stabile) per hash(i), di
+ * hash_bits bit; gli elementi con lo stesso hash, consecutivi e in ordine crescente, vengono
+ * confrontati con same(i, j), per cui le collisioni dell'hash non uniscono
+ * elementi diversi. Ogni gruppo di hash uguali e' elaborato da un solo thread.
+ *
+ * @param keys Gli hash ordinati.
+ * @param order Gli elementi nell'ordine di keys.
+ */
+template <typename Index, typename Hash, typename Same>
+void group(
+    Index n,
+    Hash hash,
+    Same same,
+    std::vector<std::uint64_t> &keys,
+    std::vector<Index> &order,
+    std::vector<Index> &first)
+{
+    const size_t min_parallel = 1 << 14;
+
+    keys.resize(n);
+    order.resize(n);
+    parallel::parallel_for(n, [&](Index i) {
+        keys[i] = hash(i);
+        order[i] = i;
+    }, min_parallel);
+
+    radix_sort(keys, order, hash_bits);
+
+    first.resize(n);
+    parallel::parallel_for(n, [&](Index s) {
+        if (s > 0 && keys[s] == keys[s - 1]) {
+            return;
+        }
+        // s e' l'inizio di un gruppo di hash uguali: di norma un solo elemento
+        // distinto, salvo collisioni
+        for (Index j = s; j < n && keys[j] == keys[s]; ++j) {
+            const Index i = order[j];
+            first[i] = i;
+            for (Index k = s; k < j; ++k) {
+                const Index d = order[k];
+                if (first[d] == d && same(d, i)) {
+                    first[i] = d;
+                    break;
+                }
+            }
+        }
+    }, min_parallel);
+}
+
+} // namespace weld
@@ -1,12 +1,601 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
+#include "cornerTable.hpp"
+#include "meshContext.hpp"
+#include "octNormals.hpp"
+#include "parallelFor.hpp"
+#include "profiler.hpp"
 #include "topology.hpp"
+#include "triangleGeometry.hpp"
 
 using namespace Eigen;
 
+namespace corner_normals {
+
+/**
+ * @brief Calcola le normali di tutti i corner del vertice v e le scrive nelle
+ * righe corrispondenti di N (vedi perCornerNormals() per il metodo).
+ *
+ * La geometria dei triangoli e' letta tramite g (triangle_geometry::Arrays o
+ * triangle_geometry::Records), il coseno dell'angolo diedrale sul lato p
+ * della faccia f, adiacente a nf, con cosine(f, p, nf).
+ *
+ * corners e parent sono buffer di lavoro, riutilizzati fra i vertici
+ * elaborati dallo stesso thread: la union-find usa indici locali al vertice,
+ * nell'ordine (crescente) dei corner in VFc.
+ */
+template <
+    typename Geometry, typename Cosine, typename DerivedF,
+    typename DerivedO, typename DerivedVFc, typename DerivedFF, typename DerivedFFi,
+    typename DerivedOut>
+void sectors(
+    typename DerivedVFc::Scalar v,
+    Geometry const &g,
+    Cosine const &cosine,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    typename Geometry::Scalar cos_thr,
+    std::vector<typename DerivedVFc::Scalar> &corners,
+    std::vector<typename DerivedVFc::Scalar> &parent,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename DerivedVFc::Scalar Int;
+
+    const Int begin = VFoffsets(v);
+    const Int n = VFoffsets(v + 1) - begin;
+
+    corners.resize(n);
+    parent.resize(n);
+    for (Int i = 0; i < n; ++i) {
+        corners[i] = VFc(begin + i);
+        parent[i] = i;
+    }
+    auto find = [&](Int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    // 1. settori: il lato p della faccia f parte dal corner (f, p); il corner
+    // dello stesso vertice nella faccia adiacente e' quello che segue il lato
+    // gemello
+    for (Int i = 0; i < n; ++i) {
+        Int f = corners[i] / 3;
+        Int p = corners[i] % 3;
+        Int nf = FF(f, p);
+        if (nf < 0 || !(cosine(f, p, nf) >= cos_thr)) {
+            continue;
+        }
+        Int nfp = (FFi(f, p) + 1) % 3;
+        if (F(nf, nfp) != v) {
+            continue;
+        }
+        Int j = Int(std::lower_bound(corners.begin(), corners.end(), 3 * nf + nfp) - corners.begin());
+        Int a = find(i);
+        Int b = find(j);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // 2. somma dei contributi nel corner radice del settore
+    for (Int i = 0; i < n; ++i) {
+        N.row(corners[i]).setZero();
+    }
+    for (Int i = 0; i < n; ++i) {
+        Int f = corners[i] / 3;
+        Int p = corners[i] % 3;
+        N.row(corners[find(i)]) += g.weight(f, p) * g.normal(f);
+    }
+    for (Int i = 0; i < n; ++i) {
+        if (find(i) == i) {
+            N.row(corners[i]).normalize();
+        }
+    }
+
+    // 3. copia della normale del settore negli altri corner
+    for (Int i = 0; i < n; ++i) {
+        Int r = find(i);
+        if (r != i) {
+            N.row(corners[i]) = N.row(corners[r]);
+        }
+    }
+}
+
+/**
+ * @brief Calcola le normali dei corner dei vertici vertices(0), ...,
+ * vertices(count - 1) in parallelo, con i buffer di lavoro per thread
+ * corners e parent.
+ */
+template <
+    typename Geometry, typename Cosine, typename DerivedF,
+    typename DerivedO, typename DerivedVFc, typename DerivedFF, typename DerivedFFi,
+    typename Vertices, typename DerivedOut>
+void run(
+    typename DerivedVFc::Scalar count,
+    Vertices const &vertices,
+    Geometry const &g,
+    Cosine const &cosine,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    double angle,
+    std::vector<std::vector<typename DerivedVFc::Scalar>> &corners,
+    std::vector<std::vector<typename DerivedVFc::Scalar>> &parent,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename Geometry::Scalar Scalar;
+    typedef typename DerivedVFc::Scalar Int;
+
+    const Scalar cos_thr = Scalar(std::cos(angle * M_PI / 180.0));
+
+    parallel::parallel_for(count,
+        [&](int nthreads) {
+            corners.resize(std::max<std::size_t>(corners.size(), nthreads));
+            parent.resize(std::max<std::size_t>(parent.size(), nthreads));
+        },
+        [&](Int k, std::size_t t) {
+            sectors(Int(vertices(k)), g, cosine, F, VFoffsets, VFc, FF, FFi, cos_thr, corners[t], parent[t], N);
+        },
+        [&](std::size_t) {},
+        1 << 12);
+}
+
+/**
+ * @brief I coseni diedrali gia' calcolati (dihedralCosines()).
+ */
+template <typename DerivedC>
+struct Cosines
+{
+    MatrixBase<DerivedC> const &FF_cosines;
+
+    template <typename Int>
+    typename DerivedC::Scalar operator()(Int f, Int p, Int) const { return FF_cosines(f, p); }
+};
+
+/**
+ * @brief I coseni diedrali calcolati al momento dalle normali dei record,
+ * con la stessa espressione di dihedralCosines().
+ */
+template <typename DerivedR>
+struct RecordCosines
+{
+    MatrixBase<DerivedR> const &R;
+
+    template <typename Int>
+    typename DerivedR::Scalar operator()(Int f, Int, Int nf) const
+    {
+        return R.template block<1, 3>(f, 0).dot(R.template block<1, 3>(nf, 0));
+    }
+};
+
+/**
+ * @brief I coseni diedrali calcolati al momento dalle normali dei triangoli,
+ * con la stessa espressione di dihedralCosines().
+ */
+template <typename DerivedN>
+struct NormalCosines
+{
+    MatrixBase<DerivedN> const &FN;
+
+    template <typename Int>
+    typename DerivedN::Scalar operator()(Int f, Int, Int nf) const
+    {
+        return FN.row(f).dot(FN.row(nf));
+    }
+};
+
+/**
+ * @brief Calcola le normali di tutti i corner del vertice v percorrendone i
+ * ventagli nella corner table, senza buffer di lavoro.
+ *
+ * In un ventaglio i settori sono tratti consecutivi di corner, separati dai
+ * lati sharp (o dal bordo): ogni settore viene percorso due volte, per
+ * sommare i contributi e per scrivere la normale normalizzata. Un ventaglio
+ * chiuso viene percorso a partire dal corner che segue un lato sharp, per cui
+ * nessun settore e' spezzato; se non ce ne sono, il ventaglio e' un solo
+ * settore.
+ */
+template <typename Geometry, typename Cosine, typename Int, typename DerivedOut>
+void fans(
+    Int v,
+    Geometry const &g,
+    Cosine const &cosine,
+    CornerTableT<Int> const &table,
+    typename Geometry::Scalar cos_thr,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename Geometry::Scalar Scalar;
+    typedef CornerTableT<Int> Table;
+
+    // il lato fra c e swing(c) va da prev(c) a c nella faccia di c
+    auto smooth = [&](Int c, Int s) {
+        return cosine(Table::face(c), Table::prev(c) % 3, Table::face(s)) >= cos_thr;
+    };
+
+    table.for_each_fan(v, [&](Int start) {
+        Int first = start;
+        if (table.unswing(start) >= 0) {
+            Int c = start;
+            do {
+                Int s = table.swing(c);
+                if (!smooth(c, s)) {
+                    first = s;
+                    break;
+                }
+                c = s;
+            } while (c != start);
+        }
+
+        Int c = first;
+        do {
+            Int begin = c;
+            Int last = c;
+            Matrix<Scalar, 1, 3> n = Matrix<Scalar, 1, 3>::Zero();
+            for (;;) {
+                n += g.weight(Table::face(c), c % 3) * g.normal(Table::face(c));
+                last = c;
+                Int s = table.swing(c);
+                if (s < 0 || s == first || !smooth(c, s)) {
+                    c = s;
+                    break;
+                }
+                c = s;
+            }
+            n.normalize();
+            for (Int k = begin;; k = table.swing(k)) {
+                N.row(k) = n;
+                if (k == last) {
+                    break;
+                }
+            }
+        } while (c >= 0 && c != first);
+    });
+}
+
+/**
+ * @brief Calcola le normali dei corner dei vertici vertices(0), ...,
+ * vertices(count - 1) in parallelo, con la corner table.
+ */
+template <typename Geometry, typename Cosine, typename Int, typename Vertices, typename DerivedOut>
+void run(
+    Int count,
+    Vertices const &vertices,
+    Geometry const &g,
+    Cosine const &cosine,
+    CornerTableT<Int> const &table,
+    double angle,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename Geometry::Scalar Scalar;
+
+    const Scalar cos_thr = Scalar(std::cos(angle * M_PI / 180.0));
+
+    parallel::parallel_for(count, [&](Int k) {
+        fans(Int(vertices(k)), g, cosine, table, cos_thr, N);
+    }, 1 << 12);
+}
+
+/**
+ * @brief Calcola le normali ai corner di tutti i vertici in N (F.rows() * 3
+ * righe), con i coseni diedrali gia' calcolati.
+ */
+template <
+    typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedF,
+    typename DerivedO, typename DerivedVFc, typename DerivedFF, typename DerivedFFi, typename DerivedC,
+    typename DerivedOut>
+void all(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    MatrixBase<DerivedC> const &FF_cosines,
+    double angle,
+    std::vector<std::vector<typename DerivedVFc::Scalar>> &corners,
+    std::vector<std::vector<typename DerivedVFc::Scalar>> &parent,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename DerivedVFc::Scalar Int;
+
+    const Int nv = Int(VFoffsets.size()) - 1;
+    N.resize(FN.rows() * 3, 3);
+    WS_PROFILE_COUNT("normal_rows", FN.rows() * 3);
+
+    auto identity = [](Int v) { return v; };
+    run(nv, identity, triangle_geometry::arrays(FN, Fareas, Fangles), Cosines<DerivedC>{FF_cosines},
+        F, VFoffsets, VFc, FF, FFi, angle, corners, parent, N);
+}
+
+} // namespace corner_normals
+
+/**
+ * @brief Calcola la direzione normale di ogni corner di ogni triangolo, a
+ * partire dalla geometria dei triangoli e dalle adiacenze gia' calcolate
+ * (vedi perCornerNormals(V, F) per la descrizione del metodo).
+ *
+ * I settori vengono calcolati con una union-find sui corner: due corner dello
+ * stesso vertice sono nello stesso settore se le loro facce condividono un
+ * lato il cui angolo diedrale non supera la soglia. I settori non escono mai
+ * dal vertice, per cui ogni vertice e' elaborato in parallelo, in modo
+ * indipendente, sui propri corner (VFoffsets, VFc), in tre passi:
+ * 1. unione dei corner adiacenti attraverso i lati smooth; la radice di ogni
+ *    settore e' il suo corner di indice minore;
+ * 2. somma dei contributi del settore nella riga della radice, in ordine di
+ *    faccia crescente, e normalizzazione;
+ * 3. copia della normale della radice negli altri corner del settore.
+ * Il costo e' lineare nel numero di corner (a meno del fattore quasi costante
+ * della union-find) invece che quadratico nella valenza dei vertici, e il
+ * risultato non dipende dal numero di thread.
+ *
+ * @param FN Le normali unitarie dei triangoli, da triangleGeometry().
+ * @param Fareas Le aree dei triangoli, da triangleGeometry().
+ * @param Fangles Gli angoli ai corner dei triangoli, da triangleGeometry().
+ * @param F I triangoli della mesh.
+ * @param VFoffsets Gli offset dell'adiacenza vertice->facce in formato CSR.
+ * @param VFc I corner dell'adiacenza vertice->facce in formato CSR.
+ * @param FF L'adiacenza faccia->facce, da face_face_adjacency().
+ * @param FFi Gli indici dei lati adiacenti, da face_face_adjacency().
+ * @param FF_cosines I coseni degli angoli diedrali, da dihedralCosines().
+ * @param angle La soglia, in gradi, dell'angolo diedrale fra due facce dello
+ *              stesso settore.
+ * @return MatrixXd Le normali ai corner (F.rows() * 3 righe, 3 colonne).
+ */
+template <
+    typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedF,
+    typename DerivedO, typename DerivedVFc, typename DerivedFF, typename DerivedFFi, typename DerivedC>
+Matrix<typename DerivedN::Scalar, Dynamic, Dynamic> perCornerNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    MatrixBase<DerivedC> const &FF_cosines,
+    double angle = 30.0)
+{
+    typedef typename DerivedN::Scalar Scalar;
+    typedef typename DerivedVFc::Scalar Int;
+
+    WS_PROFILE_SCOPE("perCornerNormals/sectors");
+    WS_PROFILE_COUNT("allocated_bytes", FN.rows() * 9 * sizeof(Scalar));
+
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    std::vector<std::vector<Int>> corners, parent;
+    corner_normals::all(FN, Fareas, Fangles, F, VFoffsets, VFc, FF, FFi, FF_cosines, angle, corners, parent, N);
+    return N;
+}
+
+/**
+ * @brief Come perCornerNormals(FN, ..., FF_cosines, angle), ma scrive le
+ * normali in N e usa i buffer di lavoro per thread del workspace, senza
+ * allocare memoria se N e il workspace hanno gia' la dimensione giusta
+ * (vedi NormalsWorkspace).
+ */
+template <
+    typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedF,
+    typename DerivedO, typename DerivedVFc, typename DerivedFF, typename DerivedFFi, typename DerivedC,
+    typename DerivedOut>
+void perCornerNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    MatrixBase<DerivedC> const &FF_cosines,
+    double angle,
+    NormalsWorkspace<typename DerivedN::Scalar, typename DerivedVFc::Scalar> &workspace,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perCornerNormals/sectors");
+
+    corner_normals::all(FN, Fareas, Fangles, F, VFoffsets, VFc, FF, FFi, FF_cosines, angle,
+                        workspace.corners, workspace.parent, N);
+}
+
+/**
+ * @brief Calcola la direzione normale di ogni corner con il kernel fuso: una
+ * passata sulle facce produce i record interlacciati (faceRecords()), una sui
+ * vertici calcola i settori leggendo da una sola riga dei record per corner
+ * sia il contributo sia la normale con cui calcolare al momento il coseno
+ * diedrale, senza FN, Fareas, Fangles e FF_cosines separati. Il risultato e'
+ * identico a quello di perCornerNormals(FN, ..., FF_cosines, angle).
+ *
+ * Le adiacenze sono fornite dal chiamante, i record e i buffer per thread sono
+ * nel workspace e le normali in N: ripetendo il calcolo sulla stessa mesh (ad
+ * esempio dopo aver spostato i vertici) con lo stesso workspace e la stessa
+ * N non viene allocata memoria.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh.
+ * @param VFoffsets Gli offset dell'adiacenza vertice->facce in formato CSR.
+ * @param VFc I corner dell'adiacenza vertice->facce in formato CSR.
+ * @param FF L'adiacenza faccia->facce, da face_face_adjacency().
+ * @param FFi Gli indici dei lati adiacenti, da face_face_adjacency().
+ * @param angle La soglia, in gradi, dell'angolo diedrale fra due facce dello
+ *              stesso settore.
+ * @param workspace I buffer di lavoro.
+ * @param N Le normali ai corner (F.rows() * 3 x 3).
+ */
+template <
+    typename DerivedV, typename DerivedF, typename DerivedO, typename DerivedVFc,
+    typename DerivedFF, typename DerivedFFi, typename DerivedOut>
+void perCornerNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    double angle,
+    NormalsWorkspace<typename DerivedV::Scalar, typename DerivedVFc::Scalar> &workspace,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename DerivedVFc::Scalar Int;
+    typedef FaceRecords<typename DerivedV::Scalar> Records;
+
+    WS_PROFILE_SCOPE("perCornerNormals/fused");
+
+    faceRecords(V, F, workspace.records);
+
+    const Int nv = Int(VFoffsets.size()) - 1;
+    N.resize(F.rows() * 3, 3);
+    WS_PROFILE_COUNT("normal_rows", F.rows() * 3);
+
+    auto identity = [](Int v) { return v; };
+    corner_normals::run(nv, identity, triangle_geometry::records(workspace.records),
+                        corner_normals::RecordCosines<Records>{workspace.records},
+                        F, VFoffsets, VFc, FF, FFi, angle, workspace.corners, workspace.parent, N);
+}
+
+/**
+ * @brief Calcola la direzione normale di ogni corner percorrendo i ventagli
+ * dei vertici nella corner table (vedi corner_normals::fans()), con i coseni
+ * diedrali calcolati al momento dalle normali dei triangoli.
+ *
+ * Rispetto a perCornerNormals(FN, ..., VFoffsets, VFc, FF, FFi, FF_cosines,
+ * angle), che cerca i corner adiacenti con una union-find su VFc, non servono
+ * ne' le adiacenze vertice->facce e faccia->facce ne' FF_cosines, ne' buffer
+ * di lavoro. I settori coincidono (sui lati manifold, vedi CornerTableT); le
+ * normali differiscono solo negli ultimi bit, per il diverso ordine delle
+ * somme.
+ *
+ * @param FN Le normali unitarie dei triangoli, da triangleGeometry().
+ * @param Fareas Le aree dei triangoli, da triangleGeometry().
+ * @param Fangles Gli angoli ai corner dei triangoli, da triangleGeometry().
+ * @param table La corner table della mesh.
+ * @param angle La soglia, in gradi, dell'angolo diedrale fra due facce dello
+ *              stesso settore.
+ * @param N Le normali ai corner (3 * FN.rows() x 3).
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename Int, typename DerivedOut>
+void perCornerNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    CornerTableT<Int> const &table,
+    double angle,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perCornerNormals/corner_table");
+
+    N.resize(FN.rows() * 3, 3);
+    WS_PROFILE_COUNT("normal_rows", FN.rows() * 3);
+
+    auto identity = [](Int v) { return v; };
+    corner_normals::run(table.vertices(), identity, triangle_geometry::arrays(FN, Fareas, Fangles),
+                        corner_normals::NormalCosines<DerivedN>{FN}, table, angle, N);
+}
+
+/**
+ * @brief Come perCornerNormals(V, F, VFoffsets, VFc, FF, FFi, angle,
+ * workspace, N), ma percorre i ventagli nella corner table: dal workspace
+ * servono solo i record delle facce.
+ */
+template <typename DerivedV, typename DerivedF, typename Int, typename DerivedOut>
+void perCornerNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    CornerTableT<Int> const &table,
+    double angle,
+    NormalsWorkspace<typename DerivedV::Scalar, Int> &workspace,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef FaceRecords<typename DerivedV::Scalar> Records;
+
+    WS_PROFILE_SCOPE("perCornerNormals/fused");
+
+    faceRecords(V, F, workspace.records);
+
+    N.resize(F.rows() * 3, 3);
+    WS_PROFILE_COUNT("normal_rows", F.rows() * 3);
+
+    auto identity = [](Int v) { return v; };
+    corner_normals::run(table.vertices(), identity, triangle_geometry::records(workspace.records),
+                        corner_normals::RecordCosines<Records>{workspace.records}, table, angle, N);
+}
+
+/**
+ * @brief Aggiorna le normali dei corner dei soli vertici indicati, lasciando
+ * invariate le altre righe di N. Il risultato e' identico a quello del
+ * calcolo completo, purche' vertices contenga tutti i vertici delle facce la
+ * cui geometria e' cambiata.
+ *
+ * @param vertices Gli indici dei vertici da aggiornare, senza ripetizioni.
+ * @param N Le normali ai corner, gia' calcolate, da aggiornare.
+ */
+template <
+    typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedF,
+    typename DerivedO, typename DerivedVFc, typename DerivedFF, typename DerivedFFi, typename DerivedC,
+    typename DerivedI, typename DerivedOut>
+void perCornerNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedVFc> const &VFc,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedFFi> const &FFi,
+    MatrixBase<DerivedC> const &FF_cosines,
+    double angle,
+    MatrixBase<DerivedI> const &vertices,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename DerivedVFc::Scalar Int;
+
+    WS_PROFILE_SCOPE("perCornerNormals/update");
+
+    std::vector<std::vector<Int>> corners, parent;
+    corner_normals::run(Int(vertices.size()), vertices, triangle_geometry::arrays(FN, Fareas, Fangles),
+                        corner_normals::Cosines<DerivedC>{FF_cosines},
+                        F, VFoffsets, VFc, FF, FFi, angle, corners, parent, N);
+}
+
+/**
+ * @brief Come perCornerNormals(FN, Fareas, Fangles, table, angle, N), ma
+ * aggiorna solo i corner dei vertici indicati. Il risultato e' identico a
+ * quello del calcolo completo, purche' vertices contenga tutti i vertici
+ * delle facce la cui geometria e' cambiata.
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename Int, typename DerivedI, typename DerivedOut>
+void perCornerNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    CornerTableT<Int> const &table,
+    double angle,
+    MatrixBase<DerivedI> const &vertices,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perCornerNormals/update");
+
+    corner_normals::run(Int(vertices.size()), vertices, triangle_geometry::arrays(FN, Fareas, Fangles),
+                        corner_normals::NormalCosines<DerivedN>{FN}, table, angle, N);
+}
+
 /**
  * @brief Calcola la direzione normale di ogni corner di ogni triangolo nella
  * mesh in input.
@@ -34,6 +623,10 @@ using namespace Eigen;
  * - il seno e' proporzionale alla normal del prodotto vettoriale
  * - il cose e' proporzionale al prodotto scalare.
  *
+ * La topologia e' una corner table (CornerTableT) e i settori sono calcolati
+ * percorrendo i ventagli dei vertici (corner_normals::fans()), con il kernel
+ * fuso sui record delle facce.
+ *
  * @param V I vertici della mesh. Per ogni riga della matrice V, la posizione
  *          del vertice e' costituita dalle coordinate x,y,z memorizzate nelle
  *          3 colonne della riga.
@@ -43,111 +636,94 @@ using namespace Eigen;
  *          triangolo, memorizzati in V.row(i), V.row(j) e V.row(k),
  *          rispettivamente. NOTA: per ogni triangolo, i 3 vertici sono da
  *          considerarsi indicati in senso antiorario.
+ * @param angle La soglia, in gradi, dell'angolo diedrale fra due facce dello
+ *              stesso settore (30 gradi se non indicata).
  * @return MatrixXd La matrice restituita ha tre righe per ogni triangolo
  *                  (N.rows() == F.rows() * 3) e 3 colonne. Ogni riga corrisponde
  *                  alla direzione normale di un corner di un triangolo, avente
- *                  le 3 coordinate x,y,z.
+ *                  le 3 coordinate x,y,z. Il tipo dei valori e' quello di V
+ *                  (double o float), quello degli indici intermedi quello di
+ *                  F (int o std::int64_t).
  */
-MatrixXd perCornerNormals(MatrixXd const &V, MatrixXi const &F)
+template <typename DerivedV, typename DerivedF>
+Matrix<typename DerivedV::Scalar, Dynamic, Dynamic> perCornerNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    double angle = 30.0)
 {
-    MatrixXd N = MatrixXd::Zero(F.rows() * 3, 3);
-
-    // coseno di 30 gradi:
-    const double cos_thr = std::sqrt(3) / 2;
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
 
     // suggerimento: e' necessario trovare le facce adiacenti intorno ad un vertice
     // se non vuoi scrivere il codice che fa questo, puoi includere il file
     // #include "topology.hpp"
     // e chiamare le funzioni `vertex_face_adjacency()` e `face_face_adjacency()`
 
-    std::vector<std::vector<int>> VF, VFi;
-    MatrixXi FF, FFi;
-
-    vertex_face_adjacency(V, F, VF, VFi);
-    face_face_adjacency(V, F, VF, VFi, FF, FFi);
+    WS_PROFILE_SCOPE("perCornerNormals");
 
-    MatrixXd FN(F.rows(), 3);
-    VectorXd Fareas(F.rows());
-    MatrixXd Fangles(F.rows(), 3);
-
-    for (int f = 0; f < F.rows(); ++f)
-    {
-        int i = F(f, 0);
-        int j = F(f, 1);
-        int k = F(f, 2);
+    CornerTableT<Int> table;
+    table.build(V, F);
 
-        Vector3d A = V.row(i);
-        Vector3d B = V.row(j);
-        Vector3d C = V.row(k);
-
-        Vector3d e0 = B - A;
-        Vector3d e1 = C - B;
-        Vector3d e2 = A - C;
-
-        Vector3d c0 = e0.cross(-e2);
-        Vector3d c1 = e1.cross(-e0);
-        Vector3d c2 = e2.cross(-e1);
-
-        Fareas(f) = c0.norm() / 2.0;
-
-        FN.row(f) = c0.normalized();
-
-        Fangles(f, 0) = std::atan2(c0.norm(), e0.dot(-e2));
-        Fangles(f, 1) = std::atan2(c1.norm(), e1.dot(-e0));
-        Fangles(f, 2) = std::atan2(c2.norm(), e2.dot(-e1));
-    }
+    NormalsWorkspace<Scalar, Int> workspace;
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    perCornerNormals(V, F, table, angle, workspace, N);
+    return N;
+}
 
-    MatrixXd FF_cosines(F.rows(), 3);
-    for (int f = 0; f < F.rows(); ++f) {
-        auto const& fn = FN.row(f);
-        for (int p = 0; p < 3; ++p) {
-            auto const& ffn = FN.row(FF(f, p));
-            FF_cosines(f, p) = fn.dot(ffn);
-        }
-    }
+/**
+ * @brief Calcola la direzione normale di ogni corner di ogni triangolo della
+ * mesh, usando (e calcolando se necessario) i dati derivati memorizzati nel
+ * MeshContext: corner table e geometria dei triangoli. La soglia dei settori
+ * e' mesh.corner_angle().
+ *
+ * @param mesh La mesh, con i dati derivati.
+ * @return MatrixXd Le normali ai corner (F.rows() * 3 righe, 3 colonne).
+ */
+template <typename Scalar, typename Int>
+Matrix<Scalar, Dynamic, Dynamic> perCornerNormals(MeshContextT<Scalar, Int> &mesh)
+{
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    perCornerNormals(mesh, N);
+    return N;
+}
 
-    for (int f = 0; f < F.rows(); ++f) {
-        auto const& fn = FN.row(f);
-        for (int p = 0; p < 3; ++p) {
-            auto n = Fareas(f) * Fangles(f, p) * fn;
-
-            N.row(3 * f + p) += n;
-
-            // contribusci alle normali di tutte le facce adiacenti intorno
-            // al corner p, il cui angolo diedrale non supera la soglia
-            int nf = FF(f, (3 + p - 1) % 3);
-            if (nf >= 0) {
-                int nfi = FFi(f, (3 + p - 1) % 3);
-                // prima le facce in senso antiorario
-                do {
-                    if (FF_cosines(nf, nfi) >= cos_thr) {
-                        N.row(3 * nf + nfi) += n;
-                        int nnf = FF(nf, (3 + nfi - 1) % 3);
-                        nfi = FFi(nf, (3 + nfi - 1) % 3);
-                        nf = nnf;
-                    } else {
-                        break;
-                    }
-                } while (nf >= 0 && nf != f);
-
-                // poi le facce in senso orario, eventualmente
-                if (nf != f) {
-                    nf = f;
-                    nfi = p;
-                    while (nf >= 0 && FF_cosines(nf, nfi) >= cos_thr) {
-                        int nnf = FF(nf, nfi);
-                        nfi = (FFi(nf, nfi) + 1) % 3;
-                        nf = nnf;
-                        N.row(3 * nf + nfi) += n;
-                    }
-                }
-            }
-        }
-    }
+/**
+ * @brief Come perCornerNormals(mesh), ma scrive le normali in N, riutilizzando
+ * la memoria di N se ha gia' la dimensione giusta (vedi
+ * MeshContextT::normals()).
+ */
+template <typename Scalar, typename Int>
+void perCornerNormals(MeshContextT<Scalar, Int> &mesh, Matrix<Scalar, Dynamic, Dynamic> &N)
+{
+    perCornerNormals(mesh.FN(), mesh.Fareas(), mesh.Fangles(), mesh.corner_table(), mesh.corner_angle(), N);
+}
 
-    for (int n = 0; n < N.rows(); ++n) {
-        N.row(n).normalize();
-    }
+/**
+ * @brief Come perCornerNormals(mesh), ma scrive le normali quantizzate in
+ * coordinate ottaedriche in NQ (vedi octEncode()): 12 byte per triangolo con
+ * OctNormals16 invece di 72 in double. Le normali in precisione piena sono
+ * solo temporanee.
+ */
+template <typename Scalar, typename Int, typename Q>
+void perCornerNormals(MeshContextT<Scalar, Int> &mesh, OctNormals<Q> &NQ)
+{
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    perCornerNormals(mesh, N);
+    octEncode(N, NQ);
+}
 
-    return N;
-}
\ No newline at end of file
+/**
+ * @brief Aggiorna le normali ai corner N della mesh dopo
+ * MeshContextT::update_vertices(): ricalcola solo i corner dei vertici delle
+ * facce modificate (mesh.dirty_vertices()), gli unici i cui settori o
+ * contributi possono essere cambiati.
+ *
+ * @param mesh La mesh, con i dati derivati.
+ * @param N Le normali ai corner calcolate prima dello spostamento.
+ */
+template <typename Scalar, typename Int>
+void updateCornerNormals(MeshContextT<Scalar, Int> &mesh, Matrix<Scalar, Dynamic, Dynamic> &N)
+{
+    perCornerNormals(mesh.FN(), mesh.Fareas(), mesh.Fangles(), mesh.corner_table(), mesh.corner_angle(),
+                     mesh.dirty_vertices(), N);
+}
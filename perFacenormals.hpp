@@ -3,6 +3,12 @@
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
+#include "meshContext.hpp"
+#include "octNormals.hpp"
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+#include "triangleGeometry.hpp"
+
 using namespace Eigen;
 
 /**
@@ -25,6 +31,9 @@ using namespace Eigen;
  *     /          \                     ||(B - A) ^ (C - A)||
  *  A *------------* B
  *
+ * Il calcolo usa il kernel vettoriale triangleGeometry(), che elabora piu'
+ * triangoli per iterazione con istruzioni SIMD e in parallelo.
+ *
  * @param V I vertici della mesh. Per ogni riga della matrice V, la posizione
  *          del vertice e' costituita dalle coordinate x,y,z memorizzate nelle
  *          3 colonne della riga.
@@ -37,11 +46,18 @@ using namespace Eigen;
  * @return MatrixXd La matrice restituita ha una riga per ogni faccia triangolare
  *                  (N.rows() == F.rows()) e 3 colonne. Ogni riga corrisponde
  *                  alla direzione normale del triangolo corrispondente, avente
- *                  le 3 coordinate x,y,z.
+ *                  le 3 coordinate x,y,z. Il tipo dei valori e' quello di V
+ *                  (double o float).
  */
-MatrixXd perFaceNormals(MatrixXd const &V, MatrixXi const &F)
+template <typename DerivedV, typename DerivedF>
+Matrix<typename DerivedV::Scalar, Dynamic, Dynamic> perFaceNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F)
 {
-    MatrixXd N(F.rows(), 3);
+    WS_PROFILE_SCOPE("perFaceNormals");
+    WS_PROFILE_COUNT("allocated_bytes", F.rows() * 3 * sizeof(typename DerivedV::Scalar));
+
+    Matrix<typename DerivedV::Scalar, Dynamic, Dynamic> N(F.rows(), 3);
 
     // per leggere/scrivere un elemento di una matrice X: X(i,j)
     // per leggere/scrivere una riga di una matrice X: X.row(i) (un vettore orizzontale)
@@ -50,15 +66,79 @@ MatrixXd perFaceNormals(MatrixXd const &V, MatrixXi const &F)
     // normalizzare un vettore, in-place: c.normalize();
     // normalizzare un vettore, in una nuova variabile: Vector3d cn = c.normalized();
 
-    for (int f = 0; f < F.rows(); ++f)
-    {
-        Vector3d A = V.row(F(f, 0));
-        Vector3d B = V.row(F(f, 1));
-        Vector3d C = V.row(F(f, 2));
-        Vector3d e0 = B - A;
-        Vector3d e1 = C - A;
-        N.row(f) = e0.cross(e1).normalized();
-    }
+    triangleGeometry(V, F, N);
 
     return N;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Come perFaceNormals(V, F), ma scrive le normali in N, riutilizzandone
+ * la memoria se ha gia' la dimensione giusta.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedN>
+void perFaceNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedN> &N)
+{
+    WS_PROFILE_SCOPE("perFaceNormals");
+    triangleGeometry(V, F, N);
+}
+
+/**
+ * @brief Calcola la direzione normale di ogni triangolo della mesh, usando (e
+ * calcolando se necessario) la geometria dei triangoli memorizzata nel
+ * MeshContext.
+ *
+ * @param mesh La mesh, con i dati derivati.
+ * @return MatrixXd Le normali ai triangoli (F.rows() righe, 3 colonne).
+ */
+template <typename Scalar, typename Int>
+Matrix<Scalar, Dynamic, Dynamic> perFaceNormals(MeshContextT<Scalar, Int> &mesh)
+{
+    WS_PROFILE_SCOPE("perFaceNormals");
+    return mesh.FN();
+}
+
+/**
+ * @brief Come perFaceNormals(mesh), ma copia le normali in N, riutilizzandone
+ * la memoria se ha gia' la dimensione giusta (vedi MeshContextT::normals()).
+ */
+template <typename Scalar, typename Int>
+void perFaceNormals(MeshContextT<Scalar, Int> &mesh, Matrix<Scalar, Dynamic, Dynamic> &N)
+{
+    WS_PROFILE_SCOPE("perFaceNormals");
+    N = mesh.FN();
+}
+
+/**
+ * @brief Come perFaceNormals(mesh), ma scrive le normali quantizzate in
+ * coordinate ottaedriche in NQ (vedi octEncode()), senza copiarle in
+ * precisione piena.
+ */
+template <typename Scalar, typename Int, typename Q>
+void perFaceNormals(MeshContextT<Scalar, Int> &mesh, OctNormals<Q> &NQ)
+{
+    WS_PROFILE_SCOPE("perFaceNormals");
+    octEncode(mesh.FN(), NQ);
+}
+
+/**
+ * @brief Aggiorna le normali alle facce N della mesh dopo
+ * MeshContextT::update_vertices(): copia solo quelle delle facce modificate
+ * (mesh.dirty_faces()), gia' aggiornate nel MeshContext.
+ *
+ * @param mesh La mesh, con i dati derivati.
+ * @param N Le normali alle facce calcolate prima dello spostamento.
+ */
+template <typename Scalar, typename Int>
+void updateFaceNormals(MeshContextT<Scalar, Int> &mesh, Matrix<Scalar, Dynamic, Dynamic> &N)
+{
+    WS_PROFILE_SCOPE("updateFaceNormals");
+
+    auto const &FN = mesh.FN();
+    auto const &faces = mesh.dirty_faces();
+    parallel::parallel_for(Int(faces.size()), [&](Int k) {
+        N.row(faces(k)) = FN.row(faces(k));
+    }, 1 << 14);
+}
@@ -3,8 +3,267 @@
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
+#include "cornerTable.hpp"
+#include "meshContext.hpp"
+#include "octNormals.hpp"
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+#include "topology.hpp"
+#include "triangleGeometry.hpp"
+
 using namespace Eigen;
 
+namespace vertex_normals {
+
+/**
+ * @brief Calcola la normale del vertice v sommando, in ordine di faccia
+ * crescente, i contributi dei suoi corner, e la scrive in N.row(v). La
+ * geometria dei triangoli e' letta tramite g (triangle_geometry::Arrays o
+ * triangle_geometry::Records).
+ */
+template <typename Geometry, typename DerivedO, typename DerivedC, typename DerivedOut>
+void gather(
+    typename DerivedC::Scalar v,
+    Geometry const &g,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename Geometry::Scalar Scalar;
+    typedef typename DerivedC::Scalar Int;
+
+    Matrix<Scalar, 3, 1> n = Matrix<Scalar, 3, 1>::Zero();
+    for (Int k = VFoffsets(v); k < VFoffsets(v + 1); ++k) {
+        Int f = VFc(k) / 3;
+        Int p = VFc(k) % 3;
+        n += g.weight(f, p) * g.normal(f).transpose();
+    }
+    N.row(v) = n.normalized();
+}
+
+/**
+ * @brief Calcola le normali di tutti i vertici in N, in parallelo.
+ */
+template <typename Geometry, typename DerivedO, typename DerivedC, typename DerivedOut>
+void run(
+    Geometry const &g,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename DerivedC::Scalar Int;
+
+    const Int nv = Int(VFoffsets.size()) - 1;
+    N.resize(nv, 3);
+    WS_PROFILE_COUNT("normal_rows", nv);
+
+    parallel::parallel_for(nv, [&](Int v) {
+        gather(v, g, VFoffsets, VFc, N);
+    }, 1 << 14);
+}
+
+/**
+ * @brief Calcola la normale del vertice v sommando i contributi dei suoi
+ * corner nell'ordine del ventaglio (CornerTableT::one_ring()), e la scrive in
+ * N.row(v).
+ */
+template <typename Geometry, typename Int, typename DerivedOut>
+void gather(Int v, Geometry const &g, CornerTableT<Int> const &table, PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename Geometry::Scalar Scalar;
+
+    Matrix<Scalar, 3, 1> n = Matrix<Scalar, 3, 1>::Zero();
+    for (Int c : table.one_ring(v)) {
+        n += g.weight(c / 3, c % 3) * g.normal(c / 3).transpose();
+    }
+    N.row(v) = n.normalized();
+}
+
+/**
+ * @brief Calcola le normali di tutti i vertici in N, in parallelo, con la
+ * corner table.
+ */
+template <typename Geometry, typename Int, typename DerivedOut>
+void run(Geometry const &g, CornerTableT<Int> const &table, PlainObjectBase<DerivedOut> &N)
+{
+    const Int nv = table.vertices();
+    N.resize(nv, 3);
+    WS_PROFILE_COUNT("normal_rows", nv);
+
+    parallel::parallel_for(nv, [&](Int v) {
+        gather(v, g, table, N);
+    }, 1 << 14);
+}
+
+} // namespace vertex_normals
+
+/**
+ * @brief Calcola la direzione normale di ogni vertice, a partire dalla
+ * geometria dei triangoli e dall'adiacenza vertice->facce gia' calcolate (vedi
+ * perVertexNormals(V, F) per la descrizione del metodo).
+ *
+ * @param FN Le normali unitarie dei triangoli, da triangleGeometry().
+ * @param Fareas Le aree dei triangoli, da triangleGeometry().
+ * @param Fangles Gli angoli ai corner dei triangoli, da triangleGeometry().
+ * @param VFoffsets Gli offset dell'adiacenza vertice->facce in formato CSR.
+ * @param VFc I corner dell'adiacenza vertice->facce in formato CSR.
+ * @return MatrixXd Le normali ai vertici (VFoffsets.size() - 1 righe, 3 colonne).
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedO, typename DerivedC>
+Matrix<typename DerivedN::Scalar, Dynamic, Dynamic> perVertexNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc)
+{
+    typedef typename DerivedN::Scalar Scalar;
+
+    WS_PROFILE_SCOPE("perVertexNormals/gather");
+    WS_PROFILE_COUNT("allocated_bytes", (VFoffsets.size() - 1) * 3 * sizeof(Scalar));
+
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    vertex_normals::run(triangle_geometry::arrays(FN, Fareas, Fangles), VFoffsets, VFc, N);
+    return N;
+}
+
+/**
+ * @brief Come perVertexNormals(FN, Fareas, Fangles, VFoffsets, VFc), ma
+ * scrive le normali in N, riutilizzandone la memoria se ha gia' la dimensione
+ * giusta.
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedO, typename DerivedC, typename DerivedOut>
+void perVertexNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perVertexNormals/gather");
+    vertex_normals::run(triangle_geometry::arrays(FN, Fareas, Fangles), VFoffsets, VFc, N);
+}
+
+/**
+ * @brief Calcola la direzione normale di ogni vertice con il kernel fuso:
+ * una passata sulle facce produce i record interlacciati (faceRecords()),
+ * una sui vertici raccoglie i contributi dei corner, ognuno letto da una sola
+ * riga dei record. Il risultato e' identico a quello di perVertexNormals(V, F).
+ *
+ * L'adiacenza vertice->facce e' fornita dal chiamante, i record sono scritti
+ * nel workspace e le normali in N: ripetendo il calcolo sulla stessa mesh (ad
+ * esempio dopo aver spostato i vertici) con lo stesso workspace e la stessa
+ * N non viene allocata memoria.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh.
+ * @param VFoffsets Gli offset dell'adiacenza vertice->facce in formato CSR.
+ * @param VFc I corner dell'adiacenza vertice->facce in formato CSR.
+ * @param workspace I buffer di lavoro.
+ * @param N Le normali ai vertici (V.rows() x 3).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedO, typename DerivedC, typename DerivedOut>
+void perVertexNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc,
+    NormalsWorkspace<typename DerivedV::Scalar, typename DerivedC::Scalar> &workspace,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perVertexNormals/fused");
+
+    faceRecords(V, F, workspace.records);
+    vertex_normals::run(triangle_geometry::records(workspace.records), VFoffsets, VFc, N);
+}
+
+/**
+ * @brief Come perVertexNormals(FN, Fareas, Fangles, VFoffsets, VFc, N), ma
+ * raccoglie i contributi di ogni vertice percorrendone il ventaglio nella
+ * corner table invece dell'adiacenza vertice->facce. Il risultato differisce
+ * solo negli ultimi bit, per il diverso ordine delle somme.
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename Int, typename DerivedOut>
+void perVertexNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    CornerTableT<Int> const &table,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perVertexNormals/corner_table");
+    vertex_normals::run(triangle_geometry::arrays(FN, Fareas, Fangles), table, N);
+}
+
+/**
+ * @brief Come perVertexNormals(V, F, VFoffsets, VFc, workspace, N), con la
+ * corner table al posto dell'adiacenza vertice->facce.
+ */
+template <typename DerivedV, typename DerivedF, typename Int, typename DerivedOut>
+void perVertexNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    CornerTableT<Int> const &table,
+    NormalsWorkspace<typename DerivedV::Scalar, Int> &workspace,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perVertexNormals/fused");
+
+    faceRecords(V, F, workspace.records);
+    vertex_normals::run(triangle_geometry::records(workspace.records), table, N);
+}
+
+/**
+ * @brief Aggiorna le normali dei soli vertici indicati, lasciando invariate
+ * le altre righe di N. Il risultato e' identico a quello del calcolo completo.
+ *
+ * @param vertices Gli indici dei vertici da aggiornare, senza ripetizioni.
+ * @param N Le normali ai vertici, gia' calcolate, da aggiornare.
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename DerivedO, typename DerivedC, typename DerivedI, typename DerivedOut>
+void perVertexNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc,
+    MatrixBase<DerivedI> const &vertices,
+    PlainObjectBase<DerivedOut> &N)
+{
+    typedef typename DerivedC::Scalar Int;
+
+    WS_PROFILE_SCOPE("perVertexNormals/update");
+    WS_PROFILE_COUNT("normal_rows", vertices.size());
+
+    auto g = triangle_geometry::arrays(FN, Fareas, Fangles);
+    parallel::parallel_for(Int(vertices.size()), [&](Int k) {
+        vertex_normals::gather(Int(vertices(k)), g, VFoffsets, VFc, N);
+    }, 1 << 14);
+}
+
+/**
+ * @brief Come perVertexNormals(FN, Fareas, Fangles, VFoffsets, VFc, vertices,
+ * N), con la corner table. Il risultato e' identico a quello di
+ * perVertexNormals(FN, Fareas, Fangles, table, N).
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng, typename Int, typename DerivedI, typename DerivedOut>
+void perVertexNormals(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles,
+    CornerTableT<Int> const &table,
+    MatrixBase<DerivedI> const &vertices,
+    PlainObjectBase<DerivedOut> &N)
+{
+    WS_PROFILE_SCOPE("perVertexNormals/update");
+    WS_PROFILE_COUNT("normal_rows", vertices.size());
+
+    auto g = triangle_geometry::arrays(FN, Fareas, Fangles);
+    parallel::parallel_for(Int(vertices.size()), [&](Int k) {
+        vertex_normals::gather(Int(vertices(k)), g, table, N);
+    }, 1 << 14);
+}
 
 /**
  * @brief Calcola la direzione normale di ogni vertice nella mesh in input.
@@ -25,6 +284,18 @@ using namespace Eigen;
  * - il seno e' proporzionale alla normal del prodotto vettoriale
  * - il cose e' proporzionale al prodotto scalare.
  *
+ * Il calcolo e' parallelo e deterministico. Invece di distribuire (scatter) il
+ * contributo di ogni faccia sui suoi 3 vertici, cosa che richiederebbe
+ * scritture atomiche o accumulatori per thread, avviene in due fasi:
+ * 1. in parallelo sulle facce: normale, area e angoli di ogni triangolo, con
+ *    il kernel vettoriale triangleGeometry();
+ * 2. in parallelo sui vertici: ogni vertice raccoglie (gather) i contributi
+ *    dei propri corner, usando l'adiacenza vertice->facce in formato CSR, e
+ *    normalizza il risultato.
+ * Ogni vertice e' scritto da un solo thread e somma i contributi sempre nello
+ * stesso ordine (facce in ordine crescente, come nel ciclo seriale), per cui
+ * il risultato e' identico bit a bit a prescindere dal numero di thread.
+ *
  * @param V I vertici della mesh. Per ogni riga della matrice V, la posizione
  *          del vertice e' costituita dalle coordinate x,y,z memorizzate nelle
  *          3 colonne della riga.
@@ -37,11 +308,17 @@ using namespace Eigen;
  * @return MatrixXd La matrice restituita ha una riga per ogni vertice
  *                  (N.rows() == V.rows()) e 3 colonne. Ogni riga corrisponde
  *                  alla direzione normale del vertice corrispondente, avente
- *                  le 3 coordinate x,y,z.
+ *                  le 3 coordinate x,y,z. Il tipo dei valori e' quello di V
+ *                  (double o float), quello degli indici intermedi quello di
+ *                  F (int o std::int64_t).
  */
-MatrixXd perVertexNormals(MatrixXd const &V, MatrixXi const &F)
+template <typename DerivedV, typename DerivedF>
+Matrix<typename DerivedV::Scalar, Dynamic, Dynamic> perVertexNormals(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F)
 {
-    MatrixXd N = MatrixXd::Zero(V.rows(), 3);
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
 
     // per leggere/scrivere un elemento di una matrice X: X(i,j)
     // per leggere/scrivere una riga di una matrice X: X.row(i) (un vettore orizzontale)
@@ -53,40 +330,64 @@ MatrixXd perVertexNormals(MatrixXd const &V, MatrixXi const &F)
     // angolo tra due vettori normalizzati: std::acos(n1.dot(n2));
     // angolo tra due vettori non-normalizzati: std::atan2(v1.cross(v2).norm(), v1.dot(v2));
 
-    for (int f = 0; f < F.rows(); ++f)
-    {
-        int i = F(f, 0);
-        int j = F(f, 1);
-        int k = F(f, 2);
+    WS_PROFILE_SCOPE("perVertexNormals");
 
-        Vector3d A = V.row(i);
-        Vector3d B = V.row(j);
-        Vector3d C = V.row(k);
+    Matrix<Int, Dynamic, 1> VFoffsets, VFc;
+    vertex_face_adjacency(V, F, VFoffsets, VFc);
 
-        Vector3d e0 = B - A;
-        Vector3d e1 = C - B;
-        Vector3d e2 = A - C;
-
-        Vector3d c0 = e0.cross(-e2);
-        Vector3d c1 = e1.cross(-e0);
-        Vector3d c2 = e2.cross(-e1);
-
-        double area = c0.norm() / 2.0;
-
-        Vector3d n = c0.normalized();
+    NormalsWorkspace<Scalar, Int> workspace;
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    perVertexNormals(V, F, VFoffsets, VFc, workspace, N);
+    return N;
+}
 
-        double a_i = std::atan2(c0.norm(), e0.dot(-e2));
-        double a_j = std::atan2(c1.norm(), e1.dot(-e0));
-        double a_k = std::atan2(c2.norm(), e2.dot(-e1));
+/**
+ * @brief Calcola la direzione normale di ogni vertice della mesh, usando (e
+ * calcolando se necessario) i dati derivati memorizzati nel MeshContext:
+ * adiacenza vertice->facce e geometria dei triangoli.
+ *
+ * @param mesh La mesh, con i dati derivati.
+ * @return MatrixXd Le normali ai vertici (V.rows() righe, 3 colonne).
+ */
+template <typename Scalar, typename Int>
+Matrix<Scalar, Dynamic, Dynamic> perVertexNormals(MeshContextT<Scalar, Int> &mesh)
+{
+    return perVertexNormals(mesh.FN(), mesh.Fareas(), mesh.Fangles(), mesh.VFoffsets(), mesh.VFc());
+}
 
-        N.row(i) += area * a_i * n;
-        N.row(j) += area * a_j * n;
-        N.row(k) += area * a_k * n;
-    }
+/**
+ * @brief Come perVertexNormals(mesh), ma scrive le normali in N, riutilizzandone
+ * la memoria se ha gia' la dimensione giusta (vedi MeshContextT::normals()).
+ */
+template <typename Scalar, typename Int>
+void perVertexNormals(MeshContextT<Scalar, Int> &mesh, Matrix<Scalar, Dynamic, Dynamic> &N)
+{
+    perVertexNormals(mesh.FN(), mesh.Fareas(), mesh.Fangles(), mesh.VFoffsets(), mesh.VFc(), N);
+}
 
-    for (int v = 0; v < V.rows(); ++v) {
-        N.row(v).normalize();
-    }
+/**
+ * @brief Come perVertexNormals(mesh), ma scrive le normali quantizzate in
+ * coordinate ottaedriche in NQ (vedi octEncode()); le normali in precisione
+ * piena sono solo temporanee.
+ */
+template <typename Scalar, typename Int, typename Q>
+void perVertexNormals(MeshContextT<Scalar, Int> &mesh, OctNormals<Q> &NQ)
+{
+    Matrix<Scalar, Dynamic, Dynamic> N;
+    perVertexNormals(mesh, N);
+    octEncode(N, NQ);
+}
 
-    return N;
-}
\ No newline at end of file
+/**
+ * @brief Aggiorna le normali ai vertici N della mesh dopo
+ * MeshContextT::update_vertices(): ricalcola solo quelle dei vertici delle
+ * facce modificate (mesh.dirty_vertices()).
+ *
+ * @param mesh La mesh, con i dati derivati.
+ * @param N Le normali ai vertici calcolate prima dello spostamento.
+ */
+template <typename Scalar, typename Int>
+void updateVertexNormals(MeshContextT<Scalar, Int> &mesh, Matrix<Scalar, Dynamic, Dynamic> &N)
+{
+    perVertexNormals(mesh.FN(), mesh.Fareas(), mesh.Fangles(), mesh.VFoffsets(), mesh.VFc(), mesh.dirty_vertices(), N);
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+/**
+ * Strumentazione dei percorsi critici: intervalli di tempo (span) e contatori.
+ *
+ * Le macro sono l'unica interfaccia usata dai kernel:
+ * - WS_PROFILE_SCOPE("nome"): misura il tempo fino alla fine del blocco
+ *   corrente e lo registra come span del thread che lo esegue;
+ * - WS_PROFILE_COUNT("nome", n): somma n al contatore "nome" (facce, lati,
+ *   byte allocati, ...).
+ * Senza la definizione WS_GEO3D_PROFILE (opzione CMake omonima) le macro non
+ * generano codice. Con la strumentazione attiva il costo e' di due letture
+ * dell'orologio e di un lock non conteso per span, e di un'addizione atomica
+ * per contatore: gli span vanno quindi messi sulle fasi (un kernel, un blocco
+ * di un ciclo parallelo), non sui singoli elementi.
+ *
+ * I nomi devono essere stringhe letterali (ne viene memorizzato il puntatore).
+ * Gli span raccolti possono essere riassunti per nome (stats(), usato dalla
+ * finestra di statistiche del Viewer) o scritti in formato Chrome trace
+ * (write_chrome_trace()), da aprire con chrome://tracing o Perfetto.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace profiler {
+
+typedef std::chrono::steady_clock Clock;
+
+// span registrati al massimo; i successivi vengono solo contati
+const std::size_t max_events = std::size_t(1) << 20;
+
+struct Event
+{
+    char const *name;
+    std::int64_t start_ns;
+    std::int64_t duration_ns;
+    int thread;
+};
+
+// statistiche degli span con lo stesso nome
+struct Stat
+{
+    std::int64_t count = 0;
+    std::int64_t total_ns = 0;
+    std::int64_t last_ns = 0;
+    std::int64_t max_ns = 0;
+};
+
+/**
+ * @brief Il registro globale di span e contatori.
+ */
+class Registry
+{
+  public:
+    static Registry &instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    std::int64_t now_ns() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _origin).count();
+    }
+
+    /**
+     * @brief Indice del thread chiamante, assegnato al primo span. igl::parallel_for
+     * crea nuovi thread ad ogni chiamata, per cui gli indici crescono nel tempo.
+     */
+    int thread_index()
+    {
+        thread_local int index = _nextThread.fetch_add(1);
+        return index;
+    }
+
+    void record(char const *name, std::int64_t start_ns, std::int64_t duration_ns)
+    {
+        int thread = thread_index();
+        std::lock_guard<std::mutex> lock(_mutex);
+        Stat &s = _stats[name];
+        ++s.count;
+        s.total_ns += duration_ns;
+        s.last_ns = duration_ns;
+        s.max_ns = std::max(s.max_ns, duration_ns);
+        if (_events.size() < max_events) {
+            _events.push_back({name, start_ns, duration_ns, thread});
+        } else {
+            ++_dropped;
+        }
+    }
+
+    std::atomic<std::int64_t> &counter(char const *name)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::unique_ptr<std::atomic<std::int64_t>> &c = _counters[name];
+        if (!c) {
+            c.reset(new std::atomic<std::int64_t>(0));
+        }
+        return *c;
+    }
+
+    /**
+     * @brief Le statistiche per nome di span, in ordine alfabetico.
+     */
+    std::vector<std::pair<std::string, Stat>> stats()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<std::pair<std::string, Stat>> out(_stats.begin(), _stats.end());
+        std::sort(out.begin(), out.end(), [](std::pair<std::string, Stat> const &a, std::pair<std::string, Stat> const &b) {
+            return a.first < b.first;
+        });
+        return out;
+    }
+
+    /**
+     * @brief I valori correnti dei contatori, in ordine alfabetico.
+     */
+    std::vector<std::pair<std::string, std::int64_t>> counters()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::vector<std::pair<std::string, std::int64_t>> out;
+        for (auto const &c : _counters) {
+            out.emplace_back(c.first, c.second->load(std::memory_order_relaxed));
+        }
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    /**
+     * @brief Azzera span, statistiche e contatori.
+     */
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _events.clear();
+        _stats.clear();
+        _dropped = 0;
+        for (auto &c : _counters) {
+            c.second->store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Scrive gli span e i contatori in formato Chrome trace (JSON):
+     * uno span completo ("ph": "X") per ogni intervallo, con il thread che
+     * lo ha eseguito, e un evento contatore ("ph": "C") per ogni contatore.
+     *
+     * @return true se il file e' stato scritto.
+     */
+    bool write_chrome_trace(std::string const &filename)
+    {
+        std::ofstream out(filename);
+        if (!out) {
+            return false;
+        }
+        std::int64_t end_ns = now_ns();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        char buffer[64];
+        for (Event const &e : _events) {
+            // tempi in microsecondi, con i nanosecondi come decimali
+            std::snprintf(buffer, sizeof(buffer), "%.3f, \"dur\": %.3f", e.start_ns * 1e-3, e.duration_ns * 1e-3);
+            out << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                << e.thread << ", \"ts\": " << buffer << "}";
+            first = false;
+        }
+        for (auto const &c : _counters) {
+            out << (first ? "" : ",\n") << "{\"name\": \"" << c.first << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": "
+                << end_ns / 1000 << ", \"args\": {\"value\": " << c.second->load(std::memory_order_relaxed) << "}}";
+            first = false;
+        }
+        out << "\n], \"otherData\": {\"dropped_events\": " << _dropped << "}}\n";
+        return bool(out);
+    }
+
+  private:
+    Registry() : _origin(Clock::now()) {}
+
+    Clock::time_point _origin;
+    std::atomic<int> _nextThread{0};
+
+    std::mutex _mutex;
+    std::vector<Event> _events;
+    std::map<std::string, Stat> _stats;
+    std::map<std::string, std::unique_ptr<std::atomic<std::int64_t>>> _counters;
+    std::int64_t _dropped = 0;
+};
+
+/**
+ * @brief Misura il tempo fra la costruzione e la distruzione e lo registra
+ * come span.
+ */
+class ScopedTimer
+{
+  public:
+    explicit ScopedTimer(char const *name) : _name(name), _start(Registry::instance().now_ns()) {}
+
+    ~ScopedTimer()
+    {
+        Registry &r = Registry::instance();
+        r.record(_name, _start, r.now_ns() - _start);
+    }
+
+    ScopedTimer(ScopedTimer const &) = delete;
+    ScopedTimer &operator=(ScopedTimer const &) = delete;
+
+  private:
+    char const *_name;
+    std::int64_t _start;
+};
+
+} // namespace profiler
+
+#define WS_PROFILE_CONCAT_(a, b) a##b
+#define WS_PROFILE_CONCAT(a, b) WS_PROFILE_CONCAT_(a, b)
+
+#if defined(WS_GEO3D_PROFILE)
+#define WS_PROFILE_SCOPE(name) profiler::ScopedTimer WS_PROFILE_CONCAT(ws_profile_scope_, __LINE__)(name)
+#define WS_PROFILE_COUNT(name, n)                                                                              \
+    do {                                                                                                       \
+        static std::atomic<std::int64_t> &ws_profile_counter = profiler::Registry::instance().counter(name); \
+        ws_profile_counter.fetch_add(std::int64_t(n), std::memory_order_relaxed);                             \
+    } while (0)
+#else
+#define WS_PROFILE_SCOPE(name) \
+    do {                       \
+    } while (0)
+#define WS_PROFILE_COUNT(name, n) \
+    do {                          \
+    } while (0)
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+
+/**
+ * @brief Ordina in modo stabile un array di chiavi intere a 64 bit, portandosi
+ * dietro un array di valori associati (ordinamento radix LSD parallelo).
+ *
+ * Le chiavi sono ordinate 8 bit alla volta, a partire dai meno significativi.
+ * Ad ogni passata l'array viene diviso in blocchi, uno per thread: ogni blocco
+ * calcola l'istogramma delle proprie cifre, una somma prefissa (cifra per
+ * cifra, blocco per blocco) assegna ad ogni blocco la sua porzione di output e
+ * infine ogni blocco sposta i propri elementi. Le passate in cui tutte le
+ * chiavi hanno la stessa cifra vengono saltate.
+ *
+ * L'ordinamento e' stabile: a parita' di chiave, i valori mantengono l'ordine
+ * di partenza. Il costo e' O(n * key_bits / 8) e la memoria aggiuntiva e' una
+ * copia di keys e values.
+ *
+ * @param keys Le chiavi da ordinare. Solo i key_bits bit meno significativi
+ *             vengono considerati.
+ * @param values I valori associati alle chiavi: values[i] segue keys[i].
+ *               Deve avere la stessa dimensione di keys.
+ * @param key_bits Numero di bit significativi delle chiavi (al piu' 64).
+ */
+template <typename Value>
+void radix_sort(std::vector<std::uint64_t> &keys, std::vector<Value> &values, int key_bits = 64)
+{
+    const std::size_t n = keys.size();
+    if (n < 2) {
+        return;
+    }
+
+    WS_PROFILE_SCOPE("radix_sort");
+
+    // sotto questa soglia un solo blocco: i thread costano piu' del lavoro
+    const std::size_t min_parallel = 1 << 16;
+    const std::size_t hw = std::size_t(parallel::threads());
+    const std::size_t nblocks = n < min_parallel ? 1 : std::min(hw, n / (min_parallel / 4));
+    const std::size_t block = (n + nblocks - 1) / nblocks;
+
+    std::vector<std::uint64_t> keys_tmp(n);
+    std::vector<Value> values_tmp(n);
+    std::vector<std::array<std::size_t, 256>> hist(nblocks);
+
+    for (int shift = 0; shift < std::min(key_bits, 64); shift += 8) {
+        parallel::parallel_for(nblocks, [&](std::size_t b) {
+            hist[b].fill(0);
+            const std::size_t end = std::min(n, (b + 1) * block);
+            for (std::size_t i = b * block; i < end; ++i) {
+                ++hist[b][(keys[i] >> shift) & 0xFF];
+            }
+        });
+
+        // se tutte le chiavi hanno la stessa cifra la passata e' inutile
+        bool trivial = false;
+        for (int d = 0; d < 256 && !trivial; ++d) {
+            std::size_t count = 0;
+            for (std::size_t b = 0; b < nblocks; ++b) {
+                count += hist[b][d];
+            }
+            trivial = count == n;
+            if (count != 0) {
+                break;
+            }
+        }
+        if (trivial) {
+            continue;
+        }
+
+        // offset di partenza di ogni (cifra, blocco), in ordine stabile
+        std::size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            for (std::size_t b = 0; b < nblocks; ++b) {
+                std::size_t count = hist[b][d];
+                hist[b][d] = sum;
+                sum += count;
+            }
+        }
+
+        parallel::parallel_for(nblocks, [&](std::size_t b) {
+            std::array<std::size_t, 256> &offset = hist[b];
+            const std::size_t end = std::min(n, (b + 1) * block);
+            for (std::size_t i = b * block; i < end; ++i) {
+                std::size_t k = offset[(keys[i] >> shift) & 0xFF]++;
+                keys_tmp[k] = keys[i];
+                values_tmp[k] = values[i];
+            }
+        });
+
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
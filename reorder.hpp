@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "meshContext.hpp"
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+#include "radixSort.hpp"
+
+using namespace Eigen;
+
+namespace reorder {
+
+// bit per coordinata del codice di Morton (3 * 21 = 63 bit)
+const int morton_bits = 21;
+
+/**
+ * @brief Distribuisce i 21 bit meno significativi di x ogni 3 bit:
+ * il bit i finisce in posizione 3 * i.
+ */
+inline std::uint64_t spread_bits(std::uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffULL;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+    x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+    x = (x | (x << 2)) & 0x1249249249249249ULL;
+    return x;
+}
+
+/**
+ * @brief Codice di Morton (Z-order) di una cella della griglia 2^21 x 2^21 x
+ * 2^21: i bit delle tre coordinate intercalati.
+ */
+inline std::uint64_t morton3(std::uint64_t x, std::uint64_t y, std::uint64_t z)
+{
+    return spread_bits(x) | (spread_bits(y) << 1) | (spread_bits(z) << 2);
+}
+
+} // namespace reorder
+
+/**
+ * @brief Riordina vertici e facce della mesh per la localita' in cache.
+ *
+ * Le mesh acquisite (ad esempio da scanner) hanno vertici e facce in ordine
+ * arbitrario: ogni kernel che legge V.row(F(f, k)) o raccoglie i contributi
+ * delle facce intorno a un vertice accede alla memoria in modo casuale. Il
+ * riordino avviene in due passi, entrambi con radix_sort() parallelo:
+ * 1. i vertici vengono ordinati lungo una curva di Morton (Z-order): il
+ *    bounding box viene diviso in una griglia di 2^21 celle per asse e ogni
+ *    vertice riceve il codice di Morton della sua cella, per cui vertici
+ *    vicini nello spazio risultano per lo piu' vicini in memoria;
+ * 2. le facce vengono ordinate per il minore dei loro (nuovi) indici di
+ *    vertice, e a parita' per quello intermedio: facce consecutive
+ *    condividono vertici e leggono righe di V vicine, e i corner di ogni
+ *    vertice (adiacenza vertice->facce) risultano vicini in F.
+ * F viene rimappata sui nuovi indici; l'ordine dei vertici all'interno di
+ * ogni faccia (e quindi l'orientazione) non cambia. A parita' di chiave
+ * l'ordine originale e' mantenuto, per cui il risultato e' deterministico.
+ *
+ * Le permutazioni restituite permettono di riportare i risultati agli indici
+ * originali (vedi restoreRowOrder() e restoreCornerOrder()).
+ *
+ * @param V I vertici della mesh, riordinati in-place.
+ * @param F I triangoli della mesh, riordinati e rimappati in-place.
+ * @param VI Per ogni nuovo vertice i, l'indice originale VI(i).
+ * @param FI Per ogni nuova faccia f, l'indice originale FI(f).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedVI, typename DerivedFI>
+void reorderMesh(
+    PlainObjectBase<DerivedV> &V,
+    PlainObjectBase<DerivedF> &F,
+    PlainObjectBase<DerivedVI> &VI,
+    PlainObjectBase<DerivedFI> &FI)
+{
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
+
+    WS_PROFILE_SCOPE("reorderMesh");
+
+    const Int nv = Int(V.rows());
+    const Int nf = Int(F.rows());
+    const size_t min_parallel = 1 << 14;
+
+    VI.resize(nv, 1);
+    FI.resize(nf, 1);
+    if (nv == 0) {
+        return;
+    }
+
+    // 1. vertici lungo la curva di Morton
+    Matrix<Scalar, 1, Dynamic> lo = V.colwise().minCoeff();
+    Matrix<Scalar, 1, Dynamic> extent = V.colwise().maxCoeff() - lo;
+    const double cells = double((1 << reorder::morton_bits) - 1);
+    double scale[3];
+    for (int k = 0; k < 3; ++k) {
+        scale[k] = extent(k) > 0 ? cells / double(extent(k)) : 0.0;
+    }
+
+    std::vector<std::uint64_t> keys(nv);
+    std::vector<Int> order(nv);
+    parallel::parallel_for(nv, [&](Int v) {
+        std::uint64_t c[3];
+        for (int k = 0; k < 3; ++k) {
+            c[k] = std::uint64_t(std::min(cells, std::max(0.0, double(V(v, k) - lo(k)) * scale[k])));
+        }
+        keys[v] = reorder::morton3(c[0], c[1], c[2]);
+        order[v] = v;
+    }, min_parallel);
+
+    radix_sort(keys, order, 3 * reorder::morton_bits);
+
+    std::vector<Int> newIndex(nv);
+    Matrix<Scalar, Dynamic, Dynamic> Vsorted(nv, V.cols());
+    parallel::parallel_for(nv, [&](Int i) {
+        VI(i) = order[i];
+        newIndex[order[i]] = i;
+        Vsorted.row(i) = V.row(order[i]);
+    }, min_parallel);
+    V = Vsorted;
+
+    // 2. facce per (minimo, intermedio) dei nuovi indici di vertice
+    int bits = 1;
+    while (bits < 32 && (std::int64_t(1) << bits) < nv) {
+        ++bits;
+    }
+
+    Matrix<Int, Dynamic, Dynamic> Fremapped(nf, F.cols());
+    keys.resize(nf);
+    order.resize(nf);
+    parallel::parallel_for(nf, [&](Int f) {
+        Int a = newIndex[F(f, 0)];
+        Int b = newIndex[F(f, 1)];
+        Int c = newIndex[F(f, 2)];
+        Fremapped(f, 0) = a;
+        Fremapped(f, 1) = b;
+        Fremapped(f, 2) = c;
+        std::uint64_t first = std::uint64_t(std::min(a, std::min(b, c)));
+        std::uint64_t mid = std::uint64_t(std::max(std::min(a, b), std::min(std::max(a, b), c)));
+        keys[f] = (first << bits) | mid;
+        order[f] = f;
+    }, min_parallel);
+
+    radix_sort(keys, order, 2 * bits);
+
+    parallel::parallel_for(nf, [&](Int f) {
+        FI(f) = order[f];
+        F.row(f) = Fremapped.row(order[f]);
+    }, min_parallel);
+}
+
+/**
+ * @brief Riordina la mesh di un MeshContext per la localita' in cache (vedi
+ * reorderMesh(V, F, VI, FI)) e invalida i dati derivati.
+ *
+ * @param mesh La mesh, riordinata in-place.
+ * @param VI Per ogni nuovo vertice i, l'indice originale VI(i).
+ * @param FI Per ogni nuova faccia f, l'indice originale FI(f).
+ */
+template <typename Scalar, typename Int>
+void reorderMesh(
+    MeshContextT<Scalar, Int> &mesh,
+    typename MeshContextT<Scalar, Int>::VectorI &VI,
+    typename MeshContextT<Scalar, Int>::VectorI &FI)
+{
+    typename MeshContextT<Scalar, Int>::MatrixS V = mesh.V();
+    typename MeshContextT<Scalar, Int>::MatrixI F = mesh.F();
+    reorderMesh(V, F, VI, FI);
+    mesh.set_mesh(V, F);
+}
+
+/**
+ * @brief Riporta all'ordine originale un risultato con una riga per vertice
+ * (con VI) o per faccia (con FI) calcolato sulla mesh riordinata.
+ *
+ * @param N Il risultato sulla mesh riordinata.
+ * @param I La permutazione restituita da reorderMesh(): VI o FI.
+ * @return La matrice con la riga I(i) uguale a N.row(i).
+ */
+template <typename DerivedN, typename DerivedI>
+Matrix<typename DerivedN::Scalar, Dynamic, Dynamic> restoreRowOrder(
+    MatrixBase<DerivedN> const &N,
+    MatrixBase<DerivedI> const &I)
+{
+    typedef typename DerivedI::Scalar Int;
+
+    Matrix<typename DerivedN::Scalar, Dynamic, Dynamic> out(N.rows(), N.cols());
+    parallel::parallel_for(Int(I.size()), [&](Int i) {
+        out.row(I(i)) = N.row(i);
+    }, 1 << 14);
+    return out;
+}
+
+/**
+ * @brief Riporta all'ordine originale un risultato con una riga per corner
+ * (ad esempio perCornerNormals()) calcolato sulla mesh riordinata: il corner
+ * p della faccia f corrisponde al corner p della faccia originale FI(f).
+ *
+ * @param N Il risultato sulla mesh riordinata (3 * F.rows() righe).
+ * @param FI La permutazione delle facce restituita da reorderMesh().
+ * @return La matrice con la riga 3 * FI(f) + p uguale a N.row(3 * f + p).
+ */
+template <typename DerivedN, typename DerivedI>
+Matrix<typename DerivedN::Scalar, Dynamic, Dynamic> restoreCornerOrder(
+    MatrixBase<DerivedN> const &N,
+    MatrixBase<DerivedI> const &FI)
+{
+    typedef typename DerivedI::Scalar Int;
+
+    Matrix<typename DerivedN::Scalar, Dynamic, Dynamic> out(N.rows(), N.cols());
+    parallel::parallel_for(Int(FI.size()), [&](Int f) {
+        for (Int p = 0; p < 3; ++p) {
+            out.row(3 * FI(f) + p) = N.row(3 * f + p);
+        }
+    }, 1 << 14);
+    return out;
+}
@@ -0,0 +1,676 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "cornerTable.hpp"
+#include "meshContext.hpp"
+#include "meshRepair.hpp"
+#include "parallelFor.hpp"
+#include "parallelGroup.hpp"
+#include "profiler.hpp"
+
+using namespace Eigen;
+
+namespace simplify {
+
+// peso dei piani perpendicolari ai lati di bordo, che tengono il bordo al
+// suo posto, rispetto a quello dei piani delle facce
+const double boundary_weight = 100.0;
+
+// coseno minimo fra la normale di una faccia prima e dopo un collasso: oltre
+// circa 78 gradi di rotazione (o un ribaltamento) il collasso viene scartato
+const double min_normal_cos = 0.2;
+
+// frazione dei lati, i meno costosi, fra cui vengono scelti i collassi di
+// un turno
+const double candidate_fraction = 0.25;
+
+// passate di selezione di un turno: le successive alla prima scelgono lati
+// lontani da quelli gia' scelti (come l'algoritmo di Luby per gli insiemi
+// indipendenti), aumentando i collassi per turno
+const int selection_passes = 3;
+
+const size_t min_parallel = 1 << 14;
+
+/**
+ * @brief Quadrica dell'errore (Garland-Heckbert): la somma dei quadrati delle
+ * distanze di un punto x da un insieme di piani, pesate, e'
+ * x^T A x + 2 b^T x + c con A simmetrica 3x3.
+ */
+struct Quadric
+{
+    // A (xx, xy, xz, yy, yz, zz), b (x, y, z) e c
+    double a[6];
+    double b[3];
+    double c;
+
+    Quadric()
+    {
+        std::fill(a, a + 6, 0.0);
+        std::fill(b, b + 3, 0.0);
+        c = 0.0;
+    }
+
+    /**
+     * @brief La quadrica del piano n.x + d == 0 (n unitaria), con peso w.
+     */
+    static Quadric plane(Vector3d const &n, double d, double w)
+    {
+        Quadric q;
+        q.a[0] = w * n(0) * n(0);
+        q.a[1] = w * n(0) * n(1);
+        q.a[2] = w * n(0) * n(2);
+        q.a[3] = w * n(1) * n(1);
+        q.a[4] = w * n(1) * n(2);
+        q.a[5] = w * n(2) * n(2);
+        q.b[0] = w * n(0) * d;
+        q.b[1] = w * n(1) * d;
+        q.b[2] = w * n(2) * d;
+        q.c = w * d * d;
+        return q;
+    }
+
+    Quadric &operator+=(Quadric const &o)
+    {
+        for (int k = 0; k < 6; ++k) {
+            a[k] += o.a[k];
+        }
+        for (int k = 0; k < 3; ++k) {
+            b[k] += o.b[k];
+        }
+        c += o.c;
+        return *this;
+    }
+
+    Quadric operator+(Quadric const &o) const
+    {
+        Quadric q = *this;
+        q += o;
+        return q;
+    }
+
+    double error(Vector3d const &x) const
+    {
+        return a[0] * x(0) * x(0) + a[3] * x(1) * x(1) + a[5] * x(2) * x(2) +
+               2.0 * (a[1] * x(0) * x(1) + a[2] * x(0) * x(2) + a[4] * x(1) * x(2)) +
+               2.0 * (b[0] * x(0) + b[1] * x(1) + b[2] * x(2)) + c;
+    }
+
+    /**
+     * @brief Il punto di errore minimo, se A e' ben condizionata (altrimenti
+     * il minimo non e' unico, ad esempio su una zona piana).
+     */
+    bool optimum(Vector3d &x) const
+    {
+        Matrix3d A;
+        A << a[0], a[1], a[2],
+             a[1], a[3], a[4],
+             a[2], a[4], a[5];
+        const double scale = A.trace();
+        const double det = A.determinant();
+        if (!(scale > 0.0) || !(std::abs(det) > 1e-9 * scale * scale * scale)) {
+            return false;
+        }
+        x = -A.inverse() * Vector3d(b[0], b[1], b[2]);
+        return x.allFinite();
+    }
+};
+
+/**
+ * @brief La mesh in semplificazione: posizioni in double, quadriche dei
+ * vertici e topologia del turno corrente.
+ */
+template <typename Int>
+struct State
+{
+    Matrix<double, Dynamic, 3, RowMajor> V;
+    Matrix<Int, Dynamic, 3, RowMajor> F;
+    std::vector<Quadric> Q;
+    // false per i vertici eliminati da un collasso
+    std::vector<char> alive;
+    CornerTableT<Int> table;
+
+    Int vertex(Int c) const { return F(c / 3, c % 3); }
+};
+
+// buffer di lavoro di un thread
+template <typename Int>
+struct Scratch
+{
+    std::vector<Int> ringA;
+    std::vector<Int> ringB;
+};
+
+/**
+ * @brief I vicini del vertice v (ordinati, senza ripetizioni) e se v e' di
+ * bordo. false se v ha piu' di un ventaglio (non-manifold): non viene
+ * collassato.
+ */
+template <typename Int>
+bool ring(State<Int> const &s, Int v, std::vector<Int> &neighbours, bool &boundary)
+{
+    typedef CornerTableT<Int> Table;
+    int fans = 0;
+    s.table.for_each_fan(v, [&](Int) { ++fans; });
+    if (fans != 1) {
+        return false;
+    }
+    neighbours.clear();
+    boundary = false;
+    for (Int k : s.table.one_ring(v)) {
+        neighbours.push_back(s.vertex(Table::next(k)));
+        neighbours.push_back(s.vertex(Table::prev(k)));
+        boundary = boundary || s.table.swing(k) < 0;
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    return true;
+}
+
+/**
+ * @brief La posizione x del vertice in cui collassa il lato da a a b: il
+ * minimo della somma delle loro quadriche o, se non e' unico o e' lontano dal
+ * lato, il migliore fra gli estremi e il punto medio.
+ *
+ * @return Il costo del collasso, l'errore della quadrica in x.
+ */
+template <typename Int>
+double placement(State<Int> const &s, Int a, Int b, Vector3d &x)
+{
+    const Quadric q = s.Q[a] + s.Q[b];
+    const Vector3d pa = s.V.row(a).transpose();
+    const Vector3d pb = s.V.row(b).transpose();
+    const Vector3d mid = 0.5 * (pa + pb);
+    if (!q.optimum(x) || (x - mid).norm() > (pa - pb).norm()) {
+        x = mid;
+        double e = q.error(mid);
+        if (q.error(pa) < e) {
+            x = pa;
+            e = q.error(pa);
+        }
+        if (q.error(pb) < e) {
+            x = pb;
+        }
+    }
+    return std::max(0.0, q.error(x));
+}
+
+/**
+ * @brief Se il collasso del lato opposto al corner c, dal vertice
+ * s.vertex(prev(c)) al vertice s.vertex(next(c)) spostato in x, e' ammesso.
+ *
+ * Il collasso non deve cambiare la topologia della mesh (condizione di link:
+ * i vertici comuni ai vicini dei due estremi sono solo quelli delle facce del
+ * lato; un lato interno non unisce due bordi; i vertici restano con almeno 3
+ * vicini, 2 sul bordo) ne' ruotare troppo nessuna faccia (vedi
+ * min_normal_cos).
+ */
+template <typename Int>
+bool admissible(State<Int> const &s, Int c, Vector3d const &x, Scratch<Int> &scratch)
+{
+    typedef CornerTableT<Int> Table;
+
+    const Int o = s.table.opposite(c);
+    const bool interior = o >= 0;
+    const Int a = s.vertex(Table::next(c));
+    const Int b = s.vertex(Table::prev(c));
+
+    bool boundaryA = false;
+    bool boundaryB = false;
+    if (!ring(s, a, scratch.ringA, boundaryA) || !ring(s, b, scratch.ringB, boundaryB)) {
+        return false;
+    }
+    if (interior && boundaryA && boundaryB) {
+        return false;
+    }
+    std::vector<Int> const &na = scratch.ringA;
+    std::vector<Int> const &nb = scratch.ringB;
+    std::size_t common = 0;
+    for (std::size_t i = 0, j = 0; i < na.size() && j < nb.size();) {
+        if (na[i] < nb[j]) {
+            ++i;
+        } else if (nb[j] < na[i]) {
+            ++j;
+        } else {
+            ++common;
+            ++i;
+            ++j;
+        }
+    }
+    if (common != (interior ? 2u : 1u)) {
+        return false;
+    }
+    const bool boundary = boundaryA || boundaryB;
+    if (na.size() + nb.size() - common - 2 < (boundary ? 2u : 3u)) {
+        return false;
+    }
+
+    // rotazione delle facce intorno ai due estremi, escluse quelle del lato
+    const Int f0 = Table::face(c);
+    const Int f1 = interior ? Table::face(o) : -1;
+    for (Int v : {a, b}) {
+        const Vector3d pv = s.V.row(v).transpose();
+        for (Int k : s.table.one_ring(v)) {
+            const Int f = Table::face(k);
+            if (f == f0 || f == f1) {
+                continue;
+            }
+            const Vector3d p = s.V.row(s.vertex(Table::next(k))).transpose();
+            const Vector3d r = s.V.row(s.vertex(Table::prev(k))).transpose();
+            const Vector3d n0 = (p - pv).cross(r - pv);
+            const Vector3d n1 = (p - x).cross(r - x);
+            if (!(n0.dot(n1) > min_normal_cos * n0.norm() * n1.norm())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Visita i vertici toccati dal collasso del lato opposto al corner c:
+ * i due estremi e i loro vicini (con ripetizioni).
+ */
+template <typename Int, typename Visit>
+void region(State<Int> const &s, Int c, Visit visit)
+{
+    typedef CornerTableT<Int> Table;
+    for (Int v : {s.vertex(Table::next(c)), s.vertex(Table::prev(c))}) {
+        for (Int k : s.table.one_ring(v)) {
+            visit(s.vertex(k));
+            visit(s.vertex(Table::next(k)));
+            visit(s.vertex(Table::prev(k)));
+        }
+    }
+}
+
+/**
+ * @brief Le quadriche iniziali dei vertici: i piani delle facce incidenti,
+ * pesati con l'area, e i piani perpendicolari ai lati di bordo incidenti.
+ */
+template <typename Int>
+void quadrics(State<Int> &s)
+{
+    typedef CornerTableT<Int> Table;
+
+    s.Q.assign(s.V.rows(), Quadric());
+    parallel::parallel_for(Int(s.V.rows()), [&](Int v) {
+        Quadric &q = s.Q[v];
+        for (Int k : s.table.one_ring(v)) {
+            const Vector3d p0 = s.V.row(v).transpose();
+            const Vector3d p1 = s.V.row(s.vertex(Table::next(k))).transpose();
+            const Vector3d p2 = s.V.row(s.vertex(Table::prev(k))).transpose();
+            Vector3d n = (p1 - p0).cross(p2 - p0);
+            const double area2 = n.norm();
+            if (!(area2 > 0.0)) {
+                continue;
+            }
+            n /= area2;
+            q += Quadric::plane(n, -n.dot(p0), 0.5 * area2);
+
+            // lati di bordo da v a p1 e da p2 a v
+            const Vector3d sides[2][2] = {{p0, p1}, {p2, p0}};
+            const Int opposite[2] = {s.table.opposite(Table::prev(k)), s.table.opposite(Table::next(k))};
+            for (int e = 0; e < 2; ++e) {
+                if (opposite[e] >= 0) {
+                    continue;
+                }
+                const Vector3d edge = sides[e][1] - sides[e][0];
+                Vector3d m = edge.cross(n);
+                const double length = m.norm();
+                if (!(length > 0.0)) {
+                    continue;
+                }
+                m /= length;
+                q += Quadric::plane(m, -m.dot(sides[e][0]), boundary_weight * edge.squaredNorm());
+            }
+        }
+    }, min_parallel);
+}
+
+/**
+ * @brief Un turno di collassi su regioni indipendenti.
+ *
+ * Ogni lato ha una chiave: il costo del collasso (placement(), come float, i
+ * cui bit sono ordinati come i valori non negativi) nei 32 bit alti e il
+ * corner nei 32 bassi, per cui le chiavi sono distinte. Partecipano al turno
+ * i lati ammessi (admissible(), il controllo piu' costoso, fatto solo su
+ * questi) fra quelli con chiave fino al quantile candidate_fraction (i meno
+ * costosi), o fra tutti se fra questi nessuno e' ammesso. Ognuno ha una
+ * priorita' pseudo-casuale ma deterministica (weld::mix() del corner):
+ * ordinarli per costo darebbe pochi minimi locali dove il costo varia poco
+ * (ad esempio su una superficie uniforme). Ogni vertice riceve la priorita'
+ * minima fra quelle dei lati la cui regione (region()) lo contiene, e un lato
+ * viene scelto se la sua priorita' e' la minima nei suoi due estremi; le
+ * passate successive (selection_passes) ripetono la scelta fra i lati con
+ * estremi fuori dalle regioni di quelli gia' scelti. Gli estremi di due lati
+ * scelti non sono quindi vicini: i collassi modificano facce diverse, non
+ * cambiano i vicini degli estremi dell'altro e possono essere applicati in
+ * parallelo senza lock. Se i collassi scelti toglierebbero troppe facce,
+ * vengono tenuti i meno costosi.
+ *
+ * @return Il numero di collassi.
+ */
+template <typename Int>
+Int collapse_round(State<Int> &s, Int targetFaces)
+{
+    typedef CornerTableT<Int> Table;
+
+    WS_PROFILE_SCOPE("simplifyMesh/round");
+
+    const Int nf = Int(s.F.rows());
+    const Int nc = 3 * nf;
+    const Int nv = Int(s.V.rows());
+    const std::uint64_t none = std::numeric_limits<std::uint64_t>::max();
+
+    s.table.build(s.V, s.F);
+
+    // 1. costo dei lati, ognuno una volta (dal corner minore se interno)
+    std::vector<std::uint64_t> key(nc, none);
+    parallel::parallel_for(nc, [&](Int c) {
+        const Int o = s.table.opposite(c);
+        if (o >= 0 && o < c) {
+            return;
+        }
+        Vector3d x;
+        const float cost = float(placement(s, s.vertex(Table::next(c)), s.vertex(Table::prev(c)), x));
+        if (std::isfinite(cost)) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &cost, sizeof(bits));
+            key[c] = (std::uint64_t(bits) << 32) | std::uint64_t(std::uint32_t(c));
+        }
+    }, min_parallel);
+
+    // 2. lati del turno: gli ammessi fra i candidate_fraction meno costosi
+    auto edge = [&](Int c) { return key[c] != none; };
+    std::vector<Int> position;
+    std::vector<std::uint64_t> sorted(weld::enumerate(nc, edge, position));
+    if (sorted.empty()) {
+        return 0;
+    }
+    parallel::parallel_for(nc, [&](Int c) {
+        if (edge(c)) {
+            sorted[position[c]] = key[c];
+        }
+    }, min_parallel);
+    auto nth = sorted.begin() + std::size_t(double(sorted.size() - 1) * candidate_fraction);
+    std::nth_element(sorted.begin(), nth, sorted.end());
+
+    std::vector<char> ok(nc, 0);
+    std::vector<Scratch<Int>> scratch;
+    const std::uint64_t threshold = *nth;
+    auto check = [&](bool above) {
+        std::atomic<Int> count(0);
+        parallel::parallel_for(nc, [&](std::size_t nt) {
+            scratch.resize(nt);
+        }, [&](Int c, std::size_t t) {
+            if (key[c] == none || (key[c] > threshold) != above) {
+                return;
+            }
+            Vector3d x;
+            placement(s, s.vertex(Table::next(c)), s.vertex(Table::prev(c)), x);
+            if (admissible(s, c, x, scratch[t])) {
+                ok[c] = 1;
+                count.fetch_add(1, std::memory_order_relaxed);
+            }
+        }, [](std::size_t) {}, min_parallel);
+        return count.load();
+    };
+    if (check(false) == 0 && check(true) == 0) {
+        return 0;
+    }
+    auto priority = [&](Int c) {
+        return ok[c] ? (weld::mix(std::uint64_t(c)) << 32) | std::uint64_t(std::uint32_t(c)) : none;
+    };
+
+    // 3. a ogni passata, lati di priorita' minima nei due estremi fra quelli
+    // con estremi fuori dalle regioni dei lati gia' scelti
+    std::vector<std::atomic<std::uint64_t>> best(nv);
+    std::vector<std::atomic<char>> blocked(nv);
+    parallel::parallel_for(nv, [&](Int v) {
+        blocked[v].store(0, std::memory_order_relaxed);
+    }, min_parallel);
+    std::vector<char> picked(nc, 0);
+    auto eligible = [&](Int c) {
+        return ok[c] && !blocked[s.vertex(Table::next(c))].load(std::memory_order_relaxed) &&
+               !blocked[s.vertex(Table::prev(c))].load(std::memory_order_relaxed);
+    };
+    for (int pass = 1; pass <= selection_passes; ++pass) {
+        parallel::parallel_for(nv, [&](Int v) {
+            best[v].store(none, std::memory_order_relaxed);
+        }, min_parallel);
+        parallel::parallel_for(nc, [&](Int c) {
+            if (eligible(c)) {
+                const std::uint64_t p = priority(c);
+                region(s, c, [&](Int v) { weld::atomic_min(best[v], p); });
+            }
+        }, min_parallel);
+        parallel::parallel_for(nc, [&](Int c) {
+            if (eligible(c)) {
+                const std::uint64_t p = priority(c);
+                if (best[s.vertex(Table::next(c))].load(std::memory_order_relaxed) == p &&
+                    best[s.vertex(Table::prev(c))].load(std::memory_order_relaxed) == p) {
+                    picked[c] = char(pass);
+                }
+            }
+        }, min_parallel);
+        parallel::parallel_for(nc, [&](Int c) {
+            if (picked[c] == pass) {
+                region(s, c, [&](Int v) { blocked[v].store(1, std::memory_order_relaxed); });
+            }
+        }, min_parallel);
+    }
+    std::vector<std::uint64_t> selected(weld::enumerate(nc, [&](Int c) { return picked[c] != 0; }, position));
+    parallel::parallel_for(nc, [&](Int c) {
+        if (picked[c]) {
+            selected[position[c]] = key[c];
+        }
+    }, min_parallel);
+
+    // un collasso toglie le facce del lato: 2, o 1 sul bordo
+    auto removed = [&](std::uint64_t k) { return s.table.opposite(Int(k & 0xFFFFFFFFu)) >= 0 ? 2 : 1; };
+    Int total = 0;
+    for (std::uint64_t k : selected) {
+        total += removed(k);
+    }
+    if (nf - total < targetFaces) {
+        std::sort(selected.begin(), selected.end());
+        Int count = 0;
+        total = 0;
+        while (count < Int(selected.size()) && nf - total > targetFaces) {
+            total += removed(selected[count++]);
+        }
+        selected.resize(count);
+    }
+
+    // 4. collassi: ogni faccia e vertice e' scritto da un solo collasso
+    std::vector<char> dead(nf, 0);
+    parallel::parallel_for(Int(selected.size()), [&](Int i) {
+        const Int c = Int(selected[i] & 0xFFFFFFFFu);
+        const Int o = s.table.opposite(c);
+        const Int a = s.vertex(Table::next(c));
+        const Int b = s.vertex(Table::prev(c));
+        Vector3d x;
+        placement(s, a, b, x);
+
+        const Int f0 = Table::face(c);
+        const Int f1 = o >= 0 ? Table::face(o) : -1;
+        for (Int k : s.table.one_ring(b)) {
+            const Int f = Table::face(k);
+            if (f != f0 && f != f1) {
+                s.F(f, k % 3) = a;
+            }
+        }
+        dead[f0] = 1;
+        if (f1 >= 0) {
+            dead[f1] = 1;
+        }
+        s.V.row(a) = x.transpose();
+        s.Q[a] += s.Q[b];
+        s.alive[b] = 0;
+    }, min_parallel / 16);
+
+    // 5. facce rimaste
+    const Int nkept = weld::enumerate(nf, [&](Int f) { return !dead[f]; }, position);
+    Matrix<Int, Dynamic, 3, RowMajor> F(nkept, 3);
+    parallel::parallel_for(nf, [&](Int f) {
+        if (!dead[f]) {
+            F.row(position[f]) = s.F.row(f);
+        }
+    }, min_parallel);
+    s.F.swap(F);
+
+    return Int(selected.size());
+}
+
+} // namespace simplify
+
+/**
+ * @brief Semplifica una mesh di triangoli fino a circa targetFaces facce,
+ * collassando lati secondo l'errore quadratico (Garland-Heckbert, quadric
+ * error metrics).
+ *
+ * Ogni vertice ha una quadrica che misura la distanza (al quadrato) dai
+ * piani delle facce originali che rappresenta, pesati con l'area, e dai
+ * piani perpendicolari ai lati di bordo, che tengono il bordo al suo posto.
+ * Il costo del collasso di un lato e' l'errore della somma delle quadriche
+ * dei due estremi nella posizione migliore del vertice risultante. Sono
+ * ammessi solo i collassi che non cambiano la topologia e non ribaltano le
+ * facce (vedi simplify::admissible()).
+ *
+ * Invece di una coda di priorita' sequenziale, i collassi avvengono a turni:
+ * ad ogni turno la corner table (CornerTableT) viene ricostruita, i costi
+ * di tutti i lati calcolati in parallelo e vengono collassati, in parallelo,
+ * lati scelti fra i meno costosi con gli estremi lontani fra loro, che sono
+ * quindi indipendenti (vedi simplify::collapse_round()). Ogni turno costa un
+ * tempo lineare nel numero di corner e toglie una frazione circa costante
+ * delle facce, per cui il totale e' circa lineare nella dimensione della
+ * mesh. L'ordine dei collassi differisce da quello della coda sequenziale, ma
+ * ogni turno collassa solo lati fra i meno costosi, con qualita' simile. Il
+ * risultato e' deterministico, qualunque sia il numero di thread.
+ *
+ * La topologia viene prima riparata con repairMesh(): i collassi richiedono
+ * lati e vertici manifold. La semplificazione si ferma prima di targetFaces
+ * se non restano collassi ammessi. Le chiavi dei lati usano 32 bit per il
+ * corner: la mesh deve avere meno di 2^32 corner.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh.
+ * @param targetFaces Il numero di facce desiderato.
+ * @param VO I vertici della mesh semplificata.
+ * @param FO I triangoli della mesh semplificata (al piu' targetFaces, se
+ *           raggiungibile).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedVO, typename DerivedFO>
+void simplifyMesh(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    Index targetFaces,
+    PlainObjectBase<DerivedVO> &VO,
+    PlainObjectBase<DerivedFO> &FO)
+{
+    typedef typename DerivedF::Scalar Int;
+
+    WS_PROFILE_SCOPE("simplifyMesh");
+
+    simplify::State<Int> s;
+    {
+        Matrix<typename DerivedV::Scalar, Dynamic, Dynamic> Vr;
+        Matrix<Int, Dynamic, Dynamic> Fr;
+        repairMesh(V, F, Vr, Fr);
+        s.V = Vr.template cast<double>();
+        s.F = Fr;
+    }
+    const Int nv = Int(s.V.rows());
+    s.alive.assign(nv, 1);
+    s.table.build(s.V, s.F);
+    simplify::quadrics(s);
+
+    const Int target = Int(std::max<Index>(0, targetFaces));
+    Int rounds = 0;
+    Int collapses = 0;
+    while (Int(s.F.rows()) > target) {
+        Int n = simplify::collapse_round(s, target);
+        if (n == 0) {
+            break;
+        }
+        collapses += n;
+        ++rounds;
+    }
+    WS_PROFILE_COUNT("simplify_rounds", rounds);
+    WS_PROFILE_COUNT("simplify_collapses", collapses);
+
+    // vertici rimasti, nell'ordine di partenza
+    std::vector<Int> position;
+    const Int nkept = weld::enumerate(nv, [&](Int v) { return s.alive[v] != 0; }, position);
+    VO.resize(nkept, 3);
+    parallel::parallel_for(nv, [&](Int v) {
+        if (s.alive[v]) {
+            VO.row(position[v]) = s.V.row(v).template cast<typename DerivedVO::Scalar>();
+        }
+    }, simplify::min_parallel);
+    FO.resize(s.F.rows(), 3);
+    parallel::parallel_for(Int(s.F.rows()), [&](Int f) {
+        for (int k = 0; k < 3; ++k) {
+            FO(f, k) = typename DerivedFO::Scalar(position[s.F(f, k)]);
+        }
+    }, simplify::min_parallel);
+}
+
+/**
+ * @brief Costruisce una catena di livelli di dettaglio (LOD) di una mesh,
+ * ognuno semplificato con simplifyMesh() dal precedente.
+ *
+ * levels[0] ha circa F.rows() / ratio facce, levels[k] circa
+ * levels[k - 1] / ratio, fino al primo livello con al piu' maxFaces facce
+ * (l'ultimo). Ogni livello e' un MeshContextT, per cui le sue normali si
+ * calcolano con le stesse funzioni della mesh completa (perVertexNormals(),
+ * perCornerNormals(), ...). Semplificare ogni livello dal precedente costa,
+ * in totale, circa quanto il primo livello.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh.
+ * @param maxFaces Il numero massimo di facce dell'ultimo livello.
+ * @param levels I livelli, dal piu' dettagliato; vuoto se F.rows() <= maxFaces.
+ * @param ratio Il rapporto fra le facce di due livelli successivi (> 1).
+ */
+template <typename DerivedV, typename DerivedF, typename Scalar, typename Int>
+void simplifyChain(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    Index maxFaces,
+    std::vector<MeshContextT<Scalar, Int>> &levels,
+    double ratio = 4.0)
+{
+    typedef MeshContextT<Scalar, Int> Mesh;
+
+    WS_PROFILE_SCOPE("simplifyChain");
+
+    levels.clear();
+    Index faces = F.rows();
+    typename Mesh::MatrixS VL;
+    typename Mesh::MatrixI FL;
+    while (faces > maxFaces) {
+        const Index target = std::max(maxFaces, Index(double(faces) / ratio));
+        if (levels.empty()) {
+            simplifyMesh(V, F.template cast<Int>(), target, VL, FL);
+        } else {
+            simplifyMesh(levels.back().V(), levels.back().F(), target, VL, FL);
+        }
+        if (FL.rows() >= faces) {
+            // nessun collasso ammesso
+            break;
+        }
+        faces = FL.rows();
+        levels.emplace_back(VL, FL);
+    }
+}
@@ -0,0 +1,907 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include <Eigen/Core>
+
+#include "load.hpp"
+#include "mappedFile.hpp"
+#include "meshCache.hpp"
+#include "meshContext.hpp"
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+#include "radixSort.hpp"
+#include "triangleGeometry.hpp"
+
+using namespace Eigen;
+
+/**
+ * Formato binario delle normali calcolate da streamNormals() (file
+ * "<nome>.wsnormals").
+ *
+ * Come la cache delle mesh (vedi meshCache.hpp): un'intestazione di
+ * dimensione fissa (normals_file::Header) seguita da una sezione per tipo di
+ * normali (NormalMode), allineata a 64 byte e memorizzata come una matrice
+ * Eigen column-major di double (prima tutte le x, poi le y, poi le z), per
+ * cui puo' essere letta senza copie dal file mappato in memoria (NormalsFile).
+ * Le sezioni assenti hanno dimensione 0.
+ */
+namespace normals_file {
+
+const char magic[8] = {'W', 'S', 'G', 'E', 'O', '3', 'D', 'N'};
+const std::uint32_t version = 1;
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+    std::uint64_t vertices;
+    std::uint64_t faces;
+    std::uint64_t offset[3];
+    std::uint64_t size[3];
+    std::uint64_t headerChecksum;
+};
+
+inline std::uint64_t header_checksum(Header const &h)
+{
+    return mesh_cache::checksum_block(reinterpret_cast<char const *>(&h), offsetof(Header, headerChecksum));
+}
+
+/**
+ * @brief Il numero di righe delle normali del tipo dato.
+ */
+inline std::uint64_t rows(Header const &h, NormalMode mode)
+{
+    return mode == NormalMode::Vertex ? h.vertices : mode == NormalMode::Face ? h.faces : 3 * h.faces;
+}
+
+/**
+ * @brief Prepara l'intestazione di un file con le sezioni indicate, allineate
+ * a mesh_cache::alignment byte; restituisce la dimensione del file.
+ */
+inline std::uint64_t layout(Header &h, std::uint64_t vertices, std::uint64_t faces, std::initializer_list<NormalMode> modes)
+{
+    std::memset(&h, 0, sizeof(Header));
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.headerSize = sizeof(Header);
+    h.vertices = vertices;
+    h.faces = faces;
+
+    const std::uint64_t a = mesh_cache::alignment;
+    std::uint64_t end = (sizeof(Header) + a - 1) / a * a;
+    for (NormalMode mode : modes) {
+        int m = int(mode);
+        h.offset[m] = end;
+        h.size[m] = rows(h, mode) * 3 * sizeof(double);
+        end = (end + h.size[m] + a - 1) / a * a;
+    }
+    h.headerChecksum = header_checksum(h);
+    return end;
+}
+
+/**
+ * @brief Posiziona il file al byte offset (anche oltre i 2GB).
+ */
+inline bool seek(std::FILE *file, std::uint64_t offset)
+{
+#if defined(_WIN32)
+    return _fseeki64(file, std::int64_t(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+/**
+ * @brief Scrive le righe row0 .. row0 + N.rows() - 1 della sezione di
+ * normali che inizia al byte offset e ha rows righe: una scrittura per
+ * colonna. tmp e' un buffer riutilizzato fra le chiamate.
+ */
+template <typename DerivedN>
+bool write_rows(
+    std::FILE *file,
+    std::uint64_t offset,
+    std::uint64_t rows,
+    std::uint64_t row0,
+    MatrixBase<DerivedN> const &N,
+    MatrixXd &tmp)
+{
+    tmp = N;
+    const std::size_t n = std::size_t(tmp.rows());
+    bool ok = true;
+    for (int k = 0; k < 3 && ok && n > 0; ++k) {
+        ok = seek(file, offset + (k * rows + row0) * sizeof(double)) &&
+             std::fwrite(tmp.col(k).data(), sizeof(double), n, file) == n;
+    }
+    return ok;
+}
+
+} // namespace normals_file
+
+/**
+ * @brief Scrive un file di normali (vedi normals_file) con la sola sezione
+ * del tipo dato, ad esempio normali calcolate in memoria.
+ *
+ * Come per la cache delle mesh, il file viene scritto con un nome temporaneo
+ * e rinominato solo alla fine, per cui un file incompleto non e' mai
+ * visibile.
+ *
+ * @param N Le normali, con normals_file::rows() righe per il tipo dato.
+ * @return false se N non ha il numero di righe giusto o il file non puo'
+ *         essere scritto.
+ */
+template <typename DerivedN>
+bool writeNormalsFile(
+    std::string const &filename,
+    std::uint64_t vertices,
+    std::uint64_t faces,
+    NormalMode mode,
+    MatrixBase<DerivedN> const &N)
+{
+    WS_PROFILE_SCOPE("writeNormalsFile");
+
+    normals_file::Header header;
+    const std::uint64_t fileSize = normals_file::layout(header, vertices, faces, {mode});
+    const std::uint64_t rows = normals_file::rows(header, mode);
+    if (std::uint64_t(N.rows()) != rows || N.cols() != 3) {
+        return false;
+    }
+
+    std::string tmpFilename = filename + ".tmp";
+    std::FILE *out = std::fopen(tmpFilename.c_str(), "wb");
+    if (out == nullptr) {
+        return false;
+    }
+    // colonne contigue in double, scritte senza copie se N e' una MatrixXd
+    Ref<const MatrixXd> const Nc(N.template cast<double>());
+    bool ok = std::fwrite(&header, sizeof(normals_file::Header), 1, out) == 1 &&
+              normals_file::seek(out, fileSize - 1) && std::fputc(0, out) != EOF;
+    for (int k = 0; k < 3 && ok && rows > 0; ++k) {
+        ok = normals_file::seek(out, header.offset[int(mode)] + k * rows * sizeof(double)) &&
+             std::fwrite(Nc.col(k).data(), sizeof(double), std::size_t(rows), out) == std::size_t(rows);
+    }
+    ok = std::fclose(out) == 0 && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Un file di normali (vedi normals_file), mappato in memoria in sola
+ * lettura.
+ */
+class NormalsFile
+{
+  public:
+    /**
+     * @brief Apre il file e ne controlla l'intestazione.
+     *
+     * @return true se il file e' un file di normali valido.
+     */
+    bool open(std::string const &filename)
+    {
+        using namespace normals_file;
+
+        _valid = false;
+        if (!_file.open(filename) || _file.size() < sizeof(Header)) {
+            return false;
+        }
+        std::memcpy(&_header, _file.data(), sizeof(Header));
+        if (std::memcmp(_header.magic, magic, sizeof(magic)) != 0 ||
+            _header.version != version ||
+            _header.headerSize != sizeof(Header) ||
+            _header.headerChecksum != header_checksum(_header)) {
+            return false;
+        }
+        for (NormalMode mode : {NormalMode::Face, NormalMode::Vertex, NormalMode::Corner}) {
+            int m = int(mode);
+            if (_header.size[m] > 0 &&
+                (_header.size[m] != rows(_header, mode) * 3 * sizeof(double) ||
+                 _header.offset[m] + _header.size[m] > _file.size())) {
+                return false;
+            }
+        }
+        _valid = true;
+        return true;
+    }
+
+    bool valid() const { return _valid; }
+
+    std::uint64_t vertices() const { return _header.vertices; }
+    std::uint64_t faces() const { return _header.faces; }
+
+    bool has_normals(NormalMode mode) const
+    {
+        return _header.size[int(mode)] > 0;
+    }
+
+    Map<const MatrixXd> normals(NormalMode mode) const
+    {
+        int m = int(mode);
+        return Map<const MatrixXd>(reinterpret_cast<double const *>(_file.data() + _header.offset[m]),
+                                   Index(_header.size[m] / (3 * sizeof(double))), 3);
+    }
+
+  private:
+    MappedFile _file;
+    normals_file::Header _header;
+    bool _valid = false;
+};
+
+namespace stream_normals {
+
+typedef Matrix<double, Dynamic, 3, RowMajor> RowsV;
+typedef Matrix<std::int64_t, Dynamic, 3, RowMajor> RowsF;
+
+/**
+ * @brief Un file temporaneo, scritto in coda e poi riletto.
+ *
+ * Dove possibile il file viene rimosso dalla cartella appena creato: lo
+ * spazio su disco viene liberato alla chiusura, anche se il processo termina
+ * in modo anomalo.
+ */
+class SpillFile
+{
+  public:
+    SpillFile() = default;
+
+    ~SpillFile()
+    {
+        close();
+    }
+
+    SpillFile(SpillFile const &) = delete;
+    SpillFile &operator=(SpillFile const &) = delete;
+
+    SpillFile(SpillFile &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    SpillFile &operator=(SpillFile &&other) noexcept
+    {
+        if (this != &other) {
+            close();
+            std::swap(_file, other._file);
+            std::swap(_buffer, other._buffer);
+            std::swap(_bytes, other._bytes);
+        }
+        return *this;
+    }
+
+    /**
+     * @brief Crea il file nella cartella directory, con un buffer di
+     * bufferBytes byte.
+     */
+    bool open(std::string const &directory, std::size_t bufferBytes)
+    {
+        close();
+#if defined(_WIN32)
+        _file = std::tmpfile();
+#else
+        std::string path = (directory.empty() ? std::string(".") : directory) + "/ws_geo3D_XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        int fd = mkstemp(name.data());
+        if (fd < 0) {
+            return false;
+        }
+        unlink(name.data());
+        _file = fdopen(fd, "w+b");
+        if (_file == nullptr) {
+            ::close(fd);
+        }
+#endif
+        if (_file == nullptr) {
+            return false;
+        }
+        // il buffer non viene inizializzato: le pagine sono allocate man mano
+        // che vengono scritte
+        bufferBytes = std::max<std::size_t>(bufferBytes, 1 << 12);
+        _buffer.reset(new char[bufferBytes]);
+        std::setvbuf(_file, _buffer.get(), _IOFBF, bufferBytes);
+        return true;
+    }
+
+    void close()
+    {
+        if (_file != nullptr) {
+            std::fclose(_file);
+        }
+        _file = nullptr;
+        _buffer.reset();
+        _bytes = 0;
+    }
+
+    template <typename T>
+    bool write(T const *data, std::size_t n)
+    {
+        _bytes += n * sizeof(T);
+        return n == 0 || std::fwrite(data, sizeof(T), n, _file) == n;
+    }
+
+    /**
+     * @brief Si posiziona al byte offset, ad esempio all'inizio per rileggere
+     * cio' che e' stato scritto.
+     */
+    bool seek(std::uint64_t offset)
+    {
+        return std::fflush(_file) == 0 && normals_file::seek(_file, offset);
+    }
+
+    /**
+     * @brief Legge fino a n elementi; restituisce il numero di elementi letti.
+     */
+    template <typename T>
+    std::size_t read(T *data, std::size_t n)
+    {
+        return n == 0 ? 0 : std::fread(data, sizeof(T), n, _file);
+    }
+
+    // byte scritti
+    std::uint64_t bytes() const { return _bytes; }
+
+  private:
+    std::FILE *_file = nullptr;
+    std::unique_ptr<char[]> _buffer;
+    std::uint64_t _bytes = 0;
+};
+
+// il vertice di un corner da risolvere (3 * faccia + corner)
+struct Request
+{
+    std::int64_t vertex;
+    std::int64_t corner;
+};
+
+// la posizione del vertice di un corner
+struct Position
+{
+    std::int64_t corner;
+    std::int64_t vertex;
+    double p[3];
+};
+
+// il contributo di un corner alla normale del suo vertice: peso e normale
+// della faccia restano separati, e il prodotto viene calcolato solo nella
+// somma con la stessa espressione del calcolo in memoria (accumulate(),
+// vertex_normals::gather()), anche dove il compilatore la contrae in FMA
+struct Contribution
+{
+    std::int64_t vertex;
+    double w;
+    double n[3];
+};
+
+/**
+ * @brief Numero di bit necessari per rappresentare i valori 0 .. n - 1.
+ */
+inline int bits_for(std::uint64_t n)
+{
+    int bits = 1;
+    while (bits < 64 && (std::uint64_t(1) << bits) < n) {
+        ++bits;
+    }
+    return bits;
+}
+
+/**
+ * @brief Distribuisce gli elementi fra i file dei rispettivi intervalli
+ * (bucket(item) in 0 .. files.size() - 1), mantenendo l'ordine: gli
+ * elementi vengono ordinati per intervallo con radix_sort() (stabile) e ogni
+ * intervallo e' scritto con una sola scrittura. keys e' un buffer riutilizzato.
+ */
+template <typename T, typename Bucket>
+bool scatter(std::vector<T> &items, Bucket bucket, std::vector<SpillFile> &files, std::vector<std::uint64_t> &keys)
+{
+    const std::size_t n = items.size();
+    keys.resize(n);
+    parallel::parallel_for(n, [&](std::size_t i) {
+        keys[i] = std::uint64_t(bucket(items[i]));
+    }, 1 << 14);
+    radix_sort(keys, items, bits_for(files.size()));
+
+    bool ok = true;
+    for (std::size_t i = 0; i < n && ok;) {
+        std::size_t j = i;
+        while (j < n && keys[j] == keys[i]) {
+            ++j;
+        }
+        ok = files[keys[i]].write(items.data() + i, j - i);
+        i = j;
+    }
+    return ok;
+}
+
+/**
+ * @brief Chiama add(i, v) per ogni elemento i = 0 .. n - 1, dove v =
+ * vertex(i) - base e' il suo vertice in 0 .. nv - 1 (gli altri elementi
+ * vengono ignorati).
+ *
+ * I vertici sono divisi in intervalli contigui, uno per thread. Gli elementi
+ * vengono prima distribuiti fra gli intervalli (conteggio per blocchi di
+ * elementi, somma prefissa e scrittura degli indici, in parallelo), poi ogni
+ * thread scorre solo gli indici dei propri vertici e chiama add(). Non ci
+ * sono scritture concorrenti e ogni vertice riceve i suoi elementi in ordine
+ * crescente di i, cioe' in ordine di faccia come nel calcolo in memoria,
+ * senza ordinare gli elementi.
+ */
+template <typename Vertex, typename Add>
+void for_each_in_order(std::int64_t n, std::int64_t base, std::int64_t nv, Vertex vertex, Add add)
+{
+    const std::int64_t hw = std::int64_t(parallel::threads());
+    const std::int64_t threads = n < (1 << 14) ? 1 : std::min(hw, nv);
+    if (threads <= 1) {
+        for (std::int64_t i = 0; i < n; ++i) {
+            const std::int64_t v = vertex(i) - base;
+            if (v >= 0 && v < nv) {
+                add(i, v);
+            }
+        }
+        return;
+    }
+
+    // intervallo del vertice v (threads se fuori da 0 .. nv - 1): il thread t
+    // ha i vertici nv * t / threads .. nv * (t + 1) / threads - 1
+    auto range_of = [&](std::int64_t v) {
+        if (v < 0 || v >= nv) {
+            return threads;
+        }
+        std::int64_t t = v * threads / nv;
+        while (nv * (t + 1) / threads <= v) {
+            ++t;
+        }
+        while (nv * t / threads > v) {
+            --t;
+        }
+        return t;
+    };
+
+    // gli indici sono a 32 bit, per cui gli elementi vengono distribuiti a
+    // gruppi di al piu' 2^30
+    const std::int64_t chunk = std::int64_t(1) << 30;
+    std::vector<std::uint32_t> order;
+    std::vector<std::int64_t> offset(std::size_t(threads * (threads + 1)));
+    std::vector<std::int64_t> start(std::size_t(threads + 1));
+    for (std::int64_t c0 = 0; c0 < n; c0 += chunk) {
+        const std::int64_t m = std::min(chunk, n - c0);
+        // il blocco b ha gli elementi c0 + m * b / threads ..
+        // c0 + m * (b + 1) / threads - 1; offset[b * (threads + 1) + t] conta
+        // quelli dell'intervallo t, poi diventa la posizione del primo
+        parallel::parallel_for(threads, [&](std::int64_t b) {
+            std::int64_t *count = offset.data() + b * (threads + 1);
+            std::fill(count, count + threads + 1, 0);
+            for (std::int64_t i = c0 + m * b / threads; i < c0 + m * (b + 1) / threads; ++i) {
+                ++count[range_of(vertex(i) - base)];
+            }
+        }, 2);
+        // somma prefissa per intervallo e, a parita' di intervallo, per
+        // blocco: gli indici di ogni intervallo restano in ordine crescente
+        std::int64_t total = 0;
+        for (std::int64_t t = 0; t < threads; ++t) {
+            start[t] = total;
+            for (std::int64_t b = 0; b < threads; ++b) {
+                const std::int64_t count = offset[b * (threads + 1) + t];
+                offset[b * (threads + 1) + t] = total;
+                total += count;
+            }
+        }
+        start[threads] = total;
+        order.resize(std::size_t(total));
+        parallel::parallel_for(threads, [&](std::int64_t b) {
+            std::int64_t *next = offset.data() + b * (threads + 1);
+            for (std::int64_t i = c0 + m * b / threads; i < c0 + m * (b + 1) / threads; ++i) {
+                const std::int64_t t = range_of(vertex(i) - base);
+                if (t < threads) {
+                    order[next[t]++] = std::uint32_t(i - c0);
+                }
+            }
+        }, 2);
+        parallel::parallel_for(threads, [&](std::int64_t t) {
+            for (std::int64_t k = start[t]; k < start[t + 1]; ++k) {
+                const std::int64_t i = c0 + std::int64_t(order[k]);
+                add(i, vertex(i) - base);
+            }
+        }, 2);
+    }
+}
+
+/**
+ * @brief Normalizza le somme dei contributi dei vertici row0 .. row0 +
+ * acc.rows() - 1 e le scrive nella sezione delle normali ai vertici, a
+ * blocchi di righe.
+ */
+inline bool write_vertex_normals(
+    std::FILE *out,
+    normals_file::Header const &header,
+    std::uint64_t row0,
+    RowsV &acc,
+    MatrixXd &tmp)
+{
+    const Index block = 1 << 16;
+    bool ok = true;
+    for (Index r = 0; r < acc.rows() && ok; r += block) {
+        Index n = std::min(block, acc.rows() - r);
+        parallel::parallel_for(n, [&](Index i) {
+            acc.row(r + i).normalize();
+        }, 1 << 14);
+        ok = normals_file::write_rows(out, header.offset[int(NormalMode::Vertex)], header.vertices, row0 + r,
+                                      acc.middleRows(r, n), tmp);
+    }
+    return ok;
+}
+
+/**
+ * @brief Somma ai vertici in acc (a partire dal vertice base) i contributi dei
+ * corner di un blocco di triangoli, di cui R sono i record (faceRecords()),
+ * in ordine di faccia come perVertexNormals(V, F).
+ */
+template <typename DerivedF>
+void accumulate(MatrixBase<DerivedF> const &F, FaceRecords<double> const &R, std::int64_t base, RowsV &acc)
+{
+    for_each_in_order(3 * std::int64_t(F.rows()), base, std::int64_t(acc.rows()),
+        [&](std::int64_t c) { return std::int64_t(F(c / 3, c % 3)); },
+        [&](std::int64_t c, std::int64_t v) {
+            acc.row(v) += R(c / 3, 3 + c % 3) * R.template block<1, 3>(c / 3, 0);
+        });
+}
+
+} // namespace stream_normals
+
+/**
+ * @brief I parametri di streamNormals().
+ */
+struct StreamOptions
+{
+    // memoria, in byte, per i buffer della pipeline (blocchi del file OBJ,
+    // vertici, accumulatori, record)
+    std::size_t memoryBudget = std::size_t(1) << 30;
+    // cartella dei file temporanei; se vuota, quella del file di output
+    std::string tempDirectory;
+};
+
+/**
+ * @brief Le statistiche di una chiamata a streamNormals().
+ */
+struct StreamStats
+{
+    long long vertices = 0;
+    long long faces = 0;
+    // intervalli in cui sono stati divisi i vertici (1: tutti in memoria)
+    long long vertexRanges = 0;
+    // intervalli in cui sono state divise le facce per la geometria
+    long long faceRanges = 0;
+    // byte scritti nei file temporanei
+    std::uint64_t spilledBytes = 0;
+};
+
+/**
+ * @brief Calcola le normali per faccia e per vertice di una mesh OBJ anche
+ * piu' grande della memoria, leggendola un blocco alla volta, e le scrive in
+ * un file binario (vedi normals_file e NormalsFile).
+ *
+ * La memoria usata e' limitata da options.memoryBudget, a prescindere dalla
+ * dimensione della mesh. La pipeline e':
+ * 1. il file OBJ viene letto a blocchi (ObjReader) e vertici e triangoli
+ *    vengono scritti in due file temporanei, in formato binario;
+ * 2. se posizioni e accumulatori dei vertici stanno in meta' della memoria,
+ *    i vertici vengono caricati e i triangoli riletti a blocchi: per ogni
+ *    blocco i record (faceRecords()) danno le normali delle facce, scritte
+ *    subito nel file di output, e i contributi dei corner, sommati ai
+ *    rispettivi vertici;
+ * 3. altrimenti i vertici vengono divisi in intervalli che stanno in memoria
+ *    e le posizioni vengono portate ai triangoli con un join esterno: i
+ *    corner vengono distribuiti in file temporanei per intervallo di vertici
+ *    (Request); per ogni intervallo si caricano i suoi vertici e le posizioni
+ *    vengono distribuite per intervallo di facce (Position); per ogni
+ *    intervallo di facce si calcolano i record, si scrivono le normali delle
+ *    facce e i contributi vengono distribuiti per intervallo di vertici
+ *    (Contribution); infine ogni intervallo di vertici somma i propri
+ *    contributi e scrive le proprie normali.
+ * Ogni passo e' parallelo, e legge e scrive i file temporanei in sequenza, a
+ * blocchi.
+ *
+ * Le normali sono quelle di perFaceNormals(V, F) e perVertexNormals(V, F)
+ * sulla stessa mesh (pesi area * angolo, stessi kernel): in entrambi i casi
+ * ogni vertice somma i contributi dei suoi corner in ordine di faccia, per
+ * cui il risultato e' identico bit a bit al calcolo in memoria. Quando la
+ * mesh sta in memoria l'unico costo in piu' e' la scrittura e la rilettura
+ * dei file temporanei del passo 1.
+ *
+ * Il file di output viene scritto con un nome temporaneo e poi rinominato.
+ *
+ * @param objFilename Il percorso del file OBJ.
+ * @param outFilename Il percorso del file di normali da scrivere.
+ * @param options La memoria disponibile e la cartella dei file temporanei.
+ * @param stats Se non nullo, riceve le statistiche del calcolo.
+ * @return true se il file di output e' stato scritto, false se il file OBJ
+ *         non esiste o non e' valido, o in caso di errori di scrittura.
+ */
+inline bool streamNormals(
+    std::string const &objFilename,
+    std::string const &outFilename,
+    StreamOptions const &options = StreamOptions(),
+    StreamStats *stats = nullptr)
+{
+    using namespace stream_normals;
+
+    WS_PROFILE_SCOPE("streamNormals");
+
+    const std::size_t budget = std::max<std::size_t>(options.memoryBudget, std::size_t(16) << 20);
+    std::string tempDirectory = options.tempDirectory;
+    if (tempDirectory.empty()) {
+        std::size_t slash = outFilename.find_last_of("/\\");
+        tempDirectory = slash == std::string::npos ? "." : outFilename.substr(0, slash);
+    }
+    const std::size_t fileBuffer = std::min<std::size_t>(budget / 64, 8 << 20);
+
+    // 1. OBJ -> file temporanei di vertici e triangoli; un blocco di testo
+    // produce al piu' circa 3 volte la sua dimensione in vertici
+    SpillFile Vfile, Ffile;
+    if (!Vfile.open(tempDirectory, fileBuffer) || !Ffile.open(tempDirectory, fileBuffer)) {
+        return false;
+    }
+    ObjReader reader;
+    if (!reader.open(objFilename, std::min<std::size_t>(budget / 16, std::size_t(256) << 20))) {
+        return false;
+    }
+    {
+        WS_PROFILE_SCOPE("streamNormals/parse");
+        RowsV Vc;
+        RowsF Fc;
+        bool ok = true;
+        while (ok && reader.read(Vc, Fc)) {
+            ok = Vfile.write(Vc.data(), std::size_t(Vc.size())) && Ffile.write(Fc.data(), std::size_t(Fc.size()));
+        }
+        if (!ok || !reader.valid()) {
+            return false;
+        }
+    }
+    const std::int64_t nv = reader.vertices();
+    const std::int64_t nf = reader.triangles();
+    reader.close();
+
+    normals_file::Header header;
+    const std::uint64_t fileSize = normals_file::layout(header, nv, nf, {NormalMode::Face, NormalMode::Vertex});
+    const std::uint64_t faceOffset = header.offset[int(NormalMode::Face)];
+
+    std::string tmpFilename = outFilename + ".tmp";
+    std::FILE *out = std::fopen(tmpFilename.c_str(), "wb");
+    if (out == nullptr) {
+        return false;
+    }
+    // il file viene esteso subito alla dimensione finale, poi le sezioni
+    // vengono scritte a blocchi nella loro posizione
+    bool ok = std::fwrite(&header, sizeof(normals_file::Header), 1, out) == 1 &&
+              normals_file::seek(out, fileSize - 1) && std::fputc(0, out) != EOF;
+
+    // dimensioni dei blocchi: circa 110 byte per faccia di buffer in memoria
+    // (triangoli, record e indici di for_each_in_order()), circa 400 nel join
+    // esterno (zuppa di triangoli, record e contributi da distribuire, con le
+    // copie dell'ordinamento)
+    const std::int64_t faceBlock = std::max<std::int64_t>(1 << 12, std::int64_t(budget / 4 / 400));
+    const std::int64_t vertexRange = std::max<std::int64_t>(1 << 12, std::int64_t(budget / 2 / (2 * sizeof(RowsV::Scalar) * 3)));
+    const std::int64_t nranges = nv == 0 ? 1 : (nv + vertexRange - 1) / vertexRange;
+
+    std::vector<std::uint64_t> keys;
+    FaceRecords<double> R;
+    MatrixXd tmp;
+    RowsF Fc;
+    Matrix<std::int64_t, Dynamic, Dynamic> Fcol;
+    RowsV acc;
+
+    std::int64_t faceRanges = 0;
+    std::uint64_t spilled = Vfile.bytes() + Ffile.bytes();
+
+    if (nranges == 1) {
+        // 2. vertici e accumulatori in memoria
+        WS_PROFILE_SCOPE("streamNormals/in_memory");
+
+        MatrixXd V(nv, 3);
+        {
+            RowsV block;
+            ok = ok && Vfile.seek(0);
+            for (std::int64_t v0 = 0; v0 < nv && ok; v0 += faceBlock) {
+                block.resize(std::min(faceBlock, nv - v0), 3);
+                ok = Vfile.read(block.data(), std::size_t(block.size())) == std::size_t(block.size());
+                V.middleRows(v0, block.rows()) = block;
+            }
+        }
+        Vfile.close();
+
+        acc.setZero(nv, 3);
+        ok = ok && Ffile.seek(0);
+        for (std::int64_t f0 = 0; f0 < nf && ok; f0 += faceBlock) {
+            WS_PROFILE_SCOPE("streamNormals/faces");
+            Fc.resize(std::min(faceBlock, nf - f0), 3);
+            ok = Ffile.read(Fc.data(), std::size_t(Fc.size())) == std::size_t(Fc.size());
+            Fcol = Fc;
+            faceRecords(V, Fcol, R);
+            ok = ok && normals_file::write_rows(out, faceOffset, nf, f0, R.leftCols(3), tmp);
+            accumulate(Fcol, R, 0, acc);
+            ++faceRanges;
+        }
+        Ffile.close();
+
+        {
+            WS_PROFILE_SCOPE("streamNormals/vertices");
+            ok = ok && write_vertex_normals(out, header, 0, acc, tmp);
+        }
+    } else {
+        // 3. join esterno per intervalli di vertici e di facce
+        const std::int64_t faceRange = faceBlock;
+        const std::int64_t nfaceRanges = (nf + faceRange - 1) / faceRange;
+        const std::size_t bucketBuffer = std::max<std::size_t>(1 << 12,
+            std::min<std::size_t>(1 << 20, budget / 8 / std::size_t(2 * nranges + nfaceRanges)));
+        const std::size_t itemsPerRead = std::max<std::size_t>(1 << 12, budget / 4 / 128);
+
+        auto open_all = [&](std::vector<SpillFile> &files, std::int64_t n) {
+            files.resize(std::size_t(n));
+            bool opened = true;
+            for (auto &file : files) {
+                opened = opened && file.open(tempDirectory, bucketBuffer);
+            }
+            return opened;
+        };
+        auto range_of_vertex = [vertexRange](std::int64_t v) { return v / vertexRange; };
+
+        std::vector<SpillFile> requests, positions, contributions;
+        ok = ok && open_all(requests, nranges) && open_all(positions, nfaceRanges) && open_all(contributions, nranges);
+
+        // 3a. i corner per intervallo di vertici
+        {
+            WS_PROFILE_SCOPE("streamNormals/requests");
+            std::vector<Request> items;
+            ok = ok && Ffile.seek(0);
+            for (std::int64_t f0 = 0; f0 < nf && ok; f0 += faceBlock) {
+                Fc.resize(std::min(faceBlock, nf - f0), 3);
+                ok = Ffile.read(Fc.data(), std::size_t(Fc.size())) == std::size_t(Fc.size());
+                items.resize(std::size_t(Fc.size()));
+                parallel::parallel_for(Fc.rows(), [&](Index f) {
+                    for (int p = 0; p < 3; ++p) {
+                        items[3 * f + p] = Request{Fc(f, p), 3 * (f0 + f) + p};
+                    }
+                }, 1 << 14);
+                ok = ok && scatter(items, [&](Request const &r) { return range_of_vertex(r.vertex); }, requests, keys);
+            }
+            Ffile.close();
+        }
+
+        // 3b. le posizioni per intervallo di facce
+        {
+            WS_PROFILE_SCOPE("streamNormals/positions");
+            RowsV Vr;
+            std::vector<Request> in;
+            std::vector<Position> items;
+            for (std::int64_t r = 0; r < nranges && ok; ++r) {
+                const std::int64_t v0 = r * vertexRange;
+                Vr.resize(std::min(vertexRange, nv - v0), 3);
+                ok = Vfile.seek(std::uint64_t(v0) * 3 * sizeof(double)) &&
+                     Vfile.read(Vr.data(), std::size_t(Vr.size())) == std::size_t(Vr.size()) &&
+                     requests[r].seek(0);
+                for (;;) {
+                    in.resize(itemsPerRead);
+                    in.resize(requests[r].read(in.data(), in.size()));
+                    if (in.empty() || !ok) {
+                        break;
+                    }
+                    items.resize(in.size());
+                    parallel::parallel_for(in.size(), [&](std::size_t i) {
+                        auto p = Vr.row(in[i].vertex - v0);
+                        items[i] = Position{in[i].corner, in[i].vertex, {p(0), p(1), p(2)}};
+                    }, 1 << 14);
+                    ok = scatter(items, [&](Position const &q) { return q.corner / 3 / faceRange; }, positions, keys);
+                }
+                spilled += requests[r].bytes();
+                requests[r].close();
+            }
+            Vfile.close();
+        }
+
+        // 3c. geometria e normali delle facce, contributi per intervallo di vertici
+        {
+            WS_PROFILE_SCOPE("streamNormals/faces");
+            MatrixXd Vs;
+            Matrix<std::int64_t, Dynamic, Dynamic> Fs;
+            std::vector<Position> in;
+            std::vector<Contribution> items;
+            for (std::int64_t q = 0; q < nfaceRanges && ok; ++q) {
+                const std::int64_t f0 = q * faceRange;
+                const std::int64_t n = std::min(faceRange, nf - f0);
+                // la zuppa di triangoli dell'intervallo: il corner c in Vs.row(c)
+                Vs.resize(3 * n, 3);
+                Fs.resize(n, 3);
+                Fcol.resize(n, 3);
+                ok = positions[q].seek(0);
+                for (;;) {
+                    in.resize(itemsPerRead);
+                    in.resize(positions[q].read(in.data(), in.size()));
+                    if (in.empty() || !ok) {
+                        break;
+                    }
+                    parallel::parallel_for(in.size(), [&](std::size_t i) {
+                        std::int64_t c = in[i].corner - 3 * f0;
+                        Vs.row(c) << in[i].p[0], in[i].p[1], in[i].p[2];
+                        Fs(c / 3, c % 3) = c;
+                        Fcol(c / 3, c % 3) = in[i].vertex;
+                    }, 1 << 14);
+                }
+                spilled += positions[q].bytes();
+                positions[q].close();
+
+                faceRecords(Vs, Fs, R);
+                ok = ok && normals_file::write_rows(out, faceOffset, nf, f0, R.leftCols(3), tmp);
+
+                items.resize(std::size_t(3 * n));
+                parallel::parallel_for(n, [&](std::int64_t f) {
+                    for (int p = 0; p < 3; ++p) {
+                        Contribution &c = items[3 * f + p];
+                        c.vertex = Fcol(f, p);
+                        c.w = R(f, 3 + p);
+                        Map<Matrix<double, 1, 3>>(c.n) = R.block<1, 3>(f, 0);
+                    }
+                }, 1 << 14);
+                ok = ok && scatter(items, [&](Contribution const &c) { return range_of_vertex(c.vertex); }, contributions, keys);
+            }
+            faceRanges = nfaceRanges;
+        }
+
+        // 3d. somma dei contributi e normali per intervallo di vertici
+        {
+            WS_PROFILE_SCOPE("streamNormals/vertices");
+            std::vector<Contribution> in;
+            for (std::int64_t r = 0; r < nranges && ok; ++r) {
+                const std::int64_t v0 = r * vertexRange;
+                acc.setZero(std::min(vertexRange, nv - v0), 3);
+                ok = contributions[r].seek(0);
+                for (;;) {
+                    in.resize(itemsPerRead);
+                    in.resize(contributions[r].read(in.data(), in.size()));
+                    if (in.empty() || !ok) {
+                        break;
+                    }
+                    for_each_in_order(std::int64_t(in.size()), v0, std::int64_t(acc.rows()),
+                        [&](std::int64_t i) { return in[i].vertex; },
+                        [&](std::int64_t i, std::int64_t v) { acc.row(v) += in[i].w * Map<const Matrix<double, 1, 3>>(in[i].n); });
+                }
+                spilled += contributions[r].bytes();
+                contributions[r].close();
+                ok = ok && write_vertex_normals(out, header, v0, acc, tmp);
+            }
+        }
+    }
+
+    ok = std::fclose(out) == 0 && ok;
+    if (!ok || std::rename(tmpFilename.c_str(), outFilename.c_str()) != 0) {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+
+    WS_PROFILE_COUNT("spilled_bytes", spilled);
+    if (stats != nullptr) {
+        stats->vertices = nv;
+        stats->faces = nf;
+        stats->vertexRanges = nranges;
+        stats->faceRanges = faceRanges;
+        stats->spilledBytes = spilled;
+    }
+    return true;
+}
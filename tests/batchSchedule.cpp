@@ -0,0 +1,90 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../batchNormals.hpp"
+
+/**
+ * Test dell'ordine in cui batchNormals() concede i core alle mesh
+ * (batch_normals::Budget).
+ *
+ * Simula la coda di batchNormals(): options.jobs thread prendono le mesh
+ * dalla coda, ordinata dalla piu' grande alla piu' piccola, e occupano tutti
+ * i core per una mesh grande e uno per una piccola. Le mesh grandi devono
+ * iniziare per prime e nel loro ordine, anche se mentre una attende i core
+ * quelle piccole dopo di essa potrebbero usare i core gia' liberi; in ogni
+ * istante i core occupati non devono superare options.jobs.
+ *
+ * Restituisce 0 se tutti i controlli riescono.
+ */
+
+namespace {
+
+int failures = 0;
+
+void run(unsigned jobs, int large, int small)
+{
+    const int n = large + small;
+    batch_normals::Budget cores(jobs);
+    std::atomic<int> next{0};
+    std::atomic<int> started{0};
+    std::atomic<unsigned> used{0};
+    std::atomic<unsigned> peak{0};
+    std::vector<int> start(n, -1);
+
+    auto process = [&](int k) {
+        const bool big = k < large;
+        const std::uint64_t c = cores.acquire(big ? jobs : 1, std::uint64_t(k));
+        start[k] = started++;
+        const unsigned u = used += unsigned(c);
+        unsigned p = peak;
+        while (u > p && !peak.compare_exchange_weak(p, u)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(big ? 20 : 2));
+        used -= unsigned(c);
+        cores.release(c);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < jobs; ++t) {
+        threads.emplace_back([&]() {
+            for (int k; (k = next++) < n;) {
+                process(k);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (int k = 0; k < large; ++k) {
+        if (start[k] != k) {
+            std::printf("FAIL jobs %u: mesh grande %d iniziata come %d-esima\n", jobs, k, start[k]);
+            ++failures;
+        }
+    }
+    if (peak > jobs) {
+        std::printf("FAIL jobs %u: %u core occupati\n", jobs, unsigned(peak));
+        ++failures;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    for (int repeat = 0; repeat < 5; ++repeat) {
+        run(4, 3, 40);
+        run(2, 2, 20);
+        run(8, 1, 60);
+    }
+    if (failures) {
+        std::printf("%d controlli falliti\n", failures);
+        return 1;
+    }
+    std::printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../meshContext.hpp"
+#include "../perFacenormals.hpp"
+#include "../perVertexNormals.hpp"
+#include "../perCornerNormals.hpp"
+#include "../bench/syntheticMeshes.hpp"
+
+using namespace Eigen;
+
+/**
+ * Test di MeshContextT::update_vertices() e delle funzioni di aggiornamento
+ * delle normali (updateFaceNormals, updateVertexNormals, updateCornerNormals).
+ *
+ * Su sfera, toro e griglia aperta, in double/float con indici int/int64,
+ * sposta a caso alcuni vertici per diversi frame e confronta, dopo ogni frame,
+ * i dati aggiornati in modo incrementale con quelli di un MeshContext nuovo
+ * sulla stessa mesh: geometria delle facce (normali, aree, angoli), coseni
+ * diedrali e normali ai triangoli, ai vertici e ai corner devono coincidere
+ * bit per bit. In alcuni frame non tutte le normali vengono richieste, per
+ * provare anche il ricalcolo completo di quelle rimaste da aggiornare.
+ *
+ * Restituisce 0 se tutti i confronti riescono.
+ */
+
+namespace {
+
+const int frames = 20;
+
+int failures = 0;
+
+template <typename Derived>
+void expect_equal(
+    MatrixBase<Derived> const &updated,
+    MatrixBase<Derived> const &full,
+    std::string const &what)
+{
+    if (updated.rows() != full.rows() || updated.cols() != full.cols() || updated != full) {
+        std::printf("FAIL %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+template <typename Scalar, typename Int>
+void run(std::string const &name, MatrixXd const &V0, MatrixXi const &F0, unsigned seed)
+{
+    typedef MeshContextT<Scalar, Int> Mesh;
+    typedef typename Mesh::MatrixS MatrixS;
+
+    const typename Mesh::NormalFunction compute[3] = {
+        [](Mesh &mesh, MatrixS &N) { perFaceNormals(mesh, N); },
+        [](Mesh &mesh, MatrixS &N) { perVertexNormals(mesh, N); },
+        [](Mesh &mesh, MatrixS &N) { perCornerNormals(mesh, N); }};
+    const typename Mesh::NormalUpdateFunction update[3] = {
+        [](Mesh &mesh, MatrixS &N) { updateFaceNormals(mesh, N); },
+        [](Mesh &mesh, MatrixS &N) { updateVertexNormals(mesh, N); },
+        [](Mesh &mesh, MatrixS &N) { updateCornerNormals(mesh, N); }};
+    const char *modes[3] = {"face", "vertex", "corner"};
+
+    Mesh mesh(V0.cast<Scalar>(), F0.cast<Int>());
+    mesh.FF_cosines();
+    for (int m = 0; m < 3; ++m) {
+        mesh.normals(NormalMode(m), compute[m], update[m]);
+    }
+
+    std::mt19937 rng(seed);
+    const Index nv = mesh.V().rows();
+    std::vector<Int> all(nv);
+    for (Index v = 0; v < nv; ++v) {
+        all[v] = Int(v);
+    }
+    for (int frame = 0; frame < frames; ++frame) {
+        // da un vertice a circa il 5% dei vertici, spostati di poco
+        const Index count = 1 + Index(rng() % std::max<Index>(1, nv / 20));
+        std::shuffle(all.begin(), all.end(), rng);
+        typename Mesh::VectorI vertices(count);
+        MatrixS positions(count, 3);
+        std::uniform_real_distribution<double> offset(-0.01, 0.01);
+        for (Index k = 0; k < count; ++k) {
+            vertices(k) = all[k];
+            for (int d = 0; d < 3; ++d) {
+                positions(k, d) = mesh.V()(all[k], d) + Scalar(offset(rng));
+            }
+        }
+        mesh.update_vertices(vertices, positions);
+
+        Mesh full(mesh.V(), mesh.F());
+        const std::string where = name + " frame " + std::to_string(frame) + ": ";
+        expect_equal(mesh.FN(), full.FN(), where + "FN");
+        expect_equal(mesh.Fareas(), full.Fareas(), where + "Fareas");
+        expect_equal(mesh.Fangles(), full.Fangles(), where + "Fangles");
+        expect_equal(mesh.FF_cosines(), full.FF_cosines(), where + "FF_cosines");
+        for (int m = 0; m < 3; ++m) {
+            // un tipo a rotazione resta da aggiornare per un frame
+            if ((frame + m) % 4 == 3) {
+                continue;
+            }
+            expect_equal(
+                mesh.normals(NormalMode(m), compute[m], update[m]),
+                full.normals(NormalMode(m), compute[m]),
+                where + modes[m] + " normals");
+        }
+    }
+}
+
+template <typename Scalar, typename Int>
+void run_all(std::string const &types)
+{
+    MatrixXd V;
+    MatrixXi F;
+    makeIcosphere(12, V, F);
+    run<Scalar, Int>("sphere " + types, V, F, 1);
+    makeTorus(48, 24, 1.0, 0.3, V, F);
+    run<Scalar, Int>("torus " + types, V, F, 2);
+    makeGrid(40, 30, V, F);
+    run<Scalar, Int>("grid " + types, V, F, 3);
+}
+
+} // namespace
+
+int main()
+{
+    run_all<double, int>("double/int");
+    run_all<double, std::int64_t>("double/int64");
+    run_all<float, int>("float/int");
+    run_all<float, std::int64_t>("float/int64");
+    if (failures) {
+        std::printf("%d confronti falliti\n", failures);
+        return 1;
+    }
+    std::printf("ok\n");
+    return 0;
+}
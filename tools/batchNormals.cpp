@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../batchNormals.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cerr << "uso: ws_geo3D_batch [--mode face|vertex|corner] [--angle gradi] [--format wsnormals|obj]\n"
+                 "                    [--output cartella] [--list elenco.txt] [--recursive] [--jobs N]\n"
+                 "                    [--memory MB] [--temp cartella] mesh.obj|cartella...\n"
+                 "Calcola le normali di molte mesh OBJ (batchNormals()): file e cartelle sulla riga\n"
+                 "di comando e, con --list, un percorso per riga di un file di elenco. L'output di\n"
+                 "ogni mesh e' mesh.obj.wsnormals (predefinito) o mesh.normals.obj (--format obj).\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    BatchOptions options;
+    bool recursive = false;
+    std::vector<std::string> paths;
+    std::vector<std::string> lists;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        auto next = [&]() -> std::string {
+            if (a + 1 >= argc) {
+                usage();
+                std::exit(1);
+            }
+            return argv[++a];
+        };
+        if (arg == "--mode") {
+            std::string mode = next();
+            if (mode == "face") {
+                options.mode = NormalMode::Face;
+            } else if (mode == "vertex") {
+                options.mode = NormalMode::Vertex;
+            } else if (mode == "corner") {
+                options.mode = NormalMode::Corner;
+            } else {
+                usage();
+                return 1;
+            }
+        } else if (arg == "--angle") {
+            options.cornerAngle = std::atof(next().c_str());
+        } else if (arg == "--format") {
+            std::string format = next();
+            if (format != "wsnormals" && format != "obj") {
+                usage();
+                return 1;
+            }
+            options.format = format == "obj" ? BatchFormat::Obj : BatchFormat::Normals;
+        } else if (arg == "--output") {
+            options.outputDirectory = next();
+        } else if (arg == "--list") {
+            lists.push_back(next());
+        } else if (arg == "--recursive") {
+            recursive = true;
+        } else if (arg == "--jobs") {
+            options.jobs = unsigned(std::max(0, std::atoi(next().c_str())));
+        } else if (arg == "--memory") {
+            options.memoryBudget = std::size_t(std::max(1LL, std::atoll(next().c_str()))) << 20;
+        } else if (arg == "--temp") {
+            options.tempDirectory = next();
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    for (auto const &list : lists) {
+        std::ifstream in(list);
+        if (!in) {
+            std::cerr << "impossibile leggere l'elenco '" << list << "'\n";
+            return 1;
+        }
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                paths.push_back(line);
+            }
+        }
+    }
+
+    // le cartelle vengono sostituite dai file OBJ che contengono
+    std::vector<std::string> files;
+    for (auto const &path : paths) {
+        if (batch_normals::is_mesh_file(path)) {
+            files.push_back(path);
+        } else if (!listMeshFiles(path, recursive, files)) {
+            std::cerr << "'" << path << "' non e' un file OBJ ne' una cartella leggibile\n";
+            return 1;
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto results = batchNormals(files, options, [](BatchResult const &r) {
+        if (r.ok) {
+            std::cerr << r.output << ": " << r.vertices << " vertici, " << r.faces << " facce in " << r.seconds
+                      << " s" << (r.outOfCore ? " (out-of-core)" : "") << "\n";
+        } else {
+            std::cerr << "impossibile calcolare le normali di '" << r.input << "'\n";
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long long failed = 0;
+    long long faces = 0;
+    for (auto const &r : results) {
+        failed += r.ok ? 0 : 1;
+        faces += r.ok ? r.faces : 0;
+    }
+    std::cerr << results.size() - failed << " mesh su " << results.size() << " in " << seconds << " s ("
+              << (seconds > 0 ? faces / seconds : 0.0) << " facce/s)\n";
+    return failed == 0 ? 0 : 1;
+}
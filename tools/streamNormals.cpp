@@ -0,0 +1,71 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "../streamNormals.hpp"
+
+namespace {
+
+void usage()
+{
+    std::cerr << "uso: ws_geo3D_stream mesh.obj [normali.wsnormals] [--memory MB] [--temp cartella]\n"
+                 "Calcola le normali per faccia e per vertice di una mesh OBJ anche piu' grande\n"
+                 "della memoria (streamNormals()); l'output predefinito e' mesh.obj.wsnormals.\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string objFile;
+    std::string outFile;
+    StreamOptions options;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg = argv[a];
+        auto next = [&]() -> std::string {
+            if (a + 1 >= argc) {
+                usage();
+                std::exit(1);
+            }
+            return argv[++a];
+        };
+        if (arg == "--memory") {
+            options.memoryBudget = std::size_t(std::max(1LL, std::atoll(next().c_str()))) << 20;
+        } else if (arg == "--temp") {
+            options.tempDirectory = next();
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        } else if (objFile.empty()) {
+            objFile = arg;
+        } else if (outFile.empty()) {
+            outFile = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (objFile.empty()) {
+        usage();
+        return 1;
+    }
+    if (outFile.empty()) {
+        outFile = objFile + ".wsnormals";
+    }
+
+    StreamStats stats;
+    auto start = std::chrono::steady_clock::now();
+    if (!streamNormals(objFile, outFile, options, &stats)) {
+        std::cerr << "impossibile calcolare le normali di '" << objFile << "'\n";
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << outFile << ": " << stats.vertices << " vertici, " << stats.faces << " facce in " << seconds
+              << " s (" << (seconds > 0 ? stats.faces / seconds : 0.0) << " facce/s), "
+              << stats.vertexRanges << " intervalli di vertici, " << stats.faceRanges << " blocchi di facce, "
+              << stats.spilledBytes / double(1 << 20) << " MB su disco\n";
+    return 0;
+}
@@ -1,18 +1,118 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+#include "radixSort.hpp"
+
 using namespace Eigen;
 
+/**
+ * @brief Calcola l'insieme di facce adiacenti a ogni vertice, in formato
+ * compresso (CSR, compressed sparse row).
+ *
+ * Invece di un array di array, l'adiacenza e' memorizzata in due soli array:
+ * VFc contiene, uno dopo l'altro, i corner incidenti su ogni vertice e
+ * VFoffsets indica dove inizia la lista di ogni vertice. I corner incidenti
+ * sul vertice v sono quindi VFc(k) per k in [VFoffsets(v), VFoffsets(v + 1)).
+ * Ogni corner e' codificato come f * F.cols() + p, dove f e' l'indice della
+ * faccia e p l'indice del corner nella faccia (F(f, p) == v):
+ * f = VFc(k) / F.cols() e p = VFc(k) % F.cols().
+ *
+ * La costruzione avviene in parallelo: un primo passo conta i corner di ogni
+ * vertice, una somma prefissa calcola gli offset e un secondo passo scrive i
+ * corner. Le liste sono infine ordinate, per cui il risultato non dipende dal
+ * numero di thread ed e' identico a quello di vertex_face_adjacency() con
+ * array di array (facce in ordine crescente).
+ *
+ * @param V I vertici della mesh. Per ogni riga della matrice V, la posizione
+ *          del vertice e' costituita dalle coordinate x,y,z memorizzate nelle
+ *          3 colonne della riga.
+ * @param F I triangoli della mesh. Per ogni riga della matrice F, il triangolo
+ *          e' descritto dagli indici i,j,k memorizzati nelle 3 colonne della
+ *          riga. Gli indici i,j,k si riferiscono ai 3 vertici A, B, C del
+ *          triangolo, memorizzati in V.row(i), V.row(j) e V.row(k),
+ *          rispettivamente. NOTA: per ogni triangolo, i 3 vertici sono da
+ *          considerarsi indicati in senso antiorario.
+ * @param VFoffsets Array di V.rows() + 1 offset in VFc. VFoffsets(0) == 0 e
+ *                  VFoffsets(V.rows()) == F.rows() * F.cols().
+ * @param VFc Array di F.rows() * F.cols() corner, raggruppati per vertice.
+ *            Con piu' di 2^31 corner occorrono indici a 64 bit
+ *            (std::int64_t): il tipo degli indici e' quello di VFc.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedO, typename DerivedC>
+void vertex_face_adjacency(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedO> &VFoffsets,
+    PlainObjectBase<DerivedC> &VFc)
+{
+    typedef typename DerivedC::Scalar Int;
+
+    WS_PROFILE_SCOPE("vertex_face_adjacency");
+
+    const Int nv = Int(V.rows());
+    const Int nc = Int(F.cols());
+    const Int nf = Int(F.rows());
+
+    WS_PROFILE_COUNT("corners", nf * nc);
+    WS_PROFILE_COUNT("allocated_bytes", (nv + 1 + nf * nc) * sizeof(Int) * 2);
+
+    // sotto questa soglia di facce il costo dei thread non vale la pena
+    const size_t min_parallel = 1 << 14;
+
+    std::vector<std::atomic<Int>> cursor(nv + 1);
+    for (auto &c : cursor) {
+        c.store(0, std::memory_order_relaxed);
+    }
+
+    // 1. conteggio dei corner per vertice
+    parallel::parallel_for(nf, [&](Int f) {
+        for (Int p = 0; p < nc; ++p) {
+            cursor[F(f, p) + 1].fetch_add(1, std::memory_order_relaxed);
+        }
+    }, min_parallel);
+
+    // 2. somma prefissa: offset di inizio della lista di ogni vertice
+    VFoffsets.resize(nv + 1, 1);
+    VFoffsets(0) = 0;
+    for (Int v = 0; v < nv; ++v) {
+        VFoffsets(v + 1) = VFoffsets(v) + cursor[v + 1].load(std::memory_order_relaxed);
+        cursor[v].store(Int(VFoffsets(v)), std::memory_order_relaxed);
+    }
+
+    // 3. scrittura dei corner nella posizione riservata al vertice
+    VFc.resize(nf * nc, 1);
+    parallel::parallel_for(nf, [&](Int f) {
+        for (Int p = 0; p < nc; ++p) {
+            Int k = cursor[F(f, p)].fetch_add(1, std::memory_order_relaxed);
+            VFc(k) = f * nc + p;
+        }
+    }, min_parallel);
+
+    // 4. l'ordine di scrittura dipende dai thread: le liste vengono ordinate
+    parallel::parallel_for(nv, [&](Int v) {
+        std::sort(VFc.data() + VFoffsets(v), VFc.data() + VFoffsets(v + 1));
+    }, min_parallel);
+}
+
 /**
  * @brief Calcola l'insieme di facce adiancenti a ogni vertice.
  *
  * Una faccia e' adiacente a un vertice se la faccia punta ad esso,
  * ovvero se esso e' uno dei suoi corner.
  *
+ * Questa versione e' un adattatore della versione compressa (CSR) di
+ * vertex_face_adjacency(), da preferire per mesh grandi: ogni lista viene
+ * allocata una sola volta, con la dimensione esatta.
+ *
  * @param V I vertici della mesh. Per ogni riga della matrice V, la posizione
  *          del vertice e' costituita dalle coordinate x,y,z memorizzate nelle
  *          3 colonne della riga.
@@ -29,24 +129,33 @@ using namespace Eigen;
  *            ha lo stesso numero di elementi del corrispondente elemento in VF[i].
  *            VFi[i][j] corrisponde al corner di Vf[i][j] che incide sul vertice i.
  */
+template <typename DerivedV, typename DerivedF, typename Int>
 void vertex_face_adjacency(
-    MatrixXd const &V,
-    MatrixXi const &F,
-    std::vector<std::vector<int>> &VF,
-    std::vector<std::vector<int>> &VFi)
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    std::vector<std::vector<Int>> &VF,
+    std::vector<std::vector<Int>> &VFi)
 {
+    Matrix<Int, Dynamic, 1> VFoffsets, VFc;
+    vertex_face_adjacency(V, F, VFoffsets, VFc);
+
+    const Int nc = Int(F.cols());
+
     VF.clear();
     VFi.clear();
     VF.resize(V.rows());
     VFi.resize(V.rows());
 
-    for (int f = 0; f < F.rows(); ++f) {
-        for (int p = 0; p < F.cols(); ++p) {
-            int v = F(f, p);
-            VF[v].push_back(f);
-            VFi[v].push_back(p);
+    parallel::parallel_for(Int(V.rows()), [&](Int v) {
+        Int begin = VFoffsets(v);
+        Int end = VFoffsets(v + 1);
+        VF[v].resize(end - begin);
+        VFi[v].resize(end - begin);
+        for (Int k = begin; k < end; ++k) {
+            VF[v][k - begin] = VFc(k) / nc;
+            VFi[v][k - begin] = VFc(k) % nc;
         }
-    }
+    }, 1 << 14);
 }
 
 /**
@@ -85,36 +194,107 @@ void vertex_face_adjacency(
  *            j-esima faccia adiacente alla i-esima, condiviso con il lato j-esimo
  *            della faccia i-esima.
  */
+template <typename DerivedV, typename DerivedF, typename Int, typename DerivedFF, typename DerivedFFi>
 void face_face_adjacency(
-    MatrixXd const &V,
-    MatrixXi const &F,
-    std::vector<std::vector<int>> const& VF,
-    std::vector<std::vector<int>> const& VFi,
-    MatrixXi &FF,
-    MatrixXi &FFi)
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    std::vector<std::vector<Int>> const& VF,
+    std::vector<std::vector<Int>> const& VFi,
+    PlainObjectBase<DerivedFF> &FF,
+    PlainObjectBase<DerivedFFi> &FFi)
 {
+    WS_PROFILE_SCOPE("face_face_adjacency/vf");
+    WS_PROFILE_COUNT("half_edges", F.rows() * F.cols());
+    WS_PROFILE_COUNT("allocated_bytes", F.rows() * F.cols() * sizeof(Int) * 2);
+
+    const Int nc = Int(F.cols());
+
     FF.resize(F.rows(), F.cols());
     FFi.resize(F.rows(), F.cols());
     FF.setConstant(-1);
     FFi.setConstant(-1);
 
-    for (int f = 0; f < F.rows(); ++f) {
-        for (int p = 0; p < F.cols(); ++p) {
-            int v = F(f, p);
-            std::vector<int> const& VF_adj = VF[v];
-            std::vector<int> const& VFi_adj = VFi[v];
+    for (Int f = 0; f < F.rows(); ++f) {
+        for (Int p = 0; p < nc; ++p) {
+            Int v = F(f, p);
+            std::vector<Int> const& VF_adj = VF[v];
+            std::vector<Int> const& VFi_adj = VFi[v];
 
-            int v_next = F(f, (p + 1) % F.cols());
+            Int v_next = F(f, (p + 1) % nc);
 
             for (std::size_t i = 0; i < VF_adj.size(); ++i) {
-                int f_adj = VF_adj[i];
+                Int f_adj = VF_adj[i];
+
+                if (f_adj == f) {
+                    continue;
+                }
+
+                Int fi_adj = VFi_adj[i];
+                Int fi_prev = (nc + fi_adj - 1) % nc;
+
+                if (F(f_adj, fi_prev) == v_next) {
+                    // trovato!
+                    FF(f, p) = f_adj;
+                    FFi(f, p) = fi_prev;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Calcola la lista di facce adiacenti ad ogni faccia, a partire
+ * dall'adiacenza vertice->facce in formato compresso (CSR).
+ *
+ * Stesso risultato di face_face_adjacency() con array di array, ma usa
+ * l'adiacenza prodotta da vertex_face_adjacency() in formato CSR. Le facce
+ * sono elaborate in parallelo: ogni faccia scrive solo la propria riga di FF
+ * e FFi.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh, con i vertici in senso antiorario.
+ * @param VFoffsets Offset delle liste di corner di ogni vertice in VFc.
+ * @param VFc Corner incidenti su ogni vertice, codificati come f * F.cols() + p.
+ * @param FF Lista di indici di facce adiacenti per ogni faccia (-1 sul bordo).
+ * @param FFi Per ogni faccia e lato, il lato corrispondente della faccia
+ *            adiacente (-1 sul bordo).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedO, typename DerivedC, typename DerivedFF, typename DerivedFFi>
+void face_face_adjacency(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    MatrixBase<DerivedO> const &VFoffsets,
+    MatrixBase<DerivedC> const &VFc,
+    PlainObjectBase<DerivedFF> &FF,
+    PlainObjectBase<DerivedFFi> &FFi)
+{
+    typedef typename DerivedC::Scalar Int;
+
+    WS_PROFILE_SCOPE("face_face_adjacency/csr");
+    WS_PROFILE_COUNT("half_edges", F.rows() * F.cols());
+    WS_PROFILE_COUNT("allocated_bytes", F.rows() * F.cols() * sizeof(Int) * 2);
+
+    const Int nc = Int(F.cols());
+
+    FF.resize(F.rows(), F.cols());
+    FFi.resize(F.rows(), F.cols());
+    FF.setConstant(-1);
+    FFi.setConstant(-1);
+
+    parallel::parallel_for(Int(F.rows()), [&](Int f) {
+        for (Int p = 0; p < nc; ++p) {
+            Int v = F(f, p);
+            Int v_next = F(f, (p + 1) % nc);
+
+            for (Int k = VFoffsets(v); k < VFoffsets(v + 1); ++k) {
+                Int f_adj = VFc(k) / nc;
 
                 if (f_adj == f) {
                     continue;
                 }
 
-                int fi_adj = VFi_adj[i];
-                int fi_prev = (F.cols() + fi_adj - 1) % F.cols();
+                Int fi_adj = VFc(k) % nc;
+                Int fi_prev = (nc + fi_adj - 1) % nc;
 
                 if (F(f_adj, fi_prev) == v_next) {
                     // trovato!
@@ -123,5 +303,140 @@ void face_face_adjacency(
                 }
             }
         }
+    }, 1 << 14);
+}
+
+/**
+ * @brief Calcola la lista di facce adiacenti ad ogni faccia, accoppiando ogni
+ * lato orientato (half-edge) con il suo gemello.
+ *
+ * Ogni corner p della faccia f definisce il lato orientato
+ * (F(f, p), F(f, (p + 1) % F.cols())). Il lato gemello e' lo stesso lato
+ * percorso in senso opposto da un'altra faccia. Ad ogni lato viene associata
+ * una chiave a 64 bit costruita con i suoi due vertici (prima il minore), per
+ * cui i due gemelli hanno la stessa chiave: ordinando i lati per chiave con
+ * radix_sort() i gemelli risultano consecutivi. Il costo e' lineare nel numero
+ * di corner e non dipende dalla valenza dei vertici; tutte le fasi sono
+ * parallele.
+ *
+ * Il risultato coincide con quello di face_face_adjacency() basata
+ * sull'adiacenza vertice->facce: su un lato non-manifold (piu' di due facce)
+ * viene scelta, come li', l'ultima faccia (di indice maggiore) che percorre
+ * il lato in senso opposto. Solo su facce degeneri (con vertici ripetuti) la
+ * scelta del gemello puo' differire. Per mesh con difetti topologici,
+ * repairMesh() (meshRepair.hpp) rende ogni lato manifold prima del calcolo.
+ *
+ * @param V I vertici della mesh.
+ * @param F I triangoli della mesh, con i vertici in senso antiorario.
+ * @param FF Lista di indici di facce adiacenti per ogni faccia. Ogni riga corrisponde
+ *           alla lista di adiacenza di una faccia. Ogni faccia ha F.cols() lati,
+ *           per cui avra' F.cols() facce adiacenti (alcune potrebbero essere
+ *           nulle in presenza di buchi - indice -1).
+ * @param FFi Lista di indici per ogni faccia. Stessa dimensionalita' di FF. Ogni
+ *            riga corrisponde a indici per una faccia, un indice per ogni faccia
+ *            adiacente. Alla riga i, colonna j, l'indice corrisponde al lato della
+ *            j-esima faccia adiacente alla i-esima, condiviso con il lato j-esimo
+ *            della faccia i-esima.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedFF, typename DerivedFFi>
+void face_face_adjacency(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedFF> &FF,
+    PlainObjectBase<DerivedFFi> &FFi)
+{
+    typedef typename DerivedFF::Scalar Int;
+
+    WS_PROFILE_SCOPE("face_face_adjacency/edges");
+
+    const Int nc = Int(F.cols());
+    const Int nf = Int(F.rows());
+    const Int ncorners = nf * nc;
+    const size_t min_parallel = 1 << 14;
+
+    WS_PROFILE_COUNT("half_edges", ncorners);
+    // FF, FFi e chiavi e corner del radix sort (con doppio buffer)
+    WS_PROFILE_COUNT("allocated_bytes", ncorners * (sizeof(Int) * 2 + (sizeof(std::uint64_t) + sizeof(Int)) * 2));
+
+    FF.resize(nf, nc);
+    FFi.resize(nf, nc);
+    FF.setConstant(-1);
+    FFi.setConstant(-1);
+
+    if (ncorners == 0) {
+        return;
     }
+
+    // bit necessari per un indice di vertice (le chiavi a 64 bit limitano i
+    // vertici a 2^32, non i corner)
+    int bits = 1;
+    while (bits < 32 && (std::int64_t(1) << bits) < V.rows()) {
+        ++bits;
+    }
+
+    auto from = [&](Int c) { return F(c / nc, c % nc); };
+    auto to = [&](Int c) { return F(c / nc, (c % nc + 1) % nc); };
+
+    std::vector<std::uint64_t> keys(ncorners);
+    std::vector<Int> corners(ncorners);
+    parallel::parallel_for(ncorners, [&](Int c) {
+        std::uint64_t a = std::uint64_t(from(c));
+        std::uint64_t b = std::uint64_t(to(c));
+        keys[c] = (std::min(a, b) << bits) | std::max(a, b);
+        corners[c] = c;
+    }, min_parallel);
+
+    radix_sort(keys, corners, 2 * bits);
+
+    // ogni gruppo di chiavi uguali contiene i lati orientati di uno stesso lato
+    parallel::parallel_for(ncorners, [&](Int g) {
+        if (g > 0 && keys[g] == keys[g - 1]) {
+            return;
+        }
+        Int end = g + 1;
+        while (end < ncorners && keys[end] == keys[g]) {
+            ++end;
+        }
+
+        // caso comune, lato manifold: due lati orientati in senso opposto
+        if (end - g == 2) {
+            Int c0 = corners[g];
+            Int c1 = corners[g + 1];
+            if (from(c0) == to(c1) && to(c0) == from(c1) && c0 / nc != c1 / nc) {
+                FF(c0 / nc, c0 % nc) = c1 / nc;
+                FFi(c0 / nc, c0 % nc) = c1 % nc;
+                FF(c1 / nc, c1 % nc) = c0 / nc;
+                FFi(c1 / nc, c1 % nc) = c0 % nc;
+            }
+            return;
+        }
+
+        // lato non-manifold: l'ultimo gemello in ordine di faccia. Per ogni
+        // verso di percorrenza (0: dal vertice minore, 1: dal maggiore,
+        // 2: lato degenere) si cercano l'ultimo lato orientato e l'ultimo di
+        // una faccia diversa da quella, nel caso il primo sia della stessa
+        // faccia del lato da accoppiare.
+        auto dir = [&](Int c) { return from(c) < to(c) ? 0 : (from(c) > to(c) ? 1 : 2); };
+        Int last[3] = {-1, -1, -1};
+        Int lastOther[3] = {-1, -1, -1};
+        for (Int i = end - 1; i >= g; --i) {
+            Int c = corners[i];
+            Int d = dir(c);
+            if (last[d] < 0) {
+                last[d] = c;
+            } else if (lastOther[d] < 0 && c / nc != last[d] / nc) {
+                lastOther[d] = c;
+            }
+        }
+        const int opposite[3] = {1, 0, 2};
+        for (Int i = g; i < end; ++i) {
+            Int c = corners[i];
+            Int d = opposite[dir(c)];
+            Int c_adj = (last[d] >= 0 && last[d] / nc != c / nc) ? last[d] : lastOther[d];
+            if (c_adj >= 0 && c_adj / nc != c / nc) {
+                FF(c / nc, c % nc) = c_adj / nc;
+                FFi(c / nc, c % nc) = c_adj % nc;
+            }
+        }
+    }, min_parallel);
 }
\ No newline at end of file
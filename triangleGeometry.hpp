@@ -0,0 +1,831 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "parallelFor.hpp"
+#include "profiler.hpp"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace Eigen;
+
+/**
+ * Kernel vettoriale per la geometria dei triangoli.
+ *
+ * I triangoli vengono elaborati a blocchi di Pack::width facce: gli indici
+ * dei vertici (colonne di F, contigue in memoria perche' le matrici Eigen sono
+ * column-major) e le coordinate (colonne di V, lette con istruzioni gather)
+ * vengono caricati in registri SIMD in formato structure-of-arrays, una
+ * corsia (lane) per triangolo. Le uscite sono anch'esse colonne contigue.
+ *
+ * Il kernel e' generico sul tipo delle coordinate (double o float) e degli
+ * indici (int a 32 bit o std::int64_t, per mesh con piu' di 2^31 corner). Le
+ * implementazioni disponibili, scelte a tempo di compilazione per ogni
+ * combinazione di tipi (NativePack), sono:
+ * - AVX-512 (__AVX512F__): 8 triangoli per iterazione in double, 16 in float
+ *   con indici a 32 bit;
+ * - AVX2 (__AVX2__): 4 triangoli per iterazione in double, 8 in float con
+ *   indici a 32 bit, 4 in float con indici a 64 bit (anche con AVX-512);
+ * - scalare: 1 triangolo per iterazione, usata anche per le facce che non
+ *   riempiono l'ultimo blocco.
+ * In float ogni blocco legge e scrive meta' dei byte: il calcolo e' limitato
+ * dalla banda di memoria, per cui anche il tempo si riduce di conseguenza.
+ * Per abilitare le versioni vettoriali occorre compilare per l'architettura
+ * della macchina (opzione CMake WS_GEO3D_NATIVE_ARCH).
+ */
+namespace triangle_geometry {
+
+template <typename S, typename I>
+struct PackScalar
+{
+    static const int width = 1;
+    typedef S scalar;
+    typedef S type;
+    typedef bool mask;
+
+    static type set1(S a) { return a; }
+    static type load(S const *p) { return *p; }
+    static void store(S *p, type a) { *p = a; }
+    static type gather(S const *base, I const *idx) { return base[*idx]; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type round(type a) { return std::nearbyint(a); }
+    static type abs(type a) { return std::abs(a); }
+    static type min(type a, type b) { return a < b ? a : b; }
+    static type max(type a, type b) { return a > b ? a : b; }
+    static mask gt(type a, type b) { return a > b; }
+    static mask lt(type a, type b) { return a < b; }
+    static type select(mask m, type a, type b) { return m ? a : b; }
+};
+
+// la combinazione di tipi migliore per la macchina, vedi sotto
+template <typename S, typename I>
+struct NativePack
+{
+    typedef PackScalar<S, I> type;
+};
+
+#if defined(__AVX2__)
+// operazioni aritmetiche, comuni a tutti i tipi di indice
+struct OpsAVX2d
+{
+    static const int width = 4;
+    typedef double scalar;
+    typedef __m256d type;
+    typedef __m256d mask;
+
+    static type set1(double a) { return _mm256_set1_pd(a); }
+    static type load(double const *p) { return _mm256_loadu_pd(p); }
+    static void store(double *p, type a) { _mm256_storeu_pd(p, a); }
+    static type add(type a, type b) { return _mm256_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm256_div_pd(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+    static type round(type a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type abs(type a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    static type min(type a, type b) { return _mm256_min_pd(a, b); }
+    static type max(type a, type b) { return _mm256_max_pd(a, b); }
+    static mask gt(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static mask lt(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_pd(b, a, m); }
+};
+
+struct OpsAVX2f
+{
+    static const int width = 8;
+    typedef float scalar;
+    typedef __m256 type;
+    typedef __m256 mask;
+
+    static type set1(float a) { return _mm256_set1_ps(a); }
+    static type load(float const *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, type a) { _mm256_storeu_ps(p, a); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+    static type round(type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type abs(type a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static type min(type a, type b) { return _mm256_min_ps(a, b); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static mask gt(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static mask lt(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_ps(b, a, m); }
+};
+
+// float con indici a 64 bit: il gather di 4 indici produce 4 float
+struct OpsSSEf
+{
+    static const int width = 4;
+    typedef float scalar;
+    typedef __m128 type;
+    typedef __m128 mask;
+
+    static type set1(float a) { return _mm_set1_ps(a); }
+    static type load(float const *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, type a) { _mm_storeu_ps(p, a); }
+    static type add(type a, type b) { return _mm_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm_div_ps(a, b); }
+    static type sqrt(type a) { return _mm_sqrt_ps(a); }
+    static type round(type a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type abs(type a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    static type min(type a, type b) { return _mm_min_ps(a, b); }
+    static type max(type a, type b) { return _mm_max_ps(a, b); }
+    static mask gt(type a, type b) { return _mm_cmp_ps(a, b, _CMP_GT_OQ); }
+    static mask lt(type a, type b) { return _mm_cmp_ps(a, b, _CMP_LT_OQ); }
+    static type select(mask m, type a, type b) { return _mm_blendv_ps(b, a, m); }
+};
+
+template <typename S, typename I>
+struct PackAVX2;
+
+template <>
+struct PackAVX2<double, int> : OpsAVX2d
+{
+    static type gather(double const *base, int const *idx)
+    {
+        return _mm256_i32gather_pd(base, _mm_loadu_si128(reinterpret_cast<__m128i const *>(idx)), 8);
+    }
+};
+
+template <>
+struct PackAVX2<double, std::int64_t> : OpsAVX2d
+{
+    static type gather(double const *base, std::int64_t const *idx)
+    {
+        return _mm256_i64gather_pd(base, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(idx)), 8);
+    }
+};
+
+template <>
+struct PackAVX2<float, int> : OpsAVX2f
+{
+    static type gather(float const *base, int const *idx)
+    {
+        return _mm256_i32gather_ps(base, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(idx)), 4);
+    }
+};
+
+template <>
+struct PackAVX2<float, std::int64_t> : OpsSSEf
+{
+    static type gather(float const *base, std::int64_t const *idx)
+    {
+        return _mm256_i64gather_ps(base, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(idx)), 4);
+    }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct OpsAVX512d
+{
+    static const int width = 8;
+    typedef double scalar;
+    typedef __m512d type;
+    typedef __mmask8 mask;
+
+    static type set1(double a) { return _mm512_set1_pd(a); }
+    static type load(double const *p) { return _mm512_loadu_pd(p); }
+    static void store(double *p, type a) { _mm512_storeu_pd(p, a); }
+    static type add(type a, type b) { return _mm512_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+    static type div(type a, type b) { return _mm512_div_pd(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_pd(a); }
+    static type round(type a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type abs(type a) { return _mm512_abs_pd(a); }
+    static type min(type a, type b) { return _mm512_min_pd(a, b); }
+    static type max(type a, type b) { return _mm512_max_pd(a, b); }
+    static mask gt(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static mask lt(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_pd(m, b, a); }
+};
+
+struct OpsAVX512f
+{
+    static const int width = 16;
+    typedef float scalar;
+    typedef __m512 type;
+    typedef __mmask16 mask;
+
+    static type set1(float a) { return _mm512_set1_ps(a); }
+    static type load(float const *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, type a) { _mm512_storeu_ps(p, a); }
+    static type add(type a, type b) { return _mm512_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+    static type div(type a, type b) { return _mm512_div_ps(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_ps(a); }
+    static type round(type a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type abs(type a) { return _mm512_abs_ps(a); }
+    static type min(type a, type b) { return _mm512_min_ps(a, b); }
+    static type max(type a, type b) { return _mm512_max_ps(a, b); }
+    static mask gt(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static mask lt(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_ps(m, b, a); }
+};
+
+template <typename S, typename I>
+struct PackAVX512;
+
+template <>
+struct PackAVX512<double, int> : OpsAVX512d
+{
+    static type gather(double const *base, int const *idx)
+    {
+        return _mm512_i32gather_pd(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(idx)), base, 8);
+    }
+};
+
+template <>
+struct PackAVX512<double, std::int64_t> : OpsAVX512d
+{
+    static type gather(double const *base, std::int64_t const *idx)
+    {
+        return _mm512_i64gather_pd(_mm512_loadu_si512(idx), base, 8);
+    }
+};
+
+template <>
+struct PackAVX512<float, int> : OpsAVX512f
+{
+    static type gather(float const *base, int const *idx)
+    {
+        return _mm512_i32gather_ps(_mm512_loadu_si512(idx), base, 4);
+    }
+};
+
+template <> struct NativePack<double, int> { typedef PackAVX512<double, int> type; };
+template <> struct NativePack<double, std::int64_t> { typedef PackAVX512<double, std::int64_t> type; };
+template <> struct NativePack<float, int> { typedef PackAVX512<float, int> type; };
+template <> struct NativePack<float, std::int64_t> { typedef PackAVX2<float, std::int64_t> type; };
+#elif defined(__AVX2__)
+template <> struct NativePack<double, int> { typedef PackAVX2<double, int> type; };
+template <> struct NativePack<double, std::int64_t> { typedef PackAVX2<double, std::int64_t> type; };
+template <> struct NativePack<float, int> { typedef PackAVX2<float, int> type; };
+template <> struct NativePack<float, std::int64_t> { typedef PackAVX2<float, std::int64_t> type; };
+#endif
+
+/**
+ * @brief Approssimazione vettoriale di atan2(y, x) per y >= 0 (risultato in
+ * [0, pi]), come serve per l'angolo di un triangolo su un vertice:
+ * y = ||e0 ^ e1||, x = e0 . e1.
+ *
+ * Il rapporto a = min(|x|, y) / max(|x|, y) in [0, 1] viene ridotto
+ * all'intervallo [-tan(pi/8), tan(pi/8)] con atan(a) = pi/4 + atan((a-1)/(a+1))
+ * e l'arcotangente e' approssimata con un polinomio dispari di grado 17
+ * (coefficienti ai minimi quadrati sui nodi di Chebyshev). L'errore assoluto
+ * massimo, misurato su tutto [0, pi], e' inferiore a 1e-14 radianti in double;
+ * in float l'errore e' dominato dall'arrotondamento (circa 1e-7 radianti).
+ * Nessun ramo dipende dai dati, per cui tutte le corsie seguono lo stesso
+ * flusso.
+ */
+template <typename P>
+typename P::type atan2_approx(typename P::type y, typename P::type x)
+{
+    typedef typename P::type T;
+    typedef typename P::scalar S;
+
+    const double coeffs[9] = {
+        9.99999999999762365e-01, -3.33333333249466792e-01, 1.99999991297282586e-01,
+        -1.42856730969037858e-01, 1.11100497175049983e-01, -9.07470844537681202e-02,
+        7.54064664015085613e-02, -5.79789869388766028e-02, 2.96140647154675957e-02};
+
+    const T zero = P::set1(S(0));
+    const T one = P::set1(S(1));
+
+    T ax = P::abs(x);
+    T num = P::min(ax, y);
+    T den = P::max(ax, y);
+    T a = P::select(P::gt(den, zero), P::div(num, den), zero);
+
+    // riduzione dell'argomento
+    auto big = P::gt(a, P::set1(S(0.41421356237309503)));
+    T t = P::select(big, P::div(P::sub(a, one), P::add(a, one)), a);
+
+    T s = P::mul(t, t);
+    T p = P::set1(S(coeffs[8]));
+    for (int k = 7; k >= 0; --k) {
+        p = P::add(P::mul(p, s), P::set1(S(coeffs[k])));
+    }
+    T r = P::mul(t, p);
+
+    r = P::select(big, P::add(r, P::set1(S(M_PI / 4))), r);
+    r = P::select(P::gt(y, ax), P::sub(P::set1(S(M_PI / 2)), r), r);
+    r = P::select(P::lt(x, zero), P::sub(P::set1(S(M_PI)), r), r);
+    return r;
+}
+
+/**
+ * @brief Elabora i P::width triangoli i cui indici iniziano in F.
+ *
+ * Scrive la normale unitaria di ogni faccia in FN e, se angles e' true, l'area
+ * in Fareas e gli angoli ai 3 corner in Fangles (puntatori alla prima faccia
+ * del blocco nelle colonne, di passo ostride). V e F hanno colonne di passo
+ * vstride e fstride.
+ */
+template <typename P, bool angles, typename S, typename I>
+void block(
+    S const *V, long vstride,
+    I const *F, long fstride,
+    S *FN, S *Fareas, S *Fangles, long ostride)
+{
+    typedef typename P::type T;
+
+    I const *ia = F;
+    I const *ib = F + fstride;
+    I const *ic = F + 2 * fstride;
+
+    T Ax = P::gather(V, ia), Ay = P::gather(V + vstride, ia), Az = P::gather(V + 2 * vstride, ia);
+    T Bx = P::gather(V, ib), By = P::gather(V + vstride, ib), Bz = P::gather(V + 2 * vstride, ib);
+    T Cx = P::gather(V, ic), Cy = P::gather(V + vstride, ic), Cz = P::gather(V + 2 * vstride, ic);
+
+    // lati uscenti da A
+    T ux = P::sub(Bx, Ax), uy = P::sub(By, Ay), uz = P::sub(Bz, Az);
+    T vx = P::sub(Cx, Ax), vy = P::sub(Cy, Ay), vz = P::sub(Cz, Az);
+
+    // prodotto vettoriale (B - A) ^ (C - A)
+    T cx = P::sub(P::mul(uy, vz), P::mul(uz, vy));
+    T cy = P::sub(P::mul(uz, vx), P::mul(ux, vz));
+    T cz = P::sub(P::mul(ux, vy), P::mul(uy, vx));
+
+    T len = P::sqrt(P::add(P::add(P::mul(cx, cx), P::mul(cy, cy)), P::mul(cz, cz)));
+
+    // come Vector3d::normalized(): un vettore nullo resta nullo
+    auto nonzero = P::gt(len, P::set1(S(0)));
+    P::store(FN, P::select(nonzero, P::div(cx, len), cx));
+    P::store(FN + ostride, P::select(nonzero, P::div(cy, len), cy));
+    P::store(FN + 2 * ostride, P::select(nonzero, P::div(cz, len), cz));
+
+    if (angles) {
+        P::store(Fareas, P::mul(len, P::set1(S(0.5))));
+
+        // il seno dei 3 angoli e' proporzionale alla stessa norma ||c||,
+        // il coseno al prodotto scalare dei due lati uscenti dal corner
+        T wx = P::sub(Cx, Bx), wy = P::sub(Cy, By), wz = P::sub(Cz, Bz);
+        T d0 = P::add(P::add(P::mul(ux, vx), P::mul(uy, vy)), P::mul(uz, vz));
+        T d1 = P::sub(P::set1(S(0)), P::add(P::add(P::mul(wx, ux), P::mul(wy, uy)), P::mul(wz, uz)));
+        T d2 = P::add(P::add(P::mul(vx, wx), P::mul(vy, wy)), P::mul(vz, wz));
+
+        P::store(Fangles, atan2_approx<P>(len, d0));
+        P::store(Fangles + ostride, atan2_approx<P>(len, d1));
+        P::store(Fangles + 2 * ostride, atan2_approx<P>(len, d2));
+    }
+}
+
+// valori per faccia nel record interlacciato: normale (3) e pesi dei corner (3)
+const int record_size = 6;
+
+/**
+ * @brief Come block(), ma scrive i P::width record interlacciati a partire da
+ * R: per ogni faccia la normale unitaria e, per ogni corner p, il peso
+ * area * angolo(p) con cui la faccia contribuisce alle normali ai vertici e
+ * ai corner.
+ */
+template <typename P, typename S, typename I>
+void record_block(
+    S const *V, long vstride,
+    I const *F, long fstride,
+    S *R)
+{
+    const long w = P::width;
+    S n[3 * P::width], area[P::width], angle[3 * P::width];
+    block<P, true>(V, vstride, F, fstride, n, area, angle, w);
+    for (long l = 0; l < w; ++l) {
+        S *r = R + l * record_size;
+        for (long k = 0; k < 3; ++k) {
+            r[k] = n[k * w + l];
+            r[3 + k] = area[l] * angle[k * w + l];
+        }
+    }
+}
+
+/**
+ * @brief Esegue il kernel su tutte le facce, in parallelo.
+ *
+ * V e F sono viste Eigen::Ref column-major: matrici, Map e blocchi di colonne
+ * vengono letti senza copie, le altre espressioni (ad esempio matrici
+ * row-major) vengono valutate una volta in una matrice temporanea.
+ */
+template <bool angles, typename S, typename I>
+void run(
+    Ref<const Matrix<S, Dynamic, Dynamic>> const &V,
+    Ref<const Matrix<I, Dynamic, Dynamic>> const &F,
+    S *FN, S *Fareas, S *Fangles)
+{
+    typedef typename NativePack<S, I>::type P;
+
+    WS_PROFILE_SCOPE("triangleGeometry");
+    WS_PROFILE_COUNT("geometry_faces", F.rows());
+
+    const long nf = long(F.rows());
+    const long vstride = long(V.outerStride());
+    const long fstride = long(F.outerStride());
+    const long w = P::width;
+    const long nblocks = nf / w;
+
+    // blocchi di 1024 facce per task, per ammortizzare il costo dei thread
+    const long per_task = std::max(1L, 1024 / w);
+    const long ntasks = (nblocks + per_task - 1) / per_task;
+
+    parallel::parallel_for(ntasks, [&](long t) {
+        long end = std::min(nblocks, (t + 1) * per_task);
+        for (long b = t * per_task; b < end; ++b) {
+            long f0 = b * w;
+            block<P, angles>(V.data(), vstride, F.data() + f0, fstride, FN + f0,
+                             angles ? Fareas + f0 : nullptr, angles ? Fangles + f0 : nullptr, nf);
+        }
+    }, 16);
+
+    // facce rimanenti, una alla volta
+    for (long f = nblocks * w; f < nf; ++f) {
+        block<PackScalar<S, I>, angles>(V.data(), vstride, F.data() + f, fstride, FN + f,
+                                        angles ? Fareas + f : nullptr, angles ? Fangles + f : nullptr, nf);
+    }
+}
+
+/**
+ * @brief Esegue il kernel su tutte le facce, in parallelo, scrivendo i record
+ * interlacciati (record_size valori per faccia) in R.
+ */
+template <typename S, typename I>
+void run_records(
+    Ref<const Matrix<S, Dynamic, Dynamic>> const &V,
+    Ref<const Matrix<I, Dynamic, Dynamic>> const &F,
+    S *R)
+{
+    typedef typename NativePack<S, I>::type P;
+
+    WS_PROFILE_SCOPE("faceRecords");
+    WS_PROFILE_COUNT("geometry_faces", F.rows());
+
+    const long nf = long(F.rows());
+    const long vstride = long(V.outerStride());
+    const long fstride = long(F.outerStride());
+    const long w = P::width;
+    const long nblocks = nf / w;
+
+    const long per_task = std::max(1L, 1024 / w);
+    const long ntasks = (nblocks + per_task - 1) / per_task;
+
+    parallel::parallel_for(ntasks, [&](long t) {
+        long end = std::min(nblocks, (t + 1) * per_task);
+        for (long b = t * per_task; b < end; ++b) {
+            long f0 = b * w;
+            record_block<P>(V.data(), vstride, F.data() + f0, fstride, R + f0 * record_size);
+        }
+    }, 16);
+
+    for (long f = nblocks * w; f < nf; ++f) {
+        record_block<PackScalar<S, I>>(V.data(), vstride, F.data() + f, fstride, R + f * record_size);
+    }
+}
+
+/**
+ * @brief Esegue il kernel solo sulle facce indicate, aggiornando le righe
+ * corrispondenti di FN, Fareas e Fangles.
+ *
+ * Ogni faccia viene calcolata con la stessa implementazione usata da run():
+ * le facce dei blocchi completi vengono raccolte a gruppi di P::width in un
+ * blocco locale (l'ultimo completato ripetendo l'ultima faccia) ed elaborate
+ * con il pack vettoriale, quelle dell'ultimo blocco incompleto con il pack
+ * scalare. Poiche' le corsie sono indipendenti, il risultato e' identico bit
+ * a bit a quello di run() su tutta la mesh.
+ */
+template <bool angles, typename S, typename I>
+void run(
+    Ref<const Matrix<S, Dynamic, Dynamic>> const &V,
+    Ref<const Matrix<I, Dynamic, Dynamic>> const &F,
+    I const *faces, long count,
+    S *FN, S *Fareas, S *Fangles)
+{
+    typedef typename NativePack<S, I>::type P;
+
+    WS_PROFILE_SCOPE("triangleGeometry/subset");
+    WS_PROFILE_COUNT("geometry_faces", count);
+
+    const long nf = long(F.rows());
+    const long vstride = long(V.outerStride());
+    const long fstride = long(F.outerStride());
+    const long w = P::width;
+    const long full = nf / w * w;
+
+    std::vector<I> vec;
+    for (long k = 0; k < count; ++k) {
+        if (long(faces[k]) < full) {
+            vec.push_back(faces[k]);
+        } else {
+            long f = long(faces[k]);
+            block<PackScalar<S, I>, angles>(V.data(), vstride, F.data() + f, fstride, FN + f,
+                                            angles ? Fareas + f : nullptr, angles ? Fangles + f : nullptr, nf);
+        }
+    }
+
+    const long nblocks = (long(vec.size()) + w - 1) / w;
+    parallel::parallel_for(nblocks, [&](long b) {
+        // blocco locale: w facce, colonne di passo w
+        I lf[3 * P::width];
+        S ln[3 * P::width], la[P::width], lang[3 * P::width];
+        for (long l = 0; l < w; ++l) {
+            I f = vec[std::min(b * w + l, long(vec.size()) - 1)];
+            for (long p = 0; p < 3; ++p) {
+                lf[p * w + l] = F(f, p);
+            }
+        }
+        block<P, angles>(V.data(), vstride, lf, w, ln, la, lang, w);
+        for (long l = 0; l < w && b * w + l < long(vec.size()); ++l) {
+            I f = vec[b * w + l];
+            for (long p = 0; p < 3; ++p) {
+                FN[p * nf + f] = ln[p * w + l];
+                if (angles) {
+                    Fangles[p * nf + f] = lang[p * w + l];
+                }
+            }
+            if (angles) {
+                Fareas[f] = la[l];
+            }
+        }
+    }, 16);
+}
+
+} // namespace triangle_geometry
+
+/**
+ * @brief Calcola la direzione normale di ogni triangolo della mesh, con il
+ * kernel vettoriale.
+ *
+ * @param V I vertici della mesh (V.rows() x 3), in double o float.
+ * @param F I triangoli della mesh (F.rows() x 3), con i vertici in senso
+ *          antiorario; indici int o std::int64_t.
+ * @param FN Le normali unitarie dei triangoli (F.rows() x 3), dello stesso
+ *           tipo di V: la riga f e' (B - A) ^ (C - A) normalizzato, per il
+ *           triangolo f = (A, B, C).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedN>
+void triangleGeometry(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedN> &FN)
+{
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
+    static_assert(std::is_same<Scalar, typename DerivedN::Scalar>::value, "FN deve avere lo stesso tipo di V");
+    static_assert(!DerivedN::IsRowMajor, "FN deve essere column-major");
+
+    FN.resize(F.rows(), 3);
+    triangle_geometry::run<false, Scalar, Int>(V, F, FN.data(), nullptr, nullptr);
+}
+
+/**
+ * @brief Calcola normale, area e angoli ai corner di ogni triangolo della
+ * mesh, con il kernel vettoriale.
+ *
+ * Gli angoli sono calcolati come atan2(||e0 ^ e1||, e0 . e1), dove e0 ed e1
+ * sono i lati uscenti dal corner, con l'approssimazione atan2_approx()
+ * (errore assoluto inferiore a 1e-14 radianti in double).
+ *
+ * @param V I vertici della mesh (V.rows() x 3), in double o float.
+ * @param F I triangoli della mesh (F.rows() x 3), con i vertici in senso
+ *          antiorario; indici int o std::int64_t.
+ * @param FN Le normali unitarie dei triangoli (F.rows() x 3).
+ * @param Fareas Le aree dei triangoli (F.rows()).
+ * @param Fangles Gli angoli, in radianti, dei triangoli ai loro 3 corner
+ *                (F.rows() x 3): Fangles(f, p) e' l'angolo sul vertice F(f, p).
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedN, typename DerivedA, typename DerivedAng>
+void triangleGeometry(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedN> &FN,
+    PlainObjectBase<DerivedA> &Fareas,
+    PlainObjectBase<DerivedAng> &Fangles)
+{
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
+    static_assert(std::is_same<Scalar, typename DerivedN::Scalar>::value &&
+                  std::is_same<Scalar, typename DerivedA::Scalar>::value &&
+                  std::is_same<Scalar, typename DerivedAng::Scalar>::value,
+                  "FN, Fareas e Fangles devono avere lo stesso tipo di V");
+    static_assert(!DerivedN::IsRowMajor && !DerivedAng::IsRowMajor, "FN e Fangles devono essere column-major");
+
+    FN.resize(F.rows(), 3);
+    Fareas.resize(F.rows(), 1);
+    Fangles.resize(F.rows(), 3);
+    triangle_geometry::run<true, Scalar, Int>(V, F, FN.data(), Fareas.data(), Fangles.data());
+}
+
+/**
+ * @brief Aggiorna normale, area e angoli ai corner dei soli triangoli
+ * indicati, ad esempio dopo lo spostamento di alcuni vertici, lasciando
+ * invariate le altre righe. Il risultato e' identico a quello di
+ * triangleGeometry(V, F, FN, Fareas, Fangles) su tutta la mesh.
+ *
+ * @param V I vertici della mesh (V.rows() x 3).
+ * @param F I triangoli della mesh (F.rows() x 3).
+ * @param faces Gli indici dei triangoli da aggiornare, senza ripetizioni.
+ * @param FN Le normali dei triangoli (F.rows() x 3), gia' calcolate.
+ * @param Fareas Le aree dei triangoli (F.rows()), gia' calcolate.
+ * @param Fangles Gli angoli ai corner (F.rows() x 3), gia' calcolati.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedI, typename DerivedN, typename DerivedA, typename DerivedAng>
+void triangleGeometry(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedI> const &faces,
+    PlainObjectBase<DerivedN> &FN,
+    PlainObjectBase<DerivedA> &Fareas,
+    PlainObjectBase<DerivedAng> &Fangles)
+{
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
+    static_assert(std::is_same<Int, typename DerivedI::Scalar>::value, "faces deve avere lo stesso tipo di F");
+    static_assert(!DerivedN::IsRowMajor && !DerivedAng::IsRowMajor, "FN e Fangles devono essere column-major");
+
+    triangle_geometry::run<true, Scalar, Int>(V, F, faces.data(), long(faces.size()), FN.data(), Fareas.data(), Fangles.data());
+}
+
+/**
+ * @brief I record per faccia prodotti da faceRecords(): una riga di
+ * triangle_geometry::record_size valori per triangolo, contigui in memoria.
+ */
+template <typename Scalar>
+using FaceRecords = Matrix<Scalar, Dynamic, triangle_geometry::record_size, RowMajor>;
+
+/**
+ * @brief Calcola in una sola passata, con il kernel vettoriale, il record
+ * interlacciato di ogni triangolo: la normale unitaria (colonne 0-2) e, per
+ * ogni corner p, il peso Fareas(f) * Fangles(f, p) (colonna 3 + p) con cui il
+ * triangolo contribuisce alle normali ai vertici e ai corner.
+ *
+ * Rispetto a FN, Fareas e Fangles separati (7 colonne, ognuna in una zona
+ * diversa della memoria) i dati che servono per un corner stanno in una sola
+ * riga, e i valori sono identici bit a bit a quelli di triangleGeometry().
+ *
+ * @param V I vertici della mesh (V.rows() x 3), in double o float.
+ * @param F I triangoli della mesh (F.rows() x 3).
+ * @param R I record (F.rows() x record_size, row-major); la memoria viene
+ *          riutilizzata se R ha gia' la dimensione giusta.
+ */
+template <typename DerivedV, typename DerivedF, typename DerivedR>
+void faceRecords(
+    MatrixBase<DerivedV> const &V,
+    MatrixBase<DerivedF> const &F,
+    PlainObjectBase<DerivedR> &R)
+{
+    typedef typename DerivedV::Scalar Scalar;
+    typedef typename DerivedF::Scalar Int;
+    static_assert(std::is_same<Scalar, typename DerivedR::Scalar>::value, "R deve avere lo stesso tipo di V");
+    static_assert(DerivedR::IsRowMajor && DerivedR::ColsAtCompileTime == triangle_geometry::record_size,
+                  "R deve essere FaceRecords<Scalar>");
+
+    R.resize(F.rows(), triangle_geometry::record_size);
+    triangle_geometry::run_records<Scalar, Int>(V, F, R.data());
+}
+
+/**
+ * @brief Buffer di lavoro dei kernel delle normali che li accettano (ad
+ * esempio perVertexNormals(V, F, VFoffsets, VFc, workspace, N)): se lo stesso
+ * workspace viene passato a calcoli successivi sulla stessa mesh, questi non
+ * allocano memoria.
+ */
+template <typename Scalar, typename Int>
+struct NormalsWorkspace
+{
+    // i record per faccia, vedi faceRecords()
+    FaceRecords<Scalar> records;
+    // corner e union-find di un vertice, uno per thread (perCornerNormals)
+    std::vector<std::vector<Int>> corners;
+    std::vector<std::vector<Int>> parent;
+};
+
+namespace triangle_geometry {
+
+/**
+ * @brief Accesso alla geometria dei triangoli per i kernel delle normali,
+ * da FN, Fareas e Fangles separati (come calcolati da triangleGeometry()).
+ */
+template <typename DerivedN, typename DerivedA, typename DerivedAng>
+struct Arrays
+{
+    typedef typename DerivedN::Scalar Scalar;
+
+    MatrixBase<DerivedN> const &FN;
+    MatrixBase<DerivedA> const &Fareas;
+    MatrixBase<DerivedAng> const &Fangles;
+
+    template <typename Int>
+    Matrix<Scalar, 1, 3> normal(Int f) const { return FN.row(f); }
+
+    template <typename Int>
+    Scalar weight(Int f, Int p) const { return Fareas(f) * Fangles(f, p); }
+};
+
+template <typename DerivedN, typename DerivedA, typename DerivedAng>
+Arrays<DerivedN, DerivedA, DerivedAng> arrays(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedA> const &Fareas,
+    MatrixBase<DerivedAng> const &Fangles)
+{
+    return {FN, Fareas, Fangles};
+}
+
+/**
+ * @brief Accesso alla geometria dei triangoli per i kernel delle normali,
+ * dai record interlacciati di faceRecords().
+ */
+template <typename DerivedR>
+struct Records
+{
+    typedef typename DerivedR::Scalar Scalar;
+
+    MatrixBase<DerivedR> const &R;
+
+    template <typename Int>
+    Matrix<Scalar, 1, 3> normal(Int f) const { return R.template block<1, 3>(f, 0); }
+
+    template <typename Int>
+    Scalar weight(Int f, Int p) const { return R(f, 3 + p); }
+};
+
+template <typename DerivedR>
+Records<DerivedR> records(MatrixBase<DerivedR> const &R)
+{
+    return {R};
+}
+
+} // namespace triangle_geometry
+
+/**
+ * @brief Calcola il coseno dell'angolo diedrale fra ogni triangolo e i suoi
+ * adiacenti, come prodotto scalare fra le rispettive normali.
+ *
+ * @param FN Le normali unitarie dei triangoli (F.rows() x 3).
+ * @param FF L'adiacenza faccia->facce, risultato di face_face_adjacency().
+ * @param FF_cosines Per ogni faccia f e lato p, il coseno fra FN.row(f) e
+ *                   FN.row(FF(f, p)) (F.rows() x 3). I lati di bordo
+ *                   (FF(f, p) == -1) non hanno faccia adiacente: il coseno
+ *                   vale -1, cioe' il lato non e' mai considerato smooth.
+ */
+template <typename DerivedN, typename DerivedFF, typename DerivedC>
+void dihedralCosines(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedFF> const &FF,
+    PlainObjectBase<DerivedC> &FF_cosines)
+{
+    typedef typename DerivedC::Scalar Scalar;
+    typedef typename DerivedFF::Scalar Int;
+
+    WS_PROFILE_SCOPE("dihedralCosines");
+
+    FF_cosines.resize(FF.rows(), FF.cols());
+    parallel::parallel_for(Int(FF.rows()), [&](Int f) {
+        auto const &fn = FN.row(f);
+        for (int p = 0; p < FF.cols(); ++p) {
+            FF_cosines(f, p) = FF(f, p) < 0 ? Scalar(-1) : Scalar(fn.dot(FN.row(FF(f, p))));
+        }
+    }, 1 << 14);
+}
+
+/**
+ * @brief Aggiorna i coseni degli angoli diedrali delle sole facce indicate
+ * (righe di FF_cosines), lasciando invariate le altre.
+ *
+ * Se sono cambiate le normali di alcune facce, vanno aggiornate le righe di
+ * quelle facce e delle loro adiacenti.
+ */
+template <typename DerivedN, typename DerivedFF, typename DerivedI, typename DerivedC>
+void dihedralCosines(
+    MatrixBase<DerivedN> const &FN,
+    MatrixBase<DerivedFF> const &FF,
+    MatrixBase<DerivedI> const &faces,
+    PlainObjectBase<DerivedC> &FF_cosines)
+{
+    typedef typename DerivedC::Scalar Scalar;
+    typedef typename DerivedFF::Scalar Int;
+
+    WS_PROFILE_SCOPE("dihedralCosines/subset");
+
+    parallel::parallel_for(Int(faces.size()), [&](Int k) {
+        Int f = faces(k);
+        auto const &fn = FN.row(f);
+        for (int p = 0; p < FF.cols(); ++p) {
+            FF_cosines(f, p) = FF(f, p) < 0 ? Scalar(-1) : Scalar(fn.dot(FN.row(FF(f, p))));
+        }
+    }, 1 << 14);
+}
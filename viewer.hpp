@@ -1,52 +1,153 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <GLFW/glfw3.h>
 #include <igl/opengl/glfw/Viewer.h>
-#include <igl/unproject_onto_mesh.h>
+#include <igl/unproject_ray.h>
+#if defined(WS_GEO3D_WITH_IMGUI)
+#include <igl/opengl/glfw/imgui/ImGuiMenu.h>
+#include <imgui/imgui.h>
+#endif
+
+#include "bvh.hpp"
+#include "meshContext.hpp"
+#include "profiler.hpp"
+#include "simplify.hpp"
+#include "workerPool.hpp"
 
 using namespace Eigen;
 
-class Viewer
+/**
+ * Il Viewer e' generico sul tipo delle coordinate e degli indici della mesh
+ * (vedi MeshContextT): le normali vengono calcolate nel tipo scelto e
+ * convertite solo per il renderer di libigl, che accetta double/int.
+ * Viewer e' la versione double/int.
+ *
+ * Le normali vengono calcolate in background da un WorkerPool, cosi' che la
+ * finestra resti reattiva anche su mesh grandi: set_mesh() accoda il calcolo
+ * dei tre tipi di normali (prima quello visualizzato), e i tasti 1/2/3
+ * mostrano le normali appena sono pronte, di solito subito. I risultati
+ * vengono inviati al renderer dal thread della finestra (callback_pre_draw);
+ * quelli superati (mesh sostituita, tipo o soglia cambiati nel frattempo)
+ * vengono scartati, insieme ai calcoli non ancora iniziati.
+ *
+ * Con le normali quantizzate (set_quantized_normals(), tasto Q) il MeshContext
+ * conserva solo le normali codificate in coordinate ottaedriche a 2 x 16 bit
+ * (MeshContextT::oct_normals()), e al thread della finestra arrivano 4 byte
+ * per normale invece di 24: vengono decodificate solo al momento dell'upload.
+ * L'errore angolare (al piu' 0.004 gradi, vedi octEncode()) non e' visibile.
+ *
+ * Le mesh con piu' di interactive_faces() facce vengono semplificate in
+ * background (simplifyChain()) in una catena di livelli di dettaglio (LOD),
+ * ognuno con le sue normali calcolate dalle stesse funzioni. Mentre un tasto
+ * del mouse e' premuto (rotazione, traslazione) viene disegnato il livello
+ * piu' dettagliato con al piu' interactive_faces() facce, o uno piu'
+ * semplice se i frame durano piu' di lod_frame_time: al rilascio torna la
+ * mesh completa, su cui avviene il picking.
+ *
+ * Con la strumentazione attiva (profiler.hpp) e il menu ImGui di libigl
+ * (WS_GEO3D_WITH_IMGUI), una finestra mostra i tempi delle fasi (caricamento,
+ * adiacenze, normali, upload) e i contatori; il tasto P scrive gli span
+ * raccolti in formato Chrome trace (ws_geo3D_trace.json).
+ */
+template <typename Scalar, typename Int>
+class ViewerT
 {
   public:
-    Viewer(
-        std::function<MatrixXd(MatrixXd const&, MatrixXi const&)> const& faceNormalFun,
-        std::function<MatrixXd(MatrixXd const&, MatrixXi const&)> const& vertexNormalFun,
-        std::function<MatrixXd(MatrixXd const&, MatrixXi const&)> const& cornerNormalFun
-    ) : _viewer(), _faceNormalFun(faceNormalFun), _vertexNormalFun(vertexNormalFun), _cornerNormalFun(cornerNormalFun)
+    typedef MeshContextT<Scalar, Int> Mesh;
+
+    // le funzioni di calcolo delle normali leggono la mesh e i suoi dati
+    // derivati dal MeshContext del Viewer, che memorizza anche i risultati
+    typedef typename Mesh::NormalFunction NormalFunction;
+    // le funzioni di aggiornamento (opzionali) aggiornano le normali dopo lo
+    // spostamento di alcuni vertici, vedi update_vertices()
+    typedef typename Mesh::NormalUpdateFunction NormalUpdateFunction;
+
+    // durata massima di un frame durante l'interazione: oltre, viene
+    // disegnato il livello di dettaglio successivo (piu' semplice)
+    static constexpr double lod_frame_time = 1.0 / 30.0;
+    // facce dell'ultimo livello della catena
+    static const Index lod_min_faces = 1 << 12;
+
+    ViewerT(
+        NormalFunction const& faceNormalFun,
+        NormalFunction const& vertexNormalFun,
+        NormalFunction const& cornerNormalFun,
+        NormalUpdateFunction const& faceNormalUpdate = nullptr,
+        NormalUpdateFunction const& vertexNormalUpdate = nullptr,
+        NormalUpdateFunction const& cornerNormalUpdate = nullptr
+    ) : _viewer(),
+        _normalFun{faceNormalFun, vertexNormalFun, cornerNormalFun},
+        _normalUpdate{faceNormalUpdate, vertexNormalUpdate, cornerNormalUpdate}
     {
+        // i livelli di dettaglio vengono disegnati da un secondo ViewerData;
+        // data() resta quello della mesh completa
+        _lodData = _viewer.append_mesh();
+        _viewer.selected_data_index = 0;
+        _viewer.data_list[_lodData].show_faces = false;
+        _viewer.data_list[_lodData].show_lines = false;
+
         auto callback_mouse_down = [this](igl::opengl::glfw::Viewer &viewer, int button, int modifier) -> bool {
             if (button == GLFW_MOUSE_BUTTON_1 && modifier == 0)
             {
                 _lastTimePoint = std::chrono::steady_clock::now();
             }
+            _interacting = true;
+            _lastFrame = std::chrono::steady_clock::time_point();
+            if (_lodStale)
+            {
+                // catena superata da update_vertices()
+                build_lod();
+            }
+            show_lod();
             return false;
         };
 
         auto callback_mouse_up = [this](igl::opengl::glfw::Viewer &viewer, int button, int modifier) -> bool {
+            _interacting = false;
+            show_lod();
             if (button == GLFW_MOUSE_BUTTON_1 && modifier == 0)
             {
                 auto now = std::chrono::steady_clock::now();
                 if (std::chrono::duration_cast<std::chrono::milliseconds>(now - _lastTimePoint).count() <= 333)
                 {
+                    WS_PROFILE_SCOPE("Viewer::pick");
                     // Cast a ray in the view direction starting from the mouse position
                     float x = viewer.current_mouse_x;
                     float y = viewer.core.viewport(3) - viewer.current_mouse_y;
-                    auto &V = _viewer.data().V;
-                    auto &F = _viewer.data().F;
-                    Vector3f bc;
-                    int fid;
-                    auto hit = igl::unproject_onto_mesh(
+                    auto &V = _state->mesh.V();
+                    auto &F = _state->mesh.F();
+                    if (_bvhDirty)
+                    {
+                        // i vertici sono stati spostati dall'ultima costruzione
+                        _bvh.build(V, F);
+                        _bvhDirty = false;
+                    }
+                    Vector3f source, dir;
+                    igl::unproject_ray(
                         Vector2f(x, y),
                         viewer.core.view,
                         viewer.core.proj,
                         viewer.core.viewport,
-                        V,
-                        F,
-                        fid,
-                        bc);
+                        source,
+                        dir);
+                    // stesso risultato di igl::unproject_onto_mesh, ma il
+                    // raggio visita solo i nodi della BVH che attraversa
+                    Vector3d bc;
+                    Int fid;
+                    auto hit = _bvh.intersect(V, F, source.cast<double>(), dir.cast<double>(), fid, bc);
                     if (hit)
                     {
-                        auto hitPoint = V.row(F(fid, 0)) * bc(0) + V.row(F(fid, 1)) * bc(1) + V.row(F(fid, 2)) * bc(2);
+                        auto hitPoint = V.row(F(fid, 0)).template cast<double>() * bc(0) +
+                                        V.row(F(fid, 1)).template cast<double>() * bc(1) +
+                                        V.row(F(fid, 2)).template cast<double>() * bc(2);
                         MatrixXd P(1, 3);
                         P.row(0) = hitPoint;
                         MatrixXd C(1, 3);
@@ -64,51 +165,678 @@ class Viewer
         };
 
         auto callback_key_down = [this](igl::opengl::glfw::Viewer &viewer, unsigned char key, int modifier) -> bool {
-            auto &V = _viewer.data().V;
-            auto &F = _viewer.data().F;
-
-            MatrixXd N;
+            // le normali vengono calcolate solo la prima volta, poi sono
+            // riutilizzate finche' la mesh non cambia
             switch (key)
             {
             case '1':
                 // flat shading - face normals
-                N = _faceNormalFun(V, F);
+                show(NormalMode::Face);
                 break;
             case '2':
                 // smooth normals - vertex normals
-                N = _vertexNormalFun(V, F);
+                show(NormalMode::Vertex);
                 break;
             case '3':
                 // sharp/smooth shading - corner normals
-                N = _cornerNormalFun(V, F);
+                show(NormalMode::Corner);
+                break;
+            case 'Q':
+                // normali quantizzate a 2 x 16 bit
+                set_quantized_normals(!_quantized);
+                std::cout << "quantized normals: " << (_quantized ? "on" : "off") << std::endl;
+                break;
+            case 'P':
+                // span raccolti finora, da aprire con chrome://tracing o Perfetto
+                if (profiler::Registry::instance().write_chrome_trace("ws_geo3D_trace.json"))
+                {
+                    std::cout << "trace: ws_geo3D_trace.json" << std::endl;
+                }
                 break;
             default:
                 return false;
             }
-            viewer.data().set_normals(N);
             return true;
         };
 
+        // i tasti + e - sono caratteri (dipendono dal layout della tastiera),
+        // non codici di tasto: vengono gestiti come testo
+        auto callback_key_pressed = [this](igl::opengl::glfw::Viewer &viewer, unsigned int key, int modifier) -> bool {
+            if (key != '+' && key != '-')
+            {
+                return false;
+            }
+            // soglia dei settori delle normali ai corner, a passi di 5 gradi;
+            // cambiarla ricalcola solo le normali ai corner
+            _cornerAngle = std::min(180.0, std::max(0.0, _cornerAngle + (key == '+' ? 5.0 : -5.0)));
+            std::cout << "corner angle: " << _cornerAngle << std::endl;
+            schedule();
+            return true;
+        };
+
+        // invia al renderer le normali e i livelli di dettaglio calcolati in
+        // background, se pronti
+        auto callback_pre_draw = [this](igl::opengl::glfw::Viewer &viewer) -> bool {
+            ReadyNormals ready;
+            {
+                std::lock_guard<std::mutex> lock(_readyMutex);
+                std::swap(ready, _ready);
+                if (_readyLod.valid)
+                {
+                    if (_readyLod.generation == _lodGeneration)
+                    {
+                        // solo le normali cambiano se la catena e' la stessa
+                        if (_readyLod.levels.size() != _lodLevels.size())
+                        {
+                            _lodLevel = -1;
+                        }
+                        _lodLevels.swap(_readyLod.levels);
+                        _lodUploaded = -1;
+                    }
+                    _readyLod = ReadyLod();
+                }
+            }
+            adapt_lod();
+            if (!ready.valid)
+            {
+                return false;
+            }
+            if (ready.generation != _generation)
+            {
+                return false;
+            }
+            {
+                WS_PROFILE_SCOPE("Viewer::upload_normals");
+                if (ready.quantized)
+                {
+                    octDecode(ready.NQ, ready.N);
+                }
+                viewer.data().set_normals(ready.N);
+            }
+            // se nel frattempo sono stati spostati dei vertici le normali
+            // inviate sono gia' superate: ne serve una versione aggiornata
+            _uploaded = ready.revision == _state->revision;
+            if (!_uploaded)
+            {
+                _workers.submit(normals_job(_mode, true));
+            }
+            return false;
+        };
+
         _viewer.callback_mouse_down = callback_mouse_down;
         _viewer.callback_mouse_up = callback_mouse_up;
         _viewer.callback_key_down = callback_key_down;
+        _viewer.callback_key_pressed = callback_key_pressed;
+        _viewer.callback_pre_draw = callback_pre_draw;
+
+#if defined(WS_GEO3D_WITH_IMGUI)
+        _viewer.plugins.push_back(&_menu);
+        _menu.callback_draw_custom_window = [this]() { draw_profiler_window(); };
+#endif
+    }
+
+    void set_mesh(typename Mesh::MatrixS const &V, typename Mesh::MatrixI const &F)
+    {
+        set_mesh(Mesh(V, F));
+    }
+
+    // la mesh puo' arrivare con dati derivati gia' calcolati (es. dalla
+    // cache); se ha solo normali quantizzate, il Viewer passa alle normali
+    // quantizzate per usarle senza ricalcolarle
+    void set_mesh(Mesh mesh)
+    {
+        WS_PROFILE_SCOPE("Viewer::set_mesh");
+
+        bool octOnly = false;
+        for (int m = 0; m < 3; ++m)
+        {
+            if (mesh.has_normals(NormalMode(m)))
+            {
+                octOnly = false;
+                break;
+            }
+            octOnly = octOnly || mesh.has_oct_normals(NormalMode(m));
+        }
+        if (octOnly)
+        {
+            _quantized = true;
+        }
+
+        // i calcoli ancora in corso sulla mesh precedente ne mantengono lo
+        // stato fino alla loro fine, e il loro risultato viene scartato
+        _state = std::make_shared<MeshState>();
+        _state->mesh = std::move(mesh);
+        _cornerAngle = _state->mesh.corner_angle();
+        // la BVH per il picking viene costruita una volta per mesh
+        _bvh.build(_state->mesh.V(), _state->mesh.F());
+        _bvhDirty = false;
+        {
+            WS_PROFILE_SCOPE("Viewer::upload_mesh");
+            _viewer.data().set_mesh(_state->mesh.V().template cast<double>(), _state->mesh.F().template cast<int>());
+        }
+        _mode = NormalMode::Face;
+        build_lod();
+        schedule();
     }
 
-    void set_mesh(MatrixXd const &V, MatrixXi const &F)
+    /**
+     * @brief Il numero massimo di facce disegnate durante l'interazione
+     * (predefinito 2^20): le mesh piu' grandi vengono semplificate in
+     * background, vedi ViewerT. 0 disegna sempre la mesh completa.
+     */
+    void set_interactive_faces(Index faces)
     {
-        _viewer.data().set_mesh(V, F);
-        _viewer.data().set_normals(_faceNormalFun(V, F));
+        if (faces == _interactiveFaces)
+        {
+            return;
+        }
+        _interactiveFaces = faces;
+        if (_lod && faces > 0 && _state->mesh.F().rows() > faces)
+        {
+            // la catena e' la stessa, cambia il livello scelto
+            _lodLevel = -1;
+        }
+        else
+        {
+            build_lod();
+        }
+    }
+
+    Index interactive_faces() const { return _interactiveFaces; }
+
+    /**
+     * @brief Sceglie se calcolare e inviare al renderer le normali in
+     * precisione piena o quantizzate in coordinate ottaedriche a 2 x 16 bit
+     * (MeshContextT::oct_normals()).
+     */
+    void set_quantized_normals(bool quantized)
+    {
+        if (quantized != _quantized)
+        {
+            _quantized = quantized;
+            schedule();
+        }
+    }
+
+    bool quantized_normals() const { return _quantized; }
+
+    /**
+     * @brief Sposta alcuni vertici della mesh (animazione, sculpting) e
+     * aggiorna il rendering in modo incrementale.
+     *
+     * Le normali del tipo visualizzato vengono aggiornate con la funzione di
+     * aggiornamento del tipo (se fornita al costruttore, altrimenti
+     * ricalcolate), e nei buffer del renderer vengono riscritte solo le
+     * posizioni dei vertici spostati e le normali modificate. La BVH per il
+     * picking viene ricostruita al primo click successivo.
+     *
+     * Attende la fine dell'eventuale calcolo in background in corso sulla
+     * mesh. Se le normali visualizzate non sono ancora pronte, la loro
+     * versione aggiornata arriva in background come dopo set_mesh().
+     *
+     * @param vertices Gli indici dei vertici spostati, senza ripetizioni.
+     * @param positions Le nuove posizioni (vertices.size() x 3).
+     */
+    void update_vertices(typename Mesh::VectorI const &vertices, typename Mesh::MatrixS const &positions)
+    {
+        WS_PROFILE_SCOPE("Viewer::update_vertices");
+
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        Mesh &mesh = _state->mesh;
+        mesh.update_vertices(vertices, positions);
+        ++_state->revision;
+        _bvhDirty = true;
+        // i livelli di dettaglio sono superati: vengono ricostruiti alla
+        // prossima interazione (le mesh senza catena non ne hanno bisogno)
+        if (_lod)
+        {
+            drop_lod();
+            _lodStale = true;
+        }
+
+        auto &data = _viewer.data();
+        for (Index k = 0; k < vertices.size(); ++k)
+        {
+            data.V.row(vertices(k)) = positions.row(k).template cast<double>();
+        }
+        data.dirty |= igl::opengl::MeshGL::DIRTY_POSITION;
+
+        if (!_uploaded)
+        {
+            return;
+        }
+
+        typename Mesh::MatrixS const *N = nullptr;
+        OctNormals16 const *NQ = nullptr;
+        if (_quantized)
+        {
+            NQ = &mesh.oct_normals(_mode, _normalFun[int(_mode)], _normalUpdate[int(_mode)]);
+        }
+        else
+        {
+            N = &mesh.normals(_mode, _normalFun[int(_mode)], _normalUpdate[int(_mode)]);
+        }
+        auto normal = [&](Int r) -> RowVector3d {
+            return NQ ? octDecode(*NQ, r) : RowVector3d(N->row(r).template cast<double>());
+        };
+        WS_PROFILE_SCOPE("Viewer::upload_normals");
+        switch (_mode)
+        {
+        case NormalMode::Face:
+            for (Index k = 0; k < mesh.dirty_faces().size(); ++k)
+            {
+                Int f = mesh.dirty_faces()(k);
+                data.F_normals.row(f) = normal(f);
+            }
+            break;
+        case NormalMode::Vertex:
+            for (Index k = 0; k < mesh.dirty_vertices().size(); ++k)
+            {
+                Int v = mesh.dirty_vertices()(k);
+                data.V_normals.row(v) = normal(v);
+            }
+            break;
+        case NormalMode::Corner:
+            // i corner dei vertici modificati
+            for (Index k = 0; k < mesh.dirty_vertices().size(); ++k)
+            {
+                Int v = mesh.dirty_vertices()(k);
+                for (Int corner : mesh.corner_table().one_ring(v))
+                {
+                    data.F_normals.row(corner) = normal(corner);
+                }
+            }
+            break;
+        }
+        data.dirty |= igl::opengl::MeshGL::DIRTY_NORMAL;
     }
 
     void launch()
     {
+        _running = true;
         _viewer.launch();
+        _running = false;
     }
 
   private:
+    // la mesh con il mutex che ne protegge i dati derivati: i calcoli in
+    // background e update_vertices() la usano solo tenendo il mutex
+    struct MeshState
+    {
+        Mesh mesh;
+        std::mutex mutex;
+        // numero di chiamate a update_vertices()
+        long revision = 0;
+    };
+
+    // normali pronte per il renderer, prodotte in background
+    struct ReadyNormals
+    {
+        bool valid = false;
+        long generation = 0;
+        long revision = 0;
+        // normali quantizzate in NQ, da decodificare in N all'upload
+        bool quantized = false;
+        MatrixXd N;
+        OctNormals16 NQ;
+    };
+
+    // livelli di dettaglio della mesh, con le normali del tipo visualizzato,
+    // pronti per il renderer
+    struct LodLevel
+    {
+        MatrixXd V;
+        MatrixXi F;
+        MatrixXd N;
+    };
+
+    // la catena dei livelli di dettaglio (simplifyChain()) della mesh: il
+    // calcolo in background la usa tenendo il mutex
+    struct LodState
+    {
+        std::vector<Mesh> levels;
+        std::mutex mutex;
+    };
+
+    struct ReadyLod
+    {
+        bool valid = false;
+        long generation = 0;
+        std::vector<LodLevel> levels;
+    };
+
+    // passa al tipo di normali dato
+    void show(NormalMode mode)
+    {
+        if (mode != _mode)
+        {
+            _mode = mode;
+            schedule();
+        }
+    }
+
+    /**
+     * @brief Scarta i calcoli accodati e i risultati non ancora inviati, e
+     * accoda le normali del tipo visualizzato, da inviare al renderer, e
+     * quelle degli altri due tipi, da tenere pronte. I tipi gia' calcolati
+     * non vengono ricalcolati.
+     */
+    void schedule()
+    {
+        ++_generation;
+        _workers.clear();
+        _uploaded = false;
+        _workers.submit(normals_job(_mode, true));
+        for (int m = 0; m < 3; ++m)
+        {
+            if (NormalMode(m) != _mode)
+            {
+                _workers.submit(normals_job(NormalMode(m), false));
+            }
+        }
+        // le normali dei livelli di dettaglio, del tipo visualizzato
+        if (_lod)
+        {
+            ++_lodGeneration;
+            _lodWorkers.clear();
+            _lodWorkers.submit(lod_job(_lod));
+        }
+    }
+
+    // scarta i livelli di dettaglio della mesh e, se la mesh ha piu' di
+    // _interactiveFaces facce, ne accoda la costruzione
+    void build_lod()
+    {
+        drop_lod();
+        _lodStale = false;
+        if (_interactiveFaces <= 0 || _state->mesh.F().rows() <= _interactiveFaces)
+        {
+            return;
+        }
+        _lod = std::make_shared<LodState>();
+        _lodWorkers.submit(lod_job(_lod));
+    }
+
+    void drop_lod()
+    {
+        ++_lodGeneration;
+        _lodWorkers.clear();
+        _lod.reset();
+        _lodLevels.clear();
+        _lodLevel = -1;
+        _lodUploaded = -1;
+        _viewer.data_list[_lodData].clear();
+        show_lod();
+    }
+
+    // il calcolo in background della catena dei livelli di dettaglio, se non
+    // ancora costruita, e delle loro normali del tipo visualizzato
+    std::function<void()> lod_job(std::shared_ptr<LodState> lod)
+    {
+        std::shared_ptr<MeshState> state = _state;
+        long generation = _lodGeneration;
+        NormalMode mode = _mode;
+        double angle = _cornerAngle;
+        return [this, state, lod, generation, mode, angle]() {
+            if (generation != _lodGeneration)
+            {
+                return;
+            }
+            WS_PROFILE_SCOPE("Viewer::lod_job");
+            std::lock_guard<std::mutex> lock(lod->mutex);
+            if (lod->levels.empty())
+            {
+                typename Mesh::MatrixS V;
+                typename Mesh::MatrixI F;
+                {
+                    std::lock_guard<std::mutex> stateLock(state->mutex);
+                    V = state->mesh.V();
+                    F = state->mesh.F();
+                }
+                simplifyChain(V, F, lod_min_faces, lod->levels);
+            }
+            ReadyLod ready;
+            ready.levels.resize(lod->levels.size());
+            for (size_t l = 0; l < lod->levels.size(); ++l)
+            {
+                if (generation != _lodGeneration)
+                {
+                    return;
+                }
+                Mesh &mesh = lod->levels[l];
+                mesh.set_corner_angle(angle);
+                ready.levels[l].V = mesh.V().template cast<double>();
+                ready.levels[l].F = mesh.F().template cast<int>();
+                ready.levels[l].N = mesh.normals(mode, _normalFun[int(mode)]).template cast<double>();
+            }
+            ready.valid = true;
+            ready.generation = generation;
+            {
+                std::lock_guard<std::mutex> readyLock(_readyMutex);
+                if (generation != _lodGeneration)
+                {
+                    return;
+                }
+                std::swap(_readyLod, ready);
+            }
+            if (_running)
+            {
+                glfwPostEmptyEvent();
+            }
+        };
+    }
+
+    /**
+     * @brief Sceglie il livello di dettaglio da disegnare durante
+     * l'interazione e lo invia al renderer: il primo con al piu'
+     * _interactiveFaces facce o, se un frame durante l'interazione e' durato
+     * piu' di lod_frame_time, il successivo. Il livello scelto resta per le
+     * interazioni seguenti.
+     */
+    void adapt_lod()
+    {
+        if (_lodLevels.empty())
+        {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (_lodLevel < 0)
+        {
+            _lodLevel = 0;
+            while (_lodLevel + 1 < Index(_lodLevels.size()) && _lodLevels[_lodLevel].F.rows() > _interactiveFaces)
+            {
+                ++_lodLevel;
+            }
+        }
+        else if (_interacting && _lastFrame != std::chrono::steady_clock::time_point() &&
+                 std::chrono::duration<double>(now - _lastFrame).count() > lod_frame_time &&
+                 _lodLevel + 1 < Index(_lodLevels.size()))
+        {
+            ++_lodLevel;
+        }
+        if (_lodUploaded != _lodLevel)
+        {
+            WS_PROFILE_SCOPE("Viewer::upload_lod");
+            LodLevel const &level = _lodLevels[_lodLevel];
+            auto &data = _viewer.data_list[_lodData];
+            data.clear();
+            data.set_mesh(level.V, level.F);
+            data.set_normals(level.N);
+            _lodUploaded = _lodLevel;
+            show_lod();
+            // il tempo dell'upload non conta per il frame successivo
+            now = std::chrono::steady_clock::now();
+        }
+        _lastFrame = _interacting ? now : std::chrono::steady_clock::time_point();
+    }
+
+    // disegna il livello di dettaglio durante l'interazione, se pronto, e
+    // altrimenti la mesh completa
+    void show_lod()
+    {
+        auto &full = _viewer.data_list[0];
+        auto &lod = _viewer.data_list[_lodData];
+        bool shown = _interacting && _lodUploaded >= 0;
+        if (shown == lod.show_faces)
+        {
+            return;
+        }
+        // i lati (tasto L) passano al livello disegnato
+        if (shown)
+        {
+            lod.show_lines = full.show_lines;
+            full.show_lines = false;
+        }
+        else
+        {
+            full.show_lines = lod.show_lines;
+            lod.show_lines = false;
+        }
+        full.show_faces = !shown;
+        lod.show_faces = shown;
+    }
+
+    // il calcolo in background delle normali del tipo dato; se post, il
+    // risultato viene preparato per il renderer e la finestra risvegliata
+    std::function<void()> normals_job(NormalMode mode, bool post)
+    {
+        std::shared_ptr<MeshState> state = _state;
+        long generation = _generation;
+        double angle = _cornerAngle;
+        bool quantized = _quantized;
+        return [this, state, generation, angle, quantized, mode, post]() {
+            if (generation != _generation)
+            {
+                return;
+            }
+            WS_PROFILE_SCOPE("Viewer::normals_job");
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (generation != _generation)
+            {
+                return;
+            }
+            state->mesh.set_corner_angle(angle);
+            ReadyNormals ready;
+            if (quantized)
+            {
+                auto const &NQ = state->mesh.oct_normals(mode, _normalFun[int(mode)], _normalUpdate[int(mode)]);
+                if (post)
+                {
+                    ready.NQ = NQ;
+                }
+            }
+            else
+            {
+                auto const &N = state->mesh.normals(mode, _normalFun[int(mode)], _normalUpdate[int(mode)]);
+                if (post)
+                {
+                    ready.N = N.template cast<double>();
+                }
+            }
+            if (!post)
+            {
+                return;
+            }
+            ready.valid = true;
+            ready.quantized = quantized;
+            ready.generation = generation;
+            ready.revision = state->revision;
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> readyLock(_readyMutex);
+                if (generation != _generation)
+                {
+                    return;
+                }
+                std::swap(_ready, ready);
+            }
+            if (_running)
+            {
+                glfwPostEmptyEvent();
+            }
+        };
+    }
+
+#if defined(WS_GEO3D_WITH_IMGUI)
+    // finestra con le statistiche degli span e i contatori
+    void draw_profiler_window()
+    {
+        ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_FirstUseEver);
+        ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+#if defined(WS_GEO3D_PROFILE)
+        ImGui::Text("%-32s %6s %10s %10s", "fase", "n", "ultimo ms", "medio ms");
+        for (auto const &s : profiler::Registry::instance().stats())
+        {
+            ImGui::Text("%-32s %6lld %10.3f %10.3f", s.first.c_str(), (long long)s.second.count,
+                        s.second.last_ns * 1e-6, s.second.total_ns * 1e-6 / double(s.second.count));
+        }
+        ImGui::Separator();
+        for (auto const &c : profiler::Registry::instance().counters())
+        {
+            ImGui::Text("%-32s %lld", c.first.c_str(), (long long)c.second);
+        }
+        if (ImGui::Button("Azzera"))
+        {
+            profiler::Registry::instance().reset();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Chrome trace (P)"))
+        {
+            profiler::Registry::instance().write_chrome_trace("ws_geo3D_trace.json");
+        }
+#else
+        ImGui::Text("strumentazione disabilitata (WS_GEO3D_PROFILE)");
+#endif
+        ImGui::End();
+    }
+#endif
+
     igl::opengl::glfw::Viewer _viewer;
-    std::function<MatrixXd(MatrixXd const&, MatrixXi const&)> _faceNormalFun;
-    std::function<MatrixXd(MatrixXd const&, MatrixXi const&)> _vertexNormalFun;
-    std::function<MatrixXd(MatrixXd const&, MatrixXi const&)> _cornerNormalFun;
+    std::shared_ptr<MeshState> _state = std::make_shared<MeshState>();
+    BvhT<Int> _bvh;
+    bool _bvhDirty = false;
+    NormalMode _mode = NormalMode::Face;
+    // il renderer ha le normali aggiornate del tipo visualizzato
+    bool _uploaded = false;
+    double _cornerAngle = 30.0;
+    // normali quantizzate (set_quantized_normals())
+    bool _quantized = false;
+    NormalFunction _normalFun[3];
+    NormalUpdateFunction _normalUpdate[3];
     std::chrono::steady_clock::time_point _lastTimePoint;
-};
\ No newline at end of file
+    // livelli di dettaglio: la catena in costruzione o costruita, i livelli
+    // pronti per il renderer, quello scelto e quello nel ViewerData _lodData
+    // (-1 nessuno), durata dei frame durante l'interazione; _lodStale se la
+    // catena e' stata scartata da update_vertices() e va ricostruita
+    Index _interactiveFaces = Index(1) << 20;
+    std::shared_ptr<LodState> _lod;
+    bool _lodStale = false;
+    std::vector<LodLevel> _lodLevels;
+    Index _lodLevel = -1;
+    Index _lodUploaded = -1;
+    size_t _lodData = 0;
+    bool _interacting = false;
+    std::chrono::steady_clock::time_point _lastFrame;
+#if defined(WS_GEO3D_WITH_IMGUI)
+    igl::opengl::glfw::imgui::ImGuiMenu _menu;
+#endif
+
+    // incrementata ad ogni schedule(): i calcoli e i risultati con una
+    // generazione precedente sono superati
+    std::atomic<long> _generation{0};
+    std::atomic<bool> _running{false};
+    // come _generation, per i livelli di dettaglio
+    std::atomic<long> _lodGeneration{0};
+    std::mutex _readyMutex;
+    ReadyNormals _ready;
+    ReadyLod _readyLod;
+    // i livelli di dettaglio hanno un thread a parte: la costruzione della
+    // catena non ritarda le normali della mesh completa
+    WorkerPool _lodWorkers{1};
+    // due thread: un calcolo superato sulla mesh precedente, che non si puo'
+    // interrompere, non ritarda quelli sulla nuova. E' l'ultimo membro, per
+    // cui viene distrutto per primo, attendendo i calcoli in corso.
+    WorkerPool _workers{2};
+};
+
+typedef ViewerT<double, int> Viewer;
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Un insieme di thread che eseguono compiti in background, nell'ordine
+ * in cui vengono accodati.
+ *
+ * I compiti non possono essere interrotti una volta iniziati: chi li accoda
+ * puo' scartare quelli non ancora iniziati (clear()) e deve far si' che quelli
+ * in esecuzione riconoscano di essere superati (ad esempio confrontando un
+ * numero di generazione) e non pubblichino il loro risultato.
+ */
+class WorkerPool
+{
+  public:
+    explicit WorkerPool(unsigned threads = 1)
+    {
+        for (unsigned t = 0; t < threads; ++t) {
+            _threads.emplace_back([this]() { run(); });
+        }
+    }
+
+    /**
+     * @brief Scarta i compiti in coda e attende la fine di quelli in
+     * esecuzione.
+     */
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.clear();
+            _stop = true;
+        }
+        _cv.notify_all();
+        for (auto &t : _threads) {
+            t.join();
+        }
+    }
+
+    WorkerPool(WorkerPool const &) = delete;
+    WorkerPool &operator=(WorkerPool const &) = delete;
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push_back(std::move(task));
+        }
+        _cv.notify_one();
+    }
+
+    /**
+     * @brief Scarta i compiti non ancora iniziati.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _tasks.clear();
+    }
+
+  private:
+    void run()
+    {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+                if (_stop) {
+                    return;
+                }
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _tasks;
+    bool _stop = false;
+    std::vector<std::thread> _threads;
+};